@@ -0,0 +1,343 @@
+#include "UserShards.hpp"
+#include <algorithm>
+#include <chrono>
+#include <future>
+
+namespace {
+// Returns the wall-clock time messages are stamped with.
+int64_t currentTimeMillis() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+} // namespace
+
+UserShards::UserShards(UserManager& manager, size_t count) : manager(manager) {
+    for (size_t i = 0; i < std::max<size_t>(count, 1); ++i) shards.push_back(std::make_unique<Shard>());
+    for (std::unique_ptr<Shard>& shard : shards) {
+        Shard* owned = shard.get();
+        shard->thread = std::thread([this, owned] { run(*owned); });
+    }
+}
+
+// Replies may post more operations, so the shards stop only once a pause finds every inbox
+// empty; nothing can be posted after that but by the caller, who has stopped.
+UserShards::~UserShards() {
+    for (;;) {
+        auto drained = std::make_shared<std::promise<bool>>();
+        std::future<bool> result = drained->get_future();
+        exclusive([this, drained] {
+            bool empty = true;
+            for (const std::unique_ptr<Shard>& shard : shards) {
+                empty = empty && shard->inbox.empty() && shard->deferred.empty();
+            }
+            if (empty) stopping = true;
+            drained->set_value(empty);
+        });
+        if (result.get()) break;
+        std::this_thread::yield();
+    }
+    for (std::unique_ptr<Shard>& shard : shards) {
+        wake(*shard);
+        shard->thread.join();
+    }
+}
+
+void UserShards::post(size_t index, bool fresh, std::function<bool()> step) {
+    Task* task = new Task;
+    task->fresh = fresh;
+    task->step = std::move(step);
+    Shard& shard = *shards[index];
+    shard.inbox.push(task);
+    wake(shard);
+}
+
+// Only a sleeping shard costs the producer a lock, and only the first producer to find it asleep.
+void UserShards::wake(Shard& shard) {
+    if (!shard.sleeping.load() || !shard.sleeping.exchange(false)) return;
+    std::lock_guard<std::mutex> lock(shard.sleepMutex);
+    shard.wake.notify_one();
+}
+
+bool UserShards::idle(const Shard& shard) const {
+    if (!shard.inbox.empty() || stopping) return false;
+    // A parked shard has already checked whether the pause can run; whoever parks last checks again.
+    if (pausing) return shard.parked;
+    return !shard.parked && shard.deferred.empty();
+}
+
+// While pausing no operation starts, so each balance read is at least what it is once the
+// last one is read, and a sum of zero means none is under way.
+bool UserShards::quiescent() const {
+    int64_t sum = 0;
+    for (const std::unique_ptr<Shard>& shard : shards) sum += shard->balance.load();
+    return sum == 0;
+}
+
+// A fresh task is held back if a pause is on. The check comes after unparking, so a shard that
+// finds every shard parked knows none of them is about to start one.
+void UserShards::run(Shard& shard) {
+    for (;;) {
+        Task* task = nullptr;
+        bool wasDeferred = false;
+        if (!pausing && !shard.deferred.empty()) {
+            task = shard.deferred.front();
+            shard.deferred.pop_front();
+            wasDeferred = true;
+        } else {
+            task = static_cast<Task*>(shard.inbox.pop());
+        }
+        if (task) {
+            if (shard.parked) {
+                shard.parked = false;
+                --parked;
+            }
+            if (task->fresh && pausing) {
+                if (wasDeferred) {
+                    shard.deferred.push_front(task);
+                } else {
+                    shard.deferred.push_back(task);
+                }
+                continue;
+            }
+            execute(shard, task);
+            continue;
+        }
+
+        if (pausing) {
+            if (!shard.parked) {
+                shard.parked = true;
+                ++parked;
+            }
+            if (parked == shards.size() && quiescent() && !executing.exchange(true)) {
+                runExclusive();
+                executing = false;
+                continue;
+            }
+        } else if (shard.parked) {
+            shard.parked = false;
+            --parked;
+            continue;
+        } else if (stopping) {
+            return;
+        }
+
+        shard.sleeping = true;
+        if (!idle(shard)) {
+            shard.sleeping = false;
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(shard.sleepMutex);
+        shard.wake.wait(lock, [&shard] { return !shard.sleeping.load(); });
+    }
+}
+
+// The checkpoint flag is read before it is cleared, so shards do not bounce its line between
+// them on every task.
+void UserShards::execute(Shard& shard, Task* task) {
+    if (task->fresh) shard.balance.store(shard.balance.load(std::memory_order_relaxed) + 1);
+    if (!task->step()) shard.balance.store(shard.balance.load(std::memory_order_relaxed) - 1);
+    delete task;
+    if (manager.checkpointDue.load(std::memory_order_relaxed) && manager.checkpointDue.exchange(false)) {
+        exclusive([this] {
+            UserManager::AllLock lock(manager);
+            if (manager.wal.recordCount() >= manager.checkpointInterval) {
+                manager.startCheckpoint();
+            }
+        });
+    }
+}
+
+// Work queued while this runs joins the same pause. The pause ends under the mutex, so work
+// queued after it starts a new one.
+void UserShards::runExclusive() {
+    std::unique_lock<std::mutex> lock(exclusiveMutex);
+    while (!exclusiveWork.empty()) {
+        std::vector<std::function<void()>> work;
+        work.swap(exclusiveWork);
+        lock.unlock();
+        for (std::function<void()>& item : work) item();
+        lock.lock();
+    }
+    pausing = false;
+    lock.unlock();
+    for (std::unique_ptr<Shard>& shard : shards) wake(*shard);
+}
+
+void UserShards::exclusive(std::function<void()> work) {
+    {
+        std::lock_guard<std::mutex> lock(exclusiveMutex);
+        exclusiveWork.push_back(std::move(work));
+    }
+    if (pausing.exchange(true)) return;
+    for (std::unique_ptr<Shard>& shard : shards) wake(*shard);
+}
+
+// The name is interned by the caller, which takes the table's lock only for a new name; the
+// shard that owns the ID then decides, so two registrations of one name cannot both succeed.
+void UserShards::registerUser(const std::string& username, const std::string& password, Reply<bool> done) {
+    UserId id = manager.users.intern(username);
+    WalRecord record{WalRecordType::RegisterUser, {username, User::hashPassword(password)}};
+    post(shardOf(id), true, [this, id, record, done]() mutable {
+        if (manager.users.get(id) || !manager.log(record)) {
+            done(false);
+            return false;
+        }
+        manager.apply(record, id, kNoUser);
+        done(true);
+        return false;
+    });
+}
+
+void UserShards::authenticateUser(const std::string& username, const std::string& password, Reply<bool> done) {
+    UserId id = manager.users.find(username);
+    post(shardOf(id), true, [this, id, password, done] {
+        const User* user = manager.users.get(id);
+        done(user && user->checkPassword(password));
+        return false;
+    });
+}
+
+void UserShards::areFriends(UserId user, UserId other, Reply<bool> done) {
+    post(shardOf(user), true, [this, user, other, done] {
+        const User* found = manager.users.get(user);
+        done(found && found->hasFriend(other));
+        return false;
+    });
+}
+
+// Three steps: the sender's shard rules out requests it already sent and friends, the
+// receiver's rules out a duplicate, logs the request and records it as received, and the
+// sender's records it as sent. Both halves of any later answer are posted after these, so
+// they land after them.
+void UserShards::sendFriendRequest(UserId from, UserId to, Reply<bool> done) {
+    post(shardOf(from), true, [this, from, to, done] {
+        const User* sender = manager.users.get(from);
+        if (!sender || !manager.users.get(to) || from == to || sender->hasSentRequestTo(to) || sender->hasFriend(to)) {
+            done(false);
+            return false;
+        }
+        post(shardOf(to), false, [this, from, to, done] {
+            User* receiver = manager.users.get(to);
+            WalRecord record{WalRecordType::FriendRequest, {manager.users.name(from), manager.users.name(to)}};
+            if (receiver->hasPendingRequestFrom(from) || receiver->hasFriend(from) || !manager.log(record)) {
+                done(false);
+                return false;
+            }
+            manager.preserve(receiver);
+            receiver->receiveFriendRequestFrom(from);
+            post(shardOf(from), false, [this, from, to, done] {
+                User* sender = manager.users.get(from);
+                manager.preserve(sender);
+                sender->sendFriendRequestTo(to);
+                done(true);
+                return false;
+            });
+            return true;
+        });
+        return true;
+    });
+}
+
+void UserShards::acceptFriendRequest(UserId user, UserId from, Reply<bool> done) {
+    answer(user, from, true, std::move(done));
+}
+
+void UserShards::rejectFriendRequest(UserId rejecting, UserId sender, Reply<bool> done) {
+    answer(rejecting, sender, false, std::move(done));
+}
+
+// The receiver's shard decides and logs the answer, then the sender's shard settles its side.
+void UserShards::answer(UserId user, UserId from, bool accept, Reply<bool> done) {
+    post(shardOf(user), true, [this, user, from, accept, done] {
+        User* receiver = manager.users.get(user);
+        if (!receiver || !manager.users.get(from) || !receiver->hasPendingRequestFrom(from)) {
+            done(false);
+            return false;
+        }
+        WalRecord record{accept ? WalRecordType::FriendAccept : WalRecordType::FriendReject,
+                         {manager.users.name(user), manager.users.name(from)}};
+        if (!manager.log(record)) {
+            done(false);
+            return false;
+        }
+        manager.preserve(receiver);
+        if (accept) {
+            receiver->acceptFriendRequestFrom(from);
+        } else {
+            receiver->rejectFriendRequestFrom(from);
+        }
+        post(shardOf(from), false, [this, user, from, accept, done] {
+            User* sender = manager.users.get(from);
+            manager.preserve(sender);
+            if (accept) {
+                sender->completeOutgoingFriendRequest(user);
+            } else {
+                sender->cancelOutgoingFriendRequest(user);
+            }
+            done(true);
+            return false;
+        });
+        return true;
+    });
+}
+
+void UserShards::getIncomingFriendRequests(UserId user, Reply<std::optional<std::vector<UserId>>> done) {
+    post(shardOf(user), true, [this, user, done] {
+        const User* found = manager.users.get(user);
+        if (!found) {
+            done(std::nullopt);
+            return false;
+        }
+        const UserIdSet& requests = found->getIncomingFriendRequests();
+        done(std::vector<UserId>(requests.begin(), requests.end()));
+        return false;
+    });
+}
+
+// The conversation's shard logs and appends the message and records the partner it owns; the
+// other participant's shard records its side, if it is another shard.
+void UserShards::storeMessage(UserId sender, UserId receiver, std::string content, Reply<bool> done) {
+    UserId low = std::min(sender, receiver);
+    UserId high = std::max(sender, receiver);
+    post(shardOf(low), true, [this, sender, receiver, low, high, content = std::move(content), done]() mutable {
+        if (!manager.users.get(sender) || !manager.users.get(receiver)) {
+            done(false);
+            return false;
+        }
+        int64_t now = currentTimeMillis();
+        WalRecord record{WalRecordType::Message,
+                         {manager.users.name(sender), manager.users.name(receiver), content, std::to_string(now)}};
+        if (!manager.log(record)) {
+            done(false);
+            return false;
+        }
+        ChatHistory& history = manager.conversations.open(sender, receiver);
+        manager.preserve(history);
+        history.append(Message{sender, std::move(content), now});
+        manager.users.get(low)->addChatPartner(high);
+        if (shardOf(high) == shardOf(low)) {
+            manager.users.get(high)->addChatPartner(low);
+            done(true);
+            return false;
+        }
+        post(shardOf(high), false, [this, low, high, done] {
+            manager.users.get(high)->addChatPartner(low);
+            done(true);
+            return false;
+        });
+        return true;
+    });
+}
+
+// Reading pages messages in and may cut the log back, so it runs on the conversation's shard.
+void UserShards::getChatHistory(UserId user, UserId peer, size_t limit, Reply<std::vector<Message>> done) {
+    post(shardOf(std::min(user, peer)), true, [this, user, peer, limit, done] {
+        const ChatHistory* history = manager.conversations.find(user, peer);
+        if (!history) {
+            done(std::vector<Message>());
+            return false;
+        }
+        manager.preserve(*history);
+        done(history->tail(limit));
+        return false;
+    });
+}
@@ -0,0 +1,126 @@
+#ifndef USER_SHARDS_HPP
+#define USER_SHARDS_HPP
+
+#include "../include/Mailbox.hpp"
+#include "../include/user/UserManager.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Runs a UserManager's operations on shard threads instead of under its lock stripes.
+//
+// Users are split over the shards by ID, and each shard's thread is the only
+// one that reads or changes its users, so it needs no lock to do so and
+// their data stays in that core's cache. An operation is posted to the
+// owning shard's inbox, a lock-free queue, and its result handed to a reply
+// callback on the shard thread. An operation on two users on different
+// shards is an exchange of messages: the shard that decides it logs the
+// change and applies its half, then posts the other half to the other shard,
+// which applies it and replies. A friend request takes one more step, as the
+// sender's shard rules out what it can before the receiver's decides. A
+// conversation belongs to the shard of its lower-numbered participant, so
+// its messages are appended and logged in one order. Messages sent from one
+// shard to another arrive in the order they were sent.
+//
+// The write-ahead log, the conversation store and the history cache stay
+// shared and keep their own locks; a shard only waits on a mutex while its
+// inbox is empty.
+//
+// Work that needs the whole state still, such as checkpoint captures and
+// compaction, goes through exclusive(): operations not yet started are held
+// back, those under way finish their exchanges, and the work then runs on one
+// shard while the others are parked. Checkpoints come due and start this way
+// on their own. While the shards run, the manager must be used only through
+// them and exclusive().
+class UserShards {
+public:
+    // Receives the result of an operation, on the thread of the shard that finished it.
+    template <typename T>
+    using Reply = std::function<void(T)>;
+
+    // Starts `count` shard threads over `manager`, which must outlive them.
+    UserShards(UserManager& manager, size_t count);
+    // Finishes every operation and exclusive work already posted, then stops the threads.
+    ~UserShards();
+    UserShards(const UserShards&) = delete;
+    UserShards& operator=(const UserShards&) = delete;
+
+    // Returns the number of shards.
+    size_t size() const { return shards.size(); }
+    // Returns the shard that owns `user`.
+    size_t shardOf(UserId user) const { return user % shards.size(); }
+
+    // Each does what the UserManager member of the same name does, replying with its result.
+    void registerUser(const std::string& username, const std::string& password, Reply<bool> done);
+    void authenticateUser(const std::string& username, const std::string& password, Reply<bool> done);
+    void areFriends(UserId user, UserId other, Reply<bool> done);
+    void sendFriendRequest(UserId from, UserId to, Reply<bool> done);
+    void acceptFriendRequest(UserId user, UserId from, Reply<bool> done);
+    void rejectFriendRequest(UserId rejecting, UserId sender, Reply<bool> done);
+    void getIncomingFriendRequests(UserId user, Reply<std::optional<std::vector<UserId>>> done);
+    // Replies false if either user does not exist.
+    void storeMessage(UserId sender, UserId receiver, std::string content, Reply<bool> done);
+    void getChatHistory(UserId user, UserId peer, size_t limit, Reply<std::vector<Message>> done);
+
+    // Runs `work` on a shard thread once no operation is under way. Operations posted
+    // meanwhile wait for it.
+    void exclusive(std::function<void()> work);
+
+private:
+    // One step of an operation. Returns true if it posted the next step to another shard.
+    struct Task : IntrusiveMailbox::Node {
+        bool fresh = true; // Starts an operation, rather than continuing one.
+        std::function<bool()> step;
+    };
+
+    // A shard's thread and the state only it touches, apart from the inbox and the wakeup.
+    struct alignas(64) Shard {
+        IntrusiveMailbox inbox;
+        std::deque<Task*> deferred; // Fresh tasks held back by a pause, oldest first.
+        bool parked = false;        // Counted in UserShards::parked.
+        // Operations started here less those finished here. Only this shard writes it; the sum
+        // over all shards is the number under way.
+        std::atomic<int64_t> balance{0};
+        std::atomic<bool> sleeping{false};
+        std::mutex sleepMutex;
+        std::condition_variable wake;
+        std::thread thread;
+    };
+
+    // Posts a step to shard `index`, waking its thread if it sleeps.
+    void post(size_t index, bool fresh, std::function<bool()> step);
+    // Accepts or rejects the friend request `user` received from `from`.
+    void answer(UserId user, UserId from, bool accept, Reply<bool> done);
+    // Wakes the shard's thread if it sleeps.
+    void wake(Shard& shard);
+    // Shard thread: runs tasks until stopped.
+    void run(Shard& shard);
+    // Runs one task on `shard` and starts a checkpoint if it brought one due.
+    void execute(Shard& shard, Task* task);
+    // Runs the exclusive work queued so far, then ends the pause. Called with every shard parked.
+    void runExclusive();
+    // Returns true if the shard has nothing to do until someone wakes it.
+    bool idle(const Shard& shard) const;
+    // Returns true if no operation is under way. Only meaningful while pausing, when the
+    // balances can only fall.
+    bool quiescent() const;
+
+    UserManager& manager;
+    std::vector<std::unique_ptr<Shard>> shards;
+    alignas(64) std::atomic<bool> pausing{false};
+    std::atomic<size_t> parked{0};          // Shards idle while pausing.
+    std::atomic<bool> executing{false};     // Set by the shard running exclusive work.
+    std::atomic<bool> stopping{false};
+    std::mutex exclusiveMutex;              // Guards exclusiveWork.
+    std::vector<std::function<void()>> exclusiveWork;
+};
+
+#endif // USER_SHARDS_HPP
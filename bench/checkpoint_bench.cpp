@@ -0,0 +1,158 @@
+// Measures how checkpoints hold up mutations.
+//
+// A database of --users users, each with --friends friends, and
+// --conversations conversations between neighbouring users is built once and
+// copied for each case. Each case then
+// replays the same stream of mutations (mostly direct messages, the rest
+// friend requests and their acceptance) at a fixed --rate, the way clients
+// would send them, and reports the latency of each from the time it was due,
+// so time spent waiting behind a stalled mutation counts too:
+//   none:       no checkpoints during the run.
+//   blocking:   a checkpoint every --interval mutations, written while the
+//               mutation that triggered it waits (how checkpoints used to run).
+//   background: the same interval, with the snapshot written on a background
+//               thread while mutations carry on.
+//
+// Usage: checkpoint_bench [--users N] [--friends N] [--rate OPS] [--seconds S]
+//                         [--conversations N] [--interval N] [--dir PATH]
+
+#include "../include/user/UserManager.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+std::string name(size_t user) {
+    return "user" + std::to_string(user);
+}
+
+// Builds the database at `path`: registered users, friendships and conversations between user u
+// and u + 1 for the first `conversations` users.
+void populate(const std::string& path, size_t users, size_t friends, size_t conversations) {
+    UserManager manager(path, PersistenceOptions{}, static_cast<size_t>(-1));
+    std::vector<UserId> ids;
+    for (size_t u = 0; u < users; ++u) {
+        manager.registerUser(name(u), "password");
+        ids.push_back(manager.findUser(name(u)));
+    }
+    for (size_t u = 0; u < users; ++u) {
+        for (size_t f = 1; f <= friends; ++f) {
+            manager.sendFriendRequest(ids[u], ids[(u + f) % users]);
+            manager.acceptFriendRequest(ids[(u + f) % users], ids[u]);
+        }
+    }
+    for (size_t u = 0; u < conversations; ++u) {
+        manager.storeMessage(ids[u], ids[(u + 1) % users], "hello from " + name(u));
+    }
+}
+
+// Copies the snapshot and its message logs to `to`.
+void copyDatabase(const std::string& from, const std::string& to) {
+    std::filesystem::remove_all(to + ".history");
+    std::filesystem::remove(to);
+    std::filesystem::remove(to + ".wal");
+    std::filesystem::copy_file(from, to);
+    std::filesystem::copy(from + ".history", to + ".history", std::filesystem::copy_options::recursive);
+}
+
+struct Options {
+    size_t users = 100000;
+    size_t friends = 10;
+    size_t conversations = 10000;
+    size_t rate = 20000;
+    size_t seconds = 10;
+    size_t interval = 20000;
+    std::string dir = "checkpoint_bench.d";
+};
+
+// Runs the mutation stream against a copy of the database and prints its latency percentiles.
+void run(const char* label, const Options& options, bool blocking, bool background) {
+    std::string path = options.dir + "/" + label + ".db";
+    copyDatabase(options.dir + "/base.db", path);
+    size_t interval = background ? options.interval : static_cast<size_t>(-1);
+    std::vector<double> latencies;
+    size_t total = options.rate * options.seconds;
+    latencies.reserve(total);
+    CheckpointStats stats;
+    {
+        UserManager manager(path, PersistenceOptions{}, interval);
+        std::vector<UserId> ids;
+        for (size_t u = 0; u < options.users; ++u) ids.push_back(manager.findUser(name(u)));
+        std::mt19937_64 random(42);
+        std::uniform_int_distribution<size_t> pick(0, options.users - 1);
+        std::uniform_int_distribution<size_t> pickTalker(0, options.conversations - 1);
+        std::uniform_int_distribution<int> percent(0, 99);
+        std::string content(120, 'x');
+        auto period = std::chrono::nanoseconds(1000000000 / options.rate);
+        Clock::time_point start = Clock::now();
+        for (size_t i = 0; i < total; ++i) {
+            Clock::time_point due = start + period * i;
+            std::this_thread::sleep_until(due);
+            if (percent(random) < 90) {
+                size_t from = pickTalker(random);
+                manager.storeMessage(ids[from], ids[(from + 1) % options.users], content);
+            } else {
+                size_t from = pick(random);
+                size_t to = pick(random);
+                manager.sendFriendRequest(ids[from], ids[to]);
+                manager.acceptFriendRequest(ids[to], ids[from]);
+            }
+            if (blocking && (i + 1) % options.interval == 0) manager.checkpoint();
+            latencies.push_back(std::chrono::duration<double, std::micro>(Clock::now() - due).count());
+        }
+        stats = manager.checkpointStats();
+    }
+    std::sort(latencies.begin(), latencies.end());
+    auto at = [&](double q) { return latencies[std::min(latencies.size() - 1, static_cast<size_t>(q * latencies.size()))]; };
+    std::printf("%-10s p50 %8.1f us  p99 %9.1f us  p99.9 %9.1f us  max %9.1f us", label, at(0.5), at(0.99),
+                at(0.999), latencies.back());
+    if (background) {
+        std::printf("  (%llu checkpoints, last %llu ms, longest pause %.1f ms)",
+                    static_cast<unsigned long long>(stats.checkpoints), static_cast<unsigned long long>(stats.lastMillis),
+                    stats.longestPauseMicros / 1000.0);
+    }
+    std::printf("\n");
+    std::fflush(stdout);
+}
+} // namespace
+
+int main(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i + 1 < argc; ++i) {
+        size_t value = static_cast<size_t>(std::max(1, std::atoi(argv[i + 1])));
+        if (std::strcmp(argv[i], "--users") == 0) options.users = std::max<size_t>(value, 2);
+        if (std::strcmp(argv[i], "--friends") == 0) options.friends = value;
+        if (std::strcmp(argv[i], "--conversations") == 0) options.conversations = value;
+        if (std::strcmp(argv[i], "--rate") == 0) options.rate = value;
+        if (std::strcmp(argv[i], "--seconds") == 0) options.seconds = value;
+        if (std::strcmp(argv[i], "--interval") == 0) options.interval = value;
+        if (std::strcmp(argv[i], "--dir") == 0) options.dir = argv[i + 1];
+    }
+    options.friends = std::min(options.friends, options.users - 1);
+    options.conversations = std::min(options.conversations, options.users);
+
+    std::filesystem::remove_all(options.dir);
+    std::filesystem::create_directories(options.dir);
+    Clock::time_point started = Clock::now();
+    populate(options.dir + "/base.db", options.users, options.friends, options.conversations);
+    std::printf("%zu users, %zu friends each, %zu conversations, snapshot %.1f MB, built in %.1f s; %zu mutations/s for %zu s\n",
+                options.users, options.friends, options.conversations,
+                std::filesystem::file_size(options.dir + "/base.db") / 1048576.0,
+                std::chrono::duration<double>(Clock::now() - started).count(), options.rate, options.seconds);
+
+    run("none", options, false, false);
+    run("blocking", options, true, false);
+    run("background", options, false, true);
+
+    std::filesystem::remove_all(options.dir);
+    return 0;
+}
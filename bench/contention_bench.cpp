@@ -0,0 +1,224 @@
+// Measures how UserManager throughput scales with the number of threads calling it.
+//
+// --users users are registered, each with --friends friends, and every thread
+// count in --threads then runs --ops operations split evenly between threads.
+// The mix is what workers send in a busy server: 70% direct messages to a
+// friend, 15% friendship checks, and 15% friend requests between random users,
+// accepted by the receiver when they go through. Each thread count runs three ways:
+//   global:  every call made under one mutex, as the server used to do.
+//   striped: calls made directly, serialised only by the manager's lock stripes.
+//   shards:  calls posted to a UserShards with --shards shard threads (one per
+//            core by default); each thread keeps up to --window operations in
+//            flight and waits for their replies.
+// The write-ahead log is kept in memory so the locking, not the disk, is measured.
+//
+// Usage: contention_bench [--users N] [--friends N] [--ops N] [--threads 1,4,16,64]
+//                         [--shards N] [--window N] [--dir PATH]
+
+#include "../include/user/UserManager.hpp"
+#include "UserShards.hpp"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    size_t users = 10000;
+    size_t friends = 10;
+    size_t ops = 400000;
+    std::vector<size_t> threads = {1, 4, 16, 64};
+    size_t shards = std::max(1u, std::thread::hardware_concurrency());
+    size_t window = 1;
+    std::string dir = "contention_bench.d";
+};
+
+// Parses a comma-separated list of thread counts.
+std::vector<size_t> parseCounts(const char* text) {
+    std::vector<size_t> counts;
+    for (const char* at = text; *at;) {
+        counts.push_back(static_cast<size_t>(std::max(1, std::atoi(at))));
+        at = std::strchr(at, ',');
+        if (!at) break;
+        ++at;
+    }
+    return counts;
+}
+
+// Registers the users and gives user u the friends u + 1 .. u + friends.
+std::vector<UserId> populate(UserManager& manager, const Options& options) {
+    std::vector<UserId> ids;
+    for (size_t u = 0; u < options.users; ++u) {
+        std::string name = "user" + std::to_string(u);
+        manager.registerUser(name, "password");
+        ids.push_back(manager.findUser(name));
+    }
+    for (size_t u = 0; u < options.users; ++u) {
+        for (size_t f = 1; f <= options.friends; ++f) {
+            manager.sendFriendRequest(ids[u], ids[(u + f) % options.users]);
+            manager.acceptFriendRequest(ids[(u + f) % options.users], ids[u]);
+        }
+    }
+    return ids;
+}
+
+// Opens an empty database for one run, in memory but for the message logs.
+std::unique_ptr<UserManager> open(const Options& options, const std::string& label, size_t threads) {
+    std::string path = options.dir + "/" + label + std::to_string(threads) + ".db";
+    std::filesystem::remove_all(path + ".history");
+    std::filesystem::remove(path);
+    PersistenceOptions persistence;
+    persistence.durability = Durability::Memory;
+    return std::make_unique<UserManager>(path, persistence, static_cast<size_t>(-1));
+}
+
+// One operation of the mix.
+struct Operation {
+    enum Kind { Message, Check, Request } kind;
+    UserId user;
+    UserId other; // A friend, or for a request a random user.
+};
+
+// Draws the next operation from `random`.
+Operation draw(std::mt19937_64& random, const Options& options, const std::vector<UserId>& ids) {
+    size_t u = random() % options.users;
+    size_t f = 1 + random() % options.friends;
+    unsigned kind = static_cast<unsigned>(random() % 100);
+    if (kind < 70) return {Operation::Message, ids[u], ids[(u + f) % options.users]};
+    if (kind < 85) return {Operation::Check, ids[u], ids[(u + f) % options.users]};
+    return {Operation::Request, ids[u], ids[random() % options.users]};
+}
+
+// Runs `body(thread)` on `threads` threads and prints the rate of `total` operations.
+template <typename Body>
+void measure(const char* label, size_t threads, size_t total, Body body) {
+    std::vector<std::thread> workers;
+    Clock::time_point start = Clock::now();
+    for (size_t t = 0; t < threads; ++t) workers.emplace_back(body, t);
+    for (std::thread& worker : workers) worker.join();
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    std::printf("%-8s %3zu threads  %10.0f ops/s\n", label, threads, total / seconds);
+    std::fflush(stdout);
+}
+
+// Runs the mix on `threads` threads calling the manager, each call wrapped in `guard`.
+template <typename Guard>
+void runLocked(const char* label, const Options& options, size_t threads, Guard guard) {
+    std::unique_ptr<UserManager> manager = open(options, label, threads);
+    std::vector<UserId> ids = populate(*manager, options);
+    size_t perThread = options.ops / threads;
+    measure(label, threads, perThread * threads, [&](size_t t) {
+        std::mt19937_64 random(t + 1);
+        for (size_t i = 0; i < perThread; ++i) {
+            Operation op = draw(random, options, ids);
+            if (op.kind == Operation::Message) {
+                guard([&] { manager->storeMessage(op.user, op.other, "hello from a benchmark thread"); });
+            } else if (op.kind == Operation::Check) {
+                guard([&] { manager->areFriends(op.user, op.other); });
+            } else if (op.user != op.other) {
+                bool sent = false;
+                guard([&] { sent = manager->sendFriendRequest(op.user, op.other); });
+                if (sent) guard([&] { manager->acceptFriendRequest(op.other, op.user); });
+            }
+        }
+    });
+}
+
+// Operations a thread has posted to the shards and not yet had replies for.
+struct InFlight {
+    std::mutex mutex;
+    std::condition_variable changed;
+    size_t count = 0;
+
+    // Waits until fewer than `limit` are in flight, then counts one more.
+    void add(size_t limit) {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [&] { return count < limit; });
+        ++count;
+    }
+    // Counts one as replied to.
+    void done() {
+        std::lock_guard<std::mutex> lock(mutex);
+        --count;
+        changed.notify_all();
+    }
+    // Waits for every reply.
+    void drain() {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [&] { return count == 0; });
+    }
+};
+
+// Runs the mix on `threads` threads posting to shards.
+void runSharded(const Options& options, size_t threads) {
+    std::unique_ptr<UserManager> manager = open(options, "shards", threads);
+    std::vector<UserId> ids = populate(*manager, options);
+    UserShards shards(*manager, options.shards);
+    size_t perThread = options.ops / threads;
+    measure("shards", threads, perThread * threads, [&](size_t t) {
+        std::mt19937_64 random(t + 1);
+        InFlight inFlight;
+        auto replied = [&inFlight](bool) { inFlight.done(); };
+        for (size_t i = 0; i < perThread; ++i) {
+            Operation op = draw(random, options, ids);
+            if (op.kind == Operation::Request && op.user == op.other) continue;
+            inFlight.add(options.window);
+            if (op.kind == Operation::Message) {
+                shards.storeMessage(op.user, op.other, "hello from a benchmark thread", replied);
+            } else if (op.kind == Operation::Check) {
+                shards.areFriends(op.user, op.other, replied);
+            } else {
+                shards.sendFriendRequest(op.user, op.other, [&shards, &inFlight, op, replied](bool sent) {
+                    if (sent) {
+                        shards.acceptFriendRequest(op.other, op.user, replied);
+                    } else {
+                        inFlight.done();
+                    }
+                });
+            }
+        }
+        inFlight.drain();
+    });
+}
+} // namespace
+
+int main(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i + 1 < argc; ++i) {
+        size_t value = static_cast<size_t>(std::max(1, std::atoi(argv[i + 1])));
+        if (std::strcmp(argv[i], "--users") == 0) options.users = std::max<size_t>(value, 2);
+        if (std::strcmp(argv[i], "--friends") == 0) options.friends = value;
+        if (std::strcmp(argv[i], "--ops") == 0) options.ops = value;
+        if (std::strcmp(argv[i], "--threads") == 0) options.threads = parseCounts(argv[i + 1]);
+        if (std::strcmp(argv[i], "--shards") == 0) options.shards = value;
+        if (std::strcmp(argv[i], "--window") == 0) options.window = value;
+        if (std::strcmp(argv[i], "--dir") == 0) options.dir = argv[i + 1];
+    }
+    options.friends = std::min(options.friends, options.users - 1);
+    std::filesystem::create_directories(options.dir);
+    std::printf("%zu users, %zu friends each, %zu operations per run, %u cores, %zu shards\n", options.users,
+                options.friends, options.ops, std::thread::hardware_concurrency(), options.shards);
+
+    for (size_t threads : options.threads) {
+        std::mutex global;
+        runLocked("global", options, threads, [&](auto call) {
+            std::lock_guard<std::mutex> lock(global);
+            call();
+        });
+        runLocked("striped", options, threads, [](auto call) { call(); });
+        runSharded(options, threads);
+    }
+    std::filesystem::remove_all(options.dir);
+    return 0;
+}
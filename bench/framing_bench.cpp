@@ -0,0 +1,115 @@
+// Compares line framing throughput of the original leftover-string parser with
+// FrameBuffer's in-place, SIMD-scanned framing.
+//
+// The same stream of newline-terminated lines is fed to both parsers in
+// fixed-size chunks, as a socket would deliver it. Each parser hands every
+// line to a trivial consumer so neither can skip work.
+//
+// Usage: framing_bench [--lines N]
+
+#include "../include/net/FrameBuffer.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+// Keeps the compiler from discarding the parsed lines.
+size_t checksum = 0;
+
+void consume_line(std::string_view line) {
+    checksum += line.size();
+}
+
+// The parser the server used before FrameBuffer: append each read to a string, then
+// substr and erase one line at a time.
+size_t parse_leftover(const std::string& stream, size_t chunk_size) {
+    std::string leftover;
+    size_t lines = 0;
+    for (size_t offset = 0; offset < stream.size(); offset += chunk_size) {
+        leftover.append(stream, offset, chunk_size);
+        size_t newline_pos;
+        while ((newline_pos = leftover.find('\n')) != std::string::npos) {
+            std::string line = leftover.substr(0, newline_pos);
+            leftover.erase(0, newline_pos + 1);
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            consume_line(line);
+            ++lines;
+        }
+    }
+    return lines;
+}
+
+// FrameBuffer fed the same chunks.
+size_t parse_frame_buffer(const std::string& stream, size_t chunk_size) {
+    FrameBuffer buffer;
+    size_t lines = 0;
+    std::string_view line;
+    for (size_t offset = 0; offset < stream.size(); offset += chunk_size) {
+        buffer.append(stream.data() + offset, std::min(chunk_size, stream.size() - offset));
+        while (buffer.next_line(line) == FrameBuffer::Status::Frame) {
+            consume_line(line);
+            ++lines;
+        }
+    }
+    return lines;
+}
+
+// Builds `count` lines of `length` bytes each, newline included.
+std::string make_stream(size_t count, size_t length) {
+    std::string stream;
+    stream.reserve(count * length);
+    std::string line(length - 1, 'x');
+    line += '\n';
+    for (size_t i = 0; i < count; ++i) {
+        stream += line;
+    }
+    return stream;
+}
+
+// Returns lines per second for one parser over the stream.
+template <typename Parser>
+double measure(Parser parser, const std::string& stream, size_t chunk_size, size_t expected) {
+    auto start = Clock::now();
+    size_t lines = parser(stream, chunk_size);
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    if (lines != expected) {
+        std::fprintf(stderr, "Parsed %zu lines, expected %zu\n", lines, expected);
+        std::exit(EXIT_FAILURE);
+    }
+    return static_cast<double>(lines) / seconds;
+}
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t line_count = 2000000;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (std::strcmp(argv[i], "--lines") == 0) line_count = std::strtoull(argv[i + 1], nullptr, 10);
+    }
+
+    struct Case {
+        size_t line_length;
+        size_t chunk_size;
+    };
+    const Case cases[] = {{32, 1024}, {32, 65536}, {200, 4096}, {200, 65536}, {4096, 65536}};
+
+    std::printf("line bytes  chunk bytes  leftover lines/s  FrameBuffer lines/s  speedup\n");
+    for (const Case& c : cases) {
+        // Keep the total volume roughly constant across line lengths.
+        size_t count = std::max<size_t>(1000, line_count * 32 / c.line_length);
+        std::string stream = make_stream(count, c.line_length);
+        double leftover = measure(parse_leftover, stream, c.chunk_size, count);
+        double frame_buffer = measure(parse_frame_buffer, stream, c.chunk_size, count);
+        std::printf("%10zu  %11zu  %16.0f  %19.0f  %6.1fx\n", c.line_length, c.chunk_size, leftover, frame_buffer,
+                    frame_buffer / leftover);
+    }
+    std::printf("(checksum %zu)\n", checksum);
+    return 0;
+}
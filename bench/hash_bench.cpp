@@ -0,0 +1,187 @@
+// Compares lookups per second and memory of the open-addressing FlatMap and
+// FlatSet against the standard containers they replaced.
+//
+// --users names like "user123456" are interned, and each user gets --friends
+// friends. Then --lookups random queries run against each container:
+//   names hit/miss:  name to ID, the lookup done for every command that names
+//                    a user. std::unordered_map<std::string, ...> needs the
+//                    name copied into a std::string first; the string_view
+//                    keyed maps take it as it arrives.
+//   friends hit/miss: membership in one user's friend set, as done by every
+//                    friend request and message.
+// Memory is what the containers allocate, counted by this program's operator new.
+//
+// Usage: hash_bench [--users N] [--friends N] [--lookups N]
+
+#include "../include/user/FlatHash.hpp"
+#include "../include/user/User.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <malloc.h>
+#include <new>
+#include <random>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace {
+std::atomic<size_t> allocated{0};
+
+// Counts `block` as allocated, or fails like operator new if it is null.
+void* track(void* block) {
+    if (!block) throw std::bad_alloc();
+    allocated += malloc_usable_size(block);
+    return block;
+}
+
+// Stops counting `block` and frees it.
+void untrack(void* block) {
+    if (!block) return;
+    allocated -= malloc_usable_size(block);
+    std::free(block);
+}
+} // namespace
+
+void* operator new(size_t bytes) { return track(std::malloc(bytes)); }
+void* operator new[](size_t bytes) { return track(std::malloc(bytes)); }
+void* operator new(size_t bytes, std::align_val_t align) {
+    return track(std::aligned_alloc(static_cast<size_t>(align), (bytes + static_cast<size_t>(align) - 1) & ~(static_cast<size_t>(align) - 1)));
+}
+void operator delete(void* block) noexcept { untrack(block); }
+void operator delete[](void* block) noexcept { untrack(block); }
+void operator delete(void* block, size_t) noexcept { untrack(block); }
+void operator delete[](void* block, size_t) noexcept { untrack(block); }
+void operator delete(void* block, std::align_val_t) noexcept { untrack(block); }
+void operator delete(void* block, size_t, std::align_val_t) noexcept { untrack(block); }
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    size_t users = 1000000;
+    size_t friends = 10;
+    size_t lookups = 10000000;
+};
+
+// Runs `lookup` on each query and prints the rate, with the containers' memory.
+template <typename Query, typename Lookup>
+void measure(const char* label, size_t bytes, const std::vector<Query>& queries, Lookup lookup) {
+    size_t found = 0;
+    Clock::time_point start = Clock::now();
+    for (const Query& query : queries) found += lookup(query);
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    std::printf("%-44s %8.1f M lookups/s  %8.1f MB  (%zu found)\n", label, queries.size() / seconds / 1e6,
+                bytes / 1048576.0, found);
+    std::fflush(stdout);
+}
+
+// Builds a container with `build`, returning the bytes it allocated.
+template <typename Build>
+size_t built(Build build) {
+    size_t before = allocated;
+    build();
+    return allocated - before;
+}
+
+void benchNames(const Options& options, const std::vector<std::string>& names) {
+    // Queries are copies, as a name arrives in a command buffer rather than in the table.
+    std::mt19937_64 random(1);
+    std::vector<std::string> hits;
+    std::vector<std::string> misses;
+    hits.reserve(options.lookups);
+    misses.reserve(options.lookups);
+    for (size_t i = 0; i < options.lookups; ++i) {
+        hits.push_back(names[random() % names.size()]);
+        misses.push_back("nobody" + std::to_string(random() % names.size()));
+    }
+    std::vector<std::string_view> hitViews(hits.begin(), hits.end());
+    std::vector<std::string_view> missViews(misses.begin(), misses.end());
+
+    {
+        std::unordered_map<std::string, UserId> ids;
+        size_t bytes = built([&] {
+            for (size_t i = 0; i < names.size(); ++i) ids.emplace(names[i], static_cast<UserId>(i + 1));
+        });
+        auto lookup = [&](std::string_view name) { return ids.count(std::string(name)); };
+        measure("names hit   std::unordered_map<string>", bytes, hitViews, lookup);
+        measure("names miss  std::unordered_map<string>", bytes, missViews, lookup);
+    }
+    {
+        std::unordered_map<std::string_view, UserId> ids;
+        size_t bytes = built([&] {
+            for (size_t i = 0; i < names.size(); ++i) ids.emplace(names[i], static_cast<UserId>(i + 1));
+        });
+        auto lookup = [&](std::string_view name) { return ids.count(name); };
+        measure("names hit   std::unordered_map<string_view>", bytes, hitViews, lookup);
+        measure("names miss  std::unordered_map<string_view>", bytes, missViews, lookup);
+    }
+    {
+        FlatMap<std::string_view, UserId> ids;
+        size_t bytes = built([&] {
+            for (size_t i = 0; i < names.size(); ++i) ids.try_emplace(std::string_view(names[i]), static_cast<UserId>(i + 1));
+        });
+        auto lookup = [&](std::string_view name) { return ids.count(name); };
+        measure("names hit   FlatMap<string_view>", bytes, hitViews, lookup);
+        measure("names miss  FlatMap<string_view>", bytes, missViews, lookup);
+    }
+}
+
+struct Membership {
+    UserId user;
+    UserId other;
+};
+
+// Gives user u the friends u + 1 .. u + friends, as checkpoint_bench does, and measures
+// membership tests on random users.
+template <typename Set>
+void benchFriends(const char* hitLabel, const char* missLabel, const Options& options) {
+    std::vector<Set> friends(options.users);
+    size_t bytes = built([&] {
+        for (size_t u = 0; u < options.users; ++u) {
+            for (size_t f = 1; f <= options.friends; ++f) friends[u].insert(static_cast<UserId>((u + f) % options.users + 1));
+        }
+    });
+    std::mt19937_64 random(2);
+    std::vector<Membership> hits;
+    std::vector<Membership> misses;
+    hits.reserve(options.lookups);
+    misses.reserve(options.lookups);
+    for (size_t i = 0; i < options.lookups; ++i) {
+        size_t u = random() % options.users;
+        size_t f = 1 + random() % options.friends;
+        hits.push_back({static_cast<UserId>(u), static_cast<UserId>((u + f) % options.users + 1)});
+        misses.push_back({static_cast<UserId>(u), static_cast<UserId>((u + options.friends + 1 + f) % options.users + 1)});
+    }
+    auto lookup = [&](const Membership& query) { return friends[query.user].count(query.other); };
+    measure(hitLabel, bytes, hits, lookup);
+    measure(missLabel, bytes, misses, lookup);
+}
+} // namespace
+
+int main(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i + 1 < argc; ++i) {
+        size_t value = static_cast<size_t>(std::max(1, std::atoi(argv[i + 1])));
+        if (std::strcmp(argv[i], "--users") == 0) options.users = std::max<size_t>(value, 3);
+        if (std::strcmp(argv[i], "--friends") == 0) options.friends = value;
+        if (std::strcmp(argv[i], "--lookups") == 0) options.lookups = value;
+    }
+    options.friends = std::min(options.friends, (options.users - 1) / 2);
+
+    std::vector<std::string> names;
+    names.reserve(options.users);
+    for (size_t u = 0; u < options.users; ++u) names.push_back("user" + std::to_string(u));
+    std::printf("%zu users, %zu friends each, %zu lookups per case\n", options.users, options.friends, options.lookups);
+
+    benchNames(options, names);
+    benchFriends<std::unordered_set<UserId>>("friends hit   std::unordered_set<UserId>",
+                                             "friends miss  std::unordered_set<UserId>", options);
+    benchFriends<FlatSet<UserId>>("friends hit   FlatSet<UserId>", "friends miss  FlatSet<UserId>", options);
+    return 0;
+}
@@ -0,0 +1,187 @@
+// Compares the epoll and io_uring reactor backends on a broadcast workload.
+//
+// For each backend an in-process ChatServer with one reactor is started, N
+// clients log in, and one client sends M chat lines one at a time. Each line
+// is timed from send() until every other client has received it; the
+// server's system calls are counted over the same window.
+//
+// Usage: io_backend_bench [--clients N] [--messages M]
+
+#include "../include/ChatServer.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+struct Result {
+    double syscalls_per_message;
+    double p50_us;
+    double p99_us;
+    double mean_us;
+};
+
+// Connects to the local server, retrying while it is still starting up.
+int connect_client(int port) {
+    for (int attempt = 0; attempt < 200; ++attempt) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(static_cast<uint16_t>(port));
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0) {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            return fd;
+        }
+        close(fd);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    std::cerr << "Could not connect to benchmark server" << std::endl;
+    exit(EXIT_FAILURE);
+}
+
+void send_all(int fd, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+            perror("bench send");
+            exit(EXIT_FAILURE);
+        }
+        sent += static_cast<size_t>(n);
+    }
+}
+
+// Reads from a socket until `needle` has been seen.
+void read_until(int fd, const std::string& needle) {
+    std::string seen;
+    char buffer[4096];
+    while (seen.find(needle) == std::string::npos) {
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n <= 0) {
+            std::cerr << "Benchmark client disconnected" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        seen.append(buffer, static_cast<size_t>(n));
+    }
+}
+
+// Discards whatever is already buffered on a socket.
+void drain(int fd) {
+    char buffer[4096];
+    while (recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT) > 0) {
+    }
+}
+
+Result run(IoBackend backend, int port, int clients, int messages) {
+    ChatServer server(port, 1, backend);
+    std::thread server_thread([&server] { server.start(); });
+
+    std::vector<int> fds;
+    for (int i = 0; i < clients; ++i) {
+        int fd = connect_client(port);
+        send_all(fd, CLIENT_HANDSHAKE_MAGIC + "bench" + std::to_string(i) + "\npw\n/pending\n");
+        read_until(fd, "friend requests");
+        fds.push_back(fd);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    for (int fd : fds) drain(fd);
+
+    std::vector<double> latencies;
+    latencies.reserve(static_cast<size_t>(messages));
+    std::vector<pollfd> polls;
+    for (size_t i = 1; i < fds.size(); ++i) {
+        polls.push_back({fds[i], POLLIN, 0});
+    }
+
+    uint64_t syscalls_before = server.syscall_count();
+    char buffer[4096];
+    for (int m = 0; m < messages; ++m) {
+        std::vector<bool> done(polls.size(), false);
+        size_t remaining = polls.size();
+        auto start = Clock::now();
+        send_all(fds[0], "message " + std::to_string(m) + "\n");
+        while (remaining > 0) {
+            poll(polls.data(), polls.size(), -1);
+            for (size_t i = 0; i < polls.size(); ++i) {
+                if (!(polls[i].revents & POLLIN)) continue;
+                ssize_t n = recv(polls[i].fd, buffer, sizeof(buffer), 0);
+                if (n <= 0) {
+                    std::cerr << "Benchmark client disconnected" << std::endl;
+                    exit(EXIT_FAILURE);
+                }
+                // Each chat line arrives in one segment on loopback and ends in a newline.
+                if (!done[i] && buffer[n - 1] == '\n') {
+                    done[i] = true;
+                    --remaining;
+                }
+            }
+        }
+        latencies.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+    }
+    uint64_t syscalls_after = server.syscall_count();
+
+    for (int fd : fds) close(fd);
+    server.stop();
+    server_thread.join();
+
+    std::sort(latencies.begin(), latencies.end());
+    double total = 0;
+    for (double l : latencies) total += l;
+    Result result;
+    result.syscalls_per_message = static_cast<double>(syscalls_after - syscalls_before) / messages;
+    result.p50_us = latencies[latencies.size() / 2];
+    result.p99_us = latencies[std::min(latencies.size() - 1, latencies.size() * 99 / 100)];
+    result.mean_us = total / static_cast<double>(latencies.size());
+    return result;
+}
+} // namespace
+
+int main(int argc, char* argv[]) {
+    int clients = 100;
+    int messages = 2000;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (std::strcmp(argv[i], "--clients") == 0) clients = std::max(2, std::atoi(argv[i + 1]));
+        if (std::strcmp(argv[i], "--messages") == 0) messages = std::max(1, std::atoi(argv[i + 1]));
+    }
+
+    // The server persists users to ./users.db; keep that out of the caller's directory.
+    char dir_template[] = "/tmp/chat_bench_XXXXXX";
+    if (!mkdtemp(dir_template) || chdir(dir_template) != 0) {
+        perror("Benchmark working directory");
+        return 1;
+    }
+
+    // The server logs every chat line; silence it while measuring.
+    std::ostringstream discarded;
+    std::streambuf* original = std::cout.rdbuf(discarded.rdbuf());
+    Result epoll_result = run(IoBackend::Epoll, 9101, clients, messages);
+    discarded.str("");
+    Result uring_result = run(IoBackend::IoUring, 9102, clients, messages);
+    std::cout.rdbuf(original);
+
+    std::cout << clients << " clients, " << messages << " broadcast messages\n";
+    std::cout << "backend    syscalls/msg   p50 us   p99 us   mean us\n";
+    auto print = [](const char* name, const Result& r) {
+        std::printf("%-10s %12.2f %8.1f %8.1f %9.1f\n", name, r.syscalls_per_message, r.p50_us, r.p99_us, r.mean_us);
+    };
+    print("epoll", epoll_result);
+    print("io_uring", uring_result);
+    return 0;
+}
@@ -0,0 +1,282 @@
+// Compares the streaming JSON loader and writer with the document-tree code they replaced.
+//
+// A users.json of the requested size is generated in the same shape the old
+// exporter wrote (indented, walSequence envelope, every conversation under
+// both participants). Each case then runs in a
+// forked child so its peak resident set size can be read back from the kernel
+// on its own.
+//
+// Loading reports the wall time to a fully built user map and peak RSS:
+//   dom: read the file into a string, parse a full nlohmann::json tree, then
+//        build Users from it (the loader before streaming).
+//   sax: UserSnapshot::readJson, which builds Users from parser events.
+//
+// Saving first loads the users, then reports the time to write them back out
+// and how far the save pushed peak RSS above the loaded map:
+//   dom: build an nlohmann::json tree, dump(4) it into an ofstream (the writer
+//        before streaming).
+//   stream: UserSnapshot::writeJson, compact JSON straight into a file buffer.
+//
+// Usage: json_bench [--megabytes N] [--file PATH] [--keep]
+
+#include "../include/user/UserSnapshot.hpp"
+#include "../include/nlohmann/json.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+// Users and the conversations between them, as the server holds them.
+struct Database {
+    explicit Database(const std::string& directory) : conversations(directory, users) {}
+
+    UserTable users;
+    ConversationStore conversations;
+};
+
+// Shape of each generated user.
+constexpr int kFriends = 20;
+constexpr int kConversations = 10;
+constexpr int kMessagesPerConversation = 40;
+
+// Writes a users.json of roughly `megabytes` MB and returns the number of users in it.
+size_t generate(const std::string& path, size_t megabytes) {
+    FILE* out = std::fopen(path.c_str(), "w");
+    if (!out) {
+        std::perror("fopen");
+        exit(EXIT_FAILURE);
+    }
+    const size_t target = megabytes << 20;
+    std::fprintf(out, "{\n    \"walSequence\": 0,\n    \"users\": {");
+    size_t users = 0;
+    for (; static_cast<size_t>(std::ftell(out)) < target || users < 2; ++users) {
+        std::fprintf(out, "%s\n        \"user%zu\": {\n            \"chatHistory\": {", users ? "," : "", users);
+        for (int c = 0; c < kConversations; ++c) {
+            size_t partner = (users + 1 + c) % (users + kConversations + 1);
+            std::fprintf(out, "%s\n                \"user%zu\": [", c ? "," : "", partner);
+            for (int m = 0; m < kMessagesPerConversation; ++m) {
+                std::fprintf(out,
+                             "%s\n                    {\n                        \"content\": \"message %d between user%zu "
+                             "and user%zu, long enough to look like chat\",\n                        \"sender\": "
+                             "\"user%zu\"\n                    }",
+                             m ? "," : "", m, users, partner, m % 2 ? partner : users);
+            }
+            std::fprintf(out, "\n                ]");
+        }
+        std::fprintf(out, "\n            },\n            \"friends\": [");
+        for (int f = 0; f < kFriends; ++f) {
+            std::fprintf(out, "%s\n                \"user%zu\"", f ? "," : "", users + 1 + f);
+        }
+        std::fprintf(out, "\n            ],\n            \"incomingRequests\": [],\n            \"outgoingRequests\": [],\n"
+                          "            \"passwordHash\": \"%zu\"\n        }",
+                     std::hash<size_t>{}(users));
+    }
+    std::fprintf(out, "\n    }\n}\n");
+    std::fclose(out);
+    return users;
+}
+
+// The loader before streaming: whole file in memory, then a DOM, then users.
+size_t load_dom(const std::string& path) {
+    std::ifstream in(path);
+    std::stringstream contents;
+    contents << in.rdbuf();
+    std::string text = contents.str();
+    nlohmann::json j = nlohmann::json::parse(text);
+    const nlohmann::json& data = j["users"];
+
+    UserTable users;
+    ConversationStore conversations(path + ".history", users);
+    for (const auto& [username, entry] : data.items()) {
+        User& user = *users.add(users.intern(username)).first;
+        for (const auto& name : entry["friends"]) {
+            user.receiveFriendRequestFrom(users.intern(name.get<std::string>()));
+            user.acceptFriendRequestFrom(users.intern(name.get<std::string>()));
+        }
+        for (const auto& name : entry["incomingRequests"]) user.receiveFriendRequestFrom(users.intern(name.get<std::string>()));
+        for (const auto& name : entry["outgoingRequests"]) user.sendFriendRequestTo(users.intern(name.get<std::string>()));
+        for (const auto& [partner, messages] : entry["chatHistory"].items()) {
+            UserId partnerId = users.intern(partner);
+            ChatHistory& history = conversations.open(user.getId(), partnerId);
+            user.addChatPartner(partnerId);
+            if (history.size() > 0) continue;
+            for (const auto& msg : messages) {
+                history.append(Message{users.intern(msg["sender"].get<std::string>()), msg["content"].get<std::string>()});
+            }
+        }
+    }
+    return users.size();
+}
+
+// The streaming loader the server uses.
+void read_users(const std::string& path, Database& database) {
+    uint64_t sequence = 0;
+    std::string error;
+    if (!UserSnapshot::readJson(path, database.users, database.conversations, sequence, error)) {
+        std::cerr << "readJson failed: " << error << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+size_t load_sax(const std::string& path) {
+    Database database(path + ".history");
+    read_users(path, database);
+    return database.users.size();
+}
+
+// The writer before streaming: a full tree, pretty-printed.
+void save_dom(const Database& database, const std::string& path) {
+    nlohmann::json j = nlohmann::json::object();
+    const UserTable& users = database.users;
+    auto names = [&](const UserIdSet& ids) {
+        nlohmann::json list = nlohmann::json::array();
+        for (UserId id : ids) list.push_back(users.name(id));
+        return list;
+    };
+    for (const User* user : users.list()) {
+        nlohmann::json entry;
+        entry["friends"] = names(user->getFriends());
+        entry["incomingRequests"] = names(user->getIncomingFriendRequests());
+        j[users.name(user->getId())] = entry;
+    }
+    nlohmann::json conversations = nlohmann::json::array();
+    for (const auto& [participants, history] : database.conversations) {
+        nlohmann::json conversation;
+        conversation["participants"] = {users.name(participants.first), users.name(participants.second)};
+        conversation["messages"] = nlohmann::json::array();
+        history.forEach([&](UserId sender, std::string_view content, int64_t timestamp) {
+            conversation["messages"].push_back({{"sender", users.name(sender)}, {"content", content}, {"timestamp", timestamp}});
+        });
+        conversations.push_back(std::move(conversation));
+    }
+    nlohmann::json snapshot;
+    snapshot["walSequence"] = 0;
+    snapshot["users"] = std::move(j);
+    snapshot["conversations"] = std::move(conversations);
+    std::ofstream out(path, std::ios::trunc);
+    out << snapshot.dump(4);
+}
+
+void save_stream(const Database& database, const std::string& path) {
+    if (!UserSnapshot::writeJson(path, database.users, database.conversations, 0)) {
+        std::cerr << "writeJson failed" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Returns this process's peak RSS in MB.
+double peak_rss_mb() {
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024.0;
+}
+
+// Runs `body` in a child process and returns the line it reports; `usage` receives the child's
+// resource usage.
+template <typename Body>
+std::string in_child(Body body, rusage& usage) {
+    int pipe_fds[2];
+    if (pipe(pipe_fds) != 0) {
+        std::perror("pipe");
+        exit(EXIT_FAILURE);
+    }
+    pid_t child = fork();
+    if (child == 0) {
+        close(pipe_fds[0]);
+        std::string line = body();
+        (void)!write(pipe_fds[1], line.data(), line.size());
+        _exit(0);
+    }
+    close(pipe_fds[1]);
+    char line[128] = {};
+    (void)!read(pipe_fds[0], line, sizeof(line) - 1);
+    close(pipe_fds[0]);
+
+    int status = 0;
+    wait4(child, &status, 0, &usage);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || line[0] == '\0') {
+        std::cerr << "benchmark child failed" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return line;
+}
+
+// Reports one loader's wall time and peak RSS.
+void measure_load(const char* name, size_t (*load)(const std::string&), const std::string& path) {
+    rusage usage{};
+    std::string line = in_child([&] {
+        auto start = Clock::now();
+        size_t users = load(path);
+        double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        return std::to_string(users) + " " + std::to_string(ms);
+    }, usage);
+    size_t users = 0;
+    double ms = 0;
+    std::sscanf(line.c_str(), "%zu %lf", &users, &ms);
+    std::printf("load %-6s %8zu users %10.1f ms %10.1f MB peak RSS\n", name, users, ms, usage.ru_maxrss / 1024.0);
+}
+
+// Reports one writer's wall time and how much it raised peak RSS over the loaded users.
+void measure_save(const char* name, void (*save)(const Database&, const std::string&),
+                  const std::string& path) {
+    rusage usage{};
+    std::string out_path = path + ".out";
+    std::string line = in_child([&] {
+        Database database(path + ".history");
+        read_users(path, database);
+        double loaded = peak_rss_mb();
+        auto start = Clock::now();
+        save(database, out_path);
+        double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        return std::to_string(ms) + " " + std::to_string(peak_rss_mb() - loaded);
+    }, usage);
+    double ms = 0;
+    double spike = 0;
+    std::sscanf(line.c_str(), "%lf %lf", &ms, &spike);
+    struct stat info {};
+    stat(out_path.c_str(), &info);
+    std::printf("save %-6s %8.1f MB file %10.1f ms %+10.1f MB peak RSS during save\n", name,
+                info.st_size / 1048576.0, ms, spike);
+    std::remove(out_path.c_str());
+}
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t megabytes = 256;
+    std::string path = "json_bench.json";
+    bool keep = false;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--keep") == 0) keep = true;
+        if (i + 1 >= argc) continue;
+        if (std::strcmp(argv[i], "--megabytes") == 0) megabytes = static_cast<size_t>(std::max(1, std::atoi(argv[i + 1])));
+        if (std::strcmp(argv[i], "--file") == 0) path = argv[i + 1];
+    }
+
+    size_t users = generate(path, megabytes);
+    struct stat info {};
+    stat(path.c_str(), &info);
+    std::printf("%s: %.1f MB, %zu users\n", path.c_str(), info.st_size / 1048576.0, users);
+
+    measure_load("dom", load_dom, path);
+    measure_load("sax", load_sax, path);
+    measure_save("dom", save_dom, path);
+    measure_save("stream", save_stream, path);
+
+    if (!keep) std::remove(path.c_str());
+    std::filesystem::remove_all(path + ".history");
+    return 0;
+}
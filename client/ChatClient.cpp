@@ -1,5 +1,6 @@
 #include "../include/ChatClient.hpp"
 #include "../include/Color.hpp"
+#include <cstdlib>
 #include <iostream>
 #include <thread>
 #include <string>
@@ -31,18 +32,9 @@ ChatClient::~ChatClient()
     cleanup();
 }
 
-// Connects the client to the chat server, performing handshake and authentication.
-void ChatClient::connect_to_server()
+// Opens the TCP connection to the server.
+void ChatClient::open_socket()
 {
-#ifdef _WIN32
-    WSADATA wsaData;
-    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
-    {
-        std::cerr << COLOR_RED << "WSAStartup failed" << COLOR_RESET << std::endl;
-        exit(1);
-    }
-#endif
-
     sock_ = socket(AF_INET, SOCK_STREAM, 0);
     if (sock_ < 0)
     {
@@ -66,8 +58,54 @@ void ChatClient::connect_to_server()
         perror("Connection failed");
         exit(1);
     }
+}
+
+// Sends the V2 handshake and reads the reply line. A server that supports V2 echoes it;
+// an older one rejects the handshake and closes the connection.
+bool ChatClient::negotiate_binary()
+{
+    send(sock_, CLIENT_HANDSHAKE_MAGIC_V2.c_str(), static_cast<int>(CLIENT_HANDSHAKE_MAGIC_V2.length()), 0);
+
+    std::string reply;
+    char c;
+    while (reply.size() < CLIENT_HANDSHAKE_MAGIC_V2.size() && recv(sock_, &c, 1, 0) == 1)
+    {
+        reply += c;
+        if (c == '\n')
+            break;
+    }
+    return reply == CLIENT_HANDSHAKE_MAGIC_V2;
+}
+
+// Connects the client to the chat server, performing handshake and authentication.
+// The binary protocol is used when the server offers it; otherwise the client reconnects with V1.
+void ChatClient::connect_to_server()
+{
+#ifdef _WIN32
+    WSADATA wsaData;
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+    {
+        std::cerr << COLOR_RED << "WSAStartup failed" << COLOR_RESET << std::endl;
+        exit(1);
+    }
+#endif
 
+    open_socket();
+    binary_ = negotiate_binary();
     connected_ = true;
+
+    if (binary_)
+    {
+        std::string body;
+        wire::put_string(body, username_);
+        wire::put_string(body, password_);
+        send_frame(wire::Opcode::Login, body);
+        return;
+    }
+
+    CLOSE_SOCKET(sock_);
+    open_socket();
+
     // Send handshake magic string immediately after connecting.
     send(sock_, CLIENT_HANDSHAKE_MAGIC.c_str(), static_cast<int>(CLIENT_HANDSHAKE_MAGIC.length()), 0);
 
@@ -79,10 +117,156 @@ void ChatClient::connect_to_server()
     send(sock_, password_with_newline.c_str(), static_cast<int>(password_with_newline.length()), 0);
 }
 
+// Sends one length-prefixed frame.
+void ChatClient::send_frame(wire::Opcode opcode, const std::string& body)
+{
+    std::string frame = wire::encode_frame(opcode, body);
+    send(sock_, frame.c_str(), static_cast<int>(frame.length()), 0);
+}
+
+// Maps the text commands users type onto binary requests; anything else is chat.
+void ChatClient::send_binary_input(const std::string& message)
+{
+    std::string body;
+    if (message.rfind("/friend ", 0) == 0)
+    {
+        std::string command_args = message.substr(8);
+        size_t space_pos = command_args.find(' ');
+        std::string sub_command = command_args.substr(0, space_pos);
+        wire::FriendAction action;
+        if (space_pos != std::string::npos && sub_command == "add")
+            action = wire::FriendAction::Add;
+        else if (space_pos != std::string::npos && sub_command == "accept")
+            action = wire::FriendAction::Accept;
+        else if (space_pos != std::string::npos && sub_command == "reject")
+            action = wire::FriendAction::Reject;
+        else
+        {
+            std::cout << COLOR_RED << "Use /friend add <username>, /friend accept <username>, or /friend reject <username>." << COLOR_RESET << "\n";
+            return;
+        }
+        body.push_back(static_cast<char>(action));
+        wire::put_string(body, command_args.substr(space_pos + 1));
+        send_frame(wire::Opcode::Friend, body);
+    }
+    else if (message.rfind("/msg ", 0) == 0)
+    {
+        std::string command_args = message.substr(5);
+        size_t first_space = command_args.find(' ');
+        if (first_space == std::string::npos)
+        {
+            std::cout << COLOR_RED << "Use /msg <username> <message>." << COLOR_RESET << "\n";
+            return;
+        }
+        wire::put_string(body, command_args.substr(0, first_space));
+        wire::put_string(body, command_args.substr(first_space + 1));
+        send_frame(wire::Opcode::DirectMessage, body);
+    }
+    else if (message == "/pending")
+    {
+        send_frame(wire::Opcode::ListPending, body);
+    }
+    else if (message.rfind("/history ", 0) == 0)
+    {
+        std::string command_args = message.substr(9);
+        size_t space_pos = command_args.find(' ');
+        uint32_t limit = 20;
+        if (space_pos != std::string::npos)
+            limit = static_cast<uint32_t>(std::strtoul(command_args.c_str() + space_pos + 1, nullptr, 10));
+        wire::put_string(body, command_args.substr(0, space_pos));
+        wire::put_varint(body, limit);
+        send_frame(wire::Opcode::History, body);
+    }
+    else if (message == "/stats")
+    {
+        send_frame(wire::Opcode::Stats, body);
+    }
+    else
+    {
+        wire::put_string(body, message);
+        send_frame(wire::Opcode::Chat, body);
+    }
+}
+
+// Turns a server frame into the same text a V1 server would have sent.
+std::string ChatClient::render_frame(const wire::Frame& frame)
+{
+    wire::Reader reader(frame.body);
+    switch (frame.opcode)
+    {
+    case wire::Opcode::Ack:
+        return COLOR_GREEN "[Server]: " + std::string(reader.string()) + COLOR_RESET;
+    case wire::Opcode::Error:
+        return COLOR_RED "[Server]: " + std::string(reader.string()) + COLOR_RESET;
+    case wire::Opcode::Notice:
+        return COLOR_YELLOW "[Server]: " + std::string(reader.string()) + COLOR_RESET;
+    case wire::Opcode::UserInfo:
+    {
+        uint32_t user_id = reader.varint();
+        user_names_[user_id] = std::string(reader.string());
+        return "";
+    }
+    case wire::Opcode::UserJoined:
+    {
+        uint32_t user_id = reader.varint();
+        std::string& name = user_names_[user_id];
+        name = std::string(reader.string());
+        return COLOR_GREEN "[Server]: " + name + " has joined the chat!" COLOR_RESET;
+    }
+    case wire::Opcode::UserLeft:
+        return COLOR_YELLOW "[Server]: " + user_names_[reader.varint()] + " has left the chat." COLOR_RESET;
+    case wire::Opcode::Chat:
+    {
+        const std::string& sender = user_names_[reader.varint()];
+        return "[" + sender + "]: " + std::string(reader.string());
+    }
+    case wire::Opcode::DirectMessage:
+    {
+        const std::string& sender = user_names_[reader.varint()];
+        return COLOR_MAGENTA "[DM from " + sender + "]: " + std::string(reader.string()) + COLOR_RESET;
+    }
+    case wire::Opcode::Friend:
+    {
+        wire::FriendAction action = static_cast<wire::FriendAction>(reader.byte());
+        std::string name(reader.string());
+        if (action == wire::FriendAction::Requested)
+            return COLOR_YELLOW "[Server]: " + name + " has sent you a friend request! Use /friend accept " + name + " to accept." COLOR_RESET;
+        return COLOR_GREEN "[Server]: " + name + " has accepted your friend request!" COLOR_RESET;
+    }
+    case wire::Opcode::PendingList:
+    {
+        uint32_t count = reader.varint();
+        if (count == 0)
+            return COLOR_CYAN "[Server]: No pending friend requests." COLOR_RESET;
+        std::string text = COLOR_CYAN "[Server]: Pending friend requests:";
+        for (uint32_t i = 0; i < count && reader.ok(); ++i)
+            text += "\n- " + std::string(reader.string());
+        return text + COLOR_RESET;
+    }
+    case wire::Opcode::HistoryList:
+    {
+        std::string peer(reader.string());
+        uint32_t count = reader.varint();
+        if (count == 0)
+            return COLOR_CYAN "[Server]: No messages with " + peer + "." COLOR_RESET;
+        std::string text = COLOR_CYAN "[Server]: Last " + std::to_string(count) + " message(s) with " + peer + ":";
+        for (uint32_t i = 0; i < count && reader.ok(); ++i)
+        {
+            std::string sender(reader.string());
+            text += "\n- [" + sender + "]: " + std::string(reader.string());
+        }
+        return text + COLOR_RESET;
+    }
+    default:
+        return "";
+    }
+}
+
 // Receives messages from the server and displays them.
 void ChatClient::receive_messages()
 {
     char buffer[1024];
+    std::string pending;
     while (connected_)
     {
         int bytes_received = recv(sock_, buffer, sizeof(buffer) - 1, 0);
@@ -91,6 +275,32 @@ void ChatClient::receive_messages()
             std::cout << "\nDisconnected from server.\n";
             break;
         }
+
+        if (binary_)
+        {
+            pending.append(buffer, static_cast<size_t>(bytes_received));
+            wire::Frame frame;
+            size_t offset = 0;
+            wire::ParseStatus status;
+            while ((status = wire::parse_frame(std::string_view(pending).substr(offset), frame)) == wire::ParseStatus::Frame)
+            {
+                offset += frame.size;
+                std::string message = render_frame(frame);
+                if (!message.empty())
+                {
+                    std::cout << "\r" << message << "\n"
+                              << COLOR_CYAN << "> " << COLOR_RESET << std::flush;
+                }
+            }
+            pending.erase(0, offset);
+            if (status == wire::ParseStatus::Malformed)
+            {
+                std::cout << "\nReceived a malformed frame; disconnecting.\n";
+                break;
+            }
+            continue;
+        }
+
         buffer[bytes_received] = '\0';
 
         std::string message(buffer);
@@ -116,9 +326,16 @@ void ChatClient::send_messages()
         if (message == "/quit" || std::cin.eof())
             break;
 
-        // Appends a newline and sends the message (or command) to the server.
-        message += "\n";
-        send(sock_, message.c_str(), static_cast<int>(message.length()), 0);
+        if (binary_)
+        {
+            send_binary_input(message);
+        }
+        else
+        {
+            // Appends a newline and sends the message (or command) to the server.
+            message += "\n";
+            send(sock_, message.c_str(), static_cast<int>(message.length()), 0);
+        }
 
         std::cout << COLOR_CYAN << "> " << COLOR_RESET;
     }
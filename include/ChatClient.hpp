@@ -1,8 +1,12 @@
 #ifndef CHAT_CLIENT_HPP
 #define CHAT_CLIENT_HPP
 
+#include <cstdint>
 #include <string>
 #include <thread>
+#include <unordered_map>
+
+#include "Protocol.hpp"
 
 // Implements a chat client for connecting to the chat server.
 class ChatClient
@@ -18,6 +22,16 @@ public:
 private:
     // Connects the client to the chat server.
     void connect_to_server();
+    // Opens a TCP connection to the server.
+    void open_socket();
+    // Offers the binary protocol; returns true if the server accepted it.
+    bool negotiate_binary();
+    // Sends a binary-protocol frame.
+    void send_frame(wire::Opcode opcode, const std::string& body);
+    // Translates a typed line (chat or command) into a binary-protocol request.
+    void send_binary_input(const std::string& message);
+    // Formats a frame received from the server for display; returns an empty string for silent frames.
+    std::string render_frame(const wire::Frame& frame);
     // Receives messages from the server and displays them.
     void receive_messages();
     // Sends messages typed by the user to the server.
@@ -39,6 +53,10 @@ private:
     std::thread receiver_thread_;
     // Flag indicating if the client is connected to the server.
     bool connected_ = false;
+    // True once the server has accepted the binary protocol.
+    bool binary_ = false;
+    // Names of users the server has introduced by ID (binary protocol only).
+    std::unordered_map<uint32_t, std::string> user_names_;
 };
 
 #endif // CHAT_CLIENT_HPP
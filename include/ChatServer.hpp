@@ -3,64 +3,151 @@
 #ifndef CHAT_SERVER_HPP
 #define CHAT_SERVER_HPP
 
-#ifdef _WIN32
-#include <winsock2.h>
-#include <ws2tcpip.h>
-#pragma comment(lib, "ws2_32.lib")
-typedef int socklen_t;
-#else
-#include <arpa/inet.h>
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <unistd.h>
-#define closesocket close
-#endif
-
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
 #include <string>
 #include <mutex>
-#include <map> // For std::map
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 #include "user/UserManager.hpp" // Include UserManager
 #include "Common.hpp" // Re-added Common.hpp for CLIENT_HANDSHAKE_MAGIC
+#include "Protocol.hpp"
+#include "Roster.hpp"
+#include "WorkerPool.hpp"
+#include "net/Reactor.hpp"
+
+// A server-to-client message in both wire encodings, each built once and shared by all recipients.
+struct OutgoingMessage {
+    Payload text;   // V1: colored, newline-terminated text.
+    Payload binary; // V2: one or more frames.
+
+    // Returns the encoding for a protocol.
+    const Payload& encoded(WireProtocol protocol) const { return protocol == WireProtocol::Binary ? binary : text; }
+};
 
-class ChatServer
+// A command handed to the worker pool. The Connection stays on its reactor thread, so the
+// command works from a snapshot of the sender and collects its replies for the reactor to send.
+struct CommandContext {
+    ClientSession sender;                 // Who sent the command; user_id is 0 until login completes.
+    std::string username;                 // The sender's name, as given at login.
+    std::vector<OutgoingMessage> replies; // Sent to the sender, in order, once the command has run.
+    bool authenticated = false;           // A login succeeded; the reactor admits the client.
+    bool disconnect = false;              // Close the sender once the replies are flushed.
+    uint64_t logged = 0;                  // Newest write-ahead log record the command appended; 0 if none.
+};
+
+// Chat server driven by event-loop reactors, one per thread; each client is a
+// non-blocking Connection advanced through its state machine one line at a time.
+// Commands that touch the user database run on a bounded worker pool instead of
+// the reactor threads; a connection's input is paused until its command has
+// finished, so every client's requests are still handled in order.
+class ChatServer : public ConnectionHandler
 {
 public:
-    // Constructor: Initializes the ChatServer with the specified port.
-    ChatServer(int port);
+    // Constructor: Initializes the ChatServer with the specified port, number of
+    // reactor threads (0 means one per core), I/O backend and user-data durability.
+    explicit ChatServer(int port, size_t reactor_count = 0, IoBackend backend = IoBackend::IoUring,
+                        const PersistenceOptions& persistence = {});
     // Destructor: Cleans up resources when the ChatServer is destroyed.
     ~ChatServer();
     // Starts the server, making it listen for incoming client connections.
     void start();
+    // Asks every reactor to exit; start() returns once they have. Safe to call from any thread.
+    void stop();
+    // Returns the total number of system calls issued by all reactors.
+    uint64_t syscall_count() const;
+    // Sets the per-connection output budget and slow-consumer policy. Call before start().
+    void set_outbound_limits(const OutboundLimits& limits);
+    // Sets the number of command worker threads (0 means half the cores, at least two). Call before start().
+    void set_command_workers(size_t count);
+    // Returns the command queue depth, throughput and latency counters.
+    WorkerPool::Stats command_stats() const;
+    // Sets how much memory chat histories paged in from the user database may hold.
+    void set_history_cache_limit(size_t bytes);
+    // Sets how much chat history to keep and how often the compactor sweeps it. Call before start().
+    void set_retention(const RetentionPolicy& policy, std::chrono::seconds interval);
+
+    // Advances a connection's handshake/authentication/chat state machine by one line.
+    void on_line(Connection& conn, std::string_view line) override;
+    // Handles one binary-protocol request.
+    void on_frame(Connection& conn, const wire::Frame& frame) override;
+    // Removes a closing connection from the client list and announces authenticated departures.
+    void on_close(Connection& conn) override;
 
 private:
-    // Reads a newline-delimited message from a client socket.
-    std::optional<std::string> read_delimited_message(int client_socket, std::string& leftover_buffer);
+    // Creates a listening socket bound to the server port with SO_REUSEPORT.
+    int open_listener();
+    // Runs a command on the worker pool with the sender's input paused, or refuses it if the pool is
+    // saturated. Replies are held until the command's changes are durable.
+    void run_command(Connection& sender, std::function<void(CommandContext&)> command);
+    // Sends a finished command's replies on the sender's reactor and resumes its input.
+    void finish_command(CommandContext& command);
+    // Registers or authenticates a user once the username and password have arrived.
+    void authenticate_client(CommandContext& command, const std::string& password);
+    // Adds a freshly authenticated connection to the client list and announces it.
+    void admit_client(Connection& conn);
     // Processes chat commands (e.g., /friend, /msg, /quit, /pending) sent by clients.
-    void process_chat_command(int client_socket, const std::string& sender_username, const std::string& message);
-    // Accepts incoming client connections in a loop.
-    void accept_clients();
-    // Handles a single client connection, including authentication and message processing.
-    void handle_client(int client_socket);
+    void process_chat_command(Connection& sender, const std::string& message);
+    // Broadcasts a chat message from an authenticated client.
+    void handle_chat(Connection& sender, std::string_view text);
+    // Sends, accepts or rejects a friend request.
+    void handle_friend(CommandContext& command, wire::FriendAction action, const std::string& target_username);
+    // Stores a direct message and delivers it if the recipient is online.
+    void handle_direct_message(CommandContext& command, const std::string& recipient_username, const std::string& content);
+    // Lists the sender's incoming friend requests.
+    void handle_pending(CommandContext& command);
+    // Shows the last messages exchanged with another user.
+    void handle_history(CommandContext& command, const std::string& peer_username, size_t limit);
+    // Reports the command queue's depth and latency, history residency and compaction.
+    void handle_stats(Connection& sender);
+    // Says goodbye and disconnects the sender.
+    void handle_quit(Connection& sender);
+    // Queues a reply for a client owned by the calling reactor.
+    void send_message(int client_socket, const OutgoingMessage& message);
+    // Queues a message for a client owned by any reactor.
+    void deliver(const ClientSession& session, const OutgoingMessage& message);
+    // Returns the sessions of an online user (one per live login), or none if offline. Takes no lock.
+    std::vector<ClientSession> find_clients(UserId user);
     // Broadcasts a message to all connected clients except the sender.
-    void broadcast(const std::string &message, int sender_socket);
+    void broadcast(const OutgoingMessage& message, int sender_socket);
     // Removes a disconnected client from the server's active client list.
-    void remove_client(int socket);
-    // Disconnects a client, broadcasts a departure message, and cleans up socket resources.
-    void disconnect_client(int client_socket, const std::string& username);
+    bool remove_client(int socket);
+    // Closes a client connection after its queued output has been sent.
+    void disconnect_client(int client_socket);
+    // Compresses message logs and enforces the retention policy every compact_interval_ until
+    // stopped, a few conversations per call so chat commands are never
+    // held up for a whole pass.
+    void run_compactor();
 
     // Server port number.
     int port_;
-    // Server socket file descriptor.
-    int server_fd_;
-    // Map to store active clients, associating socket with username.
-    std::map<int, std::string> clients_;
-    // Mutex to protect access to the clients_ map.
-    std::mutex clients_mutex_;
+    // Authenticated clients by user, read without a lock. Declared before the reactors so it
+    // outlives the connections they close.
+    Roster roster_;
+    // Event loops, each owning one listening socket and the clients accepted from it.
+    std::vector<std::unique_ptr<Reactor>> reactors_;
     // Flag indicating if the server is running.
     bool running_ = false;
-    // Manages user authentication, registration, and friend requests.
+    // Manages user authentication, registration, and friend requests. Thread-safe; shared by all
+    // command workers.
     UserManager user_manager_;
+    // Threads running commands that touch user_manager_.
+    WorkerPool workers_;
+    // Number of threads workers_ starts with.
+    size_t worker_count_ = 0;
+    // Background thread compressing and trimming chat history.
+    std::thread compactor_;
+    // Time between compaction passes.
+    std::chrono::seconds compact_interval_{60};
+    // Wakes the compactor early when the server stops.
+    std::mutex compactor_mutex_;
+    std::condition_variable compactor_wake_;
+    std::atomic<bool> compactor_stop_{false};
 };
 
 #endif // CHAT_SERVER_HPP
\ No newline at end of file
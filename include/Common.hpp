@@ -5,5 +5,8 @@
 
 // Magic string for client handshake to ensure proper protocol communication.
 const std::string CLIENT_HANDSHAKE_MAGIC = "CHAT_HS_V1\n";
+// Handshake that asks for the binary protocol (see Protocol.hpp). A server that supports it
+// echoes the same line back, then both sides switch to frames.
+const std::string CLIENT_HANDSHAKE_MAGIC_V2 = "CHAT_HS_V2\n";
 
-#endif // COMMON_HPP
\ No newline at end of file
+#endif // COMMON_HPP
@@ -0,0 +1,64 @@
+#ifndef MAILBOX_HPP
+#define MAILBOX_HPP
+
+#include <atomic>
+#include <functional>
+
+// Unbounded multi-producer/single-consumer queue of nodes the caller allocates
+// (Vyukov's intrusive MPSC list). Any thread may push; only the owning thread
+// pops. Pushing is a single atomic exchange, so producers never block each other.
+class IntrusiveMailbox {
+public:
+    // Base of whatever is queued; the queue links nodes but never frees them.
+    struct Node {
+        std::atomic<Node*> next{nullptr};
+    };
+
+    // Constructor: Starts with an empty queue holding only the stub node.
+    IntrusiveMailbox();
+
+    IntrusiveMailbox(const IntrusiveMailbox&) = delete;
+    IntrusiveMailbox& operator=(const IntrusiveMailbox&) = delete;
+
+    // Enqueues a node. Safe to call from any thread.
+    void push(Node* node);
+    // Dequeues the oldest node. Consumer thread only; returns nullptr when empty.
+    Node* pop();
+    // Returns true if nothing is queued, not even a push still in progress. Consumer thread only.
+    // The push's exchange and this load are sequentially consistent, so a consumer that flags
+    // itself asleep and then finds the queue empty cannot miss a producer that pushes and then
+    // finds the flag clear.
+    bool empty() const;
+
+private:
+    alignas(64) std::atomic<Node*> head_; // Most recently pushed node (producer end).
+    alignas(64) Node* tail_;              // Oldest node not yet consumed (consumer end).
+    Node stub_;                           // Placeholder that keeps the list non-empty.
+};
+
+// Queue of tasks posted to a reactor thread, built on IntrusiveMailbox.
+class Mailbox {
+public:
+    using Task = std::function<void()>;
+
+    Mailbox() = default;
+    // Destructor: Discards any tasks that were never run.
+    ~Mailbox();
+
+    Mailbox(const Mailbox&) = delete;
+    Mailbox& operator=(const Mailbox&) = delete;
+
+    // Enqueues a task. Safe to call from any thread.
+    void push(Task task);
+    // Dequeues the oldest task into `task`. Consumer thread only; returns false when empty.
+    bool pop(Task& task);
+
+private:
+    struct Node : IntrusiveMailbox::Node {
+        Task task;
+    };
+
+    IntrusiveMailbox queue_;
+};
+
+#endif // MAILBOX_HPP
@@ -0,0 +1,203 @@
+#ifndef PROTOCOL_HPP
+#define PROTOCOL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Binary wire protocol V2, negotiated with CLIENT_HANDSHAKE_MAGIC_V2.
+//
+// After the handshake line both directions carry frames:
+//
+//   varint length | opcode byte | body (length - 1 bytes)
+//
+// Varints are unsigned LEB128, at most 5 bytes. Strings are a varint byte
+// count followed by the bytes. Users are referred to by numeric ID; the server
+// introduces every ID with UserInfo or UserJoined before using it.
+//
+// Everything here is header-only and portable so the client can share it.
+namespace wire {
+
+// Largest frame either side accepts, opcode included.
+constexpr size_t kMaxFrameSize = 64 * 1024;
+// Longest chat or direct message text the server relays: the relayed frame adds the opcode, a
+// sender ID varint (at most 5 bytes) and the text's length varint (at most 3 bytes).
+constexpr size_t kMaxTextSize = kMaxFrameSize - 1 - 5 - 3;
+
+enum class Opcode : uint8_t {
+    // Client to server.
+    Login = 0x01,         // string username, string password
+    Chat = 0x02,          // string text. Server to client: varint sender_id, string text
+    DirectMessage = 0x03, // string recipient, string text. Server to client: varint sender_id, string text
+    Friend = 0x04,        // byte FriendAction, string username
+    ListPending = 0x05,   // (empty)
+    Quit = 0x06,          // (empty)
+    History = 0x07,       // string username, varint limit
+    Stats = 0x08,         // (empty); answered with a Notice
+
+    // Server to client.
+    Ack = 0x10,           // string text
+    Error = 0x11,         // string text
+    Notice = 0x12,        // string text
+    UserInfo = 0x13,      // varint user_id, string username (introduces an online user)
+    UserJoined = 0x14,    // varint user_id, string username
+    UserLeft = 0x15,      // varint user_id
+    PendingList = 0x16,   // varint count, count x string username
+    HistoryList = 0x17    // string username, varint count, count x (string sender, string content)
+};
+
+// Argument of Opcode::Friend.
+enum class FriendAction : uint8_t {
+    Add = 0,       // Client: send a request.
+    Accept = 1,    // Client: accept a pending request.
+    Reject = 2,    // Client: reject a pending request.
+    Requested = 3, // Server: someone sent you a request.
+    Accepted = 4   // Server: someone accepted your request.
+};
+
+// Appends an unsigned LEB128 varint.
+inline void put_varint(std::string& out, uint32_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+// Appends a length-prefixed string.
+inline void put_string(std::string& out, std::string_view value) {
+    put_varint(out, static_cast<uint32_t>(value.size()));
+    out.append(value.data(), value.size());
+}
+
+// Returns the number of bytes put_varint() writes for `value`.
+inline size_t varint_size(uint32_t value) {
+    size_t size = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        ++size;
+    }
+    return size;
+}
+
+// Returns the number of bytes put_string() writes for `value`.
+inline size_t string_size(std::string_view value) {
+    return varint_size(static_cast<uint32_t>(value.size())) + value.size();
+}
+
+// Wraps a body in a frame: length prefix plus opcode. A frame larger than kMaxFrameSize would
+// be rejected by the peer, so none is built: the result is empty, which sends nothing.
+inline std::string encode_frame(Opcode opcode, std::string_view body) {
+    if (body.size() >= kMaxFrameSize) return std::string();
+    uint32_t length = static_cast<uint32_t>(body.size() + 1);
+    std::string frame;
+    frame.reserve(varint_size(length) + length);
+    put_varint(frame, length);
+    frame.push_back(static_cast<char>(opcode));
+    frame.append(body.data(), body.size());
+    return frame;
+}
+
+// Decodes a varint from [p, end). Returns the number of bytes used, 0 if the input ends
+// first, or -1 if it is longer than 5 bytes or overflows 32 bits.
+inline int get_varint(const unsigned char* p, const unsigned char* end, uint32_t& value) {
+    uint32_t result = 0;
+    for (int i = 0; i < 5; ++i) {
+        if (p + i == end) return 0;
+        uint32_t byte = p[i];
+        result |= (byte & 0x7f) << (7 * i);
+        if (byte < 0x80) {
+            if (i == 4 && byte > 0x0f) return -1;
+            value = result;
+            return i + 1;
+        }
+    }
+    return -1;
+}
+
+// Outcome of parse_frame().
+enum class ParseStatus {
+    Frame,    // A complete frame was decoded.
+    NeedMore, // The buffer ends inside a frame.
+    Malformed // Bad length prefix or a frame larger than allowed.
+};
+
+// One decoded frame; `body` points into the parsed buffer.
+struct Frame {
+    Opcode opcode;
+    std::string_view body;
+    size_t size; // Bytes the frame occupied, prefix included.
+};
+
+// Splits the first frame off `input` without copying.
+inline ParseStatus parse_frame(std::string_view input, Frame& frame, size_t max_size = kMaxFrameSize) {
+    const unsigned char* begin = reinterpret_cast<const unsigned char*>(input.data());
+    const unsigned char* end = begin + input.size();
+    uint32_t length = 0;
+    int prefix = get_varint(begin, end, length);
+    if (prefix < 0 || (prefix > 0 && (length == 0 || length > max_size))) return ParseStatus::Malformed;
+    if (prefix == 0 || input.size() - static_cast<size_t>(prefix) < length) return ParseStatus::NeedMore;
+
+    frame.opcode = static_cast<Opcode>(begin[prefix]);
+    frame.body = input.substr(static_cast<size_t>(prefix) + 1, length - 1);
+    frame.size = static_cast<size_t>(prefix) + length;
+    return ParseStatus::Frame;
+}
+
+// Sequential decoder over a frame body. Every read fails once the body is exhausted or
+// malformed, so callers check ok() once at the end instead of after each field.
+class Reader {
+public:
+    explicit Reader(std::string_view body)
+        : p_(reinterpret_cast<const unsigned char*>(body.data())), end_(p_ + body.size()) {}
+
+    // Reads one byte.
+    uint8_t byte() {
+        if (p_ == end_) {
+            ok_ = false;
+            return 0;
+        }
+        return *p_++;
+    }
+
+    // Reads a varint.
+    uint32_t varint() {
+        uint32_t value = 0;
+        int used = get_varint(p_, end_, value);
+        if (used <= 0) {
+            ok_ = false;
+            p_ = end_;
+            return 0;
+        }
+        p_ += used;
+        return value;
+    }
+
+    // Reads a length-prefixed string as a view into the body.
+    std::string_view string() {
+        uint32_t size = varint();
+        if (static_cast<size_t>(end_ - p_) < size) {
+            ok_ = false;
+            p_ = end_;
+            return {};
+        }
+        std::string_view value(reinterpret_cast<const char*>(p_), size);
+        p_ += size;
+        return value;
+    }
+
+    // Returns true if every read succeeded.
+    bool ok() const { return ok_; }
+    // Returns true if every read succeeded and the whole body was consumed.
+    bool done() const { return ok_ && p_ == end_; }
+
+private:
+    const unsigned char* p_;
+    const unsigned char* end_;
+    bool ok_ = true;
+};
+
+} // namespace wire
+
+#endif // PROTOCOL_HPP
@@ -0,0 +1,104 @@
+#ifndef ROSTER_HPP
+#define ROSTER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "net/Connection.hpp"
+#include "user/User.hpp"
+
+// Where an authenticated client lives: the reactor owning its socket and the connection it is.
+struct ClientSession {
+    int socket;             // Client socket, valid only on the owning reactor.
+    size_t reactor;         // Index of the owning reactor.
+    uint64_t connection_id; // Guards against delivering to a reused socket.
+    UserId user_id;         // Interned username, also used by the binary protocol.
+    WireProtocol protocol;  // Encoding the client expects.
+};
+
+// Counters reported by Roster::stats().
+struct RosterStats {
+    size_t sessions;    // Sessions online, published or not.
+    uint64_t changes;   // Joins and leaves so far.
+    uint64_t snapshots; // Snapshots published; each carries every change since the last.
+};
+
+// The sessions of every online user, published as immutable snapshots so that
+// presence lookups read without a lock.
+//
+// Joins and leaves change a private copy under a mutex only they take. A
+// publisher thread turns the changes into a new snapshot at most once per
+// batch interval, so under churn many share one, and swaps it in with one
+// atomic store. Readers announce themselves on one of a fixed set of counters,
+// picked per thread, while they use a snapshot; the publisher frees the one it
+// replaced only once every counter that could cover a reader of it has
+// drained. A reader therefore never waits, and a join or leave never waits
+// for a reader. A lookup may miss the last interval's changes; a message
+// sent to a session that has just left is dropped by its reactor, which
+// checks the connection ID.
+class Roster {
+public:
+    // Starts the publisher, which publishes at most once per `batch_interval`.
+    explicit Roster(std::chrono::milliseconds batch_interval = std::chrono::milliseconds(2));
+    // Stops the publisher and frees the last snapshot. No lookup may be running.
+    ~Roster();
+
+    Roster(const Roster&) = delete;
+    Roster& operator=(const Roster&) = delete;
+
+    // Adds a session. If `online` is given, fills it with every user online, this one included,
+    // as of the change rather than of the last snapshot.
+    void join(const ClientSession& session, std::vector<UserId>* online = nullptr);
+    // Removes the session on `socket` and returns it, or nothing if it never joined.
+    std::optional<ClientSession> leave(int socket);
+    // Returns the sessions of `user` in the latest snapshot, or none if offline. Lock-free.
+    std::vector<ClientSession> find(UserId user) const;
+    // Returns the current counters.
+    RosterStats stats() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+    using Sessions = std::unordered_map<UserId, std::vector<ClientSession>>;
+
+    // Counters readers are spread over, by thread.
+    static constexpr size_t kReaderSlots = 64;
+    // Readers using a snapshot, for one phase and one slot, on a cache line of its own.
+    struct alignas(64) ReaderCount {
+        std::atomic<int64_t> readers{0};
+    };
+
+    // Returns the slot the calling thread counts itself on.
+    static size_t reader_slot();
+    // Publisher thread: publishes pending changes until stopped.
+    void publish_changes();
+    // Waits until no reader can still hold a snapshot replaced before the call.
+    void wait_for_readers();
+
+    const std::chrono::milliseconds batch_interval_;
+    // The latest snapshot. Read without a lock; only the publisher replaces it.
+    std::atomic<const Sessions*> current_;
+    // Phase new readers count themselves under; the publisher flips it to drain the other.
+    std::atomic<unsigned> phase_{0};
+    mutable ReaderCount readers_[2][kReaderSlots];
+
+    mutable std::mutex mutex_; // Guards everything below.
+    std::condition_variable wake_;
+    Sessions sessions_;                           // The private copy joins and leaves change.
+    std::unordered_map<int, UserId> user_by_socket_;
+    size_t session_count_ = 0;
+    bool dirty_ = false;                          // sessions_ has changed since the last snapshot.
+    bool stopping_ = false;
+    uint64_t changes_ = 0;
+    uint64_t snapshots_ = 0;
+    std::thread publisher_;
+};
+
+#endif // ROSTER_HPP
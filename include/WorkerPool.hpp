@@ -0,0 +1,77 @@
+#ifndef WORKER_POOL_HPP
+#define WORKER_POOL_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of threads that run blocking work (user database access, disk
+// writes) off the reactor threads. The queue is bounded: a submission beyond
+// its capacity is refused instead of blocking the submitting event loop.
+class WorkerPool {
+public:
+    using Task = std::function<void()>;
+
+    // Snapshot of the pool's counters.
+    struct Stats {
+        size_t threads;          // Worker threads running.
+        size_t queue_depth;      // Tasks waiting right now.
+        size_t max_queue_depth;  // Deepest the queue has been.
+        uint64_t completed;      // Tasks run to completion.
+        uint64_t rejected;       // Submissions refused because the queue was full.
+        double avg_wait_us;      // Mean time from submission to start.
+        double avg_run_us;       // Mean execution time.
+        uint64_t max_wait_us;    // Longest time a task waited to start.
+    };
+
+    // Constructor: Sets the queue capacity; no threads run until start().
+    explicit WorkerPool(size_t capacity);
+    // Destructor: Stops the workers, discarding queued tasks.
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    // Starts `threads` workers.
+    void start(size_t threads);
+    // Stops and joins the workers. Tasks still queued are dropped.
+    void stop();
+    // Queues a task unless the queue is full. Safe to call from any thread.
+    bool try_submit(Task task);
+    // Returns the current counters.
+    Stats stats() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Item {
+        Task task;
+        Clock::time_point submitted;
+    };
+
+    // Runs tasks until stopped.
+    void work();
+
+    const size_t capacity_;
+    mutable std::mutex mutex_;
+    std::condition_variable ready_;
+    std::deque<Item> queue_;
+    bool stopping_ = false;
+    std::vector<std::thread> threads_;
+
+    size_t max_queue_depth_ = 0;
+    std::atomic<uint64_t> completed_{0};
+    std::atomic<uint64_t> rejected_{0};
+    std::atomic<uint64_t> total_wait_us_{0};
+    std::atomic<uint64_t> total_run_us_{0};
+    std::atomic<uint64_t> max_wait_us_{0};
+};
+
+#endif // WORKER_POOL_HPP
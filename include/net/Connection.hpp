@@ -0,0 +1,57 @@
+#ifndef CONNECTION_HPP
+#define CONNECTION_HPP
+
+#include <cstdint>
+#include <string>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "FrameBuffer.hpp"
+#include "OutboundQueue.hpp"
+
+// Stages a client connection moves through, driven one line at a time by the server.
+enum class ConnectionState {
+    Handshake, // Waiting for CLIENT_HANDSHAKE_MAGIC.
+    Username,  // Waiting for the username line.
+    Password,  // Waiting for the password line.
+    Chat,      // Authenticated; lines are chat messages or commands.
+    Closing    // Flushing queued output before the socket is closed.
+};
+
+// How a connection's bytes are framed. Every connection starts as Text; the handshake may switch it.
+enum class WireProtocol {
+    Text,  // V1: newline-delimited lines.
+    Binary // V2: length-prefixed frames (see Protocol.hpp).
+};
+
+// Per-socket state owned by a Reactor. Sockets are non-blocking, so partial
+// reads and writes are buffered here between readiness events.
+struct Connection {
+    Connection(int fd, uint64_t id) : fd(fd), id(id) {}
+
+    int fd;                                          // Client socket file descriptor.
+    uint64_t id;                                     // Process-wide unique id; fds are reused, ids are not.
+    ConnectionState state = ConnectionState::Handshake;
+    WireProtocol protocol = WireProtocol::Text;
+    FrameBuffer inbound;                             // Received bytes not yet split into lines or frames.
+    OutboundQueue outbound;                          // Messages queued for sending.
+    std::string username;                            // Set once the username line arrives.
+    uint32_t user_id = 0;                            // Set once authenticated.
+    bool input_paused = false;                       // Set by the handler while it finishes a message
+                                                     // elsewhere; later input waits in `inbound`.
+
+    // Bookkeeping used only by the io_uring backend.
+    struct UringState {
+        static constexpr size_t kMaxIovecs = 16; // Messages gathered into one sendmsg.
+
+        unsigned pending_ops = 0; // Submissions whose completions still reference this connection.
+        bool recv_armed = false;  // A multishot recv is outstanding.
+        bool sending = false;     // A sendmsg reading from the front of `outbound` is outstanding.
+        bool released = false;    // Removed from its reactor; freed once pending_ops drains.
+        bool closed = false;      // The teardown chain's close (or its fallback) has run.
+        msghdr msg{};             // Header of the outstanding sendmsg.
+        iovec iov[kMaxIovecs];    // Buffers of the outstanding sendmsg.
+    } uring;
+};
+
+#endif // CONNECTION_HPP
@@ -0,0 +1,45 @@
+#ifndef EPOLL_REACTOR_HPP
+#define EPOLL_REACTOR_HPP
+
+#include "Reactor.hpp"
+
+// Reactor backend built on edge-triggered epoll. Sockets are non-blocking;
+// each readiness edge is drained with recv/send until EAGAIN.
+class EpollReactor : public Reactor {
+public:
+    // Constructor: Creates the epoll instance and the wakeup eventfd.
+    EpollReactor(ConnectionHandler& handler, size_t index);
+    // Destructor: Closes every owned socket, the eventfd and the epoll instance.
+    ~EpollReactor() override;
+
+    void add_listener(int listen_fd) override;
+    void run() override;
+    IoBackend backend() const override { return IoBackend::Epoll; }
+
+protected:
+    void wake() override;
+    void start_output(Connection& conn) override;
+    void release(std::unique_ptr<Connection> conn) override;
+
+private:
+    // Accepts every pending connection on the listening socket.
+    void accept_all();
+    // Frees the spare descriptor to accept and close one client when out of descriptors.
+    // Returns false if that did not work either.
+    bool reject_one();
+    // Drains readable data from a connection and dispatches complete input.
+    void handle_readable(Connection& conn);
+    // Writes queued output until the socket would block. Returns false on a socket error.
+    bool flush(Connection& conn);
+
+    int epoll_fd_;
+    int listen_fd_ = -1;
+    // eventfd that wakes epoll_wait when tasks are posted from other threads.
+    int wake_fd_;
+    // Descriptor held in reserve (on /dev/null) so a pending client can still be drained at EMFILE.
+    int spare_fd_;
+    // Set while accepts keep failing; only the first failure of a run is reported.
+    bool accept_failing_ = false;
+};
+
+#endif // EPOLL_REACTOR_HPP
@@ -0,0 +1,60 @@
+#ifndef FRAME_BUFFER_HPP
+#define FRAME_BUFFER_HPP
+
+#include <cstddef>
+#include <memory>
+#include <string_view>
+
+// Returns the first '\n' in [begin, end), or end. Uses AVX2 or SSE2 where the CPU has them.
+const char* find_newline(const char* begin, const char* end);
+
+// Receive buffer that frames newline-delimited lines in place.
+//
+// Bytes are written at the tail and lines are handed out as string_views into
+// the buffer, so a line is never copied on its way to the handler. Consumed
+// space at the head is reclaimed only when the tail runs out of room, by
+// moving the unread bytes to the front once rather than after every line.
+// The newline scan resumes where the previous one stopped, so a long line
+// arriving in many pieces is scanned once.
+class FrameBuffer {
+public:
+    // Longest accepted line, delimiter included.
+    static constexpr size_t kMaxFrameSize = 64 * 1024;
+
+    // Outcome of next_line().
+    enum class Status {
+        Frame,    // A complete line was returned.
+        NeedMore, // No complete line is buffered yet.
+        Oversized // The buffered line exceeds kMaxFrameSize; the stream cannot be framed.
+    };
+
+    // Returns writable space at the tail of at least `min_size` bytes, compacting or growing as needed.
+    char* prepare(size_t min_size);
+    // Returns how many bytes can be written at the tail without another prepare().
+    size_t writable() const { return capacity_ - end_; }
+    // Marks `n` bytes written at the tail as received.
+    void commit(size_t n) { end_ += n; }
+    // Copies received bytes in at the tail.
+    void append(const char* data, size_t n);
+
+    // Returns the next complete line without its "\n" or "\r\n". The view stays valid until
+    // the next prepare() or append().
+    Status next_line(std::string_view& line);
+    // Returns the bytes received but not yet consumed.
+    std::string_view unread() const { return std::string_view(data_.get() + begin_, end_ - begin_); }
+    // Releases `n` unread bytes from the head.
+    void consume(size_t n);
+    // Returns true if no unread bytes are buffered.
+    bool empty() const { return begin_ == end_; }
+
+private:
+    std::unique_ptr<char[]> data_;
+    size_t capacity_ = 0;
+    // Unread bytes are [begin_, end_).
+    size_t begin_ = 0;
+    size_t end_ = 0;
+    // Bytes in [begin_, scanned_) are known to contain no newline.
+    size_t scanned_ = 0;
+};
+
+#endif // FRAME_BUFFER_HPP
@@ -0,0 +1,69 @@
+#ifndef OUTBOUND_QUEUE_HPP
+#define OUTBOUND_QUEUE_HPP
+
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <string>
+#include <sys/uio.h>
+
+// Immutable message bytes. A broadcast is formatted once and the same payload is
+// queued for every recipient, so memory per message is independent of the fan-out.
+using Payload = std::shared_ptr<const std::string>;
+
+// Wraps formatted bytes in a payload.
+inline Payload make_payload(std::string bytes) {
+    return std::make_shared<const std::string>(std::move(bytes));
+}
+
+// What a reactor does with a connection whose queued output crosses the high watermark.
+enum class SlowConsumerPolicy {
+    DropOldest, // Discard the oldest unsent messages until the queue is back at the low watermark.
+    Disconnect  // Close the connection, discarding whatever is still queued.
+};
+
+// Output budget applied to every connection of a reactor.
+struct OutboundLimits {
+    size_t high_watermark = 1 << 20;  // Queued bytes at which the policy kicks in.
+    size_t low_watermark = 256 << 10; // Level DropOldest trims back to, so it does not run on every message.
+    SlowConsumerPolicy policy = SlowConsumerPolicy::DropOldest;
+};
+
+// FIFO of whole messages waiting to be written to one socket. Writes may stop
+// part-way through a message; the unsent remainder stays at the front. Queues
+// hold references to shared payloads and never copy message bytes.
+class OutboundQueue {
+public:
+    // Returns true if nothing is queued.
+    bool empty() const { return messages_.empty(); }
+    // Returns the number of unsent bytes.
+    size_t bytes() const { return bytes_; }
+    // Returns the number of queued messages, including a partially sent one.
+    size_t size() const { return messages_.size(); }
+
+    // Appends a message.
+    void push(Payload message);
+    // Fills up to `max` iovecs with the unsent bytes in order; returns how many were filled.
+    // The buffers stay valid until consumed, dropped or cleared.
+    size_t gather(iovec* iov, size_t max) const;
+    // Marks `n` bytes as written, popping every message that is now fully sent.
+    void consume(size_t n);
+    // Protects the first `count` messages from drop_oldest while an asynchronous send reads them.
+    void pin(size_t count) { pinned_ = count; }
+    // Drops the oldest unsent messages until at most `target` bytes remain. Pinned and
+    // partially sent messages are kept. Returns the number of messages dropped.
+    size_t drop_oldest(size_t target);
+    // Discards everything, pinned messages included. Only for sockets that will never be written again.
+    void clear();
+
+private:
+    // Payload bytes live on the heap, so buffers handed to an in-flight send stay
+    // valid when the deque reshuffles around dropped messages.
+    std::deque<Payload> messages_;
+    // Bytes of the front message already written.
+    size_t front_offset_ = 0;
+    size_t bytes_ = 0;
+    size_t pinned_ = 0;
+};
+
+#endif // OUTBOUND_QUEUE_HPP
@@ -0,0 +1,158 @@
+#ifndef REACTOR_HPP
+#define REACTOR_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "../Mailbox.hpp"
+#include "../Protocol.hpp"
+#include "Connection.hpp"
+
+// Receives protocol-level events from a Reactor. All callbacks run on the reactor's thread.
+class ConnectionHandler {
+public:
+    virtual ~ConnectionHandler() = default;
+    // Called for every complete newline-delimited line (without the delimiter). The view
+    // points into the connection's receive buffer and is valid only during the call.
+    virtual void on_line(Connection& conn, std::string_view line) = 0;
+    // Called for every complete frame of a Binary connection. The body points into the
+    // connection's receive buffer and is valid only during the call.
+    virtual void on_frame(Connection& conn, const wire::Frame& frame) = 0;
+    // Called once, right before the connection's socket is closed.
+    virtual void on_close(Connection& conn) = 0;
+};
+
+// Kernel interface a Reactor uses to move bytes.
+enum class IoBackend {
+    Epoll,  // Edge-triggered readiness notifications plus non-blocking recv/send.
+    IoUring // Completion-based submissions batched through io_uring.
+};
+
+// Event loop that owns a listening socket and every client socket accepted
+// from it. Received bytes are split into lines or frames, depending on the
+// connection's protocol, and handed to the ConnectionHandler; writes are queued per connection and flushed by the
+// backend as the socket accepts them, so sending never blocks the loop. Each
+// queue is bounded by the reactor's OutboundLimits; a connection that falls
+// too far behind has its oldest messages dropped or is disconnected.
+//
+// Several reactors can run side by side, one per thread, each with its own
+// SO_REUSEPORT listener. Connections never migrate; other threads reach a
+// reactor's connections only by posting tasks to its mailbox.
+//
+// This class holds the backend-independent bookkeeping; EpollReactor and
+// UringReactor implement the actual I/O.
+class Reactor {
+public:
+    // Constructor: Binds reactor number `index` to a handler.
+    Reactor(ConnectionHandler& handler, size_t index);
+    virtual ~Reactor() = default;
+
+    Reactor(const Reactor&) = delete;
+    Reactor& operator=(const Reactor&) = delete;
+
+    // Creates a reactor using the requested backend, falling back to epoll if io_uring is unavailable.
+    static std::unique_ptr<Reactor> create(IoBackend backend, ConnectionHandler& handler, size_t index);
+
+    // Registers a bound, listening socket.
+    virtual void add_listener(int listen_fd) = 0;
+    // Runs the event loop on the calling thread until stop() is called.
+    virtual void run() = 0;
+    // Returns the backend this reactor runs on.
+    virtual IoBackend backend() const = 0;
+
+    // Requests the event loop to exit after the current iteration. Safe to call from any thread.
+    void stop();
+    // Runs a task on this reactor's thread. Safe to call from any thread.
+    void post(Mailbox::Task task);
+    // Returns the reactor running on the calling thread, or nullptr.
+    static Reactor* current();
+    // Returns this reactor's position among the server's reactors.
+    size_t index() const { return index_; }
+    // Returns the number of system calls this reactor has issued so far.
+    uint64_t syscall_count() const { return syscalls_.load(std::memory_order_relaxed); }
+    // Sets the output budget of every connection. Call before run().
+    void set_outbound_limits(const OutboundLimits& limits) { limits_ = limits; }
+    // Returns the number of queued messages discarded by the drop-oldest policy.
+    uint64_t dropped_messages() const { return dropped_messages_.load(std::memory_order_relaxed); }
+    // Returns the number of connections closed by the disconnect policy.
+    uint64_t slow_disconnects() const { return slow_disconnects_.load(std::memory_order_relaxed); }
+
+    // Queues a payload for a connection and starts writing it. Never blocks; returns false if the
+    // connection is gone, closing, or was just disconnected for exceeding its budget.
+    bool send(int fd, Payload payload);
+    // Queues a copy of `data` for a connection.
+    bool send(int fd, const std::string& data);
+    // Queues a payload only if `fd` still belongs to connection `connection_id` (sockets get reused).
+    bool send(int fd, uint64_t connection_id, Payload payload);
+    // Queues the same message for every authenticated connection except `except_fd`, in the
+    // encoding matching each connection's protocol.
+    void broadcast(const Payload& text, const Payload& binary, int except_fd);
+    // Closes a connection once its queued output has been flushed.
+    void close_after_flush(int fd);
+    // Looks up a live connection by socket, or returns nullptr.
+    Connection* find(int fd);
+    // Clears conn.input_paused and dispatches whatever input arrived in the meantime.
+    void resume_input(Connection& conn);
+
+protected:
+    // Interrupts the backend's wait so posted tasks get run. Called from any thread.
+    virtual void wake() = 0;
+    // Starts writing a connection's queued output. Once a Closing connection has
+    // nothing left to write, the backend must schedule_close() it.
+    virtual void start_output(Connection& conn) = 0;
+    // Closes the socket of a connection that has been removed from the reactor.
+    virtual void release(std::unique_ptr<Connection> conn) = 0;
+
+    // Starts tracking a newly accepted socket.
+    Connection& adopt(int fd);
+    // Hands every complete line or frame buffered in conn.inbound to the handler, stopping
+    // while the connection's input is paused. Input that cannot be framed (too long or
+    // malformed), or that piles up while paused, closes the connection.
+    void dispatch_input(Connection& conn);
+    // Closes a connection once the current batch of events has been dispatched.
+    void schedule_close(int fd);
+    // Closes every connection scheduled so far.
+    void run_pending_closes();
+    // Runs every task posted to the mailbox. The backend clears wake_pending_ first.
+    void drain_mailbox();
+    // Marks this reactor as the one running on the calling thread.
+    void enter_loop();
+    // Clears the calling thread's reactor.
+    void exit_loop();
+    // Counts system calls issued on behalf of this reactor.
+    void count_syscall(uint64_t n = 1) { syscalls_.fetch_add(n, std::memory_order_relaxed); }
+
+    ConnectionHandler& handler_;
+    size_t index_;
+    std::atomic<bool> running_{false};
+    // Set while a wakeup is outstanding so concurrent posts wake the loop only once.
+    std::atomic<bool> wake_pending_{false};
+    std::atomic<uint64_t> syscalls_{0};
+    // Tasks posted from other threads.
+    Mailbox mailbox_;
+    // Live connections keyed by socket.
+    std::unordered_map<int, std::unique_ptr<Connection>> connections_;
+
+private:
+    // Notifies the handler, then removes the connection and releases it to the backend.
+    void close_connection(int fd);
+    // Logs why a connection's input was rejected and closes it.
+    void reject_input(Connection& conn, const std::string& reason);
+    // Applies the slow-consumer policy to a connection over its high watermark. Returns false
+    // if the connection was disconnected.
+    bool enforce_limits(Connection& conn);
+
+    OutboundLimits limits_;
+    std::atomic<uint64_t> dropped_messages_{0};
+    std::atomic<uint64_t> slow_disconnects_{0};
+
+    // Sockets to close once the current batch of events has been dispatched.
+    std::vector<int> pending_close_;
+};
+
+#endif // REACTOR_HPP
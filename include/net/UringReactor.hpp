@@ -0,0 +1,125 @@
+#ifndef URING_REACTOR_HPP
+#define URING_REACTOR_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <linux/io_uring.h>
+#include <vector>
+
+#include "Reactor.hpp"
+
+// Reactor backend built on io_uring, driven through the raw system calls.
+//
+// - One multishot accept keeps producing client sockets.
+// - Each connection has one multishot recv that draws from a shared ring of
+//   provided buffers, so idle connections pin no receive memory.
+// - Queued messages go out in batches, one sendmsg per batch straight from the
+//   connection's queue; a closing connection's final batch, shutdown and close
+//   go out as one linked chain.
+// - Every completion produced while the loop slept is handled before the next
+//   io_uring_enter, which also carries all submissions made in the meantime.
+class UringReactor : public Reactor {
+public:
+    // Sets up a ring and verifies the kernel supports everything above; returns nullptr otherwise.
+    static std::unique_ptr<Reactor> create(ConnectionHandler& handler, size_t index);
+    // Destructor: Tears down the ring, then closes every owned socket.
+    ~UringReactor() override;
+
+    void add_listener(int listen_fd) override;
+    void run() override;
+    IoBackend backend() const override { return IoBackend::IoUring; }
+
+protected:
+    void wake() override;
+    void start_output(Connection& conn) override;
+    void release(std::unique_ptr<Connection> conn) override;
+
+private:
+    // Constructor: Only create() builds reactors, after setup() succeeds.
+    UringReactor(ConnectionHandler& handler, size_t index);
+
+    // Creates and maps the ring and registers the provided-buffer ring.
+    bool setup();
+    // Checks that multishot recv with provided buffers works on this kernel.
+    bool probe_multishot_recv();
+    // Returns a zeroed submission entry, submitting queued entries first if the ring is full.
+    io_uring_sqe* get_sqe();
+    // Flushes queued entries until `count` slots are free, so a linked chain goes out in one submission.
+    void reserve_sqes(unsigned count);
+    // Moves ready completions aside so the kernel accepts submissions again after an EBUSY.
+    void stash_completions();
+    // Submits queued entries and waits for at least `wait_nr` completions.
+    int enter(unsigned wait_nr);
+    // Handles every completion currently in the completion ring.
+    void reap();
+    // Dispatches a single completion.
+    void handle_completion(const io_uring_cqe& cqe);
+    // Lets released connections finish their teardown once the loop has stopped.
+    void drain_released();
+
+    // Arms the multishot accept on the listening socket.
+    void arm_accept();
+    // Re-arms the accept after a delay, so a persistent error such as EMFILE does not spin.
+    void arm_accept_retry();
+    // Arms a read of the wakeup eventfd.
+    void arm_wakeup();
+    // Arms the multishot recv of a connection.
+    void arm_recv(Connection& conn);
+    // Fills a sendmsg entry with the oldest queued messages, pinning them until it completes.
+    io_uring_sqe* prepare_sendmsg(Connection& conn, uint64_t op);
+    // Submits the oldest queued messages.
+    void submit_send(Connection& conn);
+    // Keeps sending a released connection's output until the rest fits in the teardown chain.
+    void finish_release(Connection& conn);
+    // Submits the final sendmsg (if any), shutdown and close of a released connection as one chain.
+    void submit_teardown(Connection& conn);
+
+    // Appends received data, recycles the buffer and dispatches complete input.
+    void handle_recv(Connection& conn, const io_uring_cqe& cqe);
+    // Continues or finishes writing after a send completes.
+    void handle_send(Connection& conn, int result);
+    // Frees a released connection once no submission references it.
+    void retire_if_idle(Connection& conn);
+    // Returns a provided buffer to the kernel.
+    void recycle_buffer(uint16_t buffer_id);
+
+    int ring_fd_ = -1;
+    int listen_fd_ = -1;
+    // eventfd that completes the wakeup read when tasks are posted from other threads.
+    int wake_fd_ = -1;
+    uint64_t wake_value_ = 0;
+    // Set while accepts keep failing; only the first failure of a run is reported.
+    bool accept_failing_ = false;
+
+    // Submission ring.
+    void* sq_ring_ = nullptr;
+    size_t sq_ring_size_ = 0;
+    unsigned* sq_head_ = nullptr;
+    unsigned* sq_tail_ = nullptr;
+    unsigned sq_mask_ = 0;
+    unsigned sq_entries_ = 0;
+    unsigned* sq_array_ = nullptr;
+    io_uring_sqe* sqes_ = nullptr;
+    size_t sqes_size_ = 0;
+    // Entries filled in but not yet handed to the kernel.
+    unsigned to_submit_ = 0;
+
+    // Completion ring (shares the submission ring's mapping).
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    unsigned cq_mask_ = 0;
+    io_uring_cqe* cqes_ = nullptr;
+    // Completions taken off the ring by stash_completions(), handled by the next reap().
+    std::vector<io_uring_cqe> stashed_;
+
+    // Provided receive buffers shared by all connections of this reactor.
+    io_uring_buf_ring* buf_ring_ = nullptr;
+    size_t buf_ring_size_ = 0;
+    char* buffers_ = nullptr;
+    uint16_t buf_tail_ = 0;
+
+    // Released connections waiting for their last completions.
+    std::unordered_map<Connection*, std::unique_ptr<Connection>> released_;
+};
+
+#endif // URING_REACTOR_HPP
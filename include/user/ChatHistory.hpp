@@ -0,0 +1,148 @@
+#ifndef CHAT_HISTORY_HPP
+#define CHAT_HISTORY_HPP
+
+#include "MessageLog.hpp"
+#include "User.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <list>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Represents a single chat message.
+struct Message {
+    UserId sender = kNoUser; // Who sent it.
+    std::string content;     // Content of the message.
+    int64_t timestamp = 0;   // When it was sent, in milliseconds since the Unix epoch.
+};
+
+class HistoryCache;
+
+// Messages exchanged by two users, oldest first.
+//
+// Every message lives in the conversation's on-disk log (see MessageLog) from
+// the moment it is appended. Reading the latest messages keeps them resident
+// as a window the HistoryCache may evict when memory is short; later reads
+// that fit inside the window are served from memory, and appends extend it.
+//
+// Not thread-safe: UserManager serializes access to each conversation. The
+// window has a lock of its own only because the cache evicts it from
+// whichever thread is using another conversation.
+class ChatHistory {
+public:
+    // Creates the history of conversation `id` between `first` and `second` (in name order),
+    // stored in `log`
+    // and kept resident under `cache`, if any.
+    ChatHistory(MessageLog& log, uint32_t id, UserId first, UserId second, HistoryCache* cache);
+    ChatHistory(const ChatHistory&) = delete;
+    ChatHistory& operator=(const ChatHistory&) = delete;
+    ~ChatHistory();
+
+    // Returns the number of messages kept; the first call lists the log's segments.
+    size_t size() const;
+    // Appends a message; `sender` must be one of the participants. Returns false if it could
+    // not be written.
+    bool append(const Message& message);
+    // Returns the latest `count` messages, oldest first, reading only the segments that hold them.
+    std::vector<Message> tail(size_t count) const;
+    // Calls `fn(sender, content, timestamp)` for every message in order, streaming them from
+    // disk without making them resident. Returns false if part of the log could not be read.
+    bool forEach(const std::function<void(UserId, std::string_view, int64_t)>& fn) const;
+
+    // Returns the bytes the kept messages take up in the log.
+    uint64_t logBytes() const;
+    // Returns when the newest message was sent, or 0 if there never was one.
+    int64_t lastActivity() const;
+    // Drops the oldest messages until at most `count` remain, none sent before `cutoff` (ms since
+    // the epoch), taking at most `bytes` of log. Returns the disk space freed.
+    uint64_t trim(size_t count, int64_t cutoff, uint64_t bytes);
+    // Compresses the log's closed segments, and its tail once appends to it have stopped and it
+    // holds a quarter of a segment, or if `idle`. Returns the number of segments written and adds
+    // the bytes compressed and the space they now take to `rawBytes` and `storedBytes`.
+    size_t compress(uint64_t& rawBytes, uint64_t& storedBytes, bool idle = false);
+
+private:
+    friend class ConversationStore;
+    friend class HistoryCache;
+    friend class UserManager;
+    friend class UserSnapshot;
+
+    // Drops the resident window.
+    void evict() const;
+
+    // Reading is invisible to callers, so the const accessors may change all of this.
+    mutable ConversationLog log;
+    UserId participants[2];                // In name order; a record's sender indexes this.
+    // The latest messages, oldest first, when resident, under `windowMutex`.
+    mutable std::mutex windowMutex;
+    mutable std::vector<Message> recent;
+    mutable size_t recentBytes = 0;        // Memory held by `recent`.
+    mutable HistoryCache* cache = nullptr; // Cache that may evict this history, if any.
+    // Position in the cache's recency list and the size it was counted at, valid while `cached`.
+    // Guarded by the cache's mutex.
+    mutable std::list<const ChatHistory*>::iterator lruPosition;
+    mutable bool cached = false;
+    mutable size_t cachedBytes = 0;
+    // Newest checkpoint that has read the log's length, or set it aside; see UserManager.
+    mutable uint64_t checkpointEpoch = 0;
+};
+
+// Counters reported by HistoryCache::stats().
+struct HistoryCacheStats {
+    size_t limitBytes = 0;         // Budget for resident messages.
+    size_t residentBytes = 0;      // Memory they currently hold.
+    size_t residentHistories = 0;  // How many histories have messages resident.
+    uint64_t pageIns = 0;          // Reads from a message log into memory.
+    uint64_t evictions = 0;        // Histories dropped to stay within the budget.
+    uint64_t readFailures = 0;     // Reads that found a log missing or damaged.
+};
+
+// Bounds the memory held by resident chat messages. Histories register when they
+// become resident and are evicted least recently used first once the total
+// exceeds the limit. Thread-safe: a history being used on another thread is
+// passed over rather than waited for, and the next colder one evicted instead.
+class HistoryCache {
+public:
+    // Default budget for resident messages.
+    static constexpr size_t kDefaultLimit = size_t(256) << 20;
+
+    explicit HistoryCache(size_t limitBytes = kDefaultLimit) : limit(limitBytes) {}
+    HistoryCache(const HistoryCache&) = delete;
+    HistoryCache& operator=(const HistoryCache&) = delete;
+    // Detaches the histories still registered.
+    ~HistoryCache();
+
+    // Changes the budget, evicting at once if it shrank.
+    void setLimit(size_t bytes);
+    // Returns the current counters.
+    HistoryCacheStats stats() const;
+
+private:
+    friend class ChatHistory;
+
+    // Marks `history` most recently used and re-measures it, then evicts others while over budget.
+    // Called with the history's window locked.
+    void touch(const ChatHistory& history);
+    // Removes `history` from the recency list, if it is there.
+    void forget(const ChatHistory& history);
+    // Same, with `mutex` held.
+    void forgetLocked(const ChatHistory& history);
+    // Evicts from the cold end until within budget, sparing `keep`. Called with `mutex` held.
+    void trim(const ChatHistory* keep);
+
+    std::mutex mutex;                  // Guards `lru` and the histories' places in it.
+    std::list<const ChatHistory*> lru; // Most recently used first.
+    std::atomic<size_t> limit;
+    std::atomic<size_t> residentBytes{0};
+    std::atomic<size_t> residentHistories{0};
+    std::atomic<uint64_t> pageIns{0};
+    std::atomic<uint64_t> evictions{0};
+    std::atomic<uint64_t> readFailures{0};
+};
+
+#endif // CHAT_HISTORY_HPP
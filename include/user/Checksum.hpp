@@ -0,0 +1,11 @@
+#ifndef CHECKSUM_HPP
+#define CHECKSUM_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+// Extends a CRC-32 (IEEE, as used by zlib) over another range. Start with crc = 0;
+// checksumming a buffer in pieces gives the same result as doing it at once.
+uint32_t crc32Update(uint32_t crc, const char* data, size_t size);
+
+#endif // CHECKSUM_HPP
@@ -0,0 +1,25 @@
+#ifndef COMPRESSION_HPP
+#define COMPRESSION_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+// LZ4 block format codec: a byte-oriented LZ77 with 64 KiB back-references and
+// no entropy coding, so decompression is little more than memcpy. Blocks are
+// self-contained and carry no framing; callers store the raw and compressed
+// sizes themselves.
+
+// Returns the largest compressed size of `size` bytes of input.
+constexpr size_t lz4Bound(size_t size) {
+    return size + size / 255 + 16;
+}
+
+// Compresses `size` bytes of `data` into `out`, which must hold lz4Bound(size) bytes, and
+// returns the compressed size.
+size_t lz4Compress(const char* data, size_t size, char* out);
+
+// Decompresses `size` bytes of `data` into `out`, which must hold exactly `rawSize` bytes.
+// Returns false if the input is malformed or does not decompress to exactly `rawSize` bytes.
+bool lz4Decompress(const char* data, size_t size, char* out, size_t rawSize);
+
+#endif // COMPRESSION_HPP
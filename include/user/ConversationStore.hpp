@@ -0,0 +1,83 @@
+#ifndef CONVERSATION_STORE_HPP
+#define CONVERSATION_STORE_HPP
+
+#include "ChatHistory.hpp"
+#include "MessageLog.hpp"
+#include "UserTable.hpp"
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// Every conversation, each stored once and shared by its two participants.
+//
+// A conversation is keyed by the ordered pair of participant IDs, so
+// (alice, bob) and (bob, alice) find the same history. Users only list who
+// they have conversations with (see User::getChatPartners). Messages live in
+// one log per conversation under the store's directory, named by a numeric
+// conversation ID that the snapshot records.
+//
+// open() and find() may be called from any thread; the histories they return
+// are not thread-safe themselves. Iterating, list() and clear() need the
+// caller to keep open() out, as UserManager does by holding every lock stripe.
+class ConversationStore {
+public:
+    // Participant IDs, the lower first.
+    using Key = std::pair<UserId, UserId>;
+
+    // Keeps message logs under `directory` and resident messages under `cache`, if given. The
+    // participants' names are looked up in `users`, which must outlive the store.
+    ConversationStore(const std::string& directory, const UserTable& users, HistoryCache* cache = nullptr,
+                      uint64_t segmentBytes = MessageLog::kDefaultSegmentBytes);
+
+    // Returns the key of the conversation between `a` and `b`.
+    static Key key(UserId a, UserId b) { return a < b ? Key(a, b) : Key(b, a); }
+
+    // Returns the conversation between `a` and `b`, starting a new log if needed.
+    ChatHistory& open(UserId a, UserId b);
+    // Adds the conversation between `a` and `b` saved in log `id` with `count` messages. Returns
+    // null if the pair or the ID is already taken.
+    ChatHistory* restore(UserId a, UserId b, uint32_t id, uint64_t count);
+    // Returns the conversation between `a` and `b`, or null if they never talked.
+    ChatHistory* find(UserId a, UserId b);
+    const ChatHistory* find(UserId a, UserId b) const;
+
+    // Returns the number of conversations.
+    size_t size() const;
+    // Iterates over (key, history) pairs in no particular order.
+    auto begin() const { return conversations.begin(); }
+    auto end() const { return conversations.end(); }
+    auto begin() { return conversations.begin(); }
+    auto end() { return conversations.end(); }
+    // Returns every conversation in the order it was added. The histories stay where they are
+    // until clear(), so a copy of the list can be read while more are added.
+    const std::vector<ChatHistory*>& list() const { return histories; }
+    // Forgets every conversation; their logs stay on disk until the IDs are reused.
+    void clear();
+    // Makes every message appended so far durable. Returns false if a log failed to sync.
+    bool sync() { return log.sync(); }
+    // Hands over what sync() would flush, to be synced with MessageLog::sync(paths) elsewhere.
+    UnsyncedPaths takeUnsynced() { return log.takeUnsynced(); }
+
+private:
+    // Hashes both participants as one 64-bit value.
+    struct KeyHash {
+        size_t operator()(const Key& key) const;
+    };
+
+    // Adds the history of `participants` in log `id`.
+    ChatHistory& add(const Key& participants, uint32_t id);
+
+    MessageLog log;
+    const UserTable& users;
+    HistoryCache* cache;
+    mutable std::shared_mutex mutex; // Guards everything below.
+    uint32_t nextId = 0;     // Above every ID in use.
+    std::unordered_set<uint32_t> ids; // Logs in use.
+    std::unordered_map<Key, ChatHistory, KeyHash> conversations;
+    std::vector<ChatHistory*> histories; // Every history in `conversations`, oldest first.
+};
+
+#endif // CONVERSATION_STORE_HPP
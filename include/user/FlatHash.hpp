@@ -0,0 +1,507 @@
+#ifndef FLAT_HASH_HPP
+#define FLAT_HASH_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Open-addressing hash tables in the SwissTable layout: slots in one flat
+// array, plus a control byte per slot holding 7 bits of the key's hash, or
+// marking the slot empty or deleted. A lookup hashes the key once. It
+// compares 16 control bytes at a time against those 7 bits, with one SSE2
+// compare where available, and compares keys only for the matches. Probing
+// goes group by group and stops at the first group with an empty slot, so
+// a miss usually costs one group load and no key comparison.
+//
+// Tables grow at 7/8 full. Inserting or rehashing moves elements, so
+// pointers and iterators into a table are invalidated by any insertion.
+// Erasing invalidates only the erased element. Lookups are heterogeneous
+// when the hash and equality accept other types. FlatHash and
+// std::equal_to<> do for strings, so std::string and std::string_view keys
+// can be looked up with either type without building a temporary.
+
+// Default hash: string types hash as std::string_view so either can look up the other.
+// Integers hash to themselves; the table mixes every hash before using it.
+template <typename T, typename = void>
+struct FlatHash : std::hash<T> {};
+
+template <>
+struct FlatHash<std::string_view> {
+    using is_transparent = void;
+    size_t operator()(std::string_view s) const { return std::hash<std::string_view>{}(s); }
+};
+
+template <>
+struct FlatHash<std::string> : FlatHash<std::string_view> {};
+
+namespace flat_hash_detail {
+
+// Control byte values. A full slot holds 7 bits of its hash, 0 to 127.
+constexpr int8_t kEmpty = -128;
+constexpr int8_t kDeleted = -2;
+// Slots matched by one group load.
+constexpr size_t kGroupWidth = 16;
+
+// A bitmask of positions within a group, lowest first.
+struct BitMask {
+    uint32_t bits;
+
+    explicit operator bool() const { return bits != 0; }
+    // Returns the lowest position set.
+    size_t lowest() const { return static_cast<size_t>(__builtin_ctz(bits)); }
+    // Counts the positions clear below the lowest set, or the whole width if none is.
+    size_t trailingClear() const { return bits ? lowest() : kGroupWidth; }
+    // Counts the positions clear above the highest set, or the whole width if none is.
+    size_t leadingClear() const {
+        return bits ? static_cast<size_t>(__builtin_clz(bits)) - (32 - kGroupWidth) : kGroupWidth;
+    }
+    // Clears the lowest position.
+    void next() { bits &= bits - 1; }
+};
+
+// Sixteen control bytes, loaded from any position.
+struct Group {
+#if defined(__SSE2__)
+    __m128i ctrl;
+
+    explicit Group(const int8_t* p) : ctrl(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))) {}
+    // Marks the slots whose hash bits equal `h2`.
+    BitMask match(int8_t h2) const {
+        return BitMask{static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h2), ctrl)))};
+    }
+    // Marks the empty slots.
+    BitMask matchEmpty() const { return match(kEmpty); }
+    // Marks the slots an insertion may take: empty or deleted, the only negative values below -1.
+    BitMask matchFree() const {
+        return BitMask{static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_set1_epi8(-1), ctrl)))};
+    }
+#else
+    int8_t ctrl[kGroupWidth];
+
+    explicit Group(const int8_t* p) { std::memcpy(ctrl, p, kGroupWidth); }
+    BitMask match(int8_t h2) const {
+        uint32_t bits = 0;
+        for (size_t i = 0; i < kGroupWidth; ++i) bits |= uint32_t(ctrl[i] == h2) << i;
+        return BitMask{bits};
+    }
+    BitMask matchEmpty() const { return match(kEmpty); }
+    BitMask matchFree() const {
+        uint32_t bits = 0;
+        for (size_t i = 0; i < kGroupWidth; ++i) bits |= uint32_t(ctrl[i] < -1) << i;
+        return BitMask{bits};
+    }
+#endif
+};
+
+// The table behind FlatMap and FlatSet. `Slot` is what is stored and `KeyOf` extracts its key.
+template <typename Slot, typename KeyOf, typename Hash, typename Eq>
+class RawTable {
+public:
+    template <bool Const>
+    class Iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Slot;
+        using difference_type = std::ptrdiff_t;
+        using pointer = std::conditional_t<Const, const Slot*, Slot*>;
+        using reference = std::conditional_t<Const, const Slot&, Slot&>;
+
+        Iterator() = default;
+        // Lets an iterator become a const_iterator.
+        template <bool C = Const, typename = std::enable_if_t<C>>
+        Iterator(const Iterator<false>& other) : ctrl(other.ctrl), slot(other.slot), end(other.end) {}
+
+        reference operator*() const { return *slot; }
+        pointer operator->() const { return slot; }
+        Iterator& operator++() {
+            ++ctrl;
+            ++slot;
+            skipFree();
+            return *this;
+        }
+        Iterator operator++(int) {
+            Iterator old = *this;
+            ++*this;
+            return old;
+        }
+        friend bool operator==(const Iterator& a, const Iterator& b) { return a.slot == b.slot; }
+        friend bool operator!=(const Iterator& a, const Iterator& b) { return a.slot != b.slot; }
+
+    private:
+        friend class RawTable;
+        template <bool>
+        friend class Iterator;
+
+        Iterator(const int8_t* ctrl, pointer slot, const int8_t* end) : ctrl(ctrl), slot(slot), end(end) {}
+        // Moves on to the next full slot, or the end.
+        void skipFree() {
+            while (ctrl != end && *ctrl < 0) {
+                ++ctrl;
+                ++slot;
+            }
+        }
+
+        const int8_t* ctrl = nullptr;
+        pointer slot = nullptr;
+        const int8_t* end = nullptr;
+    };
+    using iterator = Iterator<false>;
+    using const_iterator = Iterator<true>;
+
+    RawTable() = default;
+    RawTable(const RawTable& other) : hash(other.hash), eq(other.eq) {
+        reserve(other.count);
+        for (const Slot& slot : other) insertNew(hashOf(KeyOf::get(slot)), slot);
+    }
+    RawTable(RawTable&& other) noexcept { swap(other); }
+    RawTable& operator=(RawTable other) noexcept {
+        swap(other);
+        return *this;
+    }
+    ~RawTable() { release(); }
+
+    void swap(RawTable& other) noexcept {
+        std::swap(slots, other.slots);
+        std::swap(ctrl, other.ctrl);
+        std::swap(capacity, other.capacity);
+        std::swap(shift, other.shift);
+        std::swap(count, other.count);
+        std::swap(growthLeft, other.growthLeft);
+        std::swap(hash, other.hash);
+        std::swap(eq, other.eq);
+    }
+
+    iterator begin() {
+        iterator it(ctrl, slots, ctrl + capacity);
+        it.skipFree();
+        return it;
+    }
+    iterator end() { return iterator(ctrl + capacity, slots + capacity, ctrl + capacity); }
+    const_iterator begin() const { return const_cast<RawTable*>(this)->begin(); }
+    const_iterator end() const { return const_cast<RawTable*>(this)->end(); }
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    // Drops every element and frees the slots.
+    void clear() {
+        release();
+        slots = nullptr;
+        ctrl = nullptr;
+        capacity = 0;
+        shift = 64;
+        count = 0;
+        growthLeft = 0;
+    }
+
+    // Makes room for `n` elements without growing again.
+    void reserve(size_t n) {
+        if (n <= count + growthLeft) return;
+        size_t target = kGroupWidth;
+        while (target - target / 8 < n + 1) target *= 2;
+        if (target > capacity) resize(target);
+    }
+
+    // Returns the element with key `key`, or end().
+    template <typename K>
+    iterator find(const K& key) {
+        if (count == 0) return end();
+        uint64_t h = hashOf(key);
+        int8_t h2 = static_cast<int8_t>(h2Of(h));
+        size_t mask = capacity - 1;
+        size_t pos = static_cast<size_t>(h >> shift);
+        for (size_t step = kGroupWidth;; pos = (pos + step) & mask, step += kGroupWidth) {
+            Group group(ctrl + pos);
+            for (BitMask match = group.match(h2); match; match.next()) {
+                size_t index = (pos + match.lowest()) & mask;
+                if (eq(KeyOf::get(slots[index]), key)) return iteratorAt(index);
+            }
+            if (group.matchEmpty()) return end();
+        }
+    }
+    template <typename K>
+    const_iterator find(const K& key) const {
+        return const_cast<RawTable*>(this)->find(key);
+    }
+
+    // Finds `key` or, in the same probe, constructs a slot for it from `args`. Returns the slot
+    // and whether it was inserted.
+    template <typename K, typename... Args>
+    std::pair<iterator, bool> findOrInsert(const K& key, Args&&... args) {
+        if (growthLeft == 0) rehashForInsert();
+        uint64_t h = hashOf(key);
+        int8_t h2 = static_cast<int8_t>(h2Of(h));
+        size_t mask = capacity - 1;
+        size_t pos = static_cast<size_t>(h >> shift);
+        size_t free = capacity;
+        for (size_t step = kGroupWidth;; pos = (pos + step) & mask, step += kGroupWidth) {
+            Group group(ctrl + pos);
+            for (BitMask match = group.match(h2); match; match.next()) {
+                size_t index = (pos + match.lowest()) & mask;
+                if (eq(KeyOf::get(slots[index]), key)) return {iteratorAt(index), false};
+            }
+            BitMask available = group.matchFree();
+            if (free == capacity && available) free = (pos + available.lowest()) & mask;
+            if (group.matchEmpty()) break;
+        }
+        // A deleted slot is reused; only taking an empty one uses up growth.
+        if (ctrl[free] == kEmpty) --growthLeft;
+        new (slots + free) Slot(std::forward<Args>(args)...);
+        setCtrl(free, h2);
+        ++count;
+        return {iteratorAt(free), true};
+    }
+
+    // Removes the element with key `key`. Returns the number removed.
+    template <typename K>
+    size_t erase(const K& key) {
+        iterator it = find(key);
+        if (it == end()) return 0;
+        eraseAt(it);
+        return 1;
+    }
+    // Removes the element at `it`, which must be valid.
+    void eraseAt(const_iterator it) {
+        size_t index = static_cast<size_t>(it.slot - slots);
+        slots[index].~Slot();
+        --count;
+        // A slot no probe ever passed over a full group to reach can go back to empty: there is
+        // an empty one within a group's width on both sides.
+        size_t mask = capacity - 1;
+        BitMask before = Group(ctrl + ((index - kGroupWidth) & mask)).matchEmpty();
+        BitMask after = Group(ctrl + index).matchEmpty();
+        if (before && after && after.trailingClear() + before.leadingClear() < kGroupWidth) {
+            setCtrl(index, kEmpty);
+            ++growthLeft;
+        } else {
+            setCtrl(index, kDeleted);
+        }
+    }
+
+private:
+    // Alignment of the block: the slots', but at least 16 bytes.
+    static constexpr std::align_val_t kAlign{alignof(Slot) < 16 ? 16 : alignof(Slot)};
+
+    // Mixes the hash, so weak ones such as an integer's identity still spread over the table.
+    // The slot is picked from the top bits and the control byte holds the next 7.
+    template <typename K>
+    uint64_t hashOf(const K& key) const {
+        return static_cast<uint64_t>(hash(key)) * 0x9e3779b97f4a7c15ULL;
+    }
+    uint8_t h2Of(uint64_t h) const { return static_cast<uint8_t>((h >> (shift - 7)) & 0x7f); }
+
+    iterator iteratorAt(size_t index) { return iterator(ctrl + index, slots + index, ctrl + capacity); }
+
+    // Sets a control byte and its copy past the end, which lets a group load start at any slot.
+    void setCtrl(size_t index, int8_t value) {
+        ctrl[index] = value;
+        if (index < kGroupWidth - 1) ctrl[capacity + index] = value;
+    }
+
+    // Grows when more than half the used slots hold elements; otherwise tombstones are what
+    // filled the table, and rehashing at the same size clears them.
+    void rehashForInsert() {
+        if (capacity == 0) {
+            resize(kGroupWidth);
+        } else if (count * 2 > capacity - capacity / 8) {
+            resize(capacity * 2);
+        } else {
+            resize(capacity);
+        }
+    }
+
+    // Moves every element into a table of `newCapacity` slots, a power of two of at least a group.
+    void resize(size_t newCapacity) {
+        Slot* oldSlots = slots;
+        int8_t* oldCtrl = ctrl;
+        size_t oldCapacity = capacity;
+
+        size_t ctrlOffset = newCapacity * sizeof(Slot);
+        char* block = static_cast<char*>(
+            ::operator new(ctrlOffset + newCapacity + kGroupWidth, kAlign));
+        slots = reinterpret_cast<Slot*>(block);
+        ctrl = reinterpret_cast<int8_t*>(block + ctrlOffset);
+        std::memset(ctrl, kEmpty, newCapacity + kGroupWidth);
+        capacity = newCapacity;
+        shift = 64 - static_cast<unsigned>(__builtin_ctzll(newCapacity));
+        growthLeft = capacity - capacity / 8 - count;
+
+        for (size_t i = 0; i < oldCapacity; ++i) {
+            if (oldCtrl[i] < 0) continue;
+            Slot& slot = oldSlots[i];
+            uint64_t h = hashOf(KeyOf::get(slot));
+            size_t index = freeSlotFor(h);
+            new (slots + index) Slot(std::move(slot));
+            setCtrl(index, static_cast<int8_t>(h2Of(h)));
+            slot.~Slot();
+        }
+        if (oldSlots) ::operator delete(oldSlots, kAlign);
+    }
+
+    // Returns the first free slot on the probe sequence of hash `h`.
+    size_t freeSlotFor(uint64_t h) const {
+        size_t mask = capacity - 1;
+        size_t pos = static_cast<size_t>(h >> shift);
+        for (size_t step = kGroupWidth;; pos = (pos + step) & mask, step += kGroupWidth) {
+            if (BitMask available = Group(ctrl + pos).matchFree()) return (pos + available.lowest()) & mask;
+        }
+    }
+
+    // Inserts an element known to be absent, as copying does.
+    void insertNew(uint64_t h, const Slot& value) {
+        size_t index = freeSlotFor(h);
+        new (slots + index) Slot(value);
+        setCtrl(index, static_cast<int8_t>(h2Of(h)));
+        ++count;
+        --growthLeft;
+    }
+
+    // Destroys the elements and frees the block.
+    void release() {
+        if (!slots) return;
+        if (!std::is_trivially_destructible<Slot>::value) {
+            for (size_t i = 0; i < capacity; ++i) {
+                if (ctrl[i] >= 0) slots[i].~Slot();
+            }
+        }
+        ::operator delete(slots, kAlign);
+    }
+
+    Slot* slots = nullptr;  // `capacity` slots, followed in the same block by...
+    int8_t* ctrl = nullptr; // ...their control bytes and a group's width of copies.
+    size_t capacity = 0;    // Zero or a power of two of at least kGroupWidth.
+    unsigned shift = 64;    // 64 - log2(capacity): the hash's top bits pick a slot.
+    size_t count = 0;
+    size_t growthLeft = 0;  // Empty slots that may still be filled before the table must grow.
+    Hash hash;
+    Eq eq;
+};
+
+struct SetKey {
+    template <typename T>
+    static const T& get(const T& value) { return value; }
+};
+
+struct MapKey {
+    template <typename P>
+    static const typename P::first_type& get(const P& pair) { return pair.first; }
+};
+
+} // namespace flat_hash_detail
+
+// Open-addressing hash set; see the top of this file.
+template <typename T, typename Hash = FlatHash<T>, typename Eq = std::equal_to<>>
+class FlatSet {
+    using Table = flat_hash_detail::RawTable<T, flat_hash_detail::SetKey, Hash, Eq>;
+
+public:
+    using value_type = T;
+    using iterator = typename Table::const_iterator;
+    using const_iterator = typename Table::const_iterator;
+
+    FlatSet() = default;
+    FlatSet(std::initializer_list<T> values) {
+        reserve(values.size());
+        for (const T& value : values) insert(value);
+    }
+
+    iterator begin() const { return table.begin(); }
+    iterator end() const { return table.end(); }
+    size_t size() const { return table.size(); }
+    bool empty() const { return table.empty(); }
+    void clear() { table.clear(); }
+    void reserve(size_t n) { table.reserve(n); }
+
+    template <typename K>
+    iterator find(const K& key) const { return table.find(key); }
+    template <typename K>
+    bool contains(const K& key) const { return table.find(key) != table.end(); }
+    template <typename K>
+    size_t count(const K& key) const { return contains(key) ? 1 : 0; }
+
+    // Adds `value` unless present, with a single probe. Returns where it is and whether it was added.
+    std::pair<iterator, bool> insert(const T& value) { return table.findOrInsert(value, value); }
+    std::pair<iterator, bool> insert(T&& value) { return table.findOrInsert(value, std::move(value)); }
+
+    template <typename K>
+    size_t erase(const K& key) { return table.erase(key); }
+    void erase(const_iterator it) { table.eraseAt(it); }
+
+    friend bool operator==(const FlatSet& a, const FlatSet& b) {
+        if (a.size() != b.size()) return false;
+        for (const T& value : a) {
+            if (!b.contains(value)) return false;
+        }
+        return true;
+    }
+
+private:
+    Table table;
+};
+
+// Open-addressing hash map; see the top of this file. Elements are std::pair<K, V>; changing a
+// key through an iterator is allowed only if its hash and equality stay the same.
+template <typename K, typename V, typename Hash = FlatHash<K>, typename Eq = std::equal_to<>>
+class FlatMap {
+    using Table = flat_hash_detail::RawTable<std::pair<K, V>, flat_hash_detail::MapKey, Hash, Eq>;
+
+public:
+    using key_type = K;
+    using mapped_type = V;
+    using value_type = std::pair<K, V>;
+    using iterator = typename Table::iterator;
+    using const_iterator = typename Table::const_iterator;
+
+    iterator begin() { return table.begin(); }
+    iterator end() { return table.end(); }
+    const_iterator begin() const { return table.begin(); }
+    const_iterator end() const { return table.end(); }
+    size_t size() const { return table.size(); }
+    bool empty() const { return table.empty(); }
+    void clear() { table.clear(); }
+    void reserve(size_t n) { table.reserve(n); }
+
+    template <typename Q>
+    iterator find(const Q& key) { return table.find(key); }
+    template <typename Q>
+    const_iterator find(const Q& key) const { return table.find(key); }
+    template <typename Q>
+    bool contains(const Q& key) const { return table.find(key) != table.end(); }
+    template <typename Q>
+    size_t count(const Q& key) const { return contains(key) ? 1 : 0; }
+
+    // Finds `key` or inserts it with a value built from `args`, with a single probe. `key` may be
+    // any type the hash accepts that converts to K. Returns where it is and whether it was added.
+    template <typename Q, typename... Args>
+    std::pair<iterator, bool> try_emplace(const Q& key, Args&&... args) {
+        return table.findOrInsert(key, std::piecewise_construct, std::forward_as_tuple(key),
+                                  std::forward_as_tuple(std::forward<Args>(args)...));
+    }
+    // Returns the value for `key`, inserting a default one if absent.
+    template <typename Q>
+    V& operator[](const Q& key) { return try_emplace(key).first->second; }
+
+    template <typename Q>
+    size_t erase(const Q& key) { return table.erase(key); }
+    void erase(iterator it) { table.eraseAt(it); }
+    void erase(const_iterator it) { table.eraseAt(it); }
+
+private:
+    Table table;
+};
+
+#endif // FLAT_HASH_HPP
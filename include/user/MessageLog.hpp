@@ -0,0 +1,329 @@
+#ifndef MESSAGE_LOG_HPP
+#define MESSAGE_LOG_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <set>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// On-disk chat history: one append-only log per conversation, split into segments.
+//
+// Each conversation's log is a directory under the MessageLog's root, named by
+// the conversation's ID. A segment is a pair of files named by the sequence
+// number of its first message (20 decimal digits):
+//
+//   <base>.seg  records in sequence order
+//   <base>.idx  sparse index, one entry for the segment's first record and
+//               then one at least every kIndexInterval bytes of records
+//
+// A record is a 32-byte header followed by the payload:
+//
+//   u32 CRC-32 of the rest | u32 payload length | u64 sequence |
+//   i64 timestamp (ms since the Unix epoch) | u32 sender | u32 reserved
+//
+// and an index entry is u64 sequence | i64 timestamp | u64 record offset, all
+// little-endian. The sender is the participant's position in the conversation
+// (0 or 1). Timestamps never decrease within a log, so the index serves seeks
+// by time as well as by sequence.
+//
+// A segment is closed once the next record would take it past the segment
+// size, so appends only ever touch the tail segment and reading the latest
+// messages only touches as many segments as hold them. The snapshot records
+// how many messages each log had at the last checkpoint; a log is cut back to
+// that count the first time it is used, dropping anything the write-ahead log
+// will replay again.
+//
+// Old messages are dropped from the front by trim(): whole segments are
+// deleted, and compaction rewrites the segment holding the new first message
+// without the records before it once they make up half of it. Until then they
+// are only hidden, and reappear after a restart until the next trim. A
+// rewritten segment keeps its name, so its first record may come after its
+// base.
+//
+// Closed segments, and a tail that has gone quiet once it holds a quarter of a
+// segment, are compressed into a single file that replaces the pair:
+//
+//   <base>.segz  blocks, then a block table, then a 24-byte footer
+//
+// Each block holds whole records, about kBlockBytes of them, compressed with
+// LZ4 behind a 16-byte header:
+//
+//   u32 CRC-32 of the compressed bytes | u32 compressed length |
+//   u32 raw length | u32 reserved
+//
+// The table has one 32-byte entry per block, u64 sequence | i64 timestamp of
+// its first record | u64 block offset | u64 offset of that record among the
+// uncompressed records, and the footer is u64 uncompressed size | u64 sequence
+// after the last record | u32 block count | u32 CRC-32 of the table. The table
+// serves as the segment's index, so a read decompresses only from the block
+// holding its first message on. A compressed segment is never appended to:
+// the next message starts a new segment, which may later be merged back into
+// it. Files are always written under a .tmp name, synced and renamed, so a
+// crash leaves the old or the new copy of a segment; whichever are left over
+// are sorted out by the next load.
+class MessageLog;
+
+// One message read back from a log; `payload` points into a read buffer.
+struct LogRecord {
+    uint64_t sequence;
+    int64_t timestamp;
+    uint32_t sender;
+    std::string_view payload;
+};
+
+// The log of one conversation. Not thread-safe: UserManager serializes access to each
+// conversation, but logs of different conversations are used at once. writeRewrite() and
+// finishRewrite() are the exception: they touch only files, so they may run while the log is
+// in use.
+class ConversationLog {
+public:
+    struct Rewrite;
+
+    ConversationLog(MessageLog& owner, uint32_t id) : owner(owner), logId(id) {}
+    ConversationLog(const ConversationLog&) = delete;
+    ConversationLog& operator=(const ConversationLog&) = delete;
+
+    // Starts an empty log, removing whatever an earlier conversation left under this ID.
+    void create();
+    // Adopts the log on disk, which held `count` messages at the last checkpoint. Messages past
+    // them are cut off on first use; if fewer survive, the log shrinks to what is readable.
+    void restore(uint64_t count);
+
+    // Returns the conversation ID the log is stored under.
+    uint32_t id() const { return logId; }
+    // Returns the sequence the next message gets, including any messages that a first use may
+    // yet find missing.
+    uint64_t size() const { return count; }
+    // Returns the sequence of the oldest message kept.
+    uint64_t first();
+    // Returns the bytes the kept records take up.
+    uint64_t bytes();
+    // Returns the timestamp of the newest message, or 0 if the log never had a readable one.
+    int64_t newest();
+    // Appends a message, moving its timestamp up to the newest one's if it is earlier. Returns
+    // false if it could not be written.
+    bool append(uint32_t sender, int64_t timestamp, std::string_view payload);
+    // Calls `fn` for every message from sequence `from` on, in order. Returns false if a segment
+    // is missing or damaged; messages before the damage have been delivered by then.
+    bool read(uint64_t from, const std::function<void(const LogRecord&)>& fn);
+    // Returns the sequence of the first message sent at or after `timestamp`, or size() if none.
+    uint64_t seek(int64_t timestamp);
+    // Returns the oldest sequence from which the kept records take at most `budget` bytes.
+    uint64_t seekBytes(uint64_t budget);
+    // Drops every message before sequence `sequence`. Returns the disk space freed by deleting
+    // whole segments; cutting down the one holding the new first message is left to a rewrite.
+    uint64_t trim(uint64_t sequence);
+    // Carries out every rewrite planRewrite() plans, one after the other, so it compresses the
+    // closed segments, and the tail too if `idle`, or if it holds a quarter of a segment and
+    // nothing was appended since the last pass, merging a tail into the compressed segment
+    // before it while they fit in one. Returns the
+    // number of segments compressed and adds the bytes compressed and the space they now take to
+    // `rawBytes` and `storedBytes`.
+    size_t compress(uint64_t& rawBytes, uint64_t& storedBytes, bool idle);
+
+    // Compaction rewrites a segment in four steps, so the conversation is held up only for
+    // bookkeeping: planRewrite() and installRewrite() need access serialized like every other
+    // member, writeRewrite() and finishRewrite() do not. planRewrite() picks the next segment to
+    // rewrite after `previous`, if given: the head once half of it is hidden, then each segment
+    // compress() would take. writeRewrite() reads the records, then writes and syncs the new
+    // file. installRewrite() renames the file into place, unless appends have meanwhile changed
+    // the segments it was made from. finishRewrite() syncs the directory and removes the files
+    // replaced, or the new file if it was not installed. When a pass runs out of rewrites, the
+    // tail counts as quiet for the next pass if nothing is appended in between.
+    Rewrite planRewrite(bool idle, const Rewrite* previous = nullptr);
+    bool writeRewrite(Rewrite& rewrite);
+    bool installRewrite(Rewrite& rewrite);
+    void finishRewrite(Rewrite& rewrite);
+
+private:
+    // Index entry; the on-disk layout.
+    struct IndexEntry {
+        uint64_t sequence;
+        int64_t timestamp;
+        uint64_t position;
+    };
+
+    // One segment file and, once read, its index. Index positions are offsets among the
+    // uncompressed records; a compressed segment has an entry for each block.
+    struct Segment {
+        uint64_t base = 0;              // Sequence of its first message.
+        uint64_t bytes = 0;             // Size of the .seg or .segz file.
+        std::vector<IndexEntry> index;
+        bool indexed = false;           // `index` has been read from the .idx file or block table.
+        bool compressed = false;        // Stored as a .segz file.
+        uint64_t rawBytes = 0;          // Compressed: size of its records uncompressed.
+        uint64_t next = 0;              // Compressed: sequence after its last record.
+        std::vector<uint64_t> blocks;   // Compressed: file offset of each index entry's block.
+    };
+
+    // Lists the segments and trims the tail to the restored count, the first time it is needed.
+    void load();
+    // Returns the segment's index, reading it on first use.
+    const std::vector<IndexEntry>& indexOf(Segment& segment);
+    // Reads segment `s` from the last index entry at or before `from` (a sequence, or a timestamp
+    // when `byTime`) and calls `fn` for each record until it returns false. Returns false if the
+    // segment could not be read or a record fails its checks.
+    bool scan(size_t s, uint64_t from, bool byTime, const std::function<bool(const LogRecord&, uint64_t end)>& fn);
+    // Reads the segment's records, uncompressed, from index entry `entry` to the end, or from
+    // the top if `entry` is past the index. Returns false if they could not be read.
+    bool readRecords(Segment& segment, size_t entry, std::vector<char>& buffer);
+    // Returns the size of the segment's records uncompressed.
+    uint64_t rawSize(Segment& segment);
+    // Writes `records`, whole records in sequence order, as a new file for segment `base`,
+    // compressed or not, under a .tmp name and syncs it. Fills `written` in to describe it.
+    // Returns false if the records fail their checks or the file could not be written. Touches
+    // only files.
+    bool writeSegment(uint64_t base, const std::vector<char>& records, bool compress, Segment& written);
+    // Renames the file writeSegment() wrote for `segment` into place and takes on `written`,
+    // adding the old segment to `replaced` if its files are of the other kind. Returns false,
+    // leaving the old file in place, if the rename failed.
+    bool installSegment(Segment& segment, Segment& written, std::vector<Segment>& replaced);
+    // Writes and installs `records` as the segment's new file, then removes what it replaced.
+    // Returns false, leaving the old file in place, if either step failed.
+    bool replace(Segment& segment, const std::vector<char>& records, bool compress);
+    // Removes the segment's files, whichever kind it is.
+    void remove(const Segment& segment);
+    // Drops the segment's records from the owner's decompressed copy.
+    void forget(const Segment& segment);
+    // Returns true if compaction should compress segment `s`.
+    bool compressible(size_t s, bool idle);
+    // Returns the path of a segment file.
+    std::string path(uint64_t base, const char* extension) const;
+
+    MessageLog& owner;
+    uint32_t logId;
+    bool loaded = true;          // `segments` reflects the directory.
+    uint64_t count = 0;          // Sequence the next message gets.
+    uint64_t start = 0;          // Sequence of the oldest message kept.
+    uint64_t startPosition = 0;  // Its offset in the head segment.
+    std::vector<Segment> segments;
+    int64_t lastTimestamp = 0;   // Of the newest message.
+    uint64_t lastIndexed = 0;    // Offset of the tail segment's newest index entry.
+    bool appended = false;       // Since the last pass ran out of rewrites.
+
+public:
+    // One segment rewritten by compaction: the head cut down to its kept records, a closed
+    // segment or quiet tail compressed, or a quiet tail merged into the compressed segment
+    // before it. Holds copies of what it reads, so the log may change while it is written.
+    struct Rewrite {
+        enum class Kind { None, Head, Compress, Merge };
+        Kind kind = Kind::None;
+        Segment source;                // The segment rewritten, as planned.
+        Segment tail;                  // Merge: the tail folded into it.
+        uint64_t startPosition = 0;    // Head: offset of the first record kept.
+        bool compress = false;         // The new file is compressed.
+        Segment written;               // The new file, once synced under its .tmp name.
+        bool ready = false;            // writeRewrite() succeeded.
+        bool installed = false;        // installRewrite() succeeded.
+        std::vector<Segment> replaced; // Segments whose files finishRewrite() removes.
+        // Once installed: the bytes compressed and the space they now take, or for a head, the
+        // space freed.
+        uint64_t rawBytes = 0;
+        uint64_t storedBytes = 0;
+        uint64_t freedBytes = 0;
+    };
+};
+
+// Segments and directories written since a MessageLog was last synced, taken out of it so they
+// can be synced on another thread while the log carries on.
+struct UnsyncedPaths {
+    std::string root;
+    std::set<std::pair<uint32_t, uint64_t>> segments; // Log ID and segment base.
+    std::set<uint32_t> directories;                   // Logs with segments created or removed.
+    bool rootDirectory = false;                       // Logs created or removed.
+
+    // Adds `other`'s paths to these.
+    void merge(UnsyncedPaths&& other);
+};
+
+// Root directory of every conversation log, plus the open files appends go to. What the logs
+// share is kept under a mutex that appends hold only to find their files and note what to sync,
+// so different conversations can be appended to and read at once.
+class MessageLog {
+public:
+    // Size a segment is closed at.
+    static constexpr uint64_t kDefaultSegmentBytes = 1 << 20;
+    // Bytes of records between index entries.
+    static constexpr uint64_t kIndexInterval = 4096;
+    // Bytes of records compressed as one block.
+    static constexpr uint64_t kBlockBytes = 64 << 10;
+    // Tail segments kept open for appending, least recently used closed first.
+    static constexpr size_t kOpenWriters = 64;
+
+    explicit MessageLog(std::string directory, uint64_t segmentBytes = kDefaultSegmentBytes);
+    MessageLog(const MessageLog&) = delete;
+    MessageLog& operator=(const MessageLog&) = delete;
+    // Closes the open segment files without syncing them.
+    ~MessageLog();
+
+    // Returns the root directory.
+    const std::string& directory() const { return root; }
+    // Returns the size segments are closed at.
+    uint64_t segmentBytes() const { return segmentLimit; }
+    // Makes every segment written since the last sync durable, along with the directory
+    // entries of new segments and logs. Returns false if anything failed to sync.
+    bool sync();
+    // Returns everything sync() would flush and forgets it, as if it had been synced. Only swaps
+    // the sets out, so it is cheap however much is unsynced.
+    UnsyncedPaths takeUnsynced();
+    // Syncs what takeUnsynced() returned, by path, without touching the log. A segment replaced
+    // or removed since counts as synced: replacements are synced before they are renamed in.
+    // Returns false if anything failed to sync.
+    static bool sync(const UnsyncedPaths& paths);
+
+private:
+    friend class ConversationLog;
+
+    // Open tail segment of one conversation.
+    struct Writer {
+        uint64_t base;
+        int segment;
+        int index;
+        std::list<uint32_t>::iterator lruPosition;
+        unsigned users = 0; // Appends writing through the files; eviction skips the writer meanwhile.
+    };
+
+    // Returns the open files of log `id`'s segment `base`, opening them if needed, or null.
+    // Called with `mutex` held. The writer comes back pinned, so the files can be used after
+    // `mutex` is released; unpin it under `mutex` once done.
+    Writer* writer(uint32_t id, uint64_t base);
+    // Closes log `id`'s open files, if any. Only the log's own operations close its writer, and
+    // they are serialized with its appends, so it is never pinned here.
+    void closeWriter(uint32_t id);
+    // Same, with `mutex` already held.
+    void closeWriterLocked(uint32_t id);
+    // Records that log `id`'s segment `base`, or its directory, needs syncing.
+    void markSegment(uint32_t id, uint64_t base);
+    void markDirectory(uint32_t id);
+    // Returns the directory of log `id`.
+    std::string logDirectory(uint32_t id) const;
+
+    std::string root;
+    uint64_t segmentLimit;
+    // Guards everything below, which the logs of all conversations share.
+    std::mutex mutex;
+    std::unordered_map<uint32_t, Writer> writers;
+    std::list<uint32_t> writerLru;                    // Most recently used first.
+    std::set<std::pair<uint32_t, uint64_t>> dirty;    // Segments written since the last sync.
+    std::set<uint32_t> dirtyDirectories;              // Logs with segments created or removed.
+    bool rootDirty = false;                           // Logs created or removed.
+    // The records last decompressed, from index entry `entry` of segment `base` in log `id` on.
+    // Opening a log scans its segments much as the first read then does, so this saves
+    // decompressing them twice.
+    struct Decompressed {
+        uint32_t id = 0;
+        uint64_t base = 0;
+        size_t entry = 0;
+        std::vector<char> records;
+        bool valid = false;
+    } decompressed;
+};
+
+#endif // MESSAGE_LOG_HPP
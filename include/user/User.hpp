@@ -1,70 +1,79 @@
 #ifndef USER_HPP
 #define USER_HPP
 
+#include "FlatHash.hpp"
+#include <cstdint>
 #include <string>
-#include <unordered_set>
-#include <unordered_map>
-#include <vector>
 
-// Represents a single chat message.
-struct Message {
-    std::string sender;  // Username of the message sender.
-    std::string content; // Content of the message.
-};
+// Numeric ID of an interned username; see UserTable.
+using UserId = uint32_t;
+// Stands for no user: IDs start at 1.
+constexpr UserId kNoUser = 0;
+// A set of users, such as a friend list.
+using UserIdSet = FlatSet<UserId>;
 
-// Represents a chat user with their profile, friends, and chat history.
+// Represents a chat user with their profile, friends, and conversation partners. Other users
+// are referred to by ID; the name belongs to the UserTable.
 class User {
 public:
     // Grants UserManager access to private members for data management.
     friend class UserManager;
+    // Grants the snapshot codec access to private members for loading and saving.
+    friend class UserSnapshot;
+
+    // Constructor: Initializes a User with its ID and no password.
+    explicit User(UserId id = kNoUser);
 
-    // Constructor: Initializes a User with a username and password.
-    User(const std::string& username, const std::string& password);
+    // Returns the hash stored for a password.
+    static std::string hashPassword(const std::string& password);
 
-    // Returns the username of the user.
-    const std::string& getUsername() const;
+    // Returns the ID of the user.
+    UserId getId() const;
     // Checks if the provided password matches the user's stored password hash.
     bool checkPassword(const std::string& password) const;
 
     // Checks if the user is friends with another user.
-    bool hasFriend(const std::string& other) const;
+    bool hasFriend(UserId other) const;
     // Checks if there is a pending friend request from another user.
-    bool hasPendingRequestFrom(const std::string& other) const;
+    bool hasPendingRequestFrom(UserId other) const;
     // Checks if the user has sent a friend request to another user.
-    bool hasSentRequestTo(const std::string& other) const;
+    bool hasSentRequestTo(UserId other) const;
 
     // Adds another user to the outgoing friend requests.
-    void sendFriendRequestTo(const std::string& other);
+    void sendFriendRequestTo(UserId other);
     // Adds another user to the incoming friend requests.
-    void receiveFriendRequestFrom(const std::string& other);
+    void receiveFriendRequestFrom(UserId other);
     // Accepts a pending friend request from another user.
-    bool acceptFriendRequestFrom(const std::string& other);
+    bool acceptFriendRequestFrom(UserId other);
     // Rejects a pending friend request from a specified sender.
-    void rejectFriendRequestFrom(const std::string& sender_username);
+    void rejectFriendRequestFrom(UserId sender);
     // Marks an outgoing friend request as completed (accepted).
-    void completeOutgoingFriendRequest(const std::string& other);
+    void completeOutgoingFriendRequest(UserId other);
     // Cancels an outgoing friend request.
-    void cancelOutgoingFriendRequest(const std::string& other);
+    void cancelOutgoingFriendRequest(UserId other);
 
     // Returns a constant reference to the set of friends.
-    const std::unordered_set<std::string>& getFriends() const;
+    const UserIdSet& getFriends() const;
     // Returns a constant reference to the set of incoming friend requests.
-    const std::unordered_set<std::string>& getIncomingFriendRequests() const;
-    // Stores a message in the chat history with a specific partner.
-    void storeMessage(const std::string& chatPartner, const std::string& sender, const std::string& content);
-    // Returns a constant reference to the chat history with a specific friend.
-    const std::vector<Message>& getChatHistoryWith(const std::string& friendUsername) const;
+    const UserIdSet& getIncomingFriendRequests() const;
+    // Records that the user has a conversation with `partner` in the ConversationStore.
+    void addChatPartner(UserId partner);
+    // Returns the users this user has conversations with.
+    const UserIdSet& getChatPartners() const;
 
 private:
-    std::string username;     // User's unique username.
+    UserId id;                // Interned username.
     std::string passwordHash; // Hashed password for authentication.
 
-    std::unordered_set<std::string> friends;         // Set of friends' usernames.
-    std::unordered_set<std::string> incomingRequests; // Set of incoming friend requests.
-    std::unordered_set<std::string> outgoingRequests; // Set of outgoing friend requests.
+    UserIdSet friends;          // Set of friends.
+    UserIdSet incomingRequests; // Set of incoming friend requests.
+    UserIdSet outgoingRequests; // Set of outgoing friend requests.
+
+    // Users with a conversation in the ConversationStore; the messages live there, once per pair.
+    UserIdSet chatPartners;
 
-    // Stores chat history with different friends.
-    std::unordered_map<std::string, std::vector<Message>> chatHistory;
+    // Newest checkpoint that has saved this user, or set aside a copy to save; see UserManager.
+    uint64_t checkpointEpoch = 0;
 };
 
 #endif
@@ -1,53 +1,316 @@
 #ifndef USER_MANAGER_HPP
 #define USER_MANAGER_HPP
 
+#include "ConversationStore.hpp"
 #include "User.hpp"
+#include "UserTable.hpp"
+#include "WriteAheadLog.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <shared_mutex>
+#include <string_view>
+#include <thread>
 #include <unordered_map>
 #include <string>
 #include <optional>
+#include <vector>
+
+// How much chat history to keep; a zero limit is not enforced.
+struct RetentionPolicy {
+    size_t maxMessages = 0;         // Messages per conversation.
+    std::chrono::seconds maxAge{0}; // Age of a message, by the time it was sent.
+    uint64_t maxUserBytes = 0;      // Log bytes across all of one user's conversations.
+
+    // Returns true if any limit is set.
+    bool enabled() const { return maxMessages > 0 || maxAge.count() > 0 || maxUserBytes > 0; }
+};
+
+// Counters reported by UserManager::compactionStats().
+struct CompactionStats {
+    uint64_t passes = 0;             // Completed sweeps over every conversation and user.
+    uint64_t trimmedMessages = 0;    // Messages dropped for exceeding a limit.
+    uint64_t reclaimedBytes = 0;     // Disk space freed by deleting and rewriting segments.
+    uint64_t compressedSegments = 0; // Segments written compressed.
+    uint64_t compressedRawBytes = 0; // Message log bytes they compressed...
+    uint64_t compressedBytes = 0;    // ...and the space those now take.
+    uint64_t lastPassMicros = 0;     // Time the last pass spent in compact(), pauses excluded.
+    uint64_t longestHoldMicros = 0;  // Longest time compaction held a conversation's stripes at once.
+};
+
+// Counters reported by UserManager::checkpointStats().
+struct CheckpointStats {
+    uint64_t checkpoints = 0;        // Snapshots written in the background.
+    uint64_t failures = 0;           // Background snapshots that could not be written.
+    uint64_t lastMillis = 0;         // Time the last one took from capture to the log being dropped.
+    uint64_t lastPauseMicros = 0;    // Time the last capture held up mutations...
+    uint64_t longestPauseMicros = 0; // ...and the longest any did.
+    uint64_t lastCopiedUsers = 0;    // Users set aside because they changed while the last one ran.
+};
 
 // Manages user data, including registration, authentication, friend requests, and chat history.
+//
+// Every mutation is appended to a write-ahead log (<dataFile>.wal) before it is
+// applied. Callers never wait for the disk: the log's writer thread group-commits
+// records in the background, and whenDurable() tells a caller when its changes
+// have reached stable storage. The data file is a binary snapshot (see
+// UserSnapshot) rewritten only at checkpoints; on startup it is mapped and the
+// log records newer than it are replayed on top. Each conversation is kept
+// once, in a ConversationStore shared by both participants, and its messages
+// in a segmented message log under <dataFile>.history/. A HistoryCache caps
+// how much memory the messages read back from those logs may hold, and
+// compact() compresses the logs' closed segments and drops whatever the
+// retention policy no longer keeps. Trimming is not logged: it only ever
+// removes messages, and anything hidden but not yet deleted when the process
+// stops is trimmed again by the next pass. Compaction holds a conversation's
+// stripes only to trim it and to plan and install each segment it rewrites;
+// the new files are read, compressed and synced with no stripe held.
+//
+// Periodic checkpoints do not stop mutations while the snapshot is written.
+// Every stripe is held only to capture the state cheaply: copies of the
+// lists of users and conversations, the message log segments to sync and the
+// log sequence, after which the write-ahead log is rotated. A background
+// thread then syncs and writes the snapshot. Users are copied on write: the
+// first friend operation to touch a user the thread has not saved yet sets a
+// copy of it aside, which the thread saves instead. Conversations work the
+// same way with the one thing the snapshot records of them, their length.
+//
+// Every public member may be called from any thread. Users are spread over
+// lock stripes by ID: a change to one user holds its stripe exclusively, one
+// that touches two users (a friend request, a message) holds both, always
+// taking the lower-numbered stripe first, and queries about one user share
+// its stripe. Checkpoint captures, saves and the start of a compaction pass
+// hold every stripe, so they see no change half made. getUser() is the exception: it hands out the
+// user itself, for tools that use the manager from one thread. UserShards, in
+// bench/, is the alternative to the stripes that contention_bench measures:
+// each user is owned by one thread.
 class UserManager {
+    // Runs the operations on shard threads instead of under the stripes.
+    friend class UserShards;
+
 private:
-    // Stores user data with username as key.
-    std::unordered_map<std::string, User> users;
-    // Path to the JSON file where user data is stored.
+    // Lock stripes users are spread over, by ID.
+    static constexpr size_t kStripes = 64;
+    // One stripe, on a cache line of its own so that neighbouring stripes do not contend.
+    struct alignas(64) Stripe {
+        std::shared_mutex mutex;
+    };
+    // Holds the stripes of two users exclusively, the lower-numbered first, so operations on
+    // the same pair from either side cannot deadlock. Both users may share a stripe.
+    class PairLock {
+    public:
+        PairLock(const UserManager& manager, UserId a, UserId b);
+        ~PairLock();
+        PairLock(const PairLock&) = delete;
+        PairLock& operator=(const PairLock&) = delete;
+
+    private:
+        std::shared_mutex* first;
+        std::shared_mutex* second; // Null if both users share `first`.
+    };
+    // Holds every stripe exclusively, in order.
+    class AllLock {
+    public:
+        explicit AllLock(const UserManager& manager);
+        ~AllLock();
+        AllLock(const AllLock&) = delete;
+        AllLock& operator=(const AllLock&) = delete;
+
+    private:
+        const UserManager& manager;
+    };
+
+    mutable Stripe stripes[kStripes];
+    // Set by a mutation that brought the log to the checkpoint interval; the checkpoint itself
+    // waits until that caller has released its stripes.
+    std::atomic<bool> checkpointDue{false};
+
+    // Budget for chat histories paged in from the snapshot; declared first so it outlives them.
+    HistoryCache historyCache;
+    // Every username, interned as an ID, and the users registered under them.
+    UserTable users;
+    // Every conversation, one history per pair of users, with its message log.
+    ConversationStore conversations;
+    // Path to the snapshot file where user data is stored.
     std::string dataFile;
+    // Mutations made since the last checkpoint.
+    WriteAheadLog wal;
+    // Number of logged mutations that triggers a checkpoint.
+    size_t checkpointInterval;
+    // Limits compact() enforces.
+    RetentionPolicy retention;
+    // The compaction pass under way: conversations, then users, still to visit.
+    struct CompactionPass {
+        bool active = false;
+        std::vector<ChatHistory*> conversations;
+        std::vector<const User*> users;
+        RetentionPolicy retention; // As it was when the pass started.
+        size_t next = 0;          // Into conversations, then on into users.
+        uint64_t workMicros = 0;  // Spent in compact() so far.
+    } compaction;
+    std::atomic<uint64_t> compactionPasses{0};
+    std::atomic<uint64_t> trimmedMessages{0};
+    std::atomic<uint64_t> reclaimedBytes{0};
+    std::atomic<uint64_t> compressedSegments{0};
+    std::atomic<uint64_t> compressedRawBytes{0};
+    std::atomic<uint64_t> compressedBytes{0};
+    std::atomic<uint64_t> lastPassMicros{0};
+    std::atomic<uint64_t> longestHoldMicros{0};
+    // The thread that writes checkpoints, started with the first one and kept for the next.
+    std::thread checkpointThread;
+    mutable std::mutex checkpointMutex;            // Guards the members below and the epoch stamps.
+    std::condition_variable checkpointWake;        // Signals the thread: a checkpoint or stopping.
+    std::condition_variable checkpointDone;        // Signals finishCheckpoint().
+    bool checkpointStopping = false;
+    // The checkpoint handed to the thread; its lists keep their capacity from one to the next.
+    struct CheckpointJob {
+        bool pending = false;
+        std::vector<User*> users;
+        std::vector<ChatHistory*> histories;
+        uint64_t sequence = 0;
+        UnsyncedPaths paths;
+        std::chrono::steady_clock::time_point started;
+    } checkpointJob;
+    // What the running checkpoint has yet to save, as it was when it started.
+    std::atomic<bool> checkpointRunning{false};    // Set under every stripe, cleared by the thread.
+    uint64_t checkpointEpoch = 0;                  // Of the newest checkpoint.
+    std::unordered_map<const User*, User> shadows; // Users changed since it started, as they were.
+    // Lengths of the conversations touched since it started, as they were.
+    mutable std::unordered_map<const ChatHistory*, uint64_t> savedCounts;
+    UnsyncedPaths unsyncedPaths;                   // Message log files a failed checkpoint left unsynced.
+    std::atomic<uint64_t> backgroundCheckpoints{0};
+    std::atomic<uint64_t> failedCheckpoints{0};
+    std::atomic<uint64_t> lastCheckpointMillis{0};
+    std::atomic<uint64_t> lastPauseMicros{0};
+    std::atomic<uint64_t> longestPauseMicros{0};
+    std::atomic<uint64_t> lastCopiedUsers{0};
+
+    // Returns the stripe guarding `user`.
+    std::shared_mutex& stripeOf(UserId user) const { return stripes[user % kStripes].mutex; }
 
-    // Loads user data from the JSON file.
-    void loadFromFile();
-    // Removed: // void saveToFile() const; // Moved to public section
+    // Loads user data from the snapshot file and returns the log sequence number it covers.
+    // Sets `outdated` if the file is JSON.
+    uint64_t loadFromFile(bool& outdated);
+    // Saves a snapshot, or saves one and empties the log; saveToFile() and checkpoint() without
+    // the locking.
+    bool writeSnapshot();
+    void checkpointLocked();
+    // Logs a validated mutation of `first` and `second`, whose names the record holds, applies
+    // it, and marks a checkpoint due if the log has grown long enough. The caller holds the
+    // users' stripes. Returns false, changing nothing, if the log refused the record.
+    bool commit(WalRecord record, UserId first, UserId second = kNoUser);
+    // Logs a validated mutation and marks a checkpoint due if the log has grown long enough.
+    // Returns false if the log has failed; a checkpoint is then marked due, as writing a
+    // snapshot is what lets the log accept records again.
+    bool log(WalRecord& record);
+    // Starts a checkpoint if one is due. Called holding no stripe.
+    void checkpointIfDue();
+    // Applies a logged mutation to the in-memory state, looking up the users it names.
+    void applyRecord(const WalRecord& record);
+    // Applies a mutation of the users it names, `first` and `second`. For a registration,
+    // `first` is the interned name.
+    void apply(const WalRecord& record, UserId first, UserId second);
+    // Trims one conversation to the per-conversation limits and compresses its log, or trims one
+    // user's conversations to the per-user budget, adding what was done to the counters.
+    void compactConversation(ChatHistory& history, int64_t now);
+    void compactUser(const User& user);
+    // Rewrites the segments of `history`'s log that compaction picks, one at a time, adding what
+    // was done to the counters.
+    void rewriteLog(ChatHistory& history);
+    // Runs `work` holding the stripes of `a` and `b`, timing the hold for the compaction counters.
+    template <typename Work>
+    void compactionHold(UserId a, UserId b, Work work);
+    // Captures the state and starts writing a snapshot of it in the background, unless one is
+    // still being written. Checkpoints synchronously if the log cannot be rotated.
+    void startCheckpoint();
+    // Checkpoint thread: writes each checkpoint handed to it until stopped.
+    void runCheckpoints();
+    // Saves the captured users and conversations, then drops the old log. Returns true on success.
+    bool writeCheckpoint(CheckpointJob& job);
+    // Waits for a background checkpoint to finish.
+    void finishCheckpoint();
+    // Sets a copy of `user`, or the length of `history`'s log, aside before it changes if the
+    // background checkpoint has not saved it. Reading a history may change its length too: the
+    // first read cuts the log back to what survived.
+    void preserve(User* user);
+    void preserve(const ChatHistory& history) const;
+    // Returns the parts of `user` a snapshot records.
+    static User savedState(const User& user);
 
 public:
-    // Constructor: Initializes UserManager and loads data from the specified file.
-    explicit UserManager(const std::string& filename = "users.json");
-    // Saves current user data to the JSON file.
-    void saveToFile() const; // Made public for external use
+    // Constructor: Loads the snapshot in the specified file, replays the write-ahead log
+    // on top, persists according to `persistence`, and checkpoints after every
+    // `checkpointInterval` logged mutations.
+    explicit UserManager(const std::string& filename = "users.db", const PersistenceOptions& persistence = {},
+                         size_t checkpointInterval = 10000);
+    // Destructor: Checkpoints so the next start has no log to replay.
+    ~UserManager();
+    // Saves current user data as a binary snapshot, atomically replacing the previous one, and
+    // lets histories page in from it. Returns false if the snapshot could not be written.
+    bool saveToFile();
+    // Saves a snapshot and empties the write-ahead log, after waiting for a background checkpoint.
+    void checkpoint();
+    // Returns the background checkpoint counters.
+    CheckpointStats checkpointStats() const;
+    // Returns the log sequence of the newest change the calling thread made since it last asked,
+    // or 0 if it made none, and starts over.
+    uint64_t takeLoggedSequence();
+    // Returns a future that is ready once the change logged as `sequence` is as durable as the
+    // configured mode guarantees; only Batch mode ever makes it wait.
+    std::future<void> whenDurable(uint64_t sequence);
+    // Sets how much memory messages read back from the message logs may hold.
+    void setHistoryCacheLimit(size_t bytes);
+    // Returns the history cache's residency and paging counters.
+    HistoryCacheStats historyCacheStats() const;
+    // Sets the limits compact() enforces.
+    void setRetention(const RetentionPolicy& policy);
+    // Returns the limits compact() enforces.
+    const RetentionPolicy& getRetention() const { return retention; }
+    // Compresses and enforces the retention policy on the next `budget` conversations or users of
+    // the current pass, starting a new pass if none is under way. Returns true once the pass is
+    // complete. Each conversation holds up only its participants, and only for bookkeeping. Only
+    // one thread may compact.
+    bool compact(size_t budget);
+    // Returns the compaction counters.
+    CompactionStats compactionStats() const;
 
-    // Checks if a user with the given username exists.
-    bool userExists(const std::string& username) const;
+    // Returns the ID of a registered user, or kNoUser. Users are referred to by ID everywhere
+    // else; names are looked up only where they enter or leave the server.
+    UserId findUser(std::string_view username) const;
+    // Returns the name of a user ID.
+    const std::string& username(UserId id) const { return users.name(id); }
+    // Checks if a user with the given ID is registered.
+    bool userExists(UserId id) const;
     // Registers a new user with the provided username and password.
     bool registerUser(const std::string& username, const std::string& password);
     // Authenticates a user with the given username and password.
     bool authenticateUser(const std::string& username, const std::string& password) const;
 
-    // Retrieves a mutable User object by username.
-    std::optional<std::reference_wrapper<User>> getUser(const std::string& username);
-    // Retrieves a const User object by username.
-    std::optional<std::reference_wrapper<const User>> getUser(const std::string& username) const;
+    // Retrieves a mutable User object by ID. Unsynchronized; for single-threaded tools.
+    std::optional<std::reference_wrapper<User>> getUser(UserId id);
+    // Retrieves a const User object by ID. Unsynchronized; for single-threaded tools.
+    std::optional<std::reference_wrapper<const User>> getUser(UserId id) const;
+    // Checks if `user` is friends with `other`.
+    bool areFriends(UserId user, UserId other) const;
 
     // Sends a friend request from one user to another.
-    bool sendFriendRequest(const std::string& from, const std::string& to);
+    bool sendFriendRequest(UserId from, UserId to);
     // Accepts a friend request.
-    bool acceptFriendRequest(const std::string& username, const std::string& from);
+    bool acceptFriendRequest(UserId user, UserId from);
     // Rejects a friend request.
-    bool rejectFriendRequest(const std::string& rejecting_username, const std::string& sender_username);
+    bool rejectFriendRequest(UserId rejecting, UserId sender);
 
     // Gets pending incoming friend requests for a user.
-    std::optional<std::reference_wrapper<const std::unordered_set<std::string>>> getIncomingFriendRequests(const std::string& username) const;
+    std::optional<std::vector<UserId>> getIncomingFriendRequests(UserId user) const;
 
-    // Stores a chat message between two users.
-    void storeMessage(const std::string& sender, const std::string& receiver, const std::string& content);
+    // Stores a chat message between two users. Returns false if either user does not exist or
+    // the message could not be logged.
+    bool storeMessage(UserId sender, UserId receiver, const std::string& content);
+    // Returns the latest `limit` messages exchanged by two users, oldest first; empty if they
+    // never talked.
+    std::vector<Message> getChatHistory(UserId user, UserId peer, size_t limit) const;
 };
 
 #endif // USER_MANAGER_HPP
@@ -0,0 +1,71 @@
+#ifndef USER_SNAPSHOT_HPP
+#define USER_SNAPSHOT_HPP
+
+#include "ConversationStore.hpp"
+#include "UserTable.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Reads and writes complete copies of the user database.
+//
+// The native format is a versioned binary snapshot laid out for mmap: a
+// 64-byte header followed by a string table (usernames and password hashes,
+// each stored once), a fixed-size entry per user, a friend/request adjacency
+// array of string indices and a conversation table. All integers are
+// little-endian, every table starts 8-byte aligned and the header carries a
+// CRC-32 of the tables. Messages are not in the snapshot: each conversation
+// entry names its message log (see MessageLog) and how many messages the log
+// held when the snapshot was written, so a checkpoint costs the same however
+// long the histories grow.
+//
+// JSON is kept as an import/export format (see the chat_datatool program).
+class UserSnapshot {
+public:
+    // What a snapshot records of one conversation.
+    struct ConversationState {
+        UserId first;            // Participants, in name order.
+        UserId second;
+        uint32_t id;             // Its message log.
+        uint64_t count;          // Messages in the log.
+    };
+
+    // Binary format version; the only one written or read.
+    static constexpr uint32_t kVersion = 1;
+
+    // Returns the format version of a binary snapshot, or 0 if the file is not one.
+    static uint32_t binaryVersion(const std::string& path);
+    // Maps and validates a binary snapshot, fills the empty `users` and adds its conversations to
+    // the empty `conversations`, whose directory holds the snapshot's message logs and whose
+    // table is `users`. On failure returns false and describes the problem in `error`; both may
+    // be partly filled and should be cleared.
+    static bool readBinary(const std::string& path, UserTable& users, ConversationStore& conversations,
+                           uint64_t& walSequence, std::string& error);
+    // Writes a binary snapshot next to `path` and renames it into place; with `sync` the
+    // data is fsync'd first. The message logs must already be as durable as the snapshot
+    // needs them (see ConversationStore::sync). Returns false if the file could not be written.
+    static bool writeBinary(const std::string& path, const UserTable& users, const ConversationStore& conversations,
+                            uint64_t walSequence, bool sync);
+    // Writes a binary snapshot of state captured earlier, as above, with names looked up in
+    // `names`. Only the users' IDs, password hashes, friends and requests are read.
+    static bool writeBinary(const std::string& path, const UserTable& names, const std::vector<const User*>& users,
+                            const std::vector<ConversationState>& conversations, uint64_t walSequence, bool sync);
+    // Returns the state of every conversation.
+    static std::vector<ConversationState> conversationStates(const ConversationStore& conversations);
+
+    // Parses a JSON export (or a users.json from before binary snapshots) into the empty `users`
+    // and `conversations`. The file is streamed through a SAX parser in chunks; users are built
+    // and messages appended to their logs as they arrive, so no document tree is ever held in
+    // memory. On failure both may be partly filled, as with readBinary().
+    static bool readJson(const std::string& path, UserTable& users, ConversationStore& conversations,
+                         uint64_t& walSequence, std::string& error);
+    // Writes the users and conversations as JSON, atomically replacing `path`.
+    static bool writeJson(const std::string& path, const UserTable& users, const ConversationStore& conversations,
+                          uint64_t walSequence);
+
+private:
+    // SAX handler behind readJson().
+    class JsonLoader;
+};
+
+#endif // USER_SNAPSHOT_HPP
@@ -0,0 +1,97 @@
+#ifndef USER_TABLE_HPP
+#define USER_TABLE_HPP
+
+#include "FlatHash.hpp"
+#include "User.hpp"
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Every username the server knows, interned as a dense numeric ID, and the users registered
+// under them.
+//
+// IDs start at 1 and are handed out in the order names are first seen. Friend
+// lists, conversations and messages refer to users by ID, so each name is
+// stored once and compared as an integer; names are looked up only where they
+// enter or leave the server. A name may be interned before, or without, a user
+// being registered under it, since a snapshot's friend lists can name users it
+// lists later. Nothing is forgotten until clear(). IDs are not persisted: the
+// snapshot and the write-ahead log record names, and loading rebuilds the table.
+//
+// find(), intern(), name(), get() and add() may be called from any thread;
+// get() and name() take no lock. list() and clear() need the caller to keep
+// registrations out, as UserManager does by holding every lock stripe.
+class UserTable {
+public:
+    UserTable() = default;
+    UserTable(const UserTable&) = delete;
+    UserTable& operator=(const UserTable&) = delete;
+    ~UserTable();
+
+    // Returns the ID of `name`, or kNoUser if it was never interned.
+    UserId find(std::string_view name) const;
+    // Returns the ID of `name`, interning it first if it is new.
+    UserId intern(std::string_view name);
+    // Returns the name interned as `id`, which must be valid. The reference lasts until clear().
+    const std::string& name(UserId id) const { return *slot(id)->name; }
+
+    // Returns the user registered under `id`, or null if there is none.
+    User* get(UserId id) {
+        Slot* found = slot(id);
+        return found ? found->user.load(std::memory_order_acquire) : nullptr;
+    }
+    const User* get(UserId id) const { return const_cast<UserTable*>(this)->get(id); }
+    // Registers a user under the interned `id` and returns it, or returns the one already
+    // registered with false.
+    std::pair<User*, bool> add(UserId id);
+
+    // Returns the number of registered users.
+    size_t size() const { return registered.size(); }
+    // Returns every registered user in the order they were added. Users never move, so a copy of
+    // the list can be read while more are added.
+    const std::vector<User*>& list() const { return registered; }
+    // Forgets every name and user.
+    void clear();
+
+private:
+    // What an ID stands for. The name is set before the ID is handed out; the user is published
+    // once registered.
+    struct Slot {
+        const std::string* name = nullptr;
+        std::atomic<User*> user{nullptr};
+    };
+    // Slots live in chunks that double in size and are never moved or freed until clear(), so
+    // they can be read without a lock while more are added. Chunk c holds IDs
+    // kFirstChunk * (2^c - 1) + 1 onwards.
+    static constexpr unsigned kFirstChunkBits = 10;
+    static constexpr size_t kFirstChunk = size_t(1) << kFirstChunkBits;
+    static constexpr size_t kChunks = 33 - kFirstChunkBits;
+
+    // Returns the chunk and offset in it of `id`, which must not be kNoUser.
+    static std::pair<size_t, size_t> locate(UserId id) {
+        uint64_t position = uint64_t(id) - 1 + kFirstChunk;
+        unsigned bit = 63 - static_cast<unsigned>(__builtin_clzll(position));
+        return {bit - kFirstChunkBits, static_cast<size_t>(position - (uint64_t(1) << bit))};
+    }
+    // Returns the slot of `id`, or null if no chunk holds it yet.
+    Slot* slot(UserId id) const {
+        if (id == kNoUser) return nullptr;
+        auto [chunk, offset] = locate(id);
+        Slot* slots = chunks[chunk].load(std::memory_order_acquire);
+        return slots ? slots + offset : nullptr;
+    }
+
+    mutable std::shared_mutex mutex;                  // Guards everything below but the chunks' contents.
+    std::deque<std::string> names;                    // Indexed by ID - 1; never moved.
+    FlatMap<std::string_view, UserId> ids;            // Views into `names`.
+    std::deque<User> users;                           // Registered users; never moved.
+    std::atomic<Slot*> chunks[kChunks] = {};          // Indexed by ID as locate() says.
+    std::vector<User*> registered;                    // Every user in `users`, in order.
+};
+
+#endif // USER_TABLE_HPP
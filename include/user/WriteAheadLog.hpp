@@ -0,0 +1,163 @@
+#ifndef WRITE_AHEAD_LOG_HPP
+#define WRITE_AHEAD_LOG_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// How hard the log works to keep mutations across a crash.
+enum class Durability {
+    Memory,   // Nothing is written; changes live only as long as the process.
+    Interval, // Batches are written as they form and fsync'd every syncInterval.
+    Batch     // Every batch is fsync'd before its records count as committed.
+};
+
+// Tuning of the log's background writer.
+struct PersistenceOptions {
+    Durability durability = Durability::Interval;
+    // How long the writer keeps collecting records after the first one arrives, so
+    // concurrent mutations share one write (and one fsync in Batch mode).
+    std::chrono::microseconds batchWindow{2000};
+    // Interval mode: longest time written records may sit unsynced.
+    std::chrono::milliseconds syncInterval{1000};
+};
+
+// Kinds of mutation recorded in the log.
+enum class WalRecordType : uint8_t {
+    RegisterUser = 1,  // fields: username, passwordHash
+    FriendRequest = 2, // fields: from, to
+    FriendAccept = 3,  // fields: username, from
+    FriendReject = 4,  // fields: rejecting username, sender username
+    Message = 5        // fields: sender, receiver, content, timestamp (ms; absent in older logs)
+};
+
+// One logged mutation. Records describe state changes that already passed
+// validation, so replaying them needs no further checks.
+struct WalRecord {
+    WalRecordType type;
+    std::vector<std::string> fields;
+    uint64_t sequence = 0; // Assigned by append(); strictly increasing across checkpoints.
+};
+
+// Append-only log of user-data mutations, replayed on top of the last snapshot at startup.
+//
+// Each record is framed as
+//
+//   u32 payload length | u32 CRC-32 of payload | payload
+//   payload: u64 sequence | u8 type | u8 field count | (u32 length | bytes) per field
+//
+// with integers little-endian. A record cut short by a crash, or one whose
+// checksum does not match, ends the log: replay stops there and the tail is
+// truncated so later appends start from a clean boundary.
+//
+// Appends only encode the record into a pending buffer; a dedicated writer
+// thread turns everything that accumulated during the batch window into one
+// write (group commit) and syncs according to the durability mode.
+//
+// A write or fsync that fails puts the log in a failed state: the records
+// not known to be on disk are discarded, their whenDurable() futures fail,
+// and later appends are refused, so the file never holds records past a gap.
+// The state lasts until reset() empties the log under a snapshot that covers
+// everything.
+//
+// A background checkpoint rotates the log instead of waiting to truncate it:
+// the records it covers stay behind in <path>.1, which is deleted once the
+// snapshot is written, while new records go to a fresh file. Replay reads
+// <path>.1 first if a crash left it behind.
+class WriteAheadLog {
+public:
+    // Constructor: Opens (creating if needed) the log file at the given path and,
+    // unless the mode is Memory, starts the writer thread.
+    WriteAheadLog(const std::string& path, const PersistenceOptions& options = {});
+    // Destructor: Writes and syncs whatever is pending, then closes the log file.
+    ~WriteAheadLog();
+
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+    // Feeds every intact record newer than `afterSequence` to `apply`, in order, and drops a
+    // torn tail. Returns the number of records applied.
+    size_t replay(uint64_t afterSequence, const std::function<void(const WalRecord&)>& apply);
+    // Assigns the next sequence number and queues the record for the writer. Returns 0, and
+    // assigns nothing, if the log has failed.
+    uint64_t append(WalRecord& record);
+    // Returns a future that becomes ready once record `sequence` is durable: immediately in
+    // Memory and Interval modes, after the covering fsync in Batch mode. It holds an exception
+    // instead if the log failed before then.
+    std::future<void> whenDurable(uint64_t sequence);
+    // Waits until every queued record is written, then empties the log once a snapshot
+    // covers everything in it, which also clears a failure. Sequence numbers keep counting.
+    void reset();
+    // Starts a new log file after the newest record appended so far; the writer moves the
+    // current file to <path>.1 once everything queued for it is written and synced. Returns false,
+    // leaving the log as it is, if a retired file is still there or the mode is Memory.
+    bool rotate();
+    // Waits for a rotation under way to finish, then deletes the retired file once a snapshot
+    // covers everything in it.
+    void dropRetired();
+
+    // Returns the durability mode.
+    Durability durability() const { return options.durability; }
+    // Returns the sequence number of the newest record appended or replayed.
+    uint64_t lastSequence() const;
+    // Continues numbering after `sequence` (the snapshot's) if that is further along.
+    void advanceTo(uint64_t sequence);
+    // Returns the number of records in the log since it was last reset.
+    size_t recordCount() const;
+    // Returns the size of the log file in bytes, queued records included.
+    uint64_t sizeBytes() const;
+    // Returns the number of writes the writer has issued; records / batches is the group-commit factor.
+    uint64_t batchCount() const;
+
+private:
+    // Writer thread: drains the pending buffer one batch at a time.
+    void writeLoop();
+    // Writes a batch that starts at file offset `offset` in full. On failure the partial
+    // tail is cut off; returns false.
+    bool writeBatch(const std::string& batch, uint64_t offset);
+    // Flushes written records to stable storage. Returns false if that failed.
+    bool sync();
+    // Enters the failed state: drops what is queued and fails every waiter. Called with `mutex` held.
+    void fail();
+    // Writes and syncs the records queued before the rotation, then swaps in the new file.
+    // Called by the writer with `lock` held; releases it around the I/O.
+    void rotateFile(std::unique_lock<std::mutex>& lock);
+    // Fulfils the durability futures covered by syncedSequence. Called with `mutex` held.
+    void releaseWaiters();
+
+    std::string path;
+    PersistenceOptions options;
+    int fd = -1;
+
+    mutable std::mutex mutex;
+    std::condition_variable pendingReady; // Signals the writer: records queued or stopping.
+    std::condition_variable drained;      // Signals reset() and dropRetired(): everything queued has
+                                          // been written, or the rotation is done.
+    std::string pending;                  // Encoded records not yet handed to write().
+    uint64_t newestSequence = 0;          // Newest record appended or replayed.
+    uint64_t writtenSequence = 0;         // Newest record handed to the kernel.
+    uint64_t syncedSequence = 0;          // Newest record known to be on stable storage.
+    size_t records = 0;
+    uint64_t bytes = 0;                   // Log size once everything pending is written.
+    uint64_t writtenBytes = 0;            // Log size on disk.
+    uint64_t batches = 0;
+    bool stopping = false;
+    bool rotating = false;                // A rotation waits for the writer.
+    size_t rotateBytes = 0;               // Leading bytes of `pending` that belong in the old file.
+    uint64_t rotateSequence = 0;          // Newest record in the old file.
+    bool retired = false;                 // <path>.1 exists.
+    bool failed = false;                  // A write or sync failed; appends are refused.
+    // Futures from whenDurable(), each with the sequence it waits for.
+    std::vector<std::pair<uint64_t, std::promise<void>>> waiters;
+    std::thread writer;
+};
+
+#endif // WRITE_AHEAD_LOG_HPP
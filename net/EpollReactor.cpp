@@ -0,0 +1,237 @@
+#include "../include/net/EpollReactor.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+namespace {
+// Maximum number of readiness events handled per epoll_wait call.
+constexpr int kMaxEvents = 256;
+// Minimum free space offered to each recv.
+constexpr size_t kReadChunk = 4096;
+// Maximum number of queued messages written by one sendmsg call.
+constexpr size_t kMaxIovecs = 64;
+
+// Switches a socket to non-blocking mode.
+bool set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+} // namespace
+
+// Creates the epoll instance and registers the wakeup eventfd with it.
+EpollReactor::EpollReactor(ConnectionHandler& handler, size_t index)
+    : Reactor(handler, index), epoll_fd_(epoll_create1(EPOLL_CLOEXEC)), wake_fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+      spare_fd_(open("/dev/null", O_RDONLY | O_CLOEXEC)) {
+    if (epoll_fd_ < 0 || wake_fd_ < 0) {
+        perror("Reactor setup failed");
+        exit(EXIT_FAILURE);
+    }
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = wake_fd_;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &ev) < 0) {
+        perror("epoll_ctl failed on wakeup eventfd");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Closes all client sockets, the listening socket, the eventfd, the spare descriptor and the epoll instance.
+EpollReactor::~EpollReactor() {
+    for (auto& [fd, conn] : connections_) {
+        close(fd);
+    }
+    if (listen_fd_ != -1) {
+        close(listen_fd_);
+    }
+    close(wake_fd_);
+    if (spare_fd_ != -1) {
+        close(spare_fd_);
+    }
+    close(epoll_fd_);
+}
+
+// Registers the listening socket for edge-triggered accept notifications.
+void EpollReactor::add_listener(int listen_fd) {
+    if (!set_nonblocking(listen_fd)) {
+        perror("fcntl failed on listening socket");
+        exit(EXIT_FAILURE);
+    }
+    epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.fd = listen_fd;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd, &ev) < 0) {
+        perror("epoll_ctl failed on listening socket");
+        exit(EXIT_FAILURE);
+    }
+    listen_fd_ = listen_fd;
+}
+
+// Waits for readiness events and dispatches them until stopped.
+void EpollReactor::run() {
+    enter_loop();
+    epoll_event events[kMaxEvents];
+    while (running_) {
+        int count = epoll_wait(epoll_fd_, events, kMaxEvents, -1);
+        count_syscall();
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait failed");
+            break;
+        }
+
+        for (int i = 0; i < count; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == listen_fd_) {
+                accept_all();
+                continue;
+            }
+            if (fd == wake_fd_) {
+                uint64_t value;
+                ssize_t bytes_read = read(wake_fd_, &value, sizeof(value));
+                (void)bytes_read;
+                count_syscall();
+                // Reset before draining: a post that lands after this point writes a fresh wakeup.
+                wake_pending_.store(false, std::memory_order_seq_cst);
+                drain_mailbox();
+                continue;
+            }
+
+            Connection* conn = find(fd);
+            if (!conn) continue;
+
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                schedule_close(fd);
+                continue;
+            }
+            if (events[i].events & EPOLLIN) {
+                handle_readable(*conn);
+            }
+            if ((events[i].events & EPOLLOUT) && !conn->outbound.empty()) {
+                if (!flush(*conn) || (conn->state == ConnectionState::Closing && conn->outbound.empty())) {
+                    schedule_close(fd);
+                }
+            }
+        }
+
+        run_pending_closes();
+    }
+    exit_loop();
+}
+
+// Signals the eventfd so epoll_wait returns.
+void EpollReactor::wake() {
+    uint64_t one = 1;
+    ssize_t written = write(wake_fd_, &one, sizeof(one));
+    (void)written;
+    count_syscall();
+}
+
+// Accepts connections until the listening socket's backlog is empty. The listener is
+// edge-triggered, so stopping early would leave the remaining clients waiting for an event that
+// never comes; when out of descriptors they are accepted and closed instead.
+void EpollReactor::accept_all() {
+    while (true) {
+        int client_fd = accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        count_syscall();
+        if (client_fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+            if (!accept_failing_) {
+                accept_failing_ = true;
+                perror("Accept failed");
+            }
+            if ((errno == EMFILE || errno == ENFILE) && reject_one()) continue;
+            return;
+        }
+        accept_failing_ = false;
+
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.fd = client_fd;
+        count_syscall();
+        if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, client_fd, &ev) < 0) {
+            perror("epoll_ctl failed on client socket");
+            close(client_fd);
+            continue;
+        }
+        adopt(client_fd);
+    }
+}
+
+// Drops one pending client using the spare descriptor, then takes the spare back.
+bool EpollReactor::reject_one() {
+    if (spare_fd_ == -1) return false;
+    close(spare_fd_);
+    int client_fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+    count_syscall();
+    if (client_fd >= 0) {
+        close(client_fd);
+    }
+    spare_fd_ = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    return client_fd >= 0;
+}
+
+// Reads straight into the connection's frame buffer until the socket would block, handing
+// complete lines or frames to the handler after every read so the buffer stays bounded.
+void EpollReactor::handle_readable(Connection& conn) {
+    while (conn.state != ConnectionState::Closing) {
+        char* tail = conn.inbound.prepare(kReadChunk);
+        ssize_t bytes_received = recv(conn.fd, tail, conn.inbound.writable(), 0);
+        count_syscall();
+        if (bytes_received > 0) {
+            conn.inbound.commit(static_cast<size_t>(bytes_received));
+            dispatch_input(conn);
+            continue;
+        }
+        if (bytes_received < 0 && errno == EINTR) continue;
+        if (bytes_received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        // End of stream or a socket error.
+        schedule_close(conn.fd);
+        return;
+    }
+}
+
+// Writes queued messages, several per sendmsg, until everything is sent or the socket would block.
+bool EpollReactor::flush(Connection& conn) {
+    iovec iov[kMaxIovecs];
+    while (!conn.outbound.empty()) {
+        msghdr msg{};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = conn.outbound.gather(iov, kMaxIovecs);
+        ssize_t sent = sendmsg(conn.fd, &msg, MSG_NOSIGNAL);
+        count_syscall();
+        if (sent > 0) {
+            conn.outbound.consume(static_cast<size_t>(sent));
+            continue;
+        }
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        return false;
+    }
+    return true;
+}
+
+// Writes immediately; anything the socket cannot take now is sent on the next EPOLLOUT edge.
+void EpollReactor::start_output(Connection& conn) {
+    if (!flush(conn)) {
+        conn.state = ConnectionState::Closing;
+        schedule_close(conn.fd);
+        return;
+    }
+    if (conn.state == ConnectionState::Closing && conn.outbound.empty()) {
+        schedule_close(conn.fd);
+    }
+}
+
+// Deregisters and closes the socket.
+void EpollReactor::release(std::unique_ptr<Connection> conn) {
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, conn->fd, nullptr);
+    shutdown(conn->fd, SHUT_WR);
+    close(conn->fd);
+    count_syscall(3);
+}
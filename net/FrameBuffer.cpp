@@ -0,0 +1,143 @@
+#include "../include/net/FrameBuffer.hpp"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CHAT_X86_SIMD 1
+#endif
+
+namespace {
+// Initial allocation; most connections never need more.
+constexpr size_t kInitialCapacity = 4096;
+
+#ifdef CHAT_X86_SIMD
+// Scans 16 bytes per step. SSE2 is part of the x86-64 baseline, so this needs no dispatch.
+const char* find_newline_sse2(const char* p, const char* end) {
+    const __m128i newline = _mm_set1_epi8('\n');
+    for (; end - p >= 16; p += 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline));
+        if (mask != 0) {
+            return p + __builtin_ctz(static_cast<unsigned>(mask));
+        }
+    }
+    const void* hit = std::memchr(p, '\n', static_cast<size_t>(end - p));
+    return hit ? static_cast<const char*>(hit) : end;
+}
+
+// Scans 32 bytes per step; only called once the CPU is known to support AVX2.
+__attribute__((target("avx2"))) const char* find_newline_avx2(const char* p, const char* end) {
+    const __m256i newline = _mm256_set1_epi8('\n');
+    for (; end - p >= 32; p += 32) {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, newline));
+        if (mask != 0) {
+            return p + __builtin_ctz(static_cast<unsigned>(mask));
+        }
+    }
+    return find_newline_sse2(p, end);
+}
+#else
+// Portable fallback.
+const char* find_newline_scalar(const char* p, const char* end) {
+    const void* hit = std::memchr(p, '\n', static_cast<size_t>(end - p));
+    return hit ? static_cast<const char*>(hit) : end;
+}
+#endif
+
+using ScanFunction = const char* (*)(const char*, const char*);
+
+// Picks the widest scan the CPU supports.
+ScanFunction select_scan() {
+#ifdef CHAT_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return find_newline_avx2;
+    }
+    return find_newline_sse2;
+#else
+    return find_newline_scalar;
+#endif
+}
+
+const ScanFunction scan = select_scan();
+} // namespace
+
+// Dispatches to the scan chosen at startup.
+const char* find_newline(const char* begin, const char* end) {
+    return scan(begin, end);
+}
+
+// Makes room at the tail: reuses consumed head space first and grows only if that is not enough.
+char* FrameBuffer::prepare(size_t min_size) {
+    if (capacity_ - end_ >= min_size) {
+        return data_.get() + end_;
+    }
+
+    size_t unread_size = end_ - begin_;
+    if (capacity_ - unread_size >= min_size) {
+        // The tail has wrapped into consumed space: slide the unread bytes to the front once.
+        std::memmove(data_.get(), data_.get() + begin_, unread_size);
+    } else {
+        size_t new_capacity = std::max(kInitialCapacity, capacity_ * 2);
+        while (new_capacity - unread_size < min_size) {
+            new_capacity *= 2;
+        }
+        std::unique_ptr<char[]> grown(new char[new_capacity]);
+        if (unread_size > 0) {
+            std::memcpy(grown.get(), data_.get() + begin_, unread_size);
+        }
+        data_ = std::move(grown);
+        capacity_ = new_capacity;
+    }
+    scanned_ -= begin_;
+    begin_ = 0;
+    end_ = unread_size;
+    return data_.get() + end_;
+}
+
+// Copies bytes that arrived elsewhere (e.g. a shared receive buffer) into the tail.
+void FrameBuffer::append(const char* data, size_t n) {
+    std::memcpy(prepare(n), data, n);
+    commit(n);
+}
+
+// Finds the next newline past the already-scanned prefix and returns the line in place.
+FrameBuffer::Status FrameBuffer::next_line(std::string_view& line) {
+    if (begin_ == end_) {
+        return Status::NeedMore;
+    }
+    const char* base = data_.get();
+    const char* newline = find_newline(base + scanned_, base + end_);
+    if (newline == base + end_) {
+        scanned_ = end_;
+        return end_ - begin_ >= kMaxFrameSize ? Status::Oversized : Status::NeedMore;
+    }
+
+    size_t line_end = static_cast<size_t>(newline - base);
+    if (line_end + 1 - begin_ > kMaxFrameSize) {
+        return Status::Oversized;
+    }
+    size_t length = line_end - begin_;
+    // Strip carriage return for cross-platform compatibility.
+    if (length > 0 && base[line_end - 1] == '\r') {
+        --length;
+    }
+    line = std::string_view(base + begin_, length);
+    // Once everything is consumed the next write starts at the front; the bytes under `line` stay put until then.
+    begin_ = scanned_ = line_end + 1;
+    if (begin_ == end_) {
+        begin_ = end_ = scanned_ = 0;
+    }
+    return Status::Frame;
+}
+
+// Drops bytes from the head; an emptied buffer restarts at the front for free.
+void FrameBuffer::consume(size_t n) {
+    begin_ += n;
+    scanned_ = std::max(scanned_, begin_);
+    if (begin_ == end_) {
+        begin_ = end_ = scanned_ = 0;
+    }
+}
@@ -0,0 +1,61 @@
+#include "../include/net/OutboundQueue.hpp"
+#include <algorithm>
+
+// Appends a message to the back of the queue.
+void OutboundQueue::push(Payload message) {
+    if (!message || message->empty()) return;
+    bytes_ += message->size();
+    messages_.push_back(std::move(message));
+}
+
+// Points the iovecs at the unsent bytes, oldest first.
+size_t OutboundQueue::gather(iovec* iov, size_t max) const {
+    size_t count = 0;
+    for (auto it = messages_.begin(); it != messages_.end() && count < max; ++it, ++count) {
+        size_t offset = count == 0 ? front_offset_ : 0;
+        iov[count].iov_base = const_cast<char*>((*it)->data() + offset);
+        iov[count].iov_len = (*it)->size() - offset;
+    }
+    return count;
+}
+
+// Advances past written bytes, releasing messages as they complete.
+void OutboundQueue::consume(size_t n) {
+    bytes_ -= n;
+    while (n > 0) {
+        size_t remaining = messages_.front()->size() - front_offset_;
+        if (n < remaining) {
+            front_offset_ += n;
+            return;
+        }
+        n -= remaining;
+        messages_.pop_front();
+        front_offset_ = 0;
+        if (pinned_ > 0) --pinned_;
+    }
+}
+
+// Sheds whole messages from the old end, skipping those a send may still be reading.
+size_t OutboundQueue::drop_oldest(size_t target) {
+    size_t keep = pinned_;
+    if (keep == 0 && front_offset_ > 0) keep = 1;
+
+    auto first = messages_.begin() + static_cast<std::ptrdiff_t>(std::min(keep, messages_.size()));
+    auto last = first;
+    while (bytes_ > target && last != messages_.end()) {
+        bytes_ -= (*last)->size();
+        ++last;
+    }
+    // One erase for the whole run keeps shedding linear in the queue length.
+    size_t dropped = static_cast<size_t>(last - first);
+    messages_.erase(first, last);
+    return dropped;
+}
+
+// Forgets all queued output.
+void OutboundQueue::clear() {
+    messages_.clear();
+    front_offset_ = 0;
+    bytes_ = 0;
+    pinned_ = 0;
+}
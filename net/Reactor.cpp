@@ -0,0 +1,221 @@
+#include "../include/net/Reactor.hpp"
+#include "../include/net/EpollReactor.hpp"
+#include "../include/net/UringReactor.hpp"
+#include <iostream>
+
+namespace {
+// Source of Connection ids, shared by all reactors.
+std::atomic<uint64_t> next_connection_id{1};
+
+// Reactor whose event loop is running on this thread.
+thread_local Reactor* current_reactor = nullptr;
+
+// Input a connection may buffer while the handler has paused it.
+constexpr size_t kMaxPausedInput = 1 << 20;
+} // namespace
+
+// Binds the reactor to its handler.
+Reactor::Reactor(ConnectionHandler& handler, size_t index) : handler_(handler), index_(index) {}
+
+// Builds the requested backend; io_uring falls back to epoll on kernels that lack the needed features.
+std::unique_ptr<Reactor> Reactor::create(IoBackend backend, ConnectionHandler& handler, size_t index) {
+    if (backend == IoBackend::IoUring) {
+        if (std::unique_ptr<Reactor> reactor = UringReactor::create(handler, index)) {
+            return reactor;
+        }
+        std::cerr << "io_uring backend unavailable, falling back to epoll." << std::endl;
+    }
+    return std::make_unique<EpollReactor>(handler, index);
+}
+
+// Requests the event loop to exit; the flag is checked once the wakeup is handled.
+void Reactor::stop() {
+    post([this] { running_ = false; });
+}
+
+// Enqueues a task and wakes the event loop unless a wakeup is already outstanding.
+void Reactor::post(Mailbox::Task task) {
+    mailbox_.push(std::move(task));
+    if (!wake_pending_.exchange(true, std::memory_order_acq_rel)) {
+        wake();
+    }
+}
+
+// Returns the reactor whose loop runs on the calling thread.
+Reactor* Reactor::current() {
+    return current_reactor;
+}
+
+// Runs all queued tasks.
+void Reactor::drain_mailbox() {
+    Mailbox::Task task;
+    while (mailbox_.pop(task)) {
+        task();
+    }
+}
+
+// Marks this reactor as running on the calling thread.
+void Reactor::enter_loop() {
+    current_reactor = this;
+    running_ = true;
+}
+
+// Forgets the calling thread's reactor.
+void Reactor::exit_loop() {
+    current_reactor = nullptr;
+}
+
+// Creates the Connection for a freshly accepted socket.
+Connection& Reactor::adopt(int fd) {
+    uint64_t id = next_connection_id.fetch_add(1, std::memory_order_relaxed);
+    auto conn = std::make_unique<Connection>(fd, id);
+    Connection& ref = *conn;
+    connections_[fd] = std::move(conn);
+    return ref;
+}
+
+// Frames buffered input in place and hands each line or frame to the handler. The protocol is
+// re-checked per message because a handshake line can switch the rest of the stream to frames.
+void Reactor::dispatch_input(Connection& conn) {
+    if (conn.input_paused) {
+        if (conn.inbound.unread().size() > kMaxPausedInput) {
+            reject_input(conn, "too much input while a request is pending");
+        }
+        return;
+    }
+    while (conn.state != ConnectionState::Closing && !conn.input_paused) {
+        if (conn.protocol == WireProtocol::Binary) {
+            wire::Frame frame;
+            wire::ParseStatus status = wire::parse_frame(conn.inbound.unread(), frame);
+            if (status == wire::ParseStatus::NeedMore) return;
+            if (status == wire::ParseStatus::Malformed) {
+                reject_input(conn, "malformed or oversized frame");
+                return;
+            }
+            // Consuming only moves offsets; the body stays in place until the next read.
+            conn.inbound.consume(frame.size);
+            handler_.on_frame(conn, frame);
+            continue;
+        }
+
+        std::string_view line;
+        FrameBuffer::Status status = conn.inbound.next_line(line);
+        if (status == FrameBuffer::Status::NeedMore) return;
+        if (status == FrameBuffer::Status::Oversized) {
+            reject_input(conn, "line exceeds " + std::to_string(FrameBuffer::kMaxFrameSize) + " bytes");
+            return;
+        }
+        handler_.on_line(conn, line);
+    }
+}
+
+// Picks up a paused connection's input where dispatch_input() stopped.
+void Reactor::resume_input(Connection& conn) {
+    conn.input_paused = false;
+    dispatch_input(conn);
+}
+
+// Drops a connection whose input cannot be framed.
+void Reactor::reject_input(Connection& conn, const std::string& reason) {
+    std::cerr << "Closing socket " << conn.fd << ": " << reason << "." << std::endl;
+    conn.state = ConnectionState::Closing;
+    schedule_close(conn.fd);
+}
+
+// Queues a payload for a connection, kicking the backend when nothing was pending.
+bool Reactor::send(int fd, Payload payload) {
+    Connection* conn = find(fd);
+    if (!conn || conn->state == ConnectionState::Closing) return false;
+
+    bool was_idle = conn->outbound.empty();
+    conn->outbound.push(std::move(payload));
+    // If output was already pending, the backend is already working through it.
+    if (was_idle) {
+        start_output(*conn);
+    }
+    return enforce_limits(*conn);
+}
+
+// Wraps a single-recipient message in its own payload.
+bool Reactor::send(int fd, const std::string& data) {
+    return send(fd, make_payload(data));
+}
+
+// Queues a payload for a connection, provided the socket has not been reused by a newer connection.
+bool Reactor::send(int fd, uint64_t connection_id, Payload payload) {
+    Connection* conn = find(fd);
+    if (!conn || conn->id != connection_id) return false;
+    return send(fd, std::move(payload));
+}
+
+// Fans a message out to every authenticated connection owned by this reactor; each queue takes a
+// reference to the payload for its protocol.
+void Reactor::broadcast(const Payload& text, const Payload& binary, int except_fd) {
+    for (auto& [fd, conn] : connections_) {
+        if (fd != except_fd && conn->state == ConnectionState::Chat) {
+            send(fd, conn->protocol == WireProtocol::Binary ? binary : text);
+        }
+    }
+}
+
+// Marks a connection for closing; the backend closes it as soon as its output is flushed.
+void Reactor::close_after_flush(int fd) {
+    Connection* conn = find(fd);
+    if (!conn || conn->state == ConnectionState::Closing) return;
+
+    conn->state = ConnectionState::Closing;
+    start_output(*conn);
+}
+
+// Sheds output of a connection that has fallen behind, according to the configured policy.
+bool Reactor::enforce_limits(Connection& conn) {
+    if (conn.outbound.bytes() <= limits_.high_watermark || conn.state == ConnectionState::Closing) {
+        return true;
+    }
+
+    if (limits_.policy == SlowConsumerPolicy::DropOldest) {
+        size_t dropped = conn.outbound.drop_oldest(limits_.low_watermark);
+        dropped_messages_.fetch_add(dropped, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Whatever a send is still reading from must survive until it completes; the rest goes now.
+    conn.outbound.drop_oldest(0);
+    conn.state = ConnectionState::Closing;
+    slow_disconnects_.fetch_add(1, std::memory_order_relaxed);
+    schedule_close(conn.fd);
+    return false;
+}
+
+// Looks up a connection by socket.
+Connection* Reactor::find(int fd) {
+    auto it = connections_.find(fd);
+    return it != connections_.end() ? it->second.get() : nullptr;
+}
+
+// Defers closing so handlers never see a dangling reference mid-dispatch.
+void Reactor::schedule_close(int fd) {
+    pending_close_.push_back(fd);
+}
+
+// Closes scheduled connections. Closing one may schedule more (a departure broadcast hitting a dead socket).
+void Reactor::run_pending_closes() {
+    while (!pending_close_.empty()) {
+        std::vector<int> closing;
+        closing.swap(pending_close_);
+        for (int fd : closing) {
+            close_connection(fd);
+        }
+    }
+}
+
+// Notifies the handler and hands the connection to the backend for teardown.
+void Reactor::close_connection(int fd) {
+    auto it = connections_.find(fd);
+    if (it == connections_.end()) return;
+
+    handler_.on_close(*it->second);
+    std::unique_ptr<Connection> conn = std::move(it->second);
+    connections_.erase(it);
+    release(std::move(conn));
+}
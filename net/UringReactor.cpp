@@ -0,0 +1,622 @@
+#include "../include/net/UringReactor.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+namespace {
+// Submission ring size; the completion ring is kCqMultiplier times larger because
+// multishot requests post many completions per submission.
+constexpr unsigned kSqEntries = 1024;
+constexpr unsigned kCqMultiplier = 4;
+// Provided receive buffers per reactor (a power of two) and their size.
+constexpr unsigned kBufferCount = 1024;
+constexpr unsigned kBufferSize = 4096;
+// Buffer group id of the provided-buffer ring.
+constexpr uint16_t kBufferGroup = 0;
+
+// user_data of completions that do not belong to a connection.
+constexpr uint64_t kTagAccept = 1;
+constexpr uint64_t kTagWake = 2;
+constexpr uint64_t kTagIgnore = 3;
+constexpr uint64_t kTagProbe = 4;
+constexpr uint64_t kTagAcceptRetry = 5;
+
+// Delay before re-arming an accept that failed, e.g. with EMFILE until descriptors are freed.
+const __kernel_timespec kAcceptRetryDelay{0, 100 * 1000 * 1000};
+// How long the destructor waits for released connections to finish their teardown, in 1 ms steps.
+constexpr int kDrainAttempts = 100;
+
+// Connection completions carry the Connection pointer with the operation in its low bits.
+enum : uint64_t {
+    kOpRecv = 1,
+    kOpSend = 2,
+    kOpFinalSend = 3,
+    kOpShutdown = 4,
+    kOpClose = 5,
+};
+constexpr uint64_t kOpMask = 7;
+
+uint64_t tag(Connection& conn, uint64_t op) {
+    return reinterpret_cast<uint64_t>(&conn) | op;
+}
+
+int sys_io_uring_setup(unsigned entries, io_uring_params* params) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+int sys_io_uring_register(int fd, unsigned opcode, void* arg, unsigned nr_args) {
+    return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+} // namespace
+
+// Creates a reactor, or returns nullptr if the kernel lacks the required io_uring features.
+std::unique_ptr<Reactor> UringReactor::create(ConnectionHandler& handler, size_t index) {
+    std::unique_ptr<UringReactor> reactor(new UringReactor(handler, index));
+    if (!reactor->setup() || !reactor->probe_multishot_recv()) {
+        return nullptr;
+    }
+    return reactor;
+}
+
+UringReactor::UringReactor(ConnectionHandler& handler, size_t index) : Reactor(handler, index) {}
+
+// Closing the ring cancels every outstanding request, so buffers can be freed afterwards.
+UringReactor::~UringReactor() {
+    if (ring_fd_ != -1 && cqes_) {
+        drain_released();
+    }
+    if (ring_fd_ != -1) {
+        close(ring_fd_);
+    }
+    if (sq_ring_) munmap(sq_ring_, sq_ring_size_);
+    if (sqes_) munmap(sqes_, sqes_size_);
+    if (buf_ring_) munmap(buf_ring_, buf_ring_size_);
+    if (buffers_) munmap(buffers_, static_cast<size_t>(kBufferCount) * kBufferSize);
+
+    for (auto& [fd, conn] : connections_) {
+        close(fd);
+    }
+    for (auto& [key, conn] : released_) {
+        if (!conn->uring.closed) {
+            close(conn->fd);
+        }
+    }
+    if (listen_fd_ != -1) {
+        close(listen_fd_);
+    }
+    if (wake_fd_ != -1) {
+        close(wake_fd_);
+    }
+}
+
+// Creates the ring, maps its queues and registers the provided-buffer ring.
+bool UringReactor::setup() {
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+    params.cq_entries = kSqEntries * kCqMultiplier;
+
+    ring_fd_ = sys_io_uring_setup(kSqEntries, &params);
+    if (ring_fd_ < 0) {
+        ring_fd_ = -1;
+        return false;
+    }
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_NODROP)) {
+        return false;
+    }
+
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    sq_ring_size_ = std::max(sq_size, cq_size);
+    void* ring = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+    if (ring == MAP_FAILED) return false;
+    sq_ring_ = ring;
+
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) return false;
+    sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+    char* base = static_cast<char*>(ring);
+    sq_head_ = reinterpret_cast<unsigned*>(base + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned*>(base + params.sq_off.tail);
+    sq_mask_ = *reinterpret_cast<unsigned*>(base + params.sq_off.ring_mask);
+    sq_entries_ = params.sq_entries;
+    sq_array_ = reinterpret_cast<unsigned*>(base + params.sq_off.array);
+    cq_head_ = reinterpret_cast<unsigned*>(base + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(base + params.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned*>(base + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(base + params.cq_off.cqes);
+
+    // Provided buffers: the kernel picks one per received chunk, so memory is bounded per reactor, not per connection.
+    buf_ring_size_ = kBufferCount * sizeof(io_uring_buf);
+    void* buf_ring = mmap(nullptr, buf_ring_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf_ring == MAP_FAILED) return false;
+    buf_ring_ = static_cast<io_uring_buf_ring*>(buf_ring);
+    void* buffers = mmap(nullptr, static_cast<size_t>(kBufferCount) * kBufferSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffers == MAP_FAILED) return false;
+    buffers_ = static_cast<char*>(buffers);
+
+    io_uring_buf_reg reg;
+    std::memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<uint64_t>(buf_ring_);
+    reg.ring_entries = kBufferCount;
+    reg.bgid = kBufferGroup;
+    if (sys_io_uring_register(ring_fd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        return false;
+    }
+    for (unsigned i = 0; i < kBufferCount; ++i) {
+        recycle_buffer(static_cast<uint16_t>(i));
+    }
+
+    wake_fd_ = eventfd(0, EFD_CLOEXEC);
+    return wake_fd_ >= 0;
+}
+
+// Runs one multishot, buffer-selecting recv over a socketpair; older kernels reject it with -EINVAL.
+bool UringReactor::probe_multishot_recv() {
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) < 0) return false;
+
+    io_uring_sqe* sqe = get_sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = pair[0];
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = kBufferGroup;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->user_data = kTagProbe;
+
+    char byte = 'x';
+    bool supported = false;
+    bool finished = false;
+    bool cancelled = false;
+    if (write(pair[1], &byte, 1) == 1) {
+        while (!finished) {
+            if (enter(1) < 0 && errno != EINTR) break;
+            unsigned head = *cq_head_;
+            unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+            for (; head != tail; ++head) {
+                const io_uring_cqe& cqe = cqes_[head & cq_mask_];
+                if (cqe.user_data != kTagProbe) continue;
+                if (cqe.flags & IORING_CQE_F_BUFFER) {
+                    recycle_buffer(static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT));
+                }
+                if (cqe.res == 1 && (cqe.flags & IORING_CQE_F_BUFFER)) {
+                    supported = true;
+                }
+                if (!(cqe.flags & IORING_CQE_F_MORE)) {
+                    finished = true;
+                }
+            }
+            __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+
+            if (!finished && !cancelled) {
+                io_uring_sqe* cancel = get_sqe();
+                cancel->opcode = IORING_OP_ASYNC_CANCEL;
+                cancel->addr = kTagProbe;
+                cancel->user_data = kTagIgnore;
+                cancelled = true;
+            }
+        }
+    }
+    close(pair[0]);
+    close(pair[1]);
+    return supported;
+}
+
+// Hands out the next submission slot, flushing the queue to the kernel if it is full.
+io_uring_sqe* UringReactor::get_sqe() {
+    reserve_sqes(1);
+    unsigned tail = *sq_tail_;
+    unsigned slot = tail & sq_mask_;
+    io_uring_sqe* sqe = &sqes_[slot];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sq_array_[slot] = slot;
+    // The kernel only reads entries during io_uring_enter, so publishing the tail before filling is safe.
+    __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+    ++to_submit_;
+    return sqe;
+}
+
+// The kernel may take only part of the queue, or refuse it with EBUSY while completions are
+// backed up, so keep submitting until the free space is really there. Any other failure leaves
+// the ring unusable; carrying on would overwrite entries the kernel has not read yet.
+void UringReactor::reserve_sqes(unsigned count) {
+    while (sq_entries_ - (*sq_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE)) < count) {
+        if (enter(0) >= 0 || errno == EINTR) continue;
+        if (errno != EBUSY && errno != EAGAIN) {
+            perror("io_uring_enter failed");
+            std::abort();
+        }
+        stash_completions();
+    }
+}
+
+// Copies ready completions out of the ring without handling them; this runs in the middle of
+// building submissions, where handlers must not be re-entered.
+void UringReactor::stash_completions() {
+    unsigned head = *cq_head_;
+    unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+        stashed_.push_back(cqes_[head & cq_mask_]);
+    }
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+}
+
+// Submits everything queued so far and optionally waits for completions.
+int UringReactor::enter(unsigned wait_nr) {
+    unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+    int result = sys_io_uring_enter(ring_fd_, to_submit_, wait_nr, flags);
+    count_syscall();
+    if (result >= 0) {
+        to_submit_ -= std::min(to_submit_, static_cast<unsigned>(result));
+    }
+    return result;
+}
+
+// The listening socket is consumed by a multishot accept once the loop runs.
+void UringReactor::add_listener(int listen_fd) {
+    listen_fd_ = listen_fd;
+}
+
+// Submits pending work, waits for completions and handles them until stopped.
+void UringReactor::run() {
+    enter_loop();
+    arm_wakeup();
+    if (listen_fd_ != -1) {
+        arm_accept();
+    }
+
+    while (running_) {
+        // Stashed completions are already here; do not sleep waiting for new ones.
+        if (enter(stashed_.empty() ? 1 : 0) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            perror("io_uring_enter failed");
+            break;
+        }
+        reap();
+        run_pending_closes();
+    }
+    exit_loop();
+}
+
+// Consumes every stashed completion, then every completion currently in the ring.
+void UringReactor::reap() {
+    if (!stashed_.empty()) {
+        std::vector<io_uring_cqe> stashed;
+        stashed.swap(stashed_);
+        for (const io_uring_cqe& cqe : stashed) {
+            handle_completion(cqe);
+        }
+    }
+    unsigned head = *cq_head_;
+    unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+        // Copy out and release the slot first, so the kernel can post more while this one is handled.
+        io_uring_cqe cqe = cqes_[head & cq_mask_];
+        __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+        handle_completion(cqe);
+    }
+}
+
+// Routes a completion to its connection or reactor-level handler.
+void UringReactor::handle_completion(const io_uring_cqe& cqe) {
+    uint64_t op = cqe.user_data & kOpMask;
+    Connection* conn = reinterpret_cast<Connection*>(cqe.user_data & ~kOpMask);
+
+    if (conn == nullptr) {
+        if (cqe.user_data == kTagAccept) {
+            bool failed = cqe.res < 0 && cqe.res != -ECANCELED;
+            if (cqe.res >= 0) {
+                accept_failing_ = false;
+                arm_recv(adopt(cqe.res));
+            } else if (failed && !accept_failing_) {
+                accept_failing_ = true;
+                errno = -cqe.res;
+                perror("Accept failed");
+            }
+            if (!(cqe.flags & IORING_CQE_F_MORE) && running_) {
+                if (failed) {
+                    arm_accept_retry();
+                } else {
+                    arm_accept();
+                }
+            }
+        } else if (cqe.user_data == kTagAcceptRetry) {
+            if (running_) {
+                arm_accept();
+            }
+        } else if (cqe.user_data == kTagWake) {
+            // Reset before draining: a post that lands after this point writes a fresh wakeup.
+            wake_pending_.store(false, std::memory_order_seq_cst);
+            drain_mailbox();
+            arm_wakeup();
+        }
+        return;
+    }
+
+    switch (op) {
+    case kOpRecv:
+        handle_recv(*conn, cqe);
+        break;
+    case kOpSend:
+        --conn->uring.pending_ops;
+        handle_send(*conn, cqe.res);
+        break;
+    case kOpFinalSend:
+    case kOpShutdown:
+        --conn->uring.pending_ops;
+        retire_if_idle(*conn);
+        break;
+    case kOpClose:
+        --conn->uring.pending_ops;
+        // A broken chain cancels the close; fall back to closing directly.
+        if (cqe.res == -ECANCELED) {
+            close(conn->fd);
+            count_syscall();
+        }
+        conn->uring.closed = true;
+        retire_if_idle(*conn);
+        break;
+    }
+}
+
+// Arms a multishot accept; new sockets keep arriving until the request terminates.
+void UringReactor::arm_accept() {
+    io_uring_sqe* sqe = get_sqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listen_fd_;
+    sqe->accept_flags = SOCK_CLOEXEC | SOCK_NONBLOCK;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = kTagAccept;
+}
+
+// Waits out kAcceptRetryDelay; its completion re-arms the accept. Pending clients stay in the
+// listen backlog meanwhile.
+void UringReactor::arm_accept_retry() {
+    io_uring_sqe* sqe = get_sqe();
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->addr = reinterpret_cast<uint64_t>(&kAcceptRetryDelay);
+    sqe->len = 1;
+    sqe->user_data = kTagAcceptRetry;
+}
+
+// Arms a read of the wakeup eventfd.
+void UringReactor::arm_wakeup() {
+    io_uring_sqe* sqe = get_sqe();
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = wake_fd_;
+    sqe->addr = reinterpret_cast<uint64_t>(&wake_value_);
+    sqe->len = sizeof(wake_value_);
+    sqe->user_data = kTagWake;
+}
+
+// Signals the eventfd so the outstanding wakeup read completes.
+void UringReactor::wake() {
+    uint64_t one = 1;
+    ssize_t written = write(wake_fd_, &one, sizeof(one));
+    (void)written;
+    count_syscall();
+}
+
+// Arms a multishot recv that picks buffers from the provided-buffer ring.
+void UringReactor::arm_recv(Connection& conn) {
+    io_uring_sqe* sqe = get_sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn.fd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = kBufferGroup;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->user_data = tag(conn, kOpRecv);
+    conn.uring.recv_armed = true;
+    ++conn.uring.pending_ops;
+}
+
+// Copies received bytes into the connection, returns the buffer and dispatches complete input.
+void UringReactor::handle_recv(Connection& conn, const io_uring_cqe& cqe) {
+    bool more = (cqe.flags & IORING_CQE_F_MORE) != 0;
+    if (!more) {
+        conn.uring.recv_armed = false;
+        --conn.uring.pending_ops;
+    }
+
+    if (cqe.flags & IORING_CQE_F_BUFFER) {
+        uint16_t buffer_id = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+        if (cqe.res > 0 && !conn.uring.released) {
+            conn.inbound.append(buffers_ + static_cast<size_t>(buffer_id) * kBufferSize, static_cast<size_t>(cqe.res));
+        }
+        recycle_buffer(buffer_id);
+    }
+
+    if (conn.uring.released) {
+        retire_if_idle(conn);
+        return;
+    }
+
+    if (cqe.res > 0 || cqe.res == -ENOBUFS) {
+        dispatch_input(conn);
+        // The multishot request ends when buffers run out; the ones just returned let it restart.
+        if (!more && !conn.uring.recv_armed && conn.state != ConnectionState::Closing) {
+            arm_recv(conn);
+        }
+        return;
+    }
+
+    // End of stream or a socket error.
+    schedule_close(conn.fd);
+}
+
+// Sends whatever is queued unless a send is already in flight.
+void UringReactor::start_output(Connection& conn) {
+    if (conn.uring.sending) return;
+    if (!conn.outbound.empty()) {
+        submit_send(conn);
+        return;
+    }
+    if (conn.state == ConnectionState::Closing) {
+        schedule_close(conn.fd);
+    }
+}
+
+// Points the connection's sendmsg header at the oldest queued messages and pins them. A short
+// send completes with the byte count and the rest is resubmitted. Once the connection is released
+// the send takes only what the socket buffer accepts right away, so a peer that stopped reading
+// cannot hold the connection open.
+io_uring_sqe* UringReactor::prepare_sendmsg(Connection& conn, uint64_t op) {
+    size_t count = conn.outbound.gather(conn.uring.iov, Connection::UringState::kMaxIovecs);
+    conn.outbound.pin(count);
+    conn.uring.msg = msghdr{};
+    conn.uring.msg.msg_iov = conn.uring.iov;
+    conn.uring.msg.msg_iovlen = count;
+
+    io_uring_sqe* sqe = get_sqe();
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = conn.fd;
+    sqe->addr = reinterpret_cast<uint64_t>(&conn.uring.msg);
+    sqe->len = 1;
+    sqe->msg_flags = conn.uring.released ? MSG_NOSIGNAL | MSG_DONTWAIT : MSG_NOSIGNAL;
+    sqe->user_data = tag(conn, op);
+    ++conn.uring.pending_ops;
+    return sqe;
+}
+
+// Submits the oldest queued messages as one sendmsg.
+void UringReactor::submit_send(Connection& conn) {
+    prepare_sendmsg(conn, kOpSend);
+    conn.uring.sending = true;
+}
+
+// Moves on to the next batch of queued output once a send completes.
+void UringReactor::handle_send(Connection& conn, int result) {
+    conn.uring.sending = false;
+    if (result < 0) {
+        conn.outbound.clear();
+        if (conn.uring.released) {
+            submit_teardown(conn);
+        } else {
+            schedule_close(conn.fd);
+        }
+        return;
+    }
+
+    conn.outbound.consume(static_cast<size_t>(result));
+    conn.outbound.pin(0);
+    if (conn.uring.released) {
+        finish_release(conn);
+        return;
+    }
+    if (!conn.outbound.empty()) {
+        submit_send(conn);
+        return;
+    }
+    if (conn.state == ConnectionState::Closing) {
+        schedule_close(conn.fd);
+    }
+}
+
+// Cancels the connection's recv and queues its teardown. A send still in flight may be waiting
+// on a peer that stopped reading (a slow consumer being disconnected), so it is cancelled too;
+// the teardown continues from its completion, which keeps the output that did go out in order.
+void UringReactor::release(std::unique_ptr<Connection> conn) {
+    conn->uring.released = true;
+    if (conn->uring.recv_armed) {
+        io_uring_sqe* sqe = get_sqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = tag(*conn, kOpRecv);
+        sqe->user_data = kTagIgnore;
+    }
+    if (conn->uring.sending) {
+        io_uring_sqe* sqe = get_sqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = tag(*conn, kOpSend);
+        sqe->user_data = kTagIgnore;
+    } else {
+        finish_release(*conn);
+    }
+    Connection* key = conn.get();
+    released_[key] = std::move(conn);
+}
+
+// Sends the remaining output of a released connection; the last batch rides the teardown chain.
+void UringReactor::finish_release(Connection& conn) {
+    if (conn.outbound.size() > Connection::UringState::kMaxIovecs) {
+        submit_send(conn);
+        return;
+    }
+    submit_teardown(conn);
+}
+
+// Links [final sendmsg ->] shutdown -> close so the kernel finishes the connection without another round trip.
+void UringReactor::submit_teardown(Connection& conn) {
+    // A flush between linked entries would end the chain early and let the close overtake the shutdown.
+    reserve_sqes(conn.outbound.empty() ? 2 : 3);
+    if (!conn.outbound.empty()) {
+        io_uring_sqe* send_sqe = prepare_sendmsg(conn, kOpFinalSend);
+        send_sqe->flags = IOSQE_IO_LINK;
+    }
+
+    io_uring_sqe* shutdown_sqe = get_sqe();
+    shutdown_sqe->opcode = IORING_OP_SHUTDOWN;
+    shutdown_sqe->fd = conn.fd;
+    shutdown_sqe->len = SHUT_WR;
+    shutdown_sqe->flags = IOSQE_IO_LINK;
+    shutdown_sqe->user_data = tag(conn, kOpShutdown);
+    ++conn.uring.pending_ops;
+
+    io_uring_sqe* close_sqe = get_sqe();
+    close_sqe->opcode = IORING_OP_CLOSE;
+    close_sqe->fd = conn.fd;
+    close_sqe->user_data = tag(conn, kOpClose);
+    ++conn.uring.pending_ops;
+}
+
+// Runs in the destructor, after the loop stopped: teardowns queued by its last iteration have not
+// been submitted yet. Only released connections' completions are handled; the rest are dropped.
+// Sends of released connections never wait on the peer, so this normally finishes at once.
+void UringReactor::drain_released() {
+    for (int attempt = 0; attempt < kDrainAttempts && !released_.empty(); ++attempt) {
+        if (enter(0) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            break;
+        }
+        stash_completions();
+        std::vector<io_uring_cqe> stashed;
+        stashed.swap(stashed_);
+        for (const io_uring_cqe& cqe : stashed) {
+            Connection* conn = reinterpret_cast<Connection*>(cqe.user_data & ~kOpMask);
+            if (conn && released_.count(conn)) {
+                handle_completion(cqe);
+            }
+        }
+        if (!released_.empty()) {
+            usleep(1000);
+        }
+    }
+}
+
+// Frees a released connection once its last submission has completed.
+void UringReactor::retire_if_idle(Connection& conn) {
+    if (conn.uring.released && conn.uring.pending_ops == 0) {
+        released_.erase(&conn);
+    }
+}
+
+// Publishes a buffer back to the provided-buffer ring.
+void UringReactor::recycle_buffer(uint16_t buffer_id) {
+    // Index the ring as a plain array: the header's flexible-array wrapper has a different layout in C++.
+    io_uring_buf* buf = reinterpret_cast<io_uring_buf*>(buf_ring_) + (buf_tail_ & (kBufferCount - 1));
+    buf->addr = reinterpret_cast<uint64_t>(buffers_ + static_cast<size_t>(buffer_id) * kBufferSize);
+    buf->len = kBufferSize;
+    buf->bid = buffer_id;
+    ++buf_tail_;
+    __atomic_store_n(&buf_ring_->tail, buf_tail_, __ATOMIC_RELEASE);
+}
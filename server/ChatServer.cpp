@@ -1,392 +1,872 @@
-// ChatServer.cpp (Cross-platform)
+// ChatServer.cpp
 #include "../include/ChatServer.hpp"
 #include <iostream>
-#include <thread>
 #include <mutex>
 #include <string>
 #include <cstring>
 #include <map>
+#include <algorithm>
 #include <optional>
+#include <thread>
+#include <vector>
+#include <csignal>
+#include <filesystem>
+#include <cstdlib>
+#include <cctype>
+#include <iomanip>
+#include <sstream>
+#include <exception>
 
-#ifdef _WIN32
-#include <winsock2.h>
-#include <ws2tcpip.h>
-#pragma comment(lib, "ws2_32.lib") // Link with ws2_32.lib for Winsock functions
-#else
 #include <unistd.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
-#endif
-
-#ifdef _WIN32
-#define CLOSE_SOCKET closesocket
-#else
-#define CLOSE_SOCKET close
-#endif
 
 #include "../include/user/UserManager.hpp"
 #include "../include/Color.hpp"
 
-// Constructor: Initializes ChatServer with a given port and sets up UserManager.
-ChatServer::ChatServer(int port) : port_(port), server_fd_(-1), user_manager_("users.json") {}
+namespace {
+// Commands that may wait for a worker; beyond this the server answers "busy".
+constexpr size_t kCommandQueueCapacity = 4096;
+// Conversations or users the compactor visits per call; each holds up only its own participants.
+constexpr size_t kCompactionStep = 32;
+// Messages /history shows when no count is given.
+constexpr size_t kDefaultHistoryLimit = 20;
+// Most messages one /history or History request may ask for.
+constexpr size_t kMaxHistoryLimit = 1000;
+// Snapshot of the user database; its write-ahead log sits next to it with a ".wal" suffix.
+const char* const kDataFile = "users.db";
+// Where the user database lived before binary snapshots.
+const char* const kLegacyDataFile = "users.json";
+
+// Returns the data file, first carrying a pre-snapshot users.json (and its log) over if this is
+// the first start since the upgrade. UserManager imports the JSON and rewrites it as a binary
+// snapshot at its next checkpoint; the original is left in place.
+std::string data_file()
+{
+    std::error_code error;
+    if (std::filesystem::exists(kDataFile, error) || !std::filesystem::exists(kLegacyDataFile, error)) {
+        return kDataFile;
+    }
+    std::cout << "Importing " << kLegacyDataFile << " into " << kDataFile << "." << std::endl;
+    std::filesystem::copy_file(kLegacyDataFile, kDataFile, error);
+    std::string legacy_wal = std::string(kLegacyDataFile) + ".wal";
+    if (std::filesystem::exists(legacy_wal, error)) {
+        std::filesystem::copy_file(legacy_wal, std::string(kDataFile) + ".wal", std::filesystem::copy_options::overwrite_existing, error);
+    }
+    return kDataFile;
+}
+
+// Tone of a "[Server]: ..." reply: its V1 color and V2 opcode.
+enum class Reply { Ack, Error, Notice };
 
-// Destructor: Cleans up socket resources when ChatServer is destroyed.
-ChatServer::~ChatServer()
+// Wraps both encodings of a message in shared payloads.
+OutgoingMessage make_message(std::string text, std::string binary)
 {
-    if (server_fd_ != -1)
-    {
-        CLOSE_SOCKET(server_fd_);
+    return OutgoingMessage{make_payload(std::move(text)), make_payload(std::move(binary))};
+}
+
+// Builds a server reply: colored "[Server]: body" for V1, an Ack/Error/Notice frame for V2.
+OutgoingMessage server_reply(Reply tone, const std::string& body)
+{
+    const char* color = tone == Reply::Ack ? COLOR_GREEN : tone == Reply::Error ? COLOR_RED : COLOR_YELLOW;
+    wire::Opcode opcode = tone == Reply::Ack ? wire::Opcode::Ack : tone == Reply::Error ? wire::Opcode::Error : wire::Opcode::Notice;
+    std::string frame_body;
+    wire::put_string(frame_body, body);
+    return make_message(color + std::string("[Server]: ") + body + COLOR_RESET "\n", wire::encode_frame(opcode, frame_body));
+}
+
+// Builds a message whose V2 body is a user ID followed by a string (chat, DM, join).
+OutgoingMessage user_message(std::string text, wire::Opcode opcode, uint32_t user_id, std::string_view value)
+{
+    std::string frame_body;
+    wire::put_varint(frame_body, user_id);
+    wire::put_string(frame_body, value);
+    return make_message(std::move(text), wire::encode_frame(opcode, frame_body));
+}
+
+// Builds a friend-request notification.
+OutgoingMessage friend_notice(std::string text, wire::FriendAction action, const std::string& username)
+{
+    std::string frame_body(1, static_cast<char>(action));
+    wire::put_string(frame_body, username);
+    return make_message(std::move(text), wire::encode_frame(wire::Opcode::Friend, frame_body));
+}
+} // namespace
+
+// Constructor: Initializes ChatServer with a given port, one reactor per core by default, and sets up UserManager.
+ChatServer::ChatServer(int port, size_t reactor_count, IoBackend backend, const PersistenceOptions& persistence)
+    : port_(port), user_manager_(data_file(), persistence), workers_(kCommandQueueCapacity)
+{
+    if (reactor_count == 0) {
+        reactor_count = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (size_t i = 0; i < reactor_count; ++i) {
+        reactors_.push_back(Reactor::create(backend, *this, i));
     }
-#ifdef _WIN32
-    WSACleanup();
-#endif
 }
 
-// Initializes networking and starts listening for client connections.
+// Destructor: The reactors own and close the listening and client sockets.
+ChatServer::~ChatServer() = default;
+
+// Starts one listening socket and event loop per reactor; the calling thread runs the first.
 void ChatServer::start()
 {
-#ifdef _WIN32
-    WSADATA wsaData;
-    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+    // Writes to sockets closed by the peer must fail with EPIPE instead of killing the process.
+    signal(SIGPIPE, SIG_IGN);
+
+    // Every idle client holds one descriptor, so lift the soft limit as far as the hard limit allows.
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
     {
-        std::cerr << "WSAStartup failed\n";
-        exit(EXIT_FAILURE);
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    for (auto& reactor : reactors_) {
+        reactor->add_listener(open_listener());
+    }
+
+    if (worker_count_ == 0) {
+        worker_count_ = std::max(2u, std::thread::hardware_concurrency() / 2);
+    }
+    workers_.start(worker_count_);
+    compactor_stop_ = false;
+    compactor_ = std::thread(&ChatServer::run_compactor, this);
+
+    running_ = true;
+    const char* backend_name = reactors_[0]->backend() == IoBackend::IoUring ? "io_uring" : "epoll";
+    std::cout << "Server listening on port: " << port_ << " with " << reactors_.size() << " " << backend_name << " reactor(s)" << std::endl;
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < reactors_.size(); ++i) {
+        threads.emplace_back(&Reactor::run, reactors_[i].get());
+    }
+    reactors_[0]->run();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    workers_.stop();
+    if (compactor_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(compactor_mutex_);
+            compactor_stop_ = true;
+        }
+        compactor_wake_.notify_all();
+        compactor_.join();
+    }
+}
+
+// Stops every reactor's event loop.
+void ChatServer::stop()
+{
+    running_ = false;
+    for (auto& reactor : reactors_) {
+        reactor->stop();
+    }
+}
+
+// Sums the system calls issued by all reactors.
+uint64_t ChatServer::syscall_count() const
+{
+    uint64_t total = 0;
+    for (const auto& reactor : reactors_) {
+        total += reactor->syscall_count();
+    }
+    return total;
+}
+
+// Applies the same output budget to every reactor.
+void ChatServer::set_outbound_limits(const OutboundLimits& limits)
+{
+    for (auto& reactor : reactors_) {
+        reactor->set_outbound_limits(limits);
     }
-#endif
+}
+
+// Records the worker count start() uses.
+void ChatServer::set_command_workers(size_t count)
+{
+    worker_count_ = count;
+}
+
+// Reads the worker pool's counters.
+WorkerPool::Stats ChatServer::command_stats() const
+{
+    return workers_.stats();
+}
 
+// Resizes the history cache, evicting at once if it shrank.
+void ChatServer::set_history_cache_limit(size_t bytes)
+{
+    user_manager_.setHistoryCacheLimit(bytes);
+}
+
+// Hands the limits to the user database, which applies them in compact().
+void ChatServer::set_retention(const RetentionPolicy& policy, std::chrono::seconds interval)
+{
+    user_manager_.setRetention(policy);
+    compact_interval_ = interval;
+}
+
+// Runs a pass right away, so limits lowered across a restart apply at once, then one per interval.
+void ChatServer::run_compactor()
+{
+    while (!compactor_stop_)
+    {
+        bool done = false;
+        while (!done && !compactor_stop_)
+        {
+            done = user_manager_.compact(kCompactionStep);
+            std::this_thread::yield();
+        }
+        std::unique_lock<std::mutex> lock(compactor_mutex_);
+        compactor_wake_.wait_for(lock, compact_interval_, [this] { return compactor_stop_.load(); });
+    }
+}
+
+// Creates a socket bound to the server port. SO_REUSEPORT lets every reactor bind its own,
+// and the kernel spreads incoming connections across them.
+int ChatServer::open_listener()
+{
     struct sockaddr_in address;
     int opt = 1;
-    socklen_t addlen = sizeof(address);
 
-    server_fd_ = static_cast<int>(socket(AF_INET, SOCK_STREAM, 0));
-    if (server_fd_ < 0)
+    int server_fd = static_cast<int>(socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0));
+    if (server_fd < 0)
     {
         perror("Socket failed");
         exit(EXIT_FAILURE);
     }
 
-// Set socket options for reuse of address and port
-#ifndef _WIN32
-    setsockopt(server_fd_, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &opt, sizeof(opt));
-#else
-    setsockopt(server_fd_, SOL_SOCKET, SO_REUSEADDR, (const char *)&opt, sizeof(opt));
-#endif
+    // Set socket options for reuse of address and port
+    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
 
     address.sin_family = AF_INET;
     address.sin_addr.s_addr = INADDR_ANY;
     address.sin_port = htons(port_);
 
-    if (bind(server_fd_, (struct sockaddr *)&address, sizeof(address)) < 0)
+    if (bind(server_fd, (struct sockaddr *)&address, sizeof(address)) < 0)
     {
         perror("Bind failed");
         exit(EXIT_FAILURE);
     }
 
-    if (listen(server_fd_, 10) < 0)
+    if (listen(server_fd, SOMAXCONN) < 0)
     {
         perror("Listen failed");
         exit(EXIT_FAILURE);
     }
-
-    running_ = true;
-    std::cout << "Server listening on port: " << port_ << std::endl;
-    accept_clients();
+    return server_fd;
 }
 
-// Continuously accepts new client connections.
-void ChatServer::accept_clients()
+// Advances a connection's handshake/authentication/chat state machine by one line.
+void ChatServer::on_line(Connection& conn, std::string_view line)
 {
-    while (running_)
-    {
-        int client_socket = static_cast<int>(accept(server_fd_, nullptr, nullptr));
-        if (client_socket < 0)
-        {
-            perror("Accept failed");
-            continue;
+    switch (conn.state) {
+    case ConnectionState::Handshake: {
+        std::string_view magic_v1 = std::string_view(CLIENT_HANDSHAKE_MAGIC).substr(0, CLIENT_HANDSHAKE_MAGIC.length() - 1);
+        std::string_view magic_v2 = std::string_view(CLIENT_HANDSHAKE_MAGIC_V2).substr(0, CLIENT_HANDSHAKE_MAGIC_V2.length() - 1);
+        if (line == magic_v2) {
+            // Accept the offer by echoing it; everything after this line is framed, in both directions.
+            Reactor::current()->send(conn.fd, CLIENT_HANDSHAKE_MAGIC_V2);
+            conn.protocol = WireProtocol::Binary;
+        } else if (line != magic_v1) {
+            std::cerr << COLOR_RED << "Invalid handshake from client: '" << line << "'" << COLOR_RESET << std::endl;
+            disconnect_client(conn.fd);
+            return;
         }
-        std::thread(&ChatServer::handle_client, this, client_socket).detach();
+        conn.state = ConnectionState::Username;
+        return;
+    }
+
+    case ConnectionState::Username:
+        conn.username = line;
+        conn.state = ConnectionState::Password;
+        return;
+
+    case ConnectionState::Password: {
+        std::string password(line);
+        run_command(conn, [this, password](CommandContext& command) { authenticate_client(command, password); });
+        return;
+    }
+
+    case ConnectionState::Chat:
+        if (!line.empty() && line.front() == '/') {
+            process_chat_command(conn, std::string(line));
+        } else {
+            handle_chat(conn, line);
+        }
+        return;
+
+    case ConnectionState::Closing:
+        return;
     }
 }
 
-// Handles individual client connections, including authentication and message processing.
-void ChatServer::handle_client(int client_socket)
+// Decodes a binary request and runs the same handler its text command would.
+void ChatServer::on_frame(Connection& conn, const wire::Frame& frame)
 {
-    std::string received_data_leftover;
+    wire::Reader reader(frame.body);
+
+    if (conn.state == ConnectionState::Username) {
+        if (frame.opcode == wire::Opcode::Login) {
+            std::string_view username = reader.string();
+            std::string_view password = reader.string();
+            if (reader.done()) {
+                conn.username = username;
+                run_command(conn, [this, password = std::string(password)](CommandContext& command) {
+                    authenticate_client(command, password);
+                });
+                return;
+            }
+        }
+        send_message(conn.fd, server_reply(Reply::Error, "Expected a login request."));
+        disconnect_client(conn.fd);
+        return;
+    }
+    if (conn.state != ConnectionState::Chat) {
+        return;
+    }
 
-    // Perform handshake, and receive/validate username and password.
-    auto read_and_validate = [&](const std::string& type) -> std::optional<std::string> {
-        std::optional<std::string> data_opt = read_delimited_message(client_socket, received_data_leftover);
-        if (!data_opt) {
-            std::cerr << "Client disconnected during " << type << " reception or sent no data." << std::endl;
-            disconnect_client(client_socket, "");
-            return std::nullopt;
+    switch (frame.opcode) {
+    case wire::Opcode::Chat: {
+        std::string_view text = reader.string();
+        if (!reader.done()) break;
+        handle_chat(conn, text);
+        return;
+    }
+    case wire::Opcode::DirectMessage: {
+        std::string recipient(reader.string());
+        std::string content(reader.string());
+        if (!reader.done()) break;
+        run_command(conn, [this, recipient, content](CommandContext& command) {
+            handle_direct_message(command, recipient, content);
+        });
+        return;
+    }
+    case wire::Opcode::Friend: {
+        uint8_t action = reader.byte();
+        std::string target(reader.string());
+        if (!reader.done() || action > static_cast<uint8_t>(wire::FriendAction::Reject)) break;
+        run_command(conn, [this, action, target](CommandContext& command) {
+            handle_friend(command, static_cast<wire::FriendAction>(action), target);
+        });
+        return;
+    }
+    case wire::Opcode::ListPending:
+        run_command(conn, [this](CommandContext& command) { handle_pending(command); });
+        return;
+    case wire::Opcode::History: {
+        std::string peer(reader.string());
+        size_t limit = std::min<size_t>(reader.varint(), kMaxHistoryLimit);
+        if (!reader.done()) break;
+        run_command(conn, [this, peer, limit](CommandContext& command) { handle_history(command, peer, limit); });
+        return;
+    }
+    case wire::Opcode::Stats:
+        handle_stats(conn);
+        return;
+    case wire::Opcode::Quit:
+        handle_quit(conn);
+        return;
+    default:
+        break;
+    }
+    send_message(conn.fd, server_reply(Reply::Error, "Malformed or unknown request."));
+}
+
+// Hands a command to the worker pool. The sender's input stays paused until finish_command()
+// runs, so a client's next request is never handled before the previous one has been answered.
+void ChatServer::run_command(Connection& sender, std::function<void(CommandContext&)> command)
+{
+    auto context = std::make_shared<CommandContext>();
+    context->sender = ClientSession{sender.fd, Reactor::current()->index(), sender.id, sender.user_id, sender.protocol};
+    context->username = sender.username;
+    sender.input_paused = true;
+
+    bool login = sender.state != ConnectionState::Chat;
+    bool queued = workers_.try_submit([this, context, login, command = std::move(command)] {
+        // Starts from nothing, in case an earlier task on this worker logged a change of its own.
+        user_manager_.takeLoggedSequence();
+        command(*context);
+        context->logged = user_manager_.takeLoggedSequence();
+        // Waiting only after the command has logged its change lets other workers' changes join the
+        // same group commit. If it never reaches the disk, nothing the command did is confirmed.
+        // Commands that changed nothing, reads and refusals alike, reply at once.
+        if (context->logged != 0) {
+            try {
+                user_manager_.whenDurable(context->logged).get();
+            } catch (const std::exception&) {
+                context->replies.assign(1, server_reply(Reply::Error, "The server could not save your change. Please try again later."));
+                if (login) {
+                    context->authenticated = false;
+                    context->disconnect = true;
+                }
+            }
         }
-        return data_opt;
-    };
+        Reactor* owner = reactors_[context->sender.reactor].get();
+        owner->post([this, context] { finish_command(*context); });
+    });
+    if (queued) {
+        return;
+    }
 
-    std::optional<std::string> handshake_opt = read_and_validate("handshake");
-    if (!handshake_opt) return;
-    std::string handshake_received = *handshake_opt;
+    sender.input_paused = false;
+    send_message(sender.fd, server_reply(Reply::Error, "Server is busy. Please try again."));
+    // A refused login cannot be retried on the same connection.
+    if (sender.state != ConnectionState::Chat) {
+        disconnect_client(sender.fd);
+    }
+}
 
-    if (handshake_received != CLIENT_HANDSHAKE_MAGIC.substr(0, CLIENT_HANDSHAKE_MAGIC.length() -1)) {
-        std::cerr << COLOR_RED << "Invalid handshake from client: '" << handshake_received << "'" << COLOR_RESET << std::endl;
-        CLOSE_SOCKET(client_socket);
+// Completes a command on the reactor that owns the sender, unless the sender has gone away meanwhile.
+void ChatServer::finish_command(CommandContext& command)
+{
+    Reactor* reactor = Reactor::current();
+    Connection* conn = reactor->find(command.sender.socket);
+    if (!conn || conn->id != command.sender.connection_id) {
         return;
     }
 
-    std::optional<std::string> username_opt = read_and_validate("username");
-    if (!username_opt) return;
-    std::string username = *username_opt;
+    for (const OutgoingMessage& reply : command.replies) {
+        reactor->send(conn->fd, reply.encoded(conn->protocol));
+    }
+    if (command.disconnect) {
+        disconnect_client(conn->fd);
+        return;
+    }
+    // Replies may have pushed the client over its output budget and closed it.
+    if (conn->state == ConnectionState::Closing) {
+        return;
+    }
+    if (command.authenticated) {
+        conn->user_id = command.sender.user_id;
+        admit_client(*conn);
+    }
+    reactor->resume_input(*conn);
+}
 
-    std::optional<std::string> password_opt = read_and_validate("password");
-    if (!password_opt) return;
-    std::string password = *password_opt;
+// Registers or authenticates the user once both credentials have arrived. Runs on a worker.
+void ChatServer::authenticate_client(CommandContext& command, const std::string& password)
+{
+    const std::string& username = command.username;
 
     // Handle user registration or authentication.
-    if (!user_manager_.userExists(username)) {
+    if (user_manager_.findUser(username) == kNoUser) {
         if (user_manager_.registerUser(username, password)) {
             std::cout << "New user " << username << " registered successfully." << std::endl;
-        } else {
-            std::string reg_failed_msg = COLOR_RED "[Server]: Registration failed for user: " + username + ". Please try again." COLOR_RESET "\n";
-            send(client_socket, reg_failed_msg.c_str(), static_cast<int>(reg_failed_msg.length()), 0);
-            disconnect_client(client_socket, username);
+        } else if (user_manager_.findUser(username) == kNoUser) { // Not registered by another worker meanwhile.
+            command.replies.push_back(server_reply(Reply::Error, "Registration failed for user: " + username + ". Please try again."));
+            command.disconnect = true;
             std::cerr << "Registration failed for user: " << username << std::endl;
             return;
         }
     }
 
     if (!user_manager_.authenticateUser(username, password)) {
-        std::string auth_failed_msg = COLOR_RED "[Server]: Authentication failed. Invalid username or password." COLOR_RESET "\n";
-        send(client_socket, auth_failed_msg.c_str(), static_cast<int>(auth_failed_msg.length()), 0);
-        disconnect_client(client_socket, username);
+        command.replies.push_back(server_reply(Reply::Error, "Authentication failed. Invalid username or password."));
+        command.disconnect = true;
         std::cerr << "Authentication failed for user: " << username << std::endl;
         return;
     }
 
     std::cout << "User " << username << " authenticated successfully." << std::endl;
+    command.sender.user_id = user_manager_.findUser(username);
+    command.authenticated = true;
+}
 
-    {
-        std::lock_guard<std::mutex> lock(clients_mutex_);
-        clients_[client_socket] = username;
+// Makes an authenticated connection visible to everyone else. Runs on the connection's reactor.
+void ChatServer::admit_client(Connection& conn)
+{
+    const std::string& username = conn.username;
+
+    // Binary clients learn the ID of everyone already online; later arrivals come with UserJoined.
+    // The list is taken with the join, not from the published roster, so nobody who joined
+    // just before is missed.
+    ClientSession session{conn.fd, Reactor::current()->index(), conn.id, conn.user_id, conn.protocol};
+    std::vector<UserId> online;
+    roster_.join(session, conn.protocol == WireProtocol::Binary ? &online : nullptr);
+    std::string roster;
+    std::string frame_body;
+    for (UserId online_user : online) {
+        frame_body.clear();
+        wire::put_varint(frame_body, online_user);
+        wire::put_string(frame_body, user_manager_.username(online_user));
+        roster += wire::encode_frame(wire::Opcode::UserInfo, frame_body);
+    }
+    conn.state = ConnectionState::Chat;
+    if (!roster.empty()) {
+        Reactor::current()->send(conn.fd, make_payload(std::move(roster)));
     }
 
     std::string welcome = COLOR_GREEN "[Server]: " + username + " has joined the chat!" COLOR_RESET "\n";
-    broadcast(welcome, client_socket);
     std::cout << welcome;
+    broadcast(user_message(std::move(welcome), wire::Opcode::UserJoined, conn.user_id, username), conn.fd);
+}
 
-    std::string leftover = received_data_leftover;
-
-    // Main chat loop: Continuously read and process messages from the client.
-    while (true) {
-        std::optional<std::string> msg_opt = read_delimited_message(client_socket, leftover);
-        if (!msg_opt) {
-            break;
-        }
-        std::string msg = *msg_opt;
-
-        if (msg.rfind("/", 0) == 0) {
-            process_chat_command(client_socket, username, msg);
-        } else {
-            std::string formatted = "[" + username + "]: " + msg + "\n";
-            std::cout << formatted;
-            broadcast(formatted, client_socket);
-        }
+// Cleans up after a connection the reactor is about to close.
+void ChatServer::on_close(Connection& conn)
+{
+    // Only authenticated clients were announced, so only they get a departure message.
+    if (remove_client(conn.fd)) {
+        std::string frame_body;
+        wire::put_varint(frame_body, conn.user_id);
+        broadcast(make_message(COLOR_YELLOW "[Server]: " + conn.username + " has left the chat." COLOR_RESET "\n",
+                               wire::encode_frame(wire::Opcode::UserLeft, frame_body)),
+                  conn.fd);
     }
-
-    // Client disconnected, clean up resources.
-    disconnect_client(client_socket, username);
 }
 
-// Helper function to read a newline-delimited message from a socket, handling leftover data.
-std::optional<std::string> ChatServer::read_delimited_message(int client_socket, std::string& leftover_buffer) {
-    char temp_buffer[1024];
-    while (true) {
-        size_t newline_pos = leftover_buffer.find('\n');
-        if (newline_pos != std::string::npos) {
-            std::string message = leftover_buffer.substr(0, newline_pos);
-            leftover_buffer.erase(0, newline_pos + 1);
-            // Strip carriage return for cross-platform compatibility.
-            if (!message.empty() && message.back() == '\r') {
-                message.pop_back();
-            }
-            return message;
-        }
+// Queues a reply for a client owned by the calling reactor without blocking the event loop.
+void ChatServer::send_message(int client_socket, const OutgoingMessage& message)
+{
+    Reactor* reactor = Reactor::current();
+    if (Connection* conn = reactor->find(client_socket)) {
+        reactor->send(client_socket, message.encoded(conn->protocol));
+    }
+}
 
-        int bytes_received = recv(client_socket, temp_buffer, sizeof(temp_buffer) - 1, 0);
-        if (bytes_received <= 0) {
-            return std::nullopt;
-        }
-        temp_buffer[bytes_received] = '\0';
-        leftover_buffer += temp_buffer;
+// Queues a message for a client that may be owned by another reactor.
+void ChatServer::deliver(const ClientSession& session, const OutgoingMessage& message)
+{
+    Reactor* owner = reactors_[session.reactor].get();
+    const Payload& payload = message.encoded(session.protocol);
+    if (owner == Reactor::current()) {
+        owner->send(session.socket, session.connection_id, payload);
+        return;
     }
+    owner->post([owner, session, payload] {
+        owner->send(session.socket, session.connection_id, payload);
+    });
+}
+
+// Finds the sessions of an online user in the published roster. A login or logout from the last
+// few milliseconds may not show yet.
+std::vector<ClientSession> ChatServer::find_clients(UserId user)
+{
+    return roster_.find(user);
 }
 
 // Handles various chat commands received from clients (e.g., /friend, /msg, /quit, /pending).
-void ChatServer::process_chat_command(int client_socket, const std::string& sender_username, const std::string& message) {
+// Commands that touch the user database go to the worker pool; the rest are answered in place.
+void ChatServer::process_chat_command(Connection& sender, const std::string& message) {
     if (message.rfind("/friend ", 0) == 0) {
         std::string command_args = message.substr(8);
         size_t space_pos = command_args.find(' ');
         if (space_pos == std::string::npos) {
-            std::string error_msg = COLOR_RED "[Server]: Invalid friend command format. Use /friend add <username>, /friend accept <username>, or /friend reject <username>." COLOR_RESET "\n";
-            send(client_socket, error_msg.c_str(), static_cast<int>(error_msg.length()), 0);
+            send_message(sender.fd, server_reply(Reply::Error, "Invalid friend command format. Use /friend add <username>, /friend accept <username>, or /friend reject <username>."));
             return;
         }
         std::string sub_command = command_args.substr(0, space_pos);
         std::string target_username = command_args.substr(space_pos + 1);
 
+        wire::FriendAction action;
         if (sub_command == "add") {
-            if (user_manager_.sendFriendRequest(sender_username, target_username)) {
-                std::string success_msg = COLOR_GREEN "[Server]: Friend request sent to " + target_username + "." COLOR_RESET "\n";
-                send(client_socket, success_msg.c_str(), static_cast<int>(success_msg.length()), 0);
-                // Notify target user if online about incoming friend request.
-                for (auto const& [sock, uname] : clients_) {
-                    if (uname == target_username) {
-                        std::string notification = COLOR_YELLOW "[Server]: " + sender_username + " has sent you a friend request! Use /friend accept " + sender_username + " to accept." COLOR_RESET "\n";
-                        send(sock, notification.c_str(), static_cast<int>(notification.length()), 0);
-                        break;
-                    }
-                }
-            } else {
-                std::string error_msg = COLOR_RED "[Server]: Failed to send friend request to " + target_username + ". (User not found, already friends, or request pending)" COLOR_RESET "\n";
-                send(client_socket, error_msg.c_str(), static_cast<int>(error_msg.length()), 0);
-            }
+            action = wire::FriendAction::Add;
         } else if (sub_command == "accept") {
-            if (user_manager_.acceptFriendRequest(sender_username, target_username)) {
-                std::string success_msg = COLOR_GREEN "[Server]: You are now friends with " + target_username + "." COLOR_RESET "\n";
-                send(client_socket, success_msg.c_str(), static_cast<int>(success_msg.length()), 0);
-                // Notify target user if online about accepted friend request.
-                for (auto const& [sock, uname] : clients_) {
-                    if (uname == target_username) {
-                        std::string notification = COLOR_GREEN "[Server]: " + sender_username + " has accepted your friend request!" COLOR_RESET "\n";
-                        send(sock, notification.c_str(), static_cast<int>(notification.length()), 0);
-                        break;
-                    }
-                }
-            } else {
-                std::string error_msg = COLOR_RED "[Server]: Failed to accept friend request from " + target_username + ". (No pending request or user not found)" COLOR_RESET "\n";
-                send(client_socket, error_msg.c_str(), static_cast<int>(error_msg.length()), 0);
-            }
+            action = wire::FriendAction::Accept;
         } else if (sub_command == "reject") {
-            if (user_manager_.rejectFriendRequest(sender_username, target_username)) {
-                std::string success_msg = COLOR_GREEN "[Server]: Friend request from " + target_username + " rejected." COLOR_RESET "\n";
-                send(client_socket, success_msg.c_str(), static_cast<int>(success_msg.length()), 0);
-            } else {
-                std::string error_msg = COLOR_RED "[Server]: Failed to reject friend request from " + target_username + ". (No pending request or user not found)" COLOR_RESET "\n";
-                send(client_socket, error_msg.c_str(), static_cast<int>(error_msg.length()), 0);
-            }
+            action = wire::FriendAction::Reject;
+        } else {
+            return;
         }
+        run_command(sender, [this, action, target_username](CommandContext& command) {
+            handle_friend(command, action, target_username);
+        });
     } else if (message.rfind("/msg ", 0) == 0) {
         std::string command_args = message.substr(5);
         size_t first_space = command_args.find(' ');
         if (first_space == std::string::npos) {
-            std::string error_msg = COLOR_RED "[Server]: Invalid message format. Use /msg <username> <message>." COLOR_RESET "\n";
-            send(client_socket, error_msg.c_str(), static_cast<int>(error_msg.length()), 0);
+            send_message(sender.fd, server_reply(Reply::Error, "Invalid message format. Use /msg <username> <message>."));
             return;
         }
         std::string recipient_username = command_args.substr(0, first_space);
-        std::string dm_content = command_args.substr(first_space + 1);
-
-        std::optional<std::reference_wrapper<User>> sender_user_opt = user_manager_.getUser(sender_username);
-        std::optional<std::reference_wrapper<User>> recipient_user_opt = user_manager_.getUser(recipient_username);
+        std::string content = command_args.substr(first_space + 1);
+        run_command(sender, [this, recipient_username, content](CommandContext& command) {
+            handle_direct_message(command, recipient_username, content);
+        });
 
-        if (!sender_user_opt || !recipient_user_opt) {
-            std::string error_msg = COLOR_RED "[Server]: User not found." COLOR_RESET "\n";
-            send(client_socket, error_msg.c_str(), static_cast<int>(error_msg.length()), 0);
-            return;
+    } else if (message.rfind("/history ", 0) == 0) {
+        std::string command_args = message.substr(9);
+        size_t space_pos = command_args.find(' ');
+        std::string peer_username = command_args.substr(0, space_pos);
+        size_t limit = kDefaultHistoryLimit;
+        if (space_pos != std::string::npos) {
+            // strtoul would take a sign (wrapping "-1" around) or leading blanks; only digits are a count.
+            const char* digits = command_args.c_str() + space_pos + 1;
+            char* end = nullptr;
+            unsigned long parsed = std::strtoul(digits, &end, 10);
+            if (!std::isdigit(static_cast<unsigned char>(*digits)) || *end != '\0') {
+                send_message(sender.fd, server_reply(Reply::Error, "Invalid history command format. Use /history <username> [count]."));
+                return;
+            }
+            limit = std::min<unsigned long>(parsed, kMaxHistoryLimit);
         }
+        run_command(sender, [this, peer_username, limit](CommandContext& command) {
+            handle_history(command, peer_username, limit);
+        });
 
-        User& sender_user = sender_user_opt->get();
-        User& recipient_user = recipient_user_opt->get();
+    } else if (message == "/quit") {
+        handle_quit(sender);
 
-        if (!sender_user.hasFriend(recipient_username)) {
-            std::string error_msg = COLOR_RED "[Server]: You are not friends with " + recipient_username + "." COLOR_RESET "\n";
-            send(client_socket, error_msg.c_str(), static_cast<int>(error_msg.length()), 0);
-            return;
-        }
+    } else if (message == "/pending") {
+        run_command(sender, [this](CommandContext& command) { handle_pending(command); });
+
+    } else if (message == "/stats") {
+        handle_stats(sender);
+
+    } else {
+        handle_chat(sender, message);
+    }
+}
 
-        user_manager_.storeMessage(sender_username, recipient_username, dm_content);
-        std::string formatted_dm = COLOR_MAGENTA "[DM from " + sender_username + "]: " + dm_content + COLOR_RESET + "\n";
+// Formats a chat line once per protocol and broadcasts it.
+void ChatServer::handle_chat(Connection& sender, std::string_view text)
+{
+    if (text.size() > wire::kMaxTextSize) {
+        send_message(sender.fd, server_reply(Reply::Error, "Message too long; the limit is " + std::to_string(wire::kMaxTextSize) + " bytes."));
+        return;
+    }
+    // Format straight from the receive buffer without an intermediate line copy.
+    std::string formatted;
+    formatted.reserve(sender.username.size() + text.size() + 5);
+    formatted.append("[").append(sender.username).append("]: ").append(text).append("\n");
+    std::cout << formatted;
+    broadcast(user_message(std::move(formatted), wire::Opcode::Chat, sender.user_id, text), sender.fd);
+}
 
-        // Send DM to recipient if online, otherwise store message.
-        bool recipient_online = false;
-        for (auto const& [sock, uname] : clients_) {
-            if (uname == recipient_username) {
-                send(sock, formatted_dm.c_str(), static_cast<int>(formatted_dm.length()), 0);
-                recipient_online = true;
-                break;
+// Sends, accepts or rejects a friend request and notifies the other user if they are online.
+// An unknown target resolves to no user, which every request refuses.
+void ChatServer::handle_friend(CommandContext& command, wire::FriendAction action, const std::string& target_username)
+{
+    const std::string& sender_username = command.username;
+    UserId sender = command.sender.user_id;
+    UserId target_user = user_manager_.findUser(target_username);
+    if (action == wire::FriendAction::Add) {
+        if (user_manager_.sendFriendRequest(sender, target_user)) {
+            command.replies.push_back(server_reply(Reply::Ack, "Friend request sent to " + target_username + "."));
+            // Notify target user if online about incoming friend request.
+            OutgoingMessage notification = friend_notice(
+                COLOR_YELLOW "[Server]: " + sender_username + " has sent you a friend request! Use /friend accept " + sender_username + " to accept." COLOR_RESET "\n",
+                wire::FriendAction::Requested, sender_username);
+            for (const ClientSession& target : find_clients(target_user)) {
+                deliver(target, notification);
             }
+        } else {
+            command.replies.push_back(server_reply(Reply::Error, "Failed to send friend request to " + target_username + ". (User not found, already friends, or request pending)"));
         }
-
-        if (recipient_online) {
-            std::string success_msg = COLOR_GREEN "[Server]: Message sent to " + recipient_username + "." COLOR_RESET "\n";
-            send(client_socket, success_msg.c_str(), static_cast<int>(success_msg.length()), 0);
+    } else if (action == wire::FriendAction::Accept) {
+        if (user_manager_.acceptFriendRequest(sender, target_user)) {
+            command.replies.push_back(server_reply(Reply::Ack, "You are now friends with " + target_username + "."));
+            // Notify target user if online about accepted friend request.
+            OutgoingMessage notification = friend_notice(
+                COLOR_GREEN "[Server]: " + sender_username + " has accepted your friend request!" COLOR_RESET "\n",
+                wire::FriendAction::Accepted, sender_username);
+            for (const ClientSession& target : find_clients(target_user)) {
+                deliver(target, notification);
+            }
         } else {
-            std::string info_msg = COLOR_YELLOW "[Server]: " + recipient_username + " is offline. Message stored." COLOR_RESET "\n";
-            send(client_socket, info_msg.c_str(), static_cast<int>(info_msg.length()), 0);
+            command.replies.push_back(server_reply(Reply::Error, "Failed to accept friend request from " + target_username + ". (No pending request or user not found)"));
         }
+    } else if (action == wire::FriendAction::Reject) {
+        if (user_manager_.rejectFriendRequest(sender, target_user)) {
+            command.replies.push_back(server_reply(Reply::Ack, "Friend request from " + target_username + " rejected."));
+        } else {
+            command.replies.push_back(server_reply(Reply::Error, "Failed to reject friend request from " + target_username + ". (No pending request or user not found)"));
+        }
+    }
+}
 
-    } else if (message == "/quit") {
-        std::string goodbye_msg = COLOR_YELLOW "[Server]: You have successfully disconnected." COLOR_RESET "\n";
-        send(client_socket, goodbye_msg.c_str(), static_cast<int>(goodbye_msg.length()), 0);
-        disconnect_client(client_socket, sender_username);
+// Stores a direct message between friends and delivers it to every session of the recipient.
+void ChatServer::handle_direct_message(CommandContext& command, const std::string& recipient_username, const std::string& content)
+{
+    const std::string& sender_username = command.username;
+    if (content.size() > wire::kMaxTextSize) {
+        command.replies.push_back(server_reply(Reply::Error, "Message too long; the limit is " + std::to_string(wire::kMaxTextSize) + " bytes."));
         return;
+    }
+    UserId recipient = user_manager_.findUser(recipient_username);
 
-    } else if (message == "/pending") {
-        std::optional<std::reference_wrapper<const std::unordered_set<std::string>>> pending_requests_opt = user_manager_.getIncomingFriendRequests(sender_username);
-        if (pending_requests_opt && !pending_requests_opt->get().empty()) {
-            std::string response = COLOR_CYAN "[Server]: Pending friend requests:\n" COLOR_RESET;
-            for (const std::string& req_sender : pending_requests_opt->get()) {
-                response += COLOR_CYAN "- " + req_sender + "\n" COLOR_RESET;
+    if (!user_manager_.userExists(command.sender.user_id) || recipient == kNoUser) {
+        command.replies.push_back(server_reply(Reply::Error, "User not found."));
+        return;
+    }
+
+    if (!user_manager_.areFriends(command.sender.user_id, recipient)) {
+        command.replies.push_back(server_reply(Reply::Error, "You are not friends with " + recipient_username + "."));
+        return;
+    }
+
+    if (!user_manager_.storeMessage(command.sender.user_id, recipient, content)) {
+        command.replies.push_back(server_reply(Reply::Error, "Message to " + recipient_username + " could not be saved."));
+        return;
+    }
+    OutgoingMessage formatted_dm = user_message(COLOR_MAGENTA "[DM from " + sender_username + "]: " + content + COLOR_RESET + "\n",
+                                                wire::Opcode::DirectMessage, command.sender.user_id, content);
+
+    // Send DM to every session of the recipient if online, otherwise store message.
+    std::vector<ClientSession> recipients = find_clients(recipient);
+    for (const ClientSession& recipient : recipients) {
+        deliver(recipient, formatted_dm);
+    }
+
+    if (!recipients.empty()) {
+        command.replies.push_back(server_reply(Reply::Ack, "Message sent to " + recipient_username + "."));
+    } else {
+        command.replies.push_back(server_reply(Reply::Notice, recipient_username + " is offline. Message stored."));
+    }
+}
+
+// Lists incoming friend requests: a cyan list for V1, one PendingList frame for V2. The frame
+// stops at the first request that would take it past wire::kMaxFrameSize.
+void ChatServer::handle_pending(CommandContext& command)
+{
+    std::optional<std::vector<UserId>> pending_requests_opt = user_manager_.getIncomingFriendRequests(command.sender.user_id);
+    size_t count = pending_requests_opt ? pending_requests_opt->size() : 0;
+
+    std::string response;
+    std::string entries;
+    size_t listed = 0;
+    bool full = false;
+    // Room left after the opcode and the count.
+    size_t room = wire::kMaxFrameSize - 1 - wire::varint_size(static_cast<uint32_t>(count));
+    if (count > 0) {
+        response = COLOR_CYAN "[Server]: Pending friend requests:\n" COLOR_RESET;
+        for (UserId req_sender_id : *pending_requests_opt) {
+            const std::string& req_sender = user_manager_.username(req_sender_id);
+            response += COLOR_CYAN "- " + req_sender + "\n" COLOR_RESET;
+            full = full || entries.size() + wire::string_size(req_sender) > room;
+            if (!full) {
+                wire::put_string(entries, req_sender);
+                ++listed;
             }
-            send(client_socket, response.c_str(), static_cast<int>(response.length()), 0);
-        } else {
-            std::string no_requests_msg = COLOR_CYAN "[Server]: No pending friend requests." COLOR_RESET "\n";
-            send(client_socket, no_requests_msg.c_str(), static_cast<int>(no_requests_msg.length()), 0);
         }
+    } else {
+        response = COLOR_CYAN "[Server]: No pending friend requests." COLOR_RESET "\n";
+    }
+    std::string frame_body;
+    wire::put_varint(frame_body, static_cast<uint32_t>(listed));
+    frame_body += entries;
+    command.replies.push_back(make_message(std::move(response), wire::encode_frame(wire::Opcode::PendingList, frame_body)));
+}
 
+// Shows up to `limit` of the latest messages with a user: a cyan list for V1, one HistoryList frame for V2.
+void ChatServer::handle_history(CommandContext& command, const std::string& peer_username, size_t limit)
+{
+    UserId peer = user_manager_.findUser(peer_username);
+    if (!user_manager_.userExists(command.sender.user_id) || peer == kNoUser) {
+        command.replies.push_back(server_reply(Reply::Error, "User not found."));
+        return;
+    }
+
+    std::vector<Message> history = user_manager_.getChatHistory(command.sender.user_id, peer, limit);
+    size_t count = history.size();
+
+    // The frame keeps the newest messages that fit in wire::kMaxFrameSize after the opcode, the
+    // peer's name and the count.
+    size_t header = 1 + wire::string_size(peer_username) + wire::varint_size(static_cast<uint32_t>(count));
+    size_t room = header < wire::kMaxFrameSize ? wire::kMaxFrameSize - header : 0;
+    size_t first = count;
+    for (size_t used = 0; first > 0; --first) {
+        const Message& message = history[first - 1];
+        used += wire::string_size(user_manager_.username(message.sender)) + wire::string_size(message.content);
+        if (used > room) break;
+    }
+
+    std::string response;
+    std::string frame_body;
+    wire::put_string(frame_body, peer_username);
+    wire::put_varint(frame_body, static_cast<uint32_t>(count - first));
+    if (count > 0) {
+        response = COLOR_CYAN "[Server]: Last " + std::to_string(count) + " message(s) with " + peer_username + ":\n" COLOR_RESET;
+        for (size_t i = 0; i < count; ++i) {
+            const std::string& sender = user_manager_.username(history[i].sender);
+            response += COLOR_CYAN "- [" + sender + "]: " + history[i].content + "\n" COLOR_RESET;
+            if (i >= first) {
+                wire::put_string(frame_body, sender);
+                wire::put_string(frame_body, history[i].content);
+            }
+        }
     } else {
-        std::string formatted = "[" + sender_username + "]: " + message + "\n";
-        std::cout << formatted;
-        broadcast(formatted, client_socket);
+        response = COLOR_CYAN "[Server]: No messages with " + peer_username + "." COLOR_RESET "\n";
     }
+    command.replies.push_back(make_message(std::move(response), wire::encode_frame(wire::Opcode::HistoryList, frame_body)));
 }
 
-// Broadcasts a message to all connected clients except the sender.
-void ChatServer::broadcast(const std::string &message, int sender_socket)
+// Reports how deep the command queue is, how long commands wait and run, how much chat
+// history is resident, what compaction has compressed and reclaimed, how long checkpoints
+// held up other commands and how many roster snapshots the logins and logouts took.
+void ChatServer::handle_stats(Connection& sender)
 {
-    std::lock_guard<std::mutex> lock(clients_mutex_); // Protects access to clients_ map.
-    for (auto const& [client_socket, username] : clients_)
+    WorkerPool::Stats stats = workers_.stats();
+    HistoryCacheStats history = user_manager_.historyCacheStats();
+    CompactionStats compaction = user_manager_.compactionStats();
+    CheckpointStats checkpoints = user_manager_.checkpointStats();
+    RosterStats roster = roster_.stats();
+    std::ostringstream report;
+    report << std::fixed << std::setprecision(1)
+           << "Workers: " << stats.threads << ", queued: " << stats.queue_depth << " (max " << stats.max_queue_depth
+           << "), completed: " << stats.completed << ", rejected: " << stats.rejected
+           << ", wait avg/max: " << stats.avg_wait_us << "/" << stats.max_wait_us << " us"
+           << ", run avg: " << stats.avg_run_us << " us. History cache: "
+           << history.residentBytes / 1048576.0 << "/" << history.limitBytes / 1048576.0 << " MB in "
+           << history.residentHistories << " conversation(s), " << history.pageIns << " paged in, "
+           << history.evictions << " evicted.";
+    report << " Compaction: " << compaction.passes << " pass(es), " << compaction.compressedSegments
+           << " segment(s) compressed (" << compaction.compressedRawBytes / 1048576.0 << " MB to "
+           << compaction.compressedBytes / 1048576.0 << " MB), " << compaction.trimmedMessages
+           << " message(s) trimmed, " << compaction.reclaimedBytes / 1048576.0 << " MB reclaimed, last pass "
+           << compaction.lastPassMicros / 1000.0 << " ms, longest hold " << compaction.longestHoldMicros / 1000.0
+           << " ms.";
+    report << " Checkpoints: " << checkpoints.checkpoints << " in the background, " << checkpoints.failures
+           << " failed, last " << checkpoints.lastMillis << " ms with a " << checkpoints.lastPauseMicros / 1000.0
+           << " ms pause (longest " << checkpoints.longestPauseMicros / 1000.0 << " ms), "
+           << checkpoints.lastCopiedUsers << " user(s) copied on write.";
+    report << " Roster: " << roster.sessions << " session(s) online, " << roster.changes << " join(s) and leave(s) in "
+           << roster.snapshots << " snapshot(s).";
+    send_message(sender.fd, server_reply(Reply::Notice, report.str()));
+}
+
+// Acknowledges /quit, then closes the connection once the goodbye is flushed.
+void ChatServer::handle_quit(Connection& sender)
+{
+    send_message(sender.fd, server_reply(Reply::Notice, "You have successfully disconnected."));
+    disconnect_client(sender.fd);
+}
+
+// Broadcasts a message to all connected clients except the sender. Each encoding is a single
+// shared payload; each reactor fans it out to its own connections, so no lock is held across
+// the fan-out and no recipient gets its own copy of the bytes.
+void ChatServer::broadcast(const OutgoingMessage& message, int sender_socket)
+{
+    Reactor* self = Reactor::current();
+    for (auto& reactor : reactors_)
     {
-        if (client_socket != sender_socket)
+        if (reactor.get() == self)
         {
-            send(client_socket, message.c_str(), static_cast<int>(message.length()), 0);
+            reactor->broadcast(message.text, message.binary, sender_socket);
+            continue;
         }
+        Reactor* target = reactor.get();
+        target->post([target, message] { target->broadcast(message.text, message.binary, -1); });
     }
 }
 
-// Removes a client from the active client list.
-void ChatServer::remove_client(int socket)
+// Removes a client from the roster. Returns true if the client was authenticated.
+bool ChatServer::remove_client(int socket)
 {
-    std::lock_guard<std::mutex> lock(clients_mutex_); // Protects access to clients_ map.
-    auto it = clients_.find(socket);
-    if (it != clients_.end()) {
-        std::string username = it->second;
-        std::cout << username << " has disconnected." << std::endl;
-        clients_.erase(it);
+    std::optional<ClientSession> session = roster_.leave(socket);
+    if (!session) {
+        return false;
     }
+    std::cout << user_manager_.username(session->user_id) << " has disconnected." << std::endl;
+    return true;
 }
 
-// Disconnects a client, broadcasts a departure message, and cleans up resources.
-void ChatServer::disconnect_client(int client_socket, const std::string& username) {
-    std::string goodbye_message = COLOR_YELLOW "[Server]: " + username + " has left the chat." COLOR_RESET "\n";
-    broadcast(goodbye_message, client_socket); // Broadcast before removing client.
-    remove_client(client_socket);
-#ifdef _WIN32
-    shutdown(client_socket, SD_SEND);
-    closesocket(client_socket);
-#else
-    shutdown(client_socket, SHUT_WR);
-    close(client_socket);
-#endif
-}
\ No newline at end of file
+// Disconnects a client once its pending output is flushed; the departure broadcast happens in on_close.
+void ChatServer::disconnect_client(int client_socket) {
+    Reactor::current()->close_after_flush(client_socket);
+}
@@ -0,0 +1,76 @@
+#include "../include/Mailbox.hpp"
+#include <thread>
+
+// Starts with head and tail both at the stub node.
+IntrusiveMailbox::IntrusiveMailbox() : head_(&stub_), tail_(&stub_) {}
+
+// Swings head to the new node, then links the previous head to it.
+void IntrusiveMailbox::push(Node* node) {
+    node->next.store(nullptr, std::memory_order_relaxed);
+    Node* prev = head_.exchange(node, std::memory_order_seq_cst);
+    prev->next.store(node, std::memory_order_release);
+}
+
+// Dequeues the oldest node, skipping over the stub node as it cycles through the list.
+IntrusiveMailbox::Node* IntrusiveMailbox::pop() {
+    Node* tail = tail_;
+    Node* next = tail->next.load(std::memory_order_acquire);
+
+    if (tail == &stub_) {
+        if (next == nullptr) {
+            if (head_.load(std::memory_order_acquire) == &stub_) return nullptr;
+            // A producer has swapped head but not yet linked its node; it is a few instructions away.
+            while ((next = tail->next.load(std::memory_order_acquire)) == nullptr) {
+                std::this_thread::yield();
+            }
+        }
+        tail_ = next;
+        tail = next;
+        next = next->next.load(std::memory_order_acquire);
+    }
+
+    if (next == nullptr) {
+        if (tail != head_.load(std::memory_order_acquire)) {
+            while ((next = tail->next.load(std::memory_order_acquire)) == nullptr) {
+                std::this_thread::yield();
+            }
+        } else {
+            // Tail is the last real node: re-insert the stub behind it so it can be detached.
+            push(&stub_);
+            while ((next = tail->next.load(std::memory_order_acquire)) == nullptr) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    tail_ = next;
+    return tail;
+}
+
+// A push moves head off the stub before it links anything, so a half-finished push counts.
+bool IntrusiveMailbox::empty() const {
+    return tail_ == &stub_ && head_.load(std::memory_order_seq_cst) == &stub_;
+}
+
+// Frees every node still queued.
+Mailbox::~Mailbox() {
+    Task task;
+    while (pop(task)) {
+    }
+}
+
+// Enqueues a task at the producer end.
+void Mailbox::push(Task task) {
+    Node* node = new Node;
+    node->task = std::move(task);
+    queue_.push(node);
+}
+
+// Dequeues the oldest task and frees its node.
+bool Mailbox::pop(Task& task) {
+    Node* node = static_cast<Node*>(queue_.pop());
+    if (node == nullptr) return false;
+    task = std::move(node->task);
+    delete node;
+    return true;
+}
@@ -0,0 +1,155 @@
+#include "../include/Roster.hpp"
+#include <algorithm>
+
+// Publishes an empty roster and starts the publisher.
+Roster::Roster(std::chrono::milliseconds batch_interval)
+    : batch_interval_(batch_interval), current_(new Sessions())
+{
+    publisher_ = std::thread(&Roster::publish_changes, this);
+}
+
+// Changes not yet published are dropped with the rest.
+Roster::~Roster()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    publisher_.join();
+    delete current_.load();
+}
+
+// Threads are dealt slots in the order they first read, so up to kReaderSlots readers never
+// share a counter.
+size_t Roster::reader_slot()
+{
+    static std::atomic<size_t> next_slot{0};
+    thread_local size_t slot = next_slot.fetch_add(1, std::memory_order_relaxed) % kReaderSlots;
+    return slot;
+}
+
+// Only the first change after a snapshot wakes the publisher; later ones ride along with it.
+void Roster::join(const ClientSession& session, std::vector<UserId>* online)
+{
+    bool was_dirty;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        sessions_[session.user_id].push_back(session);
+        user_by_socket_[session.socket] = session.user_id;
+        ++session_count_;
+        ++changes_;
+        if (online) {
+            for (const auto& [user, sessions] : sessions_) {
+                online->push_back(user);
+            }
+        }
+        was_dirty = dirty_;
+        dirty_ = true;
+    }
+    if (!was_dirty) {
+        wake_.notify_one();
+    }
+}
+
+// Removes the session from the private copy; readers still see it until the next snapshot.
+std::optional<ClientSession> Roster::leave(int socket)
+{
+    std::optional<ClientSession> session;
+    bool was_dirty;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto socket_it = user_by_socket_.find(socket);
+        if (socket_it == user_by_socket_.end()) {
+            return std::nullopt;
+        }
+        auto user_it = sessions_.find(socket_it->second);
+        std::vector<ClientSession>& sessions = user_it->second;
+        auto found = std::find_if(sessions.begin(), sessions.end(),
+                                  [socket](const ClientSession& candidate) { return candidate.socket == socket; });
+        session = *found;
+        sessions.erase(found);
+        if (sessions.empty()) {
+            sessions_.erase(user_it);
+        }
+        user_by_socket_.erase(socket_it);
+        --session_count_;
+        ++changes_;
+        was_dirty = dirty_;
+        dirty_ = true;
+    }
+    if (!was_dirty) {
+        wake_.notify_one();
+    }
+    return session;
+}
+
+// The count goes up before the snapshot is loaded and down once the reader is done with it, so
+// a snapshot loaded before being replaced is covered the whole time it is read.
+std::vector<ClientSession> Roster::find(UserId user) const
+{
+    std::atomic<int64_t>& readers = readers_[phase_.load()][reader_slot()].readers;
+    readers.fetch_add(1);
+    const Sessions* sessions = current_.load();
+    std::vector<ClientSession> found;
+    auto it = sessions->find(user);
+    if (it != sessions->end()) {
+        found = it->second;
+    }
+    readers.fetch_sub(1, std::memory_order_release);
+    return found;
+}
+
+// Reads the counters.
+RosterStats Roster::stats() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return RosterStats{session_count_, changes_, snapshots_};
+}
+
+// The first change after a quiet spell is published at once. After that, changes collect until
+// batch_interval_ has passed since the last snapshot, so churn costs one copy per interval.
+void Roster::publish_changes()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    Clock::time_point last_published = Clock::now() - batch_interval_;
+    for (;;) {
+        wake_.wait(lock, [this] { return dirty_ || stopping_; });
+        wake_.wait_until(lock, last_published + batch_interval_, [this] { return stopping_; });
+        if (stopping_) {
+            return;
+        }
+        const Sessions* next = new Sessions(sessions_);
+        dirty_ = false;
+        lock.unlock();
+
+        const Sessions* replaced = current_.exchange(next);
+        last_published = Clock::now();
+        wait_for_readers();
+        delete replaced;
+
+        lock.lock();
+        ++snapshots_;
+    }
+}
+
+// New readers count themselves under the phase not being drained, so each drain only waits for
+// readers already under way. Both phases are drained: a reader that read the phase before the
+// first flip may count itself under it after that phase's check.
+void Roster::wait_for_readers()
+{
+    for (int round = 0; round < 2; ++round) {
+        unsigned draining = phase_.load();
+        phase_.store(draining ^ 1);
+        for (;;) {
+            int64_t readers = 0;
+            for (const ReaderCount& count : readers_[draining]) {
+                readers += count.readers.load();
+            }
+            if (readers == 0) {
+                break;
+            }
+            std::this_thread::yield();
+        }
+    }
+}
@@ -0,0 +1,102 @@
+#include "../include/WorkerPool.hpp"
+#include <algorithm>
+
+// Sets the queue bound.
+WorkerPool::WorkerPool(size_t capacity) : capacity_(capacity) {}
+
+// Stops the workers before the queue they read from goes away.
+WorkerPool::~WorkerPool()
+{
+    stop();
+}
+
+// Spawns the worker threads.
+void WorkerPool::start(size_t threads)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = false;
+    }
+    for (size_t i = 0; i < threads; ++i) {
+        threads_.emplace_back(&WorkerPool::work, this);
+    }
+}
+
+// Wakes every worker, waits for them to finish their current task and drops the rest.
+void WorkerPool::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+        queue_.clear();
+    }
+    ready_.notify_all();
+    for (auto& thread : threads_) {
+        thread.join();
+    }
+    threads_.clear();
+}
+
+// Queues a task, refusing it if the queue is at capacity.
+bool WorkerPool::try_submit(Task task)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopping_ || queue_.size() >= capacity_) {
+            rejected_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        queue_.push_back(Item{std::move(task), Clock::now()});
+        max_queue_depth_ = std::max(max_queue_depth_, queue_.size());
+    }
+    ready_.notify_one();
+    return true;
+}
+
+// Reads the counters; averages are over every completed task.
+WorkerPool::Stats WorkerPool::stats() const
+{
+    Stats stats{};
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats.threads = threads_.size();
+        stats.queue_depth = queue_.size();
+        stats.max_queue_depth = max_queue_depth_;
+    }
+    stats.completed = completed_.load(std::memory_order_relaxed);
+    stats.rejected = rejected_.load(std::memory_order_relaxed);
+    stats.max_wait_us = max_wait_us_.load(std::memory_order_relaxed);
+    if (stats.completed > 0) {
+        stats.avg_wait_us = static_cast<double>(total_wait_us_.load(std::memory_order_relaxed)) / stats.completed;
+        stats.avg_run_us = static_cast<double>(total_run_us_.load(std::memory_order_relaxed)) / stats.completed;
+    }
+    return stats;
+}
+
+// Takes tasks off the queue one at a time and records how long each waited and ran.
+void WorkerPool::work()
+{
+    while (true) {
+        Item item;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            ready_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+            if (stopping_) return;
+            item = std::move(queue_.front());
+            queue_.pop_front();
+        }
+
+        Clock::time_point started = Clock::now();
+        item.task();
+        Clock::time_point finished = Clock::now();
+
+        uint64_t wait_us = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(started - item.submitted).count());
+        uint64_t run_us = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(finished - started).count());
+        total_wait_us_.fetch_add(wait_us, std::memory_order_relaxed);
+        total_run_us_.fetch_add(run_us, std::memory_order_relaxed);
+        uint64_t max_wait = max_wait_us_.load(std::memory_order_relaxed);
+        while (wait_us > max_wait && !max_wait_us_.compare_exchange_weak(max_wait, wait_us, std::memory_order_relaxed)) {
+        }
+        completed_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
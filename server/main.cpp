@@ -1,8 +1,142 @@
 #include "../include/ChatServer.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
 
-int main()
+// Usage: chat_server [--reactors N] [--workers N] [--io-backend uring|epoll]
+//                    [--outbound-high BYTES] [--outbound-low BYTES]
+//                    [--slow-consumer drop-oldest|disconnect]
+//                    [--durability memory|interval|batch] [--commit-window USEC]
+//                    [--sync-interval MS] [--history-cache MB]
+//                    [--retain-messages N] [--retain-hours H] [--retain-user-mb MB]
+//                    [--compact-interval SEC]
+// --reactors sets the number of event-loop threads; it defaults to one per core.
+// --workers sets the number of threads running commands that touch the user
+// database; it defaults to half the cores, at least two.
+// io_uring is used when the kernel supports it; epoll is the fallback.
+// A client whose queued output exceeds the high watermark either loses its
+// oldest messages down to the low watermark or is disconnected.
+// User data changes are group-committed to a write-ahead log: "memory" keeps
+// them in memory only, "interval" (the default) fsyncs every --sync-interval
+// milliseconds, and "batch" fsyncs every commit before replying to the client.
+// Chat histories live in per-conversation message logs; --history-cache caps the
+// memory messages read back from them may hold (default 256 MB), evicting the least
+// recently used. Nothing expires unless a retention limit is given: at most N
+// messages per conversation, none older than H hours, or at most MB of log across
+// one user's conversations. A background compactor compresses closed log segments
+// and enforces the limits every --compact-interval seconds (default 60).
+int main(int argc, char* argv[])
 {
-    ChatServer server(9000);
+    size_t reactor_count = 0;
+    size_t worker_count = 0;
+    IoBackend backend = IoBackend::IoUring;
+    OutboundLimits limits;
+    PersistenceOptions persistence;
+    size_t history_cache_bytes = HistoryCache::kDefaultLimit;
+    RetentionPolicy retention;
+    std::chrono::seconds compact_interval{60};
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--reactors") == 0 && i + 1 < argc)
+        {
+            reactor_count = static_cast<size_t>(std::strtoul(argv[++i], nullptr, 10));
+        }
+        else if (std::strcmp(argv[i], "--workers") == 0 && i + 1 < argc)
+        {
+            worker_count = static_cast<size_t>(std::strtoul(argv[++i], nullptr, 10));
+        }
+        else if (std::strcmp(argv[i], "--io-backend") == 0 && i + 1 < argc && std::strcmp(argv[i + 1], "epoll") == 0)
+        {
+            backend = IoBackend::Epoll;
+            ++i;
+        }
+        else if (std::strcmp(argv[i], "--io-backend") == 0 && i + 1 < argc && std::strcmp(argv[i + 1], "uring") == 0)
+        {
+            backend = IoBackend::IoUring;
+            ++i;
+        }
+        else if (std::strcmp(argv[i], "--outbound-high") == 0 && i + 1 < argc)
+        {
+            limits.high_watermark = static_cast<size_t>(std::strtoull(argv[++i], nullptr, 10));
+        }
+        else if (std::strcmp(argv[i], "--outbound-low") == 0 && i + 1 < argc)
+        {
+            limits.low_watermark = static_cast<size_t>(std::strtoull(argv[++i], nullptr, 10));
+        }
+        else if (std::strcmp(argv[i], "--slow-consumer") == 0 && i + 1 < argc && std::strcmp(argv[i + 1], "drop-oldest") == 0)
+        {
+            limits.policy = SlowConsumerPolicy::DropOldest;
+            ++i;
+        }
+        else if (std::strcmp(argv[i], "--slow-consumer") == 0 && i + 1 < argc && std::strcmp(argv[i + 1], "disconnect") == 0)
+        {
+            limits.policy = SlowConsumerPolicy::Disconnect;
+            ++i;
+        }
+        else if (std::strcmp(argv[i], "--durability") == 0 && i + 1 < argc && std::strcmp(argv[i + 1], "memory") == 0)
+        {
+            persistence.durability = Durability::Memory;
+            ++i;
+        }
+        else if (std::strcmp(argv[i], "--durability") == 0 && i + 1 < argc && std::strcmp(argv[i + 1], "interval") == 0)
+        {
+            persistence.durability = Durability::Interval;
+            ++i;
+        }
+        else if (std::strcmp(argv[i], "--durability") == 0 && i + 1 < argc && std::strcmp(argv[i + 1], "batch") == 0)
+        {
+            persistence.durability = Durability::Batch;
+            ++i;
+        }
+        else if (std::strcmp(argv[i], "--commit-window") == 0 && i + 1 < argc)
+        {
+            persistence.batchWindow = std::chrono::microseconds(std::strtoul(argv[++i], nullptr, 10));
+        }
+        else if (std::strcmp(argv[i], "--sync-interval") == 0 && i + 1 < argc)
+        {
+            persistence.syncInterval = std::chrono::milliseconds(std::strtoul(argv[++i], nullptr, 10));
+        }
+        else if (std::strcmp(argv[i], "--history-cache") == 0 && i + 1 < argc)
+        {
+            history_cache_bytes = static_cast<size_t>(std::strtoull(argv[++i], nullptr, 10)) << 20;
+        }
+        else if (std::strcmp(argv[i], "--retain-messages") == 0 && i + 1 < argc)
+        {
+            retention.maxMessages = static_cast<size_t>(std::strtoull(argv[++i], nullptr, 10));
+        }
+        else if (std::strcmp(argv[i], "--retain-hours") == 0 && i + 1 < argc)
+        {
+            retention.maxAge = std::chrono::hours(std::strtoul(argv[++i], nullptr, 10));
+        }
+        else if (std::strcmp(argv[i], "--retain-user-mb") == 0 && i + 1 < argc)
+        {
+            retention.maxUserBytes = std::strtoull(argv[++i], nullptr, 10) << 20;
+        }
+        else if (std::strcmp(argv[i], "--compact-interval") == 0 && i + 1 < argc)
+        {
+            compact_interval = std::chrono::seconds(std::max(1ul, std::strtoul(argv[++i], nullptr, 10)));
+        }
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [--reactors N] [--workers N] [--io-backend uring|epoll]"
+                      << " [--outbound-high BYTES] [--outbound-low BYTES] [--slow-consumer drop-oldest|disconnect]"
+                      << " [--durability memory|interval|batch] [--commit-window USEC] [--sync-interval MS]"
+                      << " [--history-cache MB] [--retain-messages N] [--retain-hours H] [--retain-user-mb MB]"
+                      << " [--compact-interval SEC]" << std::endl;
+            return 1;
+        }
+    }
+    if (limits.low_watermark > limits.high_watermark)
+    {
+        limits.low_watermark = limits.high_watermark;
+    }
+
+    ChatServer server(9000, reactor_count, backend, persistence);
+    server.set_outbound_limits(limits);
+    server.set_command_workers(worker_count);
+    server.set_history_cache_limit(history_cache_bytes);
+    server.set_retention(retention, compact_interval);
     server.start();
     return 0;
 }
@@ -0,0 +1,88 @@
+#include "../include/user/UserSnapshot.hpp"
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+// Usage: chat_datatool import <users.json> <users.db>
+//        chat_datatool export <users.db> <users.json>
+//        chat_datatool info <users.db>
+// Converts the user database between the server's binary snapshot and JSON.
+// The snapshot's messages are in the message logs under <users.db>.history/,
+// which import replaces and the other commands read. Changes still in the
+// write-ahead log (<users.db>.wal) are not included; stop the server cleanly
+// first so it checkpoints them into the snapshot.
+int main(int argc, char* argv[])
+{
+    UserTable users;
+    uint64_t walSequence = 0;
+    std::string error;
+    std::string database = argc == 4 && std::strcmp(argv[1], "import") == 0 ? argv[3] : argc >= 3 ? argv[2] : "";
+    std::string historyDirectory = database + ".history";
+
+    if (argc == 4 && std::strcmp(argv[1], "import") == 0)
+    {
+        // The logs belong to the snapshot being replaced.
+        std::error_code removeError;
+        std::filesystem::remove_all(historyDirectory, removeError);
+        ConversationStore conversations(historyDirectory, users);
+        if (!UserSnapshot::readJson(argv[2], users, conversations, walSequence, error))
+        {
+            std::cerr << "Cannot read " << argv[2] << ": " << error << std::endl;
+            return 1;
+        }
+        // Nothing is appended after the import, so every segment can be compressed right away.
+        uint64_t rawBytes = 0;
+        uint64_t storedBytes = 0;
+        for (auto& [key, history] : conversations)
+        {
+            history.compress(rawBytes, storedBytes, true);
+        }
+        if (!conversations.sync() || !UserSnapshot::writeBinary(argv[3], users, conversations, walSequence, true))
+        {
+            std::cerr << "Cannot write " << argv[3] << std::endl;
+            return 1;
+        }
+        std::cout << "Imported " << users.size() << " user(s) into " << argv[3] << ", history compressed from "
+                  << rawBytes / 1048576 << " MB to " << storedBytes / 1048576 << " MB." << std::endl;
+        return 0;
+    }
+    if (argc == 4 && std::strcmp(argv[1], "export") == 0)
+    {
+        ConversationStore conversations(historyDirectory, users);
+        if (!UserSnapshot::readBinary(argv[2], users, conversations, walSequence, error))
+        {
+            std::cerr << "Cannot read " << argv[2] << ": " << error << std::endl;
+            return 1;
+        }
+        if (!UserSnapshot::writeJson(argv[3], users, conversations, walSequence))
+        {
+            std::cerr << "Cannot write " << argv[3] << std::endl;
+            return 1;
+        }
+        std::cout << "Exported " << users.size() << " user(s) to " << argv[3] << "." << std::endl;
+        return 0;
+    }
+    if (argc == 3 && std::strcmp(argv[1], "info") == 0)
+    {
+        ConversationStore conversations(historyDirectory, users);
+        if (!UserSnapshot::readBinary(argv[2], users, conversations, walSequence, error))
+        {
+            std::cerr << "Invalid snapshot " << argv[2] << ": " << error << std::endl;
+            return 1;
+        }
+        size_t messages = 0;
+        for (const auto& [participants, history] : conversations)
+        {
+            messages += history.size();
+        }
+        std::cout << argv[2] << ": format version " << UserSnapshot::binaryVersion(argv[2]) << ", " << users.size() << " user(s), "
+                  << conversations.size() << " conversation(s), " << messages << " stored message(s), covers log sequence "
+                  << walSequence << "." << std::endl;
+        return 0;
+    }
+
+    std::cerr << "Usage: " << argv[0] << " import <users.json> <users.db>\n"
+              << "       " << argv[0] << " export <users.db> <users.json>\n"
+              << "       " << argv[0] << " info <users.db>" << std::endl;
+    return 1;
+}
@@ -0,0 +1,184 @@
+#include "../include/user/ChatHistory.hpp"
+#include <algorithm>
+
+namespace {
+// Approximate memory held by one message.
+size_t messageBytes(const Message& message) {
+    return sizeof(Message) + message.content.size();
+}
+} // namespace
+
+ChatHistory::ChatHistory(MessageLog& log, uint32_t id, UserId first, UserId second, HistoryCache* cache)
+    : log(log, id), participants{first, second}, cache(cache) {}
+
+// Leaves the cache so it never evicts a destroyed history.
+ChatHistory::~ChatHistory() {
+    if (cache) cache->forget(*this);
+}
+
+// Counts the messages between the log's first kept one and its end.
+size_t ChatHistory::size() const {
+    return static_cast<size_t>(log.size() - log.first());
+}
+
+// Writes the message to the log and, if the latest messages are resident, extends them.
+bool ChatHistory::append(const Message& message) {
+    if (!log.append(message.sender == participants[1] ? 1 : 0, message.timestamp, message.content)) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(windowMutex);
+    if (!recent.empty()) {
+        recent.push_back(Message{message.sender, message.content, log.newest()});
+        recentBytes += messageBytes(message);
+        if (cache) cache->touch(*this);
+    }
+    return true;
+}
+
+// Serves the request from the resident window when it is long enough; otherwise reads the
+// latest `count` messages from the log and makes them the window. A damaged log yields nothing
+// rather than a gap.
+std::vector<Message> ChatHistory::tail(size_t count) const {
+    count = std::min(count, size());
+    std::lock_guard<std::mutex> lock(windowMutex);
+    if (count > recent.size()) {
+        std::vector<Message> window;
+        window.reserve(count);
+        size_t bytes = 0;
+        bool ok = log.read(log.size() - count, [&](const LogRecord& record) {
+            window.push_back(Message{participants[record.sender & 1], std::string(record.payload), record.timestamp});
+            bytes += messageBytes(window.back());
+        });
+        if (!ok) {
+            if (cache) ++cache->readFailures;
+            return {};
+        }
+        if (cache) ++cache->pageIns;
+        recent.swap(window);
+        recentBytes = bytes;
+        // A log found shorter than the snapshot said on first use has fewer to give.
+        count = std::min(count, recent.size());
+    }
+    if (cache && !recent.empty()) cache->touch(*this);
+    return std::vector<Message>(recent.end() - static_cast<std::ptrdiff_t>(count), recent.end());
+}
+
+// Streams the whole log; the resident window is neither used nor changed.
+bool ChatHistory::forEach(const std::function<void(UserId, std::string_view, int64_t)>& fn) const {
+    bool ok = log.read(0, [&](const LogRecord& record) {
+        fn(participants[record.sender & 1], record.payload, record.timestamp);
+    });
+    if (!ok && cache) ++cache->readFailures;
+    return ok;
+}
+
+uint64_t ChatHistory::logBytes() const {
+    return log.bytes();
+}
+
+int64_t ChatHistory::lastActivity() const {
+    return log.newest();
+}
+
+// Takes the latest first message any limit allows. Only limits that are set are looked up, since
+// seeking by time or size reads the log's index. A resident window reaching into the dropped
+// messages is let go rather than cut.
+uint64_t ChatHistory::trim(size_t count, int64_t cutoff, uint64_t bytes) {
+    uint64_t end = log.size();
+    uint64_t keepFrom = end - std::min<uint64_t>(count, end - log.first());
+    if (cutoff != std::numeric_limits<int64_t>::min()) keepFrom = std::max(keepFrom, log.seek(cutoff));
+    if (bytes != std::numeric_limits<uint64_t>::max()) keepFrom = std::max(keepFrom, log.seekBytes(bytes));
+    uint64_t freed = log.trim(keepFrom);
+    std::lock_guard<std::mutex> lock(windowMutex);
+    if (recent.size() > size()) {
+        if (cache) cache->forget(*this);
+        evict();
+    }
+    return freed;
+}
+
+// Messages keep their sequences, so the resident window stays valid.
+size_t ChatHistory::compress(uint64_t& rawBytes, uint64_t& storedBytes, bool idle) {
+    return log.compress(rawBytes, storedBytes, idle);
+}
+
+// Everything is on disk, so eviction just frees the window. Called with the window locked.
+void ChatHistory::evict() const {
+    std::vector<Message>().swap(recent);
+    recentBytes = 0;
+}
+
+// Detaches every history still in the recency list.
+HistoryCache::~HistoryCache() {
+    for (const ChatHistory* history : lru) {
+        history->cached = false;
+        history->cache = nullptr;
+    }
+}
+
+// Applies the new budget right away.
+void HistoryCache::setLimit(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    limit = bytes;
+    trim(nullptr);
+}
+
+// Snapshots the counters.
+HistoryCacheStats HistoryCache::stats() const {
+    HistoryCacheStats stats;
+    stats.limitBytes = limit;
+    stats.residentBytes = residentBytes;
+    stats.residentHistories = residentHistories;
+    stats.pageIns = pageIns;
+    stats.evictions = evictions;
+    stats.readFailures = readFailures;
+    return stats;
+}
+
+// Moves the history to the hot end, adding it if new, and charges it its current size.
+void HistoryCache::touch(const ChatHistory& history) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!history.cached) {
+        lru.push_front(&history);
+        history.lruPosition = lru.begin();
+        history.cached = true;
+        history.cachedBytes = 0;
+        ++residentHistories;
+    } else if (history.lruPosition != lru.begin()) {
+        lru.splice(lru.begin(), lru, history.lruPosition);
+    }
+    residentBytes += history.recentBytes - history.cachedBytes;
+    history.cachedBytes = history.recentBytes;
+    trim(&history);
+}
+
+void HistoryCache::forget(const ChatHistory& history) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (history.cached) forgetLocked(history);
+}
+
+// Unlinks the history and stops charging for it.
+void HistoryCache::forgetLocked(const ChatHistory& history) {
+    residentBytes -= history.cachedBytes;
+    --residentHistories;
+    lru.erase(history.lruPosition);
+    history.cached = false;
+    history.cachedBytes = 0;
+}
+
+// Evicts cold histories until the budget holds. The history being accessed is never evicted,
+// even if it alone exceeds the budget, and neither is one whose window another thread holds:
+// that thread is about to touch it anyway.
+void HistoryCache::trim(const ChatHistory* keep) {
+    auto it = lru.end();
+    while (residentBytes > limit && it != lru.begin()) {
+        const ChatHistory* victim = *--it;
+        if (victim == keep) continue;
+        std::unique_lock<std::mutex> window(victim->windowMutex, std::try_to_lock);
+        if (!window) continue;
+        it = std::next(it);
+        forgetLocked(*victim);
+        victim->evict();
+        ++evictions;
+    }
+}
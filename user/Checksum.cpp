@@ -0,0 +1,27 @@
+#include "../include/user/Checksum.hpp"
+#include <array>
+
+namespace {
+// Builds the CRC-32 lookup table.
+std::array<uint32_t, 256> makeCrcTable() {
+    std::array<uint32_t, 256> table{};
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k) {
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+        table[i] = c;
+    }
+    return table;
+}
+} // namespace
+
+// Table-driven CRC-32, one byte per step.
+uint32_t crc32Update(uint32_t crc, const char* data, size_t size) {
+    static const std::array<uint32_t, 256> table = makeCrcTable();
+    uint32_t c = crc ^ 0xFFFFFFFFu;
+    for (size_t i = 0; i < size; ++i) {
+        c = table[(c ^ static_cast<unsigned char>(data[i])) & 0xFF] ^ (c >> 8);
+    }
+    return c ^ 0xFFFFFFFFu;
+}
@@ -0,0 +1,143 @@
+#include "../include/user/Compression.hpp"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace {
+// Positions remembered per hash bucket.
+constexpr int kHashBits = 14;
+// Shortest match the format can express.
+constexpr size_t kMinMatch = 4;
+// The format ends every block with at least this many literals...
+constexpr size_t kLastLiterals = 5;
+// ...and starts no match within this many bytes of the end.
+constexpr size_t kMatchLimit = 12;
+// Farthest back a match may reach.
+constexpr size_t kMaxOffset = 65535;
+
+uint32_t read32(const char* p) {
+    uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+// Multiplicative hash of the next four bytes.
+uint32_t hashAt(const char* p) {
+    return (read32(p) * 2654435761u) >> (32 - kHashBits);
+}
+
+// Writes the extension bytes of a literal or match length that did not fit in its token nibble.
+char* writeLength(char* out, size_t length) {
+    while (length >= 255) {
+        *out++ = static_cast<char>(255);
+        length -= 255;
+    }
+    *out++ = static_cast<char>(length);
+    return out;
+}
+
+// Reads the extension bytes of a length whose nibble was 15. Returns false if they run past `end`.
+bool readLength(const unsigned char*& in, const unsigned char* end, size_t& length) {
+    unsigned char byte;
+    do {
+        if (in == end) return false;
+        byte = *in++;
+        length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+// Emits one sequence: the literals since `anchor`, then a match of `matchLength` at `offset`.
+char* writeSequence(char* out, const char* anchor, size_t literals, size_t offset, size_t matchLength) {
+    char* token = out++;
+    size_t matchCode = matchLength - kMinMatch;
+    *token = static_cast<char>((std::min<size_t>(literals, 15) << 4) | std::min<size_t>(matchCode, 15));
+    if (literals >= 15) out = writeLength(out, literals - 15);
+    std::memcpy(out, anchor, literals);
+    out += literals;
+    *out++ = static_cast<char>(offset & 0xFF);
+    *out++ = static_cast<char>(offset >> 8);
+    if (matchCode >= 15) out = writeLength(out, matchCode - 15);
+    return out;
+}
+} // namespace
+
+// Greedy single-pass matcher over a hash table of recent positions. Positions that keep missing
+// are skipped at a growing stride, so incompressible input goes through quickly.
+size_t lz4Compress(const char* data, size_t size, char* out) {
+    char* op = out;
+    const char* anchor = data;
+    const char* end = data + size;
+    if (size > kMatchLimit) {
+        std::vector<uint32_t> table(size_t(1) << kHashBits, 0);
+        const char* matchStart = end - kMatchLimit;
+        const char* matchEnd = end - kLastLiterals;
+        const char* ip = data + 1;
+        while (ip < matchStart) {
+            uint32_t hash = hashAt(ip);
+            const char* ref = data + table[hash];
+            table[hash] = static_cast<uint32_t>(ip - data);
+            if (ref >= ip || static_cast<size_t>(ip - ref) > kMaxOffset || read32(ref) != read32(ip)) {
+                ip += 1 + (static_cast<size_t>(ip - anchor) >> 6);
+                continue;
+            }
+            while (ip > anchor && ref > data && ip[-1] == ref[-1]) {
+                --ip;
+                --ref;
+            }
+            const char* mp = ip + kMinMatch;
+            const char* rp = ref + kMinMatch;
+            while (mp < matchEnd && *mp == *rp) {
+                ++mp;
+                ++rp;
+            }
+            op = writeSequence(op, anchor, static_cast<size_t>(ip - anchor), static_cast<size_t>(ip - ref),
+                               static_cast<size_t>(mp - ip));
+            ip = mp;
+            anchor = ip;
+            if (ip < matchStart) table[hashAt(ip - 2)] = static_cast<uint32_t>(ip - 2 - data);
+        }
+    }
+    size_t literals = static_cast<size_t>(end - anchor);
+    *op++ = static_cast<char>(std::min<size_t>(literals, 15) << 4);
+    if (literals >= 15) op = writeLength(op, literals - 15);
+    if (literals > 0) std::memcpy(op, anchor, literals);
+    op += literals;
+    return static_cast<size_t>(op - out);
+}
+
+// Checks every length and offset against both buffers before copying.
+bool lz4Decompress(const char* data, size_t size, char* out, size_t rawSize) {
+    const unsigned char* ip = reinterpret_cast<const unsigned char*>(data);
+    const unsigned char* iend = ip + size;
+    char* op = out;
+    char* oend = out + rawSize;
+    while (ip < iend) {
+        unsigned token = *ip++;
+        size_t literals = token >> 4;
+        if (literals == 15 && !readLength(ip, iend, literals)) return false;
+        if (literals > static_cast<size_t>(iend - ip) || literals > static_cast<size_t>(oend - op)) return false;
+        if (literals > 0) std::memcpy(op, ip, literals);
+        op += literals;
+        ip += literals;
+        if (ip == iend) break;
+
+        if (iend - ip < 2) return false;
+        size_t offset = ip[0] | (static_cast<size_t>(ip[1]) << 8);
+        ip += 2;
+        if (offset == 0 || offset > static_cast<size_t>(op - out)) return false;
+        size_t matchLength = token & 15;
+        if (matchLength == 15 && !readLength(ip, iend, matchLength)) return false;
+        matchLength += kMinMatch;
+        if (matchLength > static_cast<size_t>(oend - op)) return false;
+        const char* match = op - offset;
+        if (offset >= matchLength) {
+            std::memcpy(op, match, matchLength);
+        } else {
+            // Overlapping copy: the match repeats bytes it is itself producing.
+            for (size_t i = 0; i < matchLength; ++i) op[i] = match[i];
+        }
+        op += matchLength;
+    }
+    return op == oend;
+}
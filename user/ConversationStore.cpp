@@ -0,0 +1,76 @@
+#include "../include/user/ConversationStore.hpp"
+#include <functional>
+#include <mutex>
+
+ConversationStore::ConversationStore(const std::string& directory, const UserTable& users, HistoryCache* cache,
+                                     uint64_t segmentBytes)
+    : log(directory, segmentBytes), users(users), cache(cache) {}
+
+// Creates the history with a fresh log on first use. Only that takes the exclusive lock; the
+// map is node-based, so histories found earlier stay put while it is held.
+ChatHistory& ConversationStore::open(UserId a, UserId b) {
+    if (ChatHistory* history = find(a, b)) return *history;
+    Key participants = key(a, b);
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    auto it = conversations.find(participants);
+    if (it != conversations.end()) return it->second;
+    uint32_t id = nextId++;
+    ChatHistory& history = add(participants, id);
+    history.log.create();
+    return history;
+}
+
+// Rejects duplicates so two histories can never share a log.
+ChatHistory* ConversationStore::restore(UserId a, UserId b, uint32_t id, uint64_t count) {
+    Key participants = key(a, b);
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    if (ids.count(id) || conversations.count(participants)) return nullptr;
+    ChatHistory& history = add(participants, id);
+    history.log.restore(count);
+    if (id >= nextId) nextId = id + 1;
+    return &history;
+}
+
+// Looks the pair up without creating anything.
+ChatHistory* ConversationStore::find(UserId a, UserId b) {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    auto it = conversations.find(key(a, b));
+    return it != conversations.end() ? &it->second : nullptr;
+}
+
+// Same lookup for a const store.
+const ChatHistory* ConversationStore::find(UserId a, UserId b) const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    auto it = conversations.find(key(a, b));
+    return it != conversations.end() ? &it->second : nullptr;
+}
+
+size_t ConversationStore::size() const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return conversations.size();
+}
+
+void ConversationStore::clear() {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    conversations.clear();
+    histories.clear();
+    ids.clear();
+    nextId = 0;
+}
+
+// Log records name their sender by position, so the history orders its participants by name,
+// which unlike IDs stays the same from one run to the next.
+ChatHistory& ConversationStore::add(const Key& participants, uint32_t id) {
+    UserId first = participants.first;
+    UserId second = participants.second;
+    if (users.name(second) < users.name(first)) std::swap(first, second);
+    ChatHistory& history = conversations.try_emplace(participants, log, id, first, second, cache).first->second;
+    ids.insert(id);
+    histories.push_back(&history);
+    return history;
+}
+
+// Packs the pair into one word; the key is already ordered.
+size_t ConversationStore::KeyHash::operator()(const Key& key) const {
+    return std::hash<uint64_t>{}((uint64_t(key.first) << 32 | key.second) * 0x9e3779b97f4a7c15ULL);
+}
@@ -0,0 +1,1079 @@
+#include "../include/user/MessageLog.hpp"
+#include "../include/user/Checksum.hpp"
+#include "../include/user/Compression.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "Message logs are written in host byte order");
+
+namespace {
+// Precedes each record's payload.
+struct RecordHeader {
+    uint32_t checksum; // CRC-32 of the header from `length` on, then the payload.
+    uint32_t length;
+    uint64_t sequence;
+    int64_t timestamp;
+    uint32_t sender;
+    uint32_t reserved;
+};
+static_assert(sizeof(RecordHeader) == 32, "RecordHeader layout is part of the file format");
+
+// Precedes each block of a compressed segment.
+struct BlockHeader {
+    uint32_t checksum; // CRC-32 of the compressed bytes.
+    uint32_t length;
+    uint32_t rawLength;
+    uint32_t reserved;
+};
+static_assert(sizeof(BlockHeader) == 16, "BlockHeader layout is part of the file format");
+
+// Block table entry of a compressed segment.
+struct BlockEntry {
+    uint64_t sequence;
+    int64_t timestamp;
+    uint64_t position;    // Of the block in the file.
+    uint64_t rawPosition; // Of its first record among the uncompressed records.
+};
+static_assert(sizeof(BlockEntry) == 32, "BlockEntry layout is part of the file format");
+
+// Ends a compressed segment.
+struct SegmentFooter {
+    uint64_t rawBytes;
+    uint64_t next;     // Sequence after the last record.
+    uint32_t blocks;
+    uint32_t checksum; // CRC-32 of the block table.
+};
+static_assert(sizeof(SegmentFooter) == 24, "SegmentFooter layout is part of the file format");
+
+// Returns the record's checksum.
+uint32_t recordChecksum(const RecordHeader& header, const char* payload) {
+    const char* fields = reinterpret_cast<const char*>(&header) + sizeof(header.checksum);
+    uint32_t crc = crc32Update(0, fields, sizeof(header) - sizeof(header.checksum));
+    return crc32Update(crc, payload, header.length);
+}
+
+// Reads [offset, offset + size) of `path` into `buffer`; false if the file is shorter or unreadable.
+bool readRange(const std::string& path, uint64_t offset, uint64_t size, std::vector<char>& buffer) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    buffer.resize(size);
+    uint64_t done = 0;
+    while (done < size) {
+        ssize_t n = ::pread(fd, buffer.data() + done, size - done, static_cast<off_t>(offset + done));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += static_cast<uint64_t>(n);
+    }
+    ::close(fd);
+    return done == size;
+}
+
+// Writes every byte of the pieces, retrying short writes.
+bool writeAll(int fd, iovec* pieces, int count) {
+    while (count > 0) {
+        ssize_t n = ::writev(fd, pieces, count);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        size_t left = static_cast<size_t>(n);
+        while (count > 0 && left >= pieces->iov_len) {
+            left -= pieces->iov_len;
+            ++pieces;
+            --count;
+        }
+        if (count > 0) {
+            pieces->iov_base = static_cast<char*>(pieces->iov_base) + left;
+            pieces->iov_len -= left;
+        }
+    }
+    return true;
+}
+
+// Creates or truncates `path`, writes `size` bytes and syncs them.
+bool writeFile(const std::string& path, const void* data, size_t size) {
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+    iovec piece{const_cast<void*>(data), size};
+    bool ok = writeAll(fd, &piece, 1) && ::fdatasync(fd) == 0;
+    ::close(fd);
+    return ok;
+}
+
+// Converts an offset among `from` bytes to the matching one among `to` bytes, as if both were
+// spread evenly; relates record offsets in a compressed segment to its size on disk.
+uint64_t scaleOffset(uint64_t offset, uint64_t from, uint64_t to) {
+    if (from == to || from == 0) return std::min(offset, to);
+    return static_cast<uint64_t>(static_cast<double>(offset) * static_cast<double>(to) / static_cast<double>(from));
+}
+
+// Returns the path of segment `base` in `directory`, without the extension. Names are zero-padded
+// so they sort by name too.
+std::string segmentStem(const std::string& directory, uint64_t base) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "/%020llu", static_cast<unsigned long long>(base));
+    return directory + name;
+}
+
+// Syncs a file or directory by path.
+bool syncPath(const std::string& path, bool directory) {
+    int fd = ::open(path.c_str(), (directory ? O_RDONLY | O_DIRECTORY : O_RDONLY) | O_CLOEXEC);
+    if (fd < 0) return errno == ENOENT;
+    bool ok = (directory ? ::fsync(fd) : ::fdatasync(fd)) == 0;
+    ::close(fd);
+    return ok;
+}
+} // namespace
+
+// Clears the directory so stale segments from a crashed run cannot leak into the new log.
+void ConversationLog::create() {
+    {
+        std::lock_guard<std::mutex> lock(owner.mutex);
+        owner.closeWriterLocked(logId);
+        if (owner.decompressed.id == logId) owner.decompressed.valid = false;
+        owner.rootDirty = true;
+    }
+    std::error_code error;
+    std::string directory = owner.logDirectory(logId);
+    std::filesystem::remove_all(directory, error);
+    std::filesystem::create_directories(directory, error);
+    loaded = true;
+    count = 0;
+    start = 0;
+    startPosition = 0;
+    segments.clear();
+    lastTimestamp = 0;
+    lastIndexed = 0;
+}
+
+// Defers all disk access to first use, so startup stays proportional to the snapshot.
+void ConversationLog::restore(uint64_t restoredCount) {
+    owner.closeWriter(logId);
+    loaded = false;
+    count = restoredCount;
+    start = 0;
+    startPosition = 0;
+    segments.clear();
+    lastTimestamp = 0;
+    lastIndexed = 0;
+}
+
+uint64_t ConversationLog::first() {
+    load();
+    return start;
+}
+
+// Hidden records at the front of the head segment are not counted; in a compressed head they are
+// taken to have compressed as well as the rest.
+uint64_t ConversationLog::bytes() {
+    load();
+    uint64_t total = 0;
+    for (const Segment& segment : segments) total += segment.bytes;
+    if (segments.empty()) return total;
+    Segment& head = segments.front();
+    return total - scaleOffset(startPosition, rawSize(head), head.bytes);
+}
+
+int64_t ConversationLog::newest() {
+    load();
+    return lastTimestamp;
+}
+
+// Rolls to a new segment when the tail is compressed or the record would overflow it (a record
+// larger than a whole segment gets one of its own), writes the record, and indexes it if the
+// tail has grown a full interval since its last entry.
+bool ConversationLog::append(uint32_t sender, int64_t timestamp, std::string_view payload) {
+    load();
+    uint64_t recordBytes = sizeof(RecordHeader) + payload.size();
+    if (segments.empty() || segments.back().compressed ||
+        (segments.back().bytes > 0 && segments.back().bytes + recordBytes > owner.segmentLimit)) {
+        Segment segment;
+        segment.base = count;
+        segment.indexed = true; // Nothing to read yet.
+        segments.push_back(std::move(segment));
+        lastIndexed = 0;
+        owner.markDirectory(logId);
+    }
+    Segment& tail = segments.back();
+    MessageLog::Writer* writer;
+    {
+        std::lock_guard<std::mutex> lock(owner.mutex);
+        writer = owner.writer(logId, tail.base);
+    }
+    if (!writer) {
+        return false;
+    }
+
+    timestamp = std::max(timestamp, lastTimestamp);
+    RecordHeader header{0, static_cast<uint32_t>(payload.size()), count, timestamp, sender, 0};
+    header.checksum = recordChecksum(header, payload.data());
+    iovec pieces[2] = {{&header, sizeof(header)}, {const_cast<char*>(payload.data()), payload.size()}};
+    bool written = writeAll(writer->segment, pieces, 2);
+    if (!written) {
+        std::cerr << "Message log " << path(tail.base, ".seg") << ": append failed: " << std::strerror(errno) << std::endl;
+        if (::ftruncate(writer->segment, static_cast<off_t>(tail.bytes)) != 0) {
+            std::cerr << "Cannot truncate " << path(tail.base, ".seg") << ": " << std::strerror(errno) << std::endl;
+        }
+    } else if (tail.bytes == 0 || tail.bytes - lastIndexed >= MessageLog::kIndexInterval) {
+        IndexEntry entry{count, timestamp, tail.bytes};
+        iovec piece{&entry, sizeof(entry)};
+        // A lost index entry only makes seeks scan further, so a failure here is not fatal.
+        if (writeAll(writer->index, &piece, 1)) {
+            tail.index.push_back(entry);
+            lastIndexed = tail.bytes;
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(owner.mutex);
+        --writer->users;
+        if (written) owner.dirty.emplace(logId, tail.base);
+    }
+    if (!written) {
+        return false;
+    }
+    tail.bytes += recordBytes;
+    ++count;
+    lastTimestamp = timestamp;
+    appended = true;
+    return true;
+}
+
+// Starts in the segment holding `from`, at the closest index entry, then runs to the end.
+bool ConversationLog::read(uint64_t from, const std::function<void(const LogRecord&)>& fn) {
+    load();
+    from = std::max(from, start);
+    if (from >= count) return true;
+    auto after = std::upper_bound(segments.begin(), segments.end(), from,
+                                  [](uint64_t sequence, const Segment& segment) { return sequence < segment.base; });
+    if (after == segments.begin()) return false;
+    for (size_t s = static_cast<size_t>(after - segments.begin()) - 1; s < segments.size(); ++s) {
+        uint64_t expected = s + 1 < segments.size() ? segments[s + 1].base : count;
+        uint64_t next = segments[s].base;
+        bool ok = scan(s, from, false, [&](const LogRecord& record, uint64_t) {
+            next = record.sequence + 1;
+            if (record.sequence >= from) fn(record);
+            return true;
+        });
+        if (!ok || next != expected) {
+            std::cerr << "Message log " << path(segments[s].base, segments[s].compressed ? ".segz" : ".seg")
+                      << " is damaged." << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Binary-searches the segments by the timestamp of their first index entry, then scans the one
+// segment that can hold the boundary from its closest earlier index entry.
+uint64_t ConversationLog::seek(int64_t timestamp) {
+    load();
+    size_t low = 0;
+    size_t high = segments.size();
+    while (low < high) {
+        size_t mid = (low + high) / 2;
+        const std::vector<IndexEntry>& index = indexOf(segments[mid]);
+        if (!index.empty() && index.front().timestamp >= timestamp) {
+            high = mid;
+        } else {
+            low = mid + 1;
+        }
+    }
+    if (low == 0) return start;
+    uint64_t found = low < segments.size() ? segments[low].base : count;
+    scan(low - 1, static_cast<uint64_t>(timestamp), true, [&](const LogRecord& record, uint64_t) {
+        if (record.timestamp < timestamp) return true;
+        found = record.sequence;
+        return false;
+    });
+    return std::max(found, start);
+}
+
+// Counts whole segments from the newest back, then scans the one the budget runs out in from the
+// last index entry at or before the cut. Budgets are in disk bytes, so a compressed segment's
+// share is converted to an offset among its uncompressed records.
+uint64_t ConversationLog::seekBytes(uint64_t budget) {
+    load();
+    uint64_t total = 0;
+    for (size_t s = segments.size(); s-- > 0;) {
+        Segment& segment = segments[s];
+        uint64_t raw = rawSize(segment);
+        uint64_t stored = segment.bytes - (s == 0 ? scaleOffset(startPosition, raw, segment.bytes) : 0);
+        if (total + stored <= budget) {
+            total += stored;
+            continue;
+        }
+        uint64_t cut = raw - std::min(raw, scaleOffset(budget - total, segment.bytes, raw));
+        uint64_t scanFrom = segment.base;
+        for (const IndexEntry& entry : indexOf(segment)) {
+            if (entry.position > cut) break;
+            scanFrom = entry.sequence;
+        }
+        uint64_t found = s + 1 < segments.size() ? segments[s + 1].base : count;
+        scan(s, scanFrom, false, [&](const LogRecord& record, uint64_t end) {
+            if (end - sizeof(RecordHeader) - record.payload.size() < cut) return true;
+            found = record.sequence;
+            return false;
+        });
+        return std::max(found, start);
+    }
+    return start;
+}
+
+// Segments the new first message comes after are deleted outright. The head is then only
+// located: planRewrite() cuts it down once half of it is dead, so trimming a few messages at a
+// time stays cheap.
+uint64_t ConversationLog::trim(uint64_t sequence) {
+    load();
+    sequence = std::min(sequence, count);
+    if (sequence <= start) return 0;
+    uint64_t freed = 0;
+    size_t drop = 0;
+    while (drop < segments.size() &&
+           (drop + 1 < segments.size() ? segments[drop + 1].base <= sequence : sequence == count)) {
+        ++drop;
+    }
+    if (drop == segments.size()) owner.closeWriter(logId);
+    for (size_t s = 0; s < drop; ++s) {
+        std::error_code error;
+        freed += segments[s].bytes;
+        if (!segments[s].compressed) freed += std::filesystem::file_size(path(segments[s].base, ".idx"), error);
+        remove(segments[s]);
+    }
+    if (drop > 0) {
+        segments.erase(segments.begin(), segments.begin() + static_cast<std::ptrdiff_t>(drop));
+        owner.markDirectory(logId);
+        startPosition = 0;
+        if (segments.empty()) lastIndexed = 0;
+    }
+    start = sequence;
+    if (segments.empty()) return freed;
+
+    // An unreadable head can still be hidden, just not rewritten: its position stays behind.
+    scan(0, sequence, false, [&](const LogRecord& record, uint64_t end) {
+        if (record.sequence < sequence) return true;
+        startPosition = end - sizeof(RecordHeader) - record.payload.size();
+        return false;
+    });
+    return freed;
+}
+
+// Segments at or past the restored count hold only messages the snapshot does not know about;
+// they are removed. The tail is then scanned from its last index entry before the count and cut
+// right after the last message the snapshot covers.
+void ConversationLog::load() {
+    if (loaded) return;
+    loaded = true;
+    std::error_code error;
+    std::string directory = owner.logDirectory(logId);
+    bool existed = std::filesystem::exists(directory, error);
+    std::filesystem::create_directories(directory, error);
+    for (const auto& entry : std::filesystem::directory_iterator(directory, error)) {
+        std::string extension = entry.path().extension().string();
+        if (extension == ".tmp") {
+            std::filesystem::remove(entry.path(), error);
+            owner.markDirectory(logId);
+            continue;
+        }
+        if (extension != ".seg" && extension != ".segz") continue;
+        // Names that are not a sequence, such as one too large for 64 bits, are left alone.
+        std::string stem = entry.path().stem().string();
+        Segment segment;
+        const char* stemEnd = stem.data() + stem.size();
+        auto parsed = std::from_chars(stem.data(), stemEnd, segment.base);
+        if (stem.empty() || parsed.ec != std::errc() || parsed.ptr != stemEnd) continue;
+        segment.bytes = static_cast<uint64_t>(entry.file_size(error));
+        segment.compressed = extension == ".segz";
+        if (segment.base >= count) {
+            remove(segment);
+            owner.markDirectory(logId);
+            continue;
+        }
+        segments.push_back(std::move(segment));
+    }
+    std::sort(segments.begin(), segments.end(), [](const Segment& a, const Segment& b) {
+        return a.base != b.base ? a.base < b.base : a.compressed > b.compressed;
+    });
+    // A crash while compressing can leave a segment's raw copy beside the compressed one, or a
+    // tail beside the segment it was merged into. The compressed segment is complete by the time
+    // it is renamed in, so whatever it overlaps goes.
+    size_t kept = 0;
+    for (size_t s = 0; s < segments.size(); ++s) {
+        if (kept > 0) {
+            Segment& previous = segments[kept - 1];
+            if (previous.base == segments[s].base ||
+                (previous.compressed && (indexOf(previous), segments[s].base < previous.next))) {
+                remove(segments[s]);
+                owner.markDirectory(logId);
+                continue;
+            }
+        }
+        if (kept != s) segments[kept] = std::move(segments[s]);
+        ++kept;
+    }
+    segments.resize(kept);
+
+    // Trimming may have emptied the log or left a rewritten head holding only messages past the
+    // snapshot, so either way the log legitimately starts at the restored count.
+    uint64_t expected = count;
+    start = expected;
+    if (!segments.empty()) {
+        scan(0, 0, false, [&](const LogRecord& record, uint64_t) {
+            start = record.sequence;
+            return false;
+        });
+        if (start >= expected) {
+            for (const Segment& segment : segments) remove(segment);
+            segments.clear();
+            start = expected;
+            owner.markDirectory(logId);
+        }
+    }
+    if (segments.empty()) {
+        if (!existed && expected > 0) {
+            std::cerr << "Message log " << directory << " is missing; " << expected << " message(s) lost." << std::endl;
+        }
+        return;
+    }
+    // Records before the index entry the scan starts from are trusted as they are.
+    count = 0;
+    Segment& tail = segments.back();
+    count = tail.base;
+    uint64_t cut = 0;
+    for (const IndexEntry& entry : indexOf(tail)) {
+        if (entry.sequence >= expected) break;
+        count = entry.sequence;
+        cut = entry.position;
+    }
+    scan(segments.size() - 1, expected - 1, false, [&](const LogRecord& record, uint64_t end) {
+        if (record.sequence >= expected) return false;
+        count = record.sequence + 1;
+        lastTimestamp = record.timestamp;
+        cut = end;
+        return true;
+    });
+    if (count != expected) {
+        std::cerr << "Message log " << directory << " ends early; " << expected - count << " message(s) lost." << std::endl;
+    }
+    if (tail.compressed) {
+        // A compressed tail is rewritten without the records past the cut, or dropped if that fails.
+        std::vector<char> records;
+        if (cut != tail.rawBytes &&
+            !(cut > 0 && readRecords(tail, SIZE_MAX, records) && (records.resize(cut), replace(tail, records, true)))) {
+            count = tail.base;
+            remove(tail);
+            segments.pop_back();
+            owner.markDirectory(logId);
+        }
+        start = std::min(start, count);
+        lastIndexed = 0;
+        return;
+    }
+    start = std::min(start, count);
+    if (cut != tail.bytes) {
+        if (::truncate(path(tail.base, ".seg").c_str(), static_cast<off_t>(cut)) != 0) {
+            std::cerr << "Cannot truncate " << path(tail.base, ".seg") << ": " << std::strerror(errno) << std::endl;
+        }
+        tail.bytes = cut;
+        owner.markSegment(logId, tail.base);
+    }
+    std::vector<IndexEntry>& index = tail.index;
+    size_t indexed = index.size();
+    while (indexed > 0 && index[indexed - 1].position >= cut) --indexed;
+    if (indexed != index.size()) {
+        index.resize(indexed);
+        if (::truncate(path(tail.base, ".idx").c_str(), static_cast<off_t>(indexed * sizeof(IndexEntry))) != 0) {
+            std::cerr << "Cannot truncate " << path(tail.base, ".idx") << ": " << std::strerror(errno) << std::endl;
+        }
+    }
+    lastIndexed = index.empty() ? 0 : index.back().position;
+}
+
+// Loads the whole .idx file, keeping only the entries that are in order and inside the segment;
+// a missing or torn index just means scans start further back. A compressed segment cannot be
+// read without its block table, so the table is taken whole or not at all.
+const std::vector<ConversationLog::IndexEntry>& ConversationLog::indexOf(Segment& segment) {
+    if (segment.indexed) return segment.index;
+    segment.indexed = true;
+    std::vector<char> buffer;
+    if (segment.compressed) {
+        // One read usually brings in the table along with the footer.
+        std::string segmentPath = path(segment.base, ".segz");
+        SegmentFooter footer;
+        uint64_t tail = std::min<uint64_t>(segment.bytes, 4096);
+        if (segment.bytes < sizeof(footer) || !readRange(segmentPath, segment.bytes - tail, tail, buffer)) {
+            return segment.index;
+        }
+        std::memcpy(&footer, buffer.data() + tail - sizeof(footer), sizeof(footer));
+        uint64_t tableBytes = uint64_t(footer.blocks) * sizeof(BlockEntry);
+        if (footer.blocks == 0 || tableBytes > segment.bytes - sizeof(footer)) return segment.index;
+        uint64_t tableStart = segment.bytes - sizeof(footer) - tableBytes;
+        if (tableBytes + sizeof(footer) <= tail) {
+            buffer.erase(buffer.begin(), buffer.end() - static_cast<std::ptrdiff_t>(tableBytes + sizeof(footer)));
+            buffer.resize(tableBytes);
+        } else if (!readRange(segmentPath, tableStart, tableBytes, buffer)) {
+            return segment.index;
+        }
+        if (crc32Update(0, buffer.data(), buffer.size()) != footer.checksum) return segment.index;
+        for (size_t offset = 0; offset < buffer.size(); offset += sizeof(BlockEntry)) {
+            BlockEntry entry;
+            std::memcpy(&entry, buffer.data() + offset, sizeof(entry));
+            bool first = segment.index.empty();
+            if (first ? entry.position != 0 || entry.rawPosition != 0 || entry.sequence < segment.base
+                      : entry.sequence <= segment.index.back().sequence || entry.position <= segment.blocks.back() ||
+                            entry.rawPosition <= segment.index.back().position ||
+                            entry.timestamp < segment.index.back().timestamp) {
+                break;
+            }
+            if (entry.sequence >= footer.next || entry.position >= tableStart || entry.rawPosition >= footer.rawBytes) break;
+            segment.index.push_back(IndexEntry{entry.sequence, entry.timestamp, entry.rawPosition});
+            segment.blocks.push_back(entry.position);
+        }
+        if (segment.index.size() != footer.blocks) {
+            segment.index.clear();
+            segment.blocks.clear();
+            return segment.index;
+        }
+        segment.rawBytes = footer.rawBytes;
+        segment.next = footer.next;
+        return segment.index;
+    }
+    std::error_code error;
+    std::string indexPath = path(segment.base, ".idx");
+    uint64_t size = std::filesystem::file_size(indexPath, error);
+    if (error || !readRange(indexPath, 0, size - size % sizeof(IndexEntry), buffer)) return segment.index;
+    for (size_t offset = 0; offset < buffer.size(); offset += sizeof(IndexEntry)) {
+        IndexEntry entry;
+        std::memcpy(&entry, buffer.data() + offset, sizeof(entry));
+        const IndexEntry* previous = segment.index.empty() ? nullptr : &segment.index.back();
+        if (entry.sequence < segment.base || entry.position >= segment.bytes ||
+            (previous && (entry.sequence <= previous->sequence || entry.position <= previous->position))) {
+            break;
+        }
+        segment.index.push_back(entry);
+    }
+    return segment.index;
+}
+
+// Decompresses block by block from the chosen one to the block table, checking each block's
+// checksum and that it lands where the table says.
+bool ConversationLog::readRecords(Segment& segment, size_t entry, std::vector<char>& buffer) {
+    const std::vector<IndexEntry>& index = indexOf(segment);
+    if (!segment.compressed) {
+        uint64_t position = entry < index.size() ? index[entry].position : 0;
+        return readRange(path(segment.base, ".seg"), position, segment.bytes - position, buffer);
+    }
+    if (index.empty()) return false;
+    if (entry >= index.size()) entry = 0;
+    MessageLog::Decompressed& cached = owner.decompressed;
+    {
+        std::lock_guard<std::mutex> lock(owner.mutex);
+        if (cached.valid && cached.id == logId && cached.base == segment.base && cached.entry <= entry) {
+            uint64_t skip = index[entry].position - index[cached.entry].position;
+            buffer.assign(cached.records.begin() + static_cast<std::ptrdiff_t>(skip), cached.records.end());
+            return true;
+        }
+    }
+    uint64_t tableStart = segment.bytes - sizeof(SegmentFooter) - index.size() * sizeof(BlockEntry);
+    std::vector<char> file;
+    if (!readRange(path(segment.base, ".segz"), segment.blocks[entry], tableStart - segment.blocks[entry], file)) {
+        return false;
+    }
+    buffer.resize(segment.rawBytes - index[entry].position);
+    size_t offset = 0;
+    size_t out = 0;
+    for (size_t block = entry; block < index.size(); ++block) {
+        BlockHeader header;
+        if (file.size() - offset < sizeof(header) || index[block].position - index[entry].position != out) return false;
+        std::memcpy(&header, file.data() + offset, sizeof(header));
+        const char* data = file.data() + offset + sizeof(header);
+        if (header.length > file.size() - offset - sizeof(header) || header.rawLength > buffer.size() - out ||
+            crc32Update(0, data, header.length) != header.checksum ||
+            !lz4Decompress(data, header.length, buffer.data() + out, header.rawLength)) {
+            return false;
+        }
+        offset += sizeof(header) + header.length;
+        out += header.rawLength;
+    }
+    if (offset != file.size() || out != buffer.size()) return false;
+    std::lock_guard<std::mutex> lock(owner.mutex);
+    cached.records = buffer;
+    cached.id = logId;
+    cached.base = segment.base;
+    cached.entry = entry;
+    cached.valid = true;
+    return true;
+}
+
+uint64_t ConversationLog::rawSize(Segment& segment) {
+    if (!segment.compressed) return segment.bytes;
+    indexOf(segment);
+    return segment.rawBytes;
+}
+
+// Checks the records and lays out the index, or the blocks, in one pass first.
+bool ConversationLog::writeSegment(uint64_t base, const std::vector<char>& records, bool compress, Segment& written) {
+    std::vector<IndexEntry> index;
+    uint64_t next = 0;
+    uint64_t interval = compress ? MessageLog::kBlockBytes : MessageLog::kIndexInterval;
+    for (size_t offset = 0; offset < records.size();) {
+        RecordHeader header;
+        if (records.size() - offset < sizeof(header)) return false;
+        std::memcpy(&header, records.data() + offset, sizeof(header));
+        const char* payload = records.data() + offset + sizeof(header);
+        if (header.length > records.size() - offset - sizeof(header) || (offset > 0 && header.sequence != next) ||
+            recordChecksum(header, payload) != header.checksum) {
+            return false;
+        }
+        if (index.empty() || offset - index.back().position >= interval) {
+            index.push_back(IndexEntry{header.sequence, header.timestamp, offset});
+        }
+        offset += sizeof(header) + header.length;
+        next = header.sequence + 1;
+    }
+    if (index.empty()) return false;
+
+    std::string stem = segmentStem(owner.logDirectory(logId), base);
+    std::vector<uint64_t> blocks;
+    std::vector<char> file;
+    bool ok;
+    if (compress) {
+        std::vector<BlockEntry> table;
+        for (size_t i = 0; i < index.size(); ++i) {
+            uint64_t begin = index[i].position;
+            uint64_t end = i + 1 < index.size() ? index[i + 1].position : records.size();
+            size_t at = file.size();
+            file.resize(at + sizeof(BlockHeader) + lz4Bound(end - begin));
+            char* data = file.data() + at + sizeof(BlockHeader);
+            BlockHeader header{0, 0, static_cast<uint32_t>(end - begin), 0};
+            header.length = static_cast<uint32_t>(lz4Compress(records.data() + begin, end - begin, data));
+            header.checksum = crc32Update(0, data, header.length);
+            std::memcpy(file.data() + at, &header, sizeof(header));
+            file.resize(at + sizeof(header) + header.length);
+            blocks.push_back(at);
+            table.push_back(BlockEntry{index[i].sequence, index[i].timestamp, at, begin});
+        }
+        const char* tableBytes = reinterpret_cast<const char*>(table.data());
+        size_t tableSize = table.size() * sizeof(BlockEntry);
+        SegmentFooter footer{records.size(), next, static_cast<uint32_t>(table.size()), crc32Update(0, tableBytes, tableSize)};
+        file.insert(file.end(), tableBytes, tableBytes + tableSize);
+        file.insert(file.end(), reinterpret_cast<const char*>(&footer), reinterpret_cast<const char*>(&footer + 1));
+        ok = writeFile(stem + ".segz.tmp", file.data(), file.size());
+    } else {
+        ok = writeFile(stem + ".seg.tmp", records.data(), records.size()) &&
+             writeFile(stem + ".idx.tmp", index.data(), index.size() * sizeof(IndexEntry));
+    }
+    if (!ok) {
+        std::cerr << "Cannot rewrite " << stem << (compress ? ".segz: " : ".seg: ") << std::strerror(errno) << std::endl;
+        std::remove((stem + (compress ? ".segz.tmp" : ".seg.tmp")).c_str());
+        std::remove((stem + ".idx.tmp").c_str());
+        return false;
+    }
+    written = Segment();
+    written.base = base;
+    written.bytes = compress ? file.size() : records.size();
+    written.index = std::move(index);
+    written.indexed = true;
+    written.compressed = compress;
+    written.rawBytes = compress ? records.size() : 0;
+    written.next = compress ? next : 0;
+    written.blocks = std::move(blocks);
+    return true;
+}
+
+// When the raw pair is installed the old index goes first: a missing index only makes scans
+// start at the top, whereas a stale one would send them to the wrong offsets.
+bool ConversationLog::installSegment(Segment& segment, Segment& written, std::vector<Segment>& replaced) {
+    std::string stem = segmentStem(owner.logDirectory(logId), segment.base);
+    bool last = &segment == &segments.back();
+    if (last) owner.closeWriter(logId);
+    bool ok;
+    if (written.compressed) {
+        ok = std::rename((stem + ".segz.tmp").c_str(), (stem + ".segz").c_str()) == 0;
+    } else {
+        if (!segment.compressed) std::remove((stem + ".idx").c_str());
+        ok = std::rename((stem + ".seg.tmp").c_str(), (stem + ".seg").c_str()) == 0;
+        if (ok) std::rename((stem + ".idx.tmp").c_str(), (stem + ".idx").c_str());
+    }
+    if (!ok) {
+        std::cerr << "Cannot rewrite " << stem << (written.compressed ? ".segz: " : ".seg: ") << std::strerror(errno)
+                  << std::endl;
+        std::remove((stem + (written.compressed ? ".segz.tmp" : ".seg.tmp")).c_str());
+        std::remove((stem + ".idx.tmp").c_str());
+        if (!segment.compressed && !written.compressed) {
+            // The old index may be gone already.
+            segment.index.clear();
+            if (last) lastIndexed = 0;
+        }
+        return false;
+    }
+    forget(segment);
+    if (segment.compressed != written.compressed) replaced.push_back(segment);
+    segment = std::move(written);
+    if (!segment.compressed && last) lastIndexed = segment.index.back().position;
+    return true;
+}
+
+// The new file is synced and renamed over the old one, then the directory is synced before the
+// other kind of file is removed, so a crash never leaves the records in neither.
+bool ConversationLog::replace(Segment& segment, const std::vector<char>& records, bool compress) {
+    Segment written;
+    std::vector<Segment> replaced;
+    if (!writeSegment(segment.base, records, compress, written) || !installSegment(segment, written, replaced)) {
+        return false;
+    }
+    syncPath(owner.logDirectory(logId), true);
+    for (const Segment& old : replaced) remove(old);
+    return true;
+}
+
+void ConversationLog::remove(const Segment& segment) {
+    std::error_code error;
+    forget(segment);
+    if (segment.compressed) {
+        std::filesystem::remove(path(segment.base, ".segz"), error);
+    } else {
+        std::filesystem::remove(path(segment.base, ".seg"), error);
+        std::filesystem::remove(path(segment.base, ".idx"), error);
+    }
+}
+
+void ConversationLog::forget(const Segment& segment) {
+    std::lock_guard<std::mutex> lock(owner.mutex);
+    MessageLog::Decompressed& cached = owner.decompressed;
+    if (cached.valid && cached.id == logId && cached.base == segment.base) {
+        cached.valid = false;
+        std::vector<char>().swap(cached.records);
+    }
+}
+
+// Runs the rewrites back to back; only the ones that compress count.
+size_t ConversationLog::compress(uint64_t& rawBytes, uint64_t& storedBytes, bool idle) {
+    size_t written = 0;
+    for (Rewrite rewrite = planRewrite(idle); rewrite.kind != Rewrite::Kind::None; rewrite = planRewrite(idle, &rewrite)) {
+        if (writeRewrite(rewrite) && installRewrite(rewrite) && rewrite.kind != Rewrite::Kind::Head) {
+            rawBytes += rewrite.rawBytes;
+            storedBytes += rewrite.storedBytes;
+            ++written;
+        }
+        finishRewrite(rewrite);
+    }
+    return written;
+}
+
+// The tail stays raw while appends keep coming, so appending never waits on compression. A quiet
+// tail also waits until it holds a quarter of a segment, so a slow conversation does not have
+// the compressed segment before it decompressed, merged and synced again every pass.
+bool ConversationLog::compressible(size_t s, bool idle) {
+    const Segment& segment = segments[s];
+    if (segment.compressed || segment.bytes == 0) return false;
+    return s + 1 < segments.size() || idle || (!appended && segment.bytes >= owner.segmentLimit / 4);
+}
+
+// The head comes first, so no segment about to be cut down is compressed first. Each later call
+// starts past the segments the previous rewrite took, whether or not it was installed, so a
+// damaged segment is passed over rather than tried again; only a head just cut down is looked at
+// once more, to be compressed. The segments are copied with their indexes read, so writing
+// reads nothing the log may change.
+ConversationLog::Rewrite ConversationLog::planRewrite(bool idle, const Rewrite* previous) {
+    load();
+    Rewrite rewrite;
+    uint64_t from = 0;
+    if (previous) {
+        from = previous->kind == Rewrite::Kind::Head    ? previous->source.base
+               : previous->kind == Rewrite::Kind::Merge ? previous->tail.base + 1
+                                                        : previous->source.base + 1;
+    }
+    if (!previous && !segments.empty() && startPosition > 0 && (segments.size() > 1 || idle || !appended) &&
+        startPosition >= rawSize(segments.front()) / 2) {
+        indexOf(segments.front());
+        rewrite.kind = Rewrite::Kind::Head;
+        rewrite.source = segments.front();
+        rewrite.startPosition = startPosition;
+        rewrite.compress = segments.front().compressed;
+        return rewrite;
+    }
+    for (size_t s = 0; s < segments.size(); ++s) {
+        if (segments[s].base < from || !compressible(s, idle)) continue;
+        indexOf(segments[s]);
+        rewrite.kind = Rewrite::Kind::Compress;
+        rewrite.source = segments[s];
+        rewrite.compress = true;
+        if (s + 1 == segments.size() && s > 0 && segments[s - 1].compressed &&
+            rawSize(segments[s - 1]) + segments[s].bytes <= owner.segmentLimit) {
+            rewrite.kind = Rewrite::Kind::Merge;
+            rewrite.tail = std::move(rewrite.source);
+            rewrite.source = segments[s - 1];
+        }
+        return rewrite;
+    }
+    appended = false;
+    return rewrite;
+}
+
+// A head is read from the index entry closest before its first kept record; a merge reads the
+// compressed segment and the tail whole and writes them as one.
+bool ConversationLog::writeRewrite(Rewrite& rewrite) {
+    Segment& source = rewrite.source;
+    std::vector<char> records;
+    if (rewrite.kind == Rewrite::Kind::Head) {
+        size_t entry = SIZE_MAX;
+        uint64_t position = 0;
+        for (size_t i = 0; i < source.index.size() && source.index[i].position <= rewrite.startPosition; ++i) {
+            entry = i;
+            position = source.index[i].position;
+        }
+        if (!readRecords(source, entry, records) ||
+            records.size() < rewrite.startPosition - position + sizeof(RecordHeader)) {
+            return false;
+        }
+        records.erase(records.begin(), records.begin() + static_cast<std::ptrdiff_t>(rewrite.startPosition - position));
+    } else {
+        if (!readRecords(source, SIZE_MAX, records)) return false;
+        rewrite.rawBytes = records.size();
+        if (rewrite.kind == Rewrite::Kind::Merge) {
+            std::vector<char> tail;
+            if (!readRecords(rewrite.tail, SIZE_MAX, tail)) return false;
+            rewrite.rawBytes = tail.size();
+            records.insert(records.end(), tail.begin(), tail.end());
+        }
+    }
+    rewrite.ready = writeSegment(source.base, records, rewrite.compress, rewrite.written);
+    return rewrite.ready;
+}
+
+// Appends only ever grow or close the tail, and only compaction replaces segments, so a
+// segment whose size is unchanged still holds the records the new file was made from.
+bool ConversationLog::installRewrite(Rewrite& rewrite) {
+    if (!rewrite.ready) return false;
+    auto unchanged = [](const Segment& live, const Segment& planned) {
+        return live.base == planned.base && live.bytes == planned.bytes && live.compressed == planned.compressed;
+    };
+    auto found = std::find_if(segments.begin(), segments.end(),
+                              [&](const Segment& segment) { return segment.base == rewrite.source.base; });
+    if (found == segments.end() || !unchanged(*found, rewrite.source)) return false;
+    size_t s = static_cast<size_t>(found - segments.begin());
+    if (rewrite.kind == Rewrite::Kind::Head && (s != 0 || startPosition != rewrite.startPosition)) return false;
+    if (rewrite.kind == Rewrite::Kind::Merge && (s + 2 != segments.size() || !unchanged(segments.back(), rewrite.tail))) {
+        return false;
+    }
+
+    auto stored = [](const Segment& segment) {
+        return segment.bytes + (segment.compressed ? 0 : segment.index.size() * sizeof(IndexEntry));
+    };
+    Segment& segment = *found;
+    uint64_t before = rewrite.kind == Rewrite::Kind::Compress ? 0 : stored(segment);
+    if (!installSegment(segment, rewrite.written, rewrite.replaced)) return false;
+    uint64_t after = stored(segment);
+    if (rewrite.kind == Rewrite::Kind::Head) {
+        startPosition = 0;
+        rewrite.freedBytes = before > after ? before - after : 0;
+    } else {
+        rewrite.storedBytes = after > before ? after - before : 0;
+    }
+    if (rewrite.kind == Rewrite::Kind::Merge) {
+        owner.closeWriter(logId);
+        rewrite.replaced.push_back(std::move(segments.back()));
+        segments.pop_back();
+        owner.markDirectory(logId);
+    }
+    rewrite.installed = true;
+    return true;
+}
+
+// As in replace(), nothing is removed before the directory naming the new file is synced.
+void ConversationLog::finishRewrite(Rewrite& rewrite) {
+    if (!rewrite.installed) {
+        if (!rewrite.ready) return;
+        std::string stem = segmentStem(owner.logDirectory(logId), rewrite.source.base);
+        std::remove((stem + (rewrite.compress ? ".segz.tmp" : ".seg.tmp")).c_str());
+        std::remove((stem + ".idx.tmp").c_str());
+        return;
+    }
+    syncPath(owner.logDirectory(logId), true);
+    for (const Segment& segment : rewrite.replaced) remove(segment);
+    if (!rewrite.replaced.empty()) owner.markDirectory(logId);
+}
+
+// Reads from the chosen index entry to the end of the segment in one go; segments are small.
+bool ConversationLog::scan(size_t s, uint64_t from, bool byTime,
+                           const std::function<bool(const LogRecord&, uint64_t end)>& fn) {
+    Segment& segment = segments[s];
+    const std::vector<IndexEntry>& index = indexOf(segment);
+    size_t chosen = SIZE_MAX;
+    uint64_t position = 0;
+    uint64_t sequence = segment.base;
+    for (size_t i = 0; i < index.size(); ++i) {
+        if (byTime ? index[i].timestamp >= static_cast<int64_t>(from) : index[i].sequence > from) break;
+        chosen = i;
+        position = index[i].position;
+        sequence = index[i].sequence;
+    }
+    std::vector<char> buffer;
+    if (!readRecords(segment, chosen, buffer)) {
+        return false;
+    }
+    size_t offset = 0;
+    while (offset < buffer.size()) {
+        RecordHeader header;
+        if (buffer.size() - offset < sizeof(header)) return false;
+        std::memcpy(&header, buffer.data() + offset, sizeof(header));
+        const char* payload = buffer.data() + offset + sizeof(header);
+        // A rewritten head segment starts with whichever message was the first kept.
+        if (position + offset == 0 && header.sequence > sequence) sequence = header.sequence;
+        if (header.length > buffer.size() - offset - sizeof(header) || header.sequence != sequence ||
+            recordChecksum(header, payload) != header.checksum) {
+            return false;
+        }
+        offset += sizeof(header) + header.length;
+        LogRecord record{header.sequence, header.timestamp, header.sender, std::string_view(payload, header.length)};
+        if (!fn(record, position + offset)) return true;
+        ++sequence;
+    }
+    return true;
+}
+
+// Segment files are named by their base sequence.
+std::string ConversationLog::path(uint64_t base, const char* extension) const {
+    return segmentStem(owner.logDirectory(logId), base) + extension;
+}
+
+MessageLog::MessageLog(std::string directory, uint64_t segmentBytes)
+    : root(std::move(directory)), segmentLimit(segmentBytes) {
+    std::error_code error;
+    std::filesystem::create_directories(root, error);
+}
+
+MessageLog::~MessageLog() {
+    for (auto& [id, writer] : writers) {
+        ::close(writer.segment);
+        ::close(writer.index);
+    }
+}
+
+// Syncs open tails through their descriptors and everything else by path, then the directories
+// whose entries changed.
+bool MessageLog::sync() {
+    std::lock_guard<std::mutex> lock(mutex);
+    bool ok = true;
+    for (const auto& [id, base] : dirty) {
+        auto open = writers.find(id);
+        if (open != writers.end() && open->second.base == base) {
+            ok &= ::fdatasync(open->second.segment) == 0;
+            ok &= ::fdatasync(open->second.index) == 0;
+            continue;
+        }
+        std::string stem = segmentStem(logDirectory(id), base);
+        ok &= syncPath(stem + ".seg", false);
+        ok &= syncPath(stem + ".idx", false);
+    }
+    for (uint32_t id : dirtyDirectories) {
+        ok &= syncPath(logDirectory(id), true);
+    }
+    if (rootDirty) ok &= syncPath(root, true);
+    dirty.clear();
+    dirtyDirectories.clear();
+    rootDirty = false;
+    return ok;
+}
+
+UnsyncedPaths MessageLog::takeUnsynced() {
+    std::lock_guard<std::mutex> lock(mutex);
+    UnsyncedPaths paths;
+    paths.root = root;
+    paths.segments.swap(dirty);
+    paths.directories.swap(dirtyDirectories);
+    paths.rootDirectory = rootDirty;
+    rootDirty = false;
+    return paths;
+}
+
+// Files first, then the directories that name them. Open tails are synced through a descriptor
+// of their own.
+bool MessageLog::sync(const UnsyncedPaths& paths) {
+    bool ok = true;
+    for (const auto& [id, base] : paths.segments) {
+        std::string stem = segmentStem(paths.root + "/" + std::to_string(id), base);
+        ok &= syncPath(stem + ".seg", false);
+        ok &= syncPath(stem + ".idx", false);
+    }
+    for (uint32_t id : paths.directories) {
+        ok &= syncPath(paths.root + "/" + std::to_string(id), true);
+    }
+    if (paths.rootDirectory) ok &= syncPath(paths.root, true);
+    return ok;
+}
+
+void UnsyncedPaths::merge(UnsyncedPaths&& other) {
+    if (root.empty()) root = std::move(other.root);
+    segments.merge(other.segments);
+    directories.merge(other.directories);
+    rootDirectory |= other.rootDirectory;
+}
+
+// Reuses the open tail when it is still the tail; otherwise opens the new one, closing the least
+// recently used writer if too many are open. Writers other appends are using stay open, so the
+// limit can be exceeded by the appends in progress.
+MessageLog::Writer* MessageLog::writer(uint32_t id, uint64_t base) {
+    auto open = writers.find(id);
+    if (open != writers.end()) {
+        if (open->second.base == base) {
+            writerLru.splice(writerLru.begin(), writerLru, open->second.lruPosition);
+            ++open->second.users;
+            return &open->second;
+        }
+        closeWriterLocked(id);
+    }
+    if (writers.size() >= kOpenWriters) {
+        for (auto victim = writerLru.rbegin(); victim != writerLru.rend(); ++victim) {
+            if (writers.at(*victim).users == 0) {
+                closeWriterLocked(*victim);
+                break;
+            }
+        }
+    }
+    std::string stem = segmentStem(logDirectory(id), base);
+    int segment = ::open((stem + ".seg").c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    int index = segment < 0 ? -1 : ::open((stem + ".idx").c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (index < 0) {
+        std::cerr << "Cannot open message log " << stem << ".seg: " << std::strerror(errno) << std::endl;
+        if (segment >= 0) ::close(segment);
+        return nullptr;
+    }
+    writerLru.push_front(id);
+    return &(writers[id] = Writer{base, segment, index, writerLru.begin(), 1});
+}
+
+void MessageLog::closeWriter(uint32_t id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    closeWriterLocked(id);
+}
+
+void MessageLog::closeWriterLocked(uint32_t id) {
+    auto open = writers.find(id);
+    if (open == writers.end()) return;
+    ::close(open->second.segment);
+    ::close(open->second.index);
+    writerLru.erase(open->second.lruPosition);
+    writers.erase(open);
+}
+
+void MessageLog::markSegment(uint32_t id, uint64_t base) {
+    std::lock_guard<std::mutex> lock(mutex);
+    dirty.emplace(id, base);
+}
+
+void MessageLog::markDirectory(uint32_t id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    dirtyDirectories.insert(id);
+}
+
+std::string MessageLog::logDirectory(uint32_t id) const {
+    return root + "/" + std::to_string(id);
+}
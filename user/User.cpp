@@ -2,48 +2,51 @@
 #include <functional>
 
 // Represents a chat user with their profile, friends, and chat history.
-User::User(const std::string& username, const std::string& password)
-    : username(username), passwordHash(std::to_string(std::hash<std::string>{}(password))) {}
+User::User(UserId id) : id(id) {}
 
-// Returns the username of the user.
-const std::string& User::getUsername() const {
-    return username;
+// Hashes the password the way it is stored.
+std::string User::hashPassword(const std::string& password) {
+    return std::to_string(std::hash<std::string>{}(password));
+}
+
+// Returns the ID of the user.
+UserId User::getId() const {
+    return id;
 }
 
 // Checks if the provided password matches the stored hashed password.
 bool User::checkPassword(const std::string& password) const {
-    return passwordHash == std::to_string(std::hash<std::string>{}(password));
+    return passwordHash == hashPassword(password);
 }
 
 // Checks if the user is friends with the specified other user.
-bool User::hasFriend(const std::string& other) const {
+bool User::hasFriend(UserId other) const {
     return friends.count(other) > 0;
 }
 
 // Checks if there is a pending friend request from the specified other user.
-bool User::hasPendingRequestFrom(const std::string& other) const {
+bool User::hasPendingRequestFrom(UserId other) const {
     return incomingRequests.count(other) > 0;
 }
 
 // Checks if the user has sent a friend request to the specified other user.
-bool User::hasSentRequestTo(const std::string& other) const {
+bool User::hasSentRequestTo(UserId other) const {
     return outgoingRequests.count(other) > 0;
 }
 
 // Adds the specified user to the outgoing friend requests.
-void User::sendFriendRequestTo(const std::string& other) {
+void User::sendFriendRequestTo(UserId other) {
     outgoingRequests.insert(other);
 }
 
 // Adds the specified user to the incoming friend requests.
-void User::receiveFriendRequestFrom(const std::string& other) {
+void User::receiveFriendRequestFrom(UserId other) {
     incomingRequests.insert(other);
 }
 
 // Accepts a pending friend request from the specified other user, adding them to friends.
-bool User::acceptFriendRequestFrom(const std::string& other) {
-    if (incomingRequests.count(other)) {
-        incomingRequests.erase(other);
+bool User::acceptFriendRequestFrom(UserId other) {
+    if (incomingRequests.erase(other)) {
         friends.insert(other);
         return true;
     }
@@ -51,39 +54,37 @@ bool User::acceptFriendRequestFrom(const std::string& other) {
 }
 
 // Rejects a pending friend request from the specified sender.
-void User::rejectFriendRequestFrom(const std::string& sender_username) {
-    incomingRequests.erase(sender_username);
+void User::rejectFriendRequestFrom(UserId sender) {
+    incomingRequests.erase(sender);
 }
 
 // Marks an outgoing friend request as completed and adds the user to friends.
-void User::completeOutgoingFriendRequest(const std::string& other) {
+void User::completeOutgoingFriendRequest(UserId other) {
     outgoingRequests.erase(other);
     friends.insert(other);
 }
 
 // Cancels an outgoing friend request.
-void User::cancelOutgoingFriendRequest(const std::string& other) {
+void User::cancelOutgoingFriendRequest(UserId other) {
     outgoingRequests.erase(other);
 }
 
 // Returns a constant reference to the set of friends.
-const std::unordered_set<std::string>& User::getFriends() const {
+const UserIdSet& User::getFriends() const {
     return friends;
 }
 
 // Returns a constant reference to the set of incoming friend requests.
-const std::unordered_set<std::string>& User::getIncomingFriendRequests() const {
+const UserIdSet& User::getIncomingFriendRequests() const {
     return incomingRequests;
 }
 
-// Stores a message in the chat history with a specific partner.
-void User::storeMessage(const std::string& chatPartner, const std::string& sender, const std::string& content) {
-    chatHistory[chatPartner].push_back({sender, content});
+// Records a conversation partner.
+void User::addChatPartner(UserId partner) {
+    chatPartners.insert(partner);
 }
 
-// Returns a constant reference to the chat history with a specific friend.
-const std::vector<Message>& User::getChatHistoryWith(const std::string& friendUsername) const {
-    static const std::vector<Message> empty;
-    auto it = chatHistory.find(friendUsername);
-    return it != chatHistory.end() ? it->second : empty;
+// Returns the users this user has conversations with.
+const UserIdSet& User::getChatPartners() const {
+    return chatPartners;
 }
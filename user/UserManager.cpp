@@ -1,202 +1,751 @@
 #include "../include/user/UserManager.hpp"
-#include <fstream>
+#include "../include/user/UserSnapshot.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <deque>
 #include <filesystem>
-#include "../include/nlohmann/json.hpp"
 #include <iostream>
+#include <limits>
+#include <mutex>
 
-using json = nlohmann::json;
+#include <pthread.h>
+#include <sched.h>
 
-// Initializes UserManager, ensuring the user data file exists and is valid, then loads data.
-UserManager::UserManager(const std::string& filename) : dataFile(filename) {
-    if (!std::filesystem::exists(dataFile) || std::filesystem::file_size(dataFile) == 0) {
-        std::ofstream outFile(dataFile);
-        if (outFile.is_open()) {
-            outFile << "{}";
-        }
-    } else {
-        std::ifstream checkFile(dataFile);
-        std::string content((std::istreambuf_iterator<char>(checkFile)),
-                            std::istreambuf_iterator<char>());
-        checkFile.close();
-        try {
-            nlohmann::json::parse(content);
-        } catch (const nlohmann::json::parse_error& e) {
-            std::cerr << "Corrupted JSON file detected: " << dataFile << ". Overwriting with empty object. Error: " << e.what() << std::endl;
-            std::ofstream outFile(dataFile);
-            if (outFile.is_open()) {
-                outFile << "{}";
-            }
+namespace {
+// Returns the wall-clock time messages are stamped with.
+int64_t currentTimeMillis() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// Sequence of the newest record this thread logged; see takeLoggedSequence().
+thread_local uint64_t loggedSequence = 0;
+} // namespace
+
+// Loads the latest snapshot, then replays the write-ahead log on top of it.
+UserManager::UserManager(const std::string& filename, const PersistenceOptions& persistence, size_t checkpointInterval)
+    : conversations(filename + ".history", users, &historyCache), dataFile(filename), wal(filename + ".wal", persistence),
+      checkpointInterval(checkpointInterval) {
+    bool outdated = false;
+    uint64_t snapshotSequence = loadFromFile(outdated);
+    wal.advanceTo(snapshotSequence);
+    size_t replayed = wal.replay(snapshotSequence, [this](const WalRecord& record) { applyRecord(record); });
+    if (replayed > 0) {
+        std::cout << "Replayed " << replayed << " logged change(s) from " << dataFile << ".wal." << std::endl;
+    }
+    // JSON carries its messages; rewriting it now leaves the copies in the message logs.
+    if (outdated && persistence.durability != Durability::Memory) {
+        checkpoint();
+    }
+}
+
+// Folds the log into a fresh snapshot on clean shutdown.
+UserManager::~UserManager() {
+    finishCheckpoint();
+    if (checkpointThread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(checkpointMutex);
+            checkpointStopping = true;
         }
+        checkpointWake.notify_one();
+        checkpointThread.join();
+    }
+    if (wal.durability() != Durability::Memory && wal.recordCount() > 0) {
+        checkpoint();
     }
-    loadFromFile();
 }
 
-// Loads user data from the JSON file into memory.
-void UserManager::loadFromFile() {
-    std::ifstream inFile(dataFile);
-    if (!inFile.is_open()) return;
+// Loads user data from the snapshot file into memory; messages stay in their logs. A JSON file
+// (a users.json from before binary snapshots) is flagged for rewriting.
+uint64_t UserManager::loadFromFile(bool& outdated) {
+    std::error_code sizeError;
+    if (!std::filesystem::exists(dataFile) || std::filesystem::file_size(dataFile, sizeError) == 0) {
+        return 0;
+    }
+
+    uint64_t sequence = 0;
+    std::string error;
+    bool binary = UserSnapshot::binaryVersion(dataFile) != 0;
+    bool loaded = binary ? UserSnapshot::readBinary(dataFile, users, conversations, sequence, error)
+                         : UserSnapshot::readJson(dataFile, users, conversations, sequence, error);
+    if (loaded) {
+        outdated = !binary;
+        return sequence;
+    }
+
+    // Keep the damaged file for inspection instead of letting the next checkpoint overwrite it.
+    std::string quarantine = dataFile + ".corrupt";
+    std::cerr << "Corrupted " << (binary ? "snapshot" : "JSON file") << " detected: " << dataFile << " (" << error
+              << "). Starting empty; the original was moved to " << quarantine << "." << std::endl;
+    std::error_code renameError;
+    std::filesystem::rename(dataFile, quarantine, renameError);
+    conversations.clear();
+    users.clear();
+    return 0;
+}
 
-    std::string content((std::istreambuf_iterator<char>(inFile)),
-                        std::istreambuf_iterator<char>());
-    inFile.close();
+UserManager::PairLock::PairLock(const UserManager& manager, UserId a, UserId b)
+    : first(&manager.stripeOf(a)), second(&manager.stripeOf(b)) {
+    if (second < first) std::swap(first, second);
+    if (second == first) second = nullptr;
+    first->lock();
+    if (second) second->lock();
+}
 
-    if (content.empty()) {
+UserManager::PairLock::~PairLock() {
+    if (second) second->unlock();
+    first->unlock();
+}
+
+UserManager::AllLock::AllLock(const UserManager& manager) : manager(manager) {
+    for (Stripe& stripe : manager.stripes) stripe.mutex.lock();
+}
+
+UserManager::AllLock::~AllLock() {
+    for (size_t i = kStripes; i-- > 0;) manager.stripes[i].mutex.unlock();
+}
+
+// Saves the current state of user data as a binary snapshot.
+bool UserManager::saveToFile() {
+    AllLock lock(*this);
+    return writeSnapshot();
+}
+
+// The snapshot is written next to the old one and renamed over it, so a crash mid-write never
+// leaves a truncated file behind.
+bool UserManager::writeSnapshot() {
+    // The log is truncated right after this, so the snapshot and the messages it counts must be
+    // on disk before it replaces the old one.
+    bool sync = wal.durability() != Durability::Memory;
+    if (sync && !MessageLog::sync(unsyncedPaths)) {
+        std::cerr << "Failed to sync message logs under " << dataFile << ".history" << std::endl;
+        return false;
+    }
+    unsyncedPaths = UnsyncedPaths();
+    if (sync && !conversations.sync()) {
+        std::cerr << "Failed to sync message logs under " << dataFile << ".history" << std::endl;
+        return false;
+    }
+    if (!UserSnapshot::writeBinary(dataFile, users, conversations, wal.lastSequence(), sync)) {
+        std::cerr << "Failed to write snapshot " << dataFile << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void UserManager::checkpoint() {
+    AllLock lock(*this);
+    checkpointLocked();
+}
+
+// Writes a snapshot covering every logged mutation, then drops the log. If the process dies
+// in between, the snapshot's sequence number makes replay skip the records it already holds.
+// In Memory mode nothing is persisted, so there is nothing to fold.
+void UserManager::checkpointLocked() {
+    finishCheckpoint();
+    if (wal.durability() == Durability::Memory) {
+        wal.reset();
         return;
     }
+    // A failed write keeps the log: it still holds the only copy of those changes.
+    if (writeSnapshot()) {
+        wal.reset();
+    }
+}
 
-    nlohmann::json j;
-    try {
-        j = nlohmann::json::parse(content);
-    } catch (const nlohmann::json::parse_error& e) {
-        std::cerr << "JSON parse error in " << dataFile << ": " << e.what() << std::endl;
+// The capture copies two arrays of pointers into the job's lists and swaps the message log's
+// unsynced sets out. Records up to the job's sequence go to the retired log file, which the
+// thread deletes once the snapshot covering them is in place.
+void UserManager::startCheckpoint() {
+    if (wal.durability() == Durability::Memory) {
+        wal.reset();
+        return;
+    }
+    if (checkpointRunning) return;
+    auto started = std::chrono::steady_clock::now();
+    uint64_t sequence = wal.lastSequence();
+    // Fails only while the log an earlier checkpoint could not finish is still there.
+    if (!wal.rotate()) {
+        checkpointLocked();
         return;
     }
+    if (!checkpointThread.joinable()) {
+        checkpointThread = std::thread(&UserManager::runCheckpoints, this);
+    }
+
+    // The thread leaves the job alone until it is marked pending.
+    CheckpointJob& job = checkpointJob;
+    job.users.assign(users.list().begin(), users.list().end());
+    job.histories.assign(conversations.list().begin(), conversations.list().end());
+    job.sequence = sequence;
+    job.paths = conversations.takeUnsynced();
+    job.started = started;
+    {
+        std::lock_guard<std::mutex> lock(checkpointMutex);
+        job.paths.merge(std::move(unsyncedPaths));
+        unsyncedPaths = UnsyncedPaths();
+        ++checkpointEpoch;
+        job.pending = true;
+        checkpointRunning = true;
+    }
+    checkpointWake.notify_one();
+
+    uint64_t pause = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started).count());
+    lastPauseMicros = pause;
+    if (pause > longestPauseMicros) longestPauseMicros = pause;
+}
+
+// One long-lived thread at idle priority: it only runs when no other thread wants the CPU, so
+// mutations never queue behind it, and starting a checkpoint costs no thread creation.
+void UserManager::runCheckpoints() {
+    sched_param priority{};
+    pthread_setschedparam(pthread_self(), SCHED_IDLE, &priority);
+
+    std::unique_lock<std::mutex> lock(checkpointMutex);
+    while (true) {
+        checkpointWake.wait(lock, [this] { return checkpointStopping || checkpointJob.pending; });
+        if (!checkpointJob.pending) break;
+        lock.unlock();
+        bool ok = writeCheckpoint(checkpointJob);
+        lock.lock();
+        lastCopiedUsers = shadows.size();
+        shadows.clear();
+        savedCounts.clear();
+        if (!ok) unsyncedPaths.merge(std::move(checkpointJob.paths));
+        checkpointJob.paths = UnsyncedPaths();
+        checkpointJob.pending = false;
+        lastCheckpointMillis = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                                                         std::chrono::steady_clock::now() - checkpointJob.started)
+                                                         .count());
+        checkpointRunning = false;
+        checkpointDone.notify_all();
+    }
+}
 
-    // Populate users map from parsed JSON data.
-    for (const auto& [username, data] : j.items()) {
-        User user(username, "");
-        user.passwordHash = data["passwordHash"].get<std::string>();
-        user.friends = data["friends"].get<std::unordered_set<std::string>>();
-        user.incomingRequests = data["incomingRequests"].get<std::unordered_set<std::string>>();
-        user.outgoingRequests = data["outgoingRequests"].get<std::unordered_set<std::string>>();
-
-        // Load chat history for the user.
-        for (const auto& [friendName, messages] : data["chatHistory"].items()) {
-            for (const auto& msg : messages) {
-                std::string sender = msg["sender"];
-                std::string content = msg["content"];
-                user.storeMessage(friendName, sender, content);
+// Each user and conversation is read under checkpointMutex, from what a mutation set aside if it
+// got there first, and stamped so later mutations leave it alone. Users are copied, so the live
+// ones are never read again once the lock is released.
+bool UserManager::writeCheckpoint(CheckpointJob& job) {
+    // The copies are freed before the checkpoint counts as finished, so the next one never waits
+    // on this low-priority thread to free them.
+    bool ok;
+    {
+        std::deque<User> copies;
+        std::vector<const User*> saved;
+        saved.reserve(job.users.size());
+        for (User* user : job.users) {
+            std::lock_guard<std::mutex> lock(checkpointMutex);
+            auto shadow = shadows.find(user);
+            if (shadow != shadows.end()) {
+                saved.push_back(&shadow->second);
+                continue;
             }
+            copies.push_back(savedState(*user));
+            user->checkpointEpoch = checkpointEpoch;
+            saved.push_back(&copies.back());
+        }
+        std::vector<UserSnapshot::ConversationState> states;
+        states.reserve(job.histories.size());
+        for (ChatHistory* history : job.histories) {
+            std::lock_guard<std::mutex> lock(checkpointMutex);
+            auto count = savedCounts.find(history);
+            uint64_t length = count != savedCounts.end() ? count->second : history->log.size();
+            history->checkpointEpoch = checkpointEpoch;
+            states.push_back(
+                UserSnapshot::ConversationState{history->participants[0], history->participants[1], history->log.id(), length});
         }
-        users.emplace(username, user);
+
+        // As in writeSnapshot(), the messages the snapshot counts must be durable before it is.
+        ok = MessageLog::sync(job.paths);
+        if (!ok) {
+            std::cerr << "Failed to sync message logs under " << dataFile << ".history" << std::endl;
+        } else if (!UserSnapshot::writeBinary(dataFile, users, saved, states, job.sequence, true)) {
+            std::cerr << "Failed to write snapshot " << dataFile << std::endl;
+            ok = false;
+        }
+    }
+    // A failed checkpoint keeps the retired log, so the next one runs synchronously and retries.
+    if (ok) {
+        wal.dropRetired();
+        ++backgroundCheckpoints;
+    } else {
+        ++failedCheckpoints;
     }
+    return ok;
 }
 
-// Saves the current state of user data to the JSON file.
-void UserManager::saveToFile() const {
-    nlohmann::json j;
+void UserManager::finishCheckpoint() {
+    std::unique_lock<std::mutex> lock(checkpointMutex);
+    checkpointDone.wait(lock, [this] { return !checkpointRunning; });
+}
+
+// Cheap when no checkpoint runs: one atomic load. Otherwise only the first change to each user
+// per checkpoint copies anything.
+void UserManager::preserve(User* user) {
+    if (!checkpointRunning) return;
+    std::lock_guard<std::mutex> lock(checkpointMutex);
+    if (user->checkpointEpoch == checkpointEpoch) return;
+    shadows.emplace(user, savedState(*user));
+    user->checkpointEpoch = checkpointEpoch;
+}
+
+// Before its first use the log's length is the one it was restored with, so reading it does not
+// load the log.
+void UserManager::preserve(const ChatHistory& history) const {
+    if (!checkpointRunning) return;
+    std::lock_guard<std::mutex> lock(checkpointMutex);
+    if (history.checkpointEpoch == checkpointEpoch) return;
+    savedCounts.emplace(&history, history.log.size());
+    history.checkpointEpoch = checkpointEpoch;
+}
+
+// Leaves out the chat partners, which the snapshot rebuilds from the conversations.
+User UserManager::savedState(const User& user) {
+    User state(user.id);
+    state.passwordHash = user.passwordHash;
+    state.friends = user.friends;
+    state.incomingRequests = user.incomingRequests;
+    state.outgoingRequests = user.outgoingRequests;
+    return state;
+}
+
+// Reads the checkpoint counters.
+CheckpointStats UserManager::checkpointStats() const {
+    CheckpointStats stats;
+    stats.checkpoints = backgroundCheckpoints;
+    stats.failures = failedCheckpoints;
+    stats.lastMillis = lastCheckpointMillis;
+    stats.lastPauseMicros = lastPauseMicros;
+    stats.longestPauseMicros = longestPauseMicros;
+    stats.lastCopiedUsers = lastCopiedUsers;
+    return stats;
+}
+
+// Asks the log when everything appended so far will be durable.
+uint64_t UserManager::takeLoggedSequence() {
+    uint64_t sequence = loggedSequence;
+    loggedSequence = 0;
+    return sequence;
+}
+
+std::future<void> UserManager::whenDurable(uint64_t sequence) {
+    return wal.whenDurable(sequence);
+}
+
+// Forwards the budget to the cache, which evicts at once if it shrank.
+void UserManager::setHistoryCacheLimit(size_t bytes) {
+    historyCache.setLimit(bytes);
+}
 
-    // Populate JSON object from users map.
-    for (const auto& [username, user] : users) {
-        nlohmann::json userJson;
-        userJson["passwordHash"] = user.passwordHash;
-        userJson["friends"] = user.friends;
-        userJson["incomingRequests"] = user.incomingRequests;
-        userJson["outgoingRequests"] = user.outgoingRequests;
+// Reads the cache's counters.
+HistoryCacheStats UserManager::historyCacheStats() const {
+    return historyCache.stats();
+}
 
-        // Save chat history.
-        for (const auto& [friendName, messages] : user.chatHistory) {
-            for (const auto& msg : messages) {
-                userJson["chatHistory"][friendName].push_back({
-                    {"sender", msg.sender},
-                    {"content", msg.content}
-                });
+void UserManager::setRetention(const RetentionPolicy& policy) {
+    AllLock lock(*this);
+    retention = policy;
+}
+
+// Times the hold rather than the wait for it: that is how long chat traffic could have queued.
+template <typename Work>
+void UserManager::compactionHold(UserId a, UserId b, Work work) {
+    PairLock lock(*this, a, b);
+    auto started = std::chrono::steady_clock::now();
+    work();
+    uint64_t micros = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started).count());
+    if (micros > longestHoldMicros) longestHoldMicros = micros;
+}
+
+// A pass lists every conversation and user when it starts, holding every stripe only for the
+// copy; both are stable in memory, since neither is ever removed while the server runs, and ones
+// added later wait for the next pass.
+bool UserManager::compact(size_t budget) {
+    auto started = std::chrono::steady_clock::now();
+    CompactionPass& pass = compaction;
+    if (!pass.active) {
+        AllLock lock(*this);
+        pass = CompactionPass();
+        pass.active = true;
+        pass.retention = retention;
+        pass.conversations.assign(conversations.list().begin(), conversations.list().end());
+        if (retention.maxUserBytes > 0) {
+            pass.users.assign(users.list().begin(), users.list().end());
+        }
+    }
+
+    int64_t now = currentTimeMillis();
+    size_t total = pass.conversations.size() + pass.users.size();
+    for (size_t end = std::min(total, pass.next + budget); pass.next < end; ++pass.next) {
+        if (pass.next < pass.conversations.size()) {
+            compactConversation(*pass.conversations[pass.next], now);
+        } else {
+            compactUser(*pass.users[pass.next - pass.conversations.size()]);
+        }
+    }
+
+    pass.workMicros += static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started).count());
+    if (pass.next < total) return false;
+    lastPassMicros = pass.workMicros;
+    ++compactionPasses;
+    pass = CompactionPass();
+    return true;
+}
+
+// Applies the message count and age limits in one trim, then rewrites the log, so no segment
+// about to be dropped is compressed first.
+void UserManager::compactConversation(ChatHistory& history, int64_t now) {
+    const RetentionPolicy& limits = compaction.retention;
+    if (limits.maxMessages > 0 || limits.maxAge.count() > 0) {
+        size_t count = limits.maxMessages > 0 ? limits.maxMessages : std::numeric_limits<size_t>::max();
+        int64_t cutoff = limits.maxAge.count() > 0
+                             ? now - std::chrono::duration_cast<std::chrono::milliseconds>(limits.maxAge).count()
+                             : std::numeric_limits<int64_t>::min();
+        compactionHold(history.participants[0], history.participants[1], [&] {
+            preserve(history);
+            size_t before = history.size();
+            reclaimedBytes += history.trim(count, cutoff, std::numeric_limits<uint64_t>::max());
+            trimmedMessages += before - history.size();
+        });
+    }
+    rewriteLog(history);
+}
+
+// The budget goes to the user's most recently active conversations first: they are kept whole
+// while it lasts, the one it runs out in loses its oldest messages, and older ones are emptied.
+// The conversations are shared, so this trims them for the other participants as well. Each is
+// measured and trimmed holding only its own participants' stripes, so messages sent meanwhile
+// may take a conversation past its share until the next pass.
+void UserManager::compactUser(const User& user) {
+    UserId id = user.getId();
+    std::vector<UserId> partners;
+    compactionHold(id, id, [&] {
+        const UserIdSet& chatPartners = user.getChatPartners();
+        partners.assign(chatPartners.begin(), chatPartners.end());
+    });
+    std::vector<std::pair<int64_t, ChatHistory*>> histories;
+    for (UserId partner : partners) {
+        ChatHistory* history = conversations.find(id, partner);
+        if (!history) continue;
+        int64_t lastActivity = 0;
+        compactionHold(id, partner, [&] {
+            preserve(*history);
+            lastActivity = history->lastActivity();
+        });
+        histories.emplace_back(lastActivity, history);
+    }
+    std::sort(histories.begin(), histories.end(),
+              [](const auto& a, const auto& b) { return a.first > b.first; });
+    uint64_t allowance = compaction.retention.maxUserBytes;
+    for (const auto& entry : histories) {
+        ChatHistory* history = entry.second;
+        bool trimmed = false;
+        compactionHold(history->participants[0], history->participants[1], [&] {
+            uint64_t bytes = history->logBytes();
+            if (bytes <= allowance) {
+                allowance -= bytes;
+                return;
             }
+            size_t before = history->size();
+            reclaimedBytes += history->trim(std::numeric_limits<size_t>::max(), std::numeric_limits<int64_t>::min(), allowance);
+            trimmedMessages += before - history->size();
+            allowance = 0;
+            trimmed = true;
+        });
+        if (trimmed) rewriteLog(*history);
+    }
+}
+
+// Planning and installing are bookkeeping; reading, compressing and syncing the new file happen
+// with no stripe held, while the participants carry on. A rewrite that appends overtook is
+// dropped, and the segment tried again next pass.
+void UserManager::rewriteLog(ChatHistory& history) {
+    ConversationLog& log = history.log;
+    ConversationLog::Rewrite rewrite;
+    const ConversationLog::Rewrite* previous = nullptr;
+    for (;;) {
+        compactionHold(history.participants[0], history.participants[1], [&] {
+            preserve(history);
+            rewrite = log.planRewrite(false, previous);
+        });
+        if (rewrite.kind == ConversationLog::Rewrite::Kind::None) return;
+        previous = &rewrite;
+        if (log.writeRewrite(rewrite)) {
+            compactionHold(history.participants[0], history.participants[1], [&] { log.installRewrite(rewrite); });
         }
+        log.finishRewrite(rewrite);
+        if (!rewrite.installed) continue;
+        if (rewrite.kind == ConversationLog::Rewrite::Kind::Head) {
+            reclaimedBytes += rewrite.freedBytes;
+        } else {
+            ++compressedSegments;
+            compressedRawBytes += rewrite.rawBytes;
+            compressedBytes += rewrite.storedBytes;
+        }
+    }
+}
+
+// Reads the compaction counters.
+CompactionStats UserManager::compactionStats() const {
+    CompactionStats stats;
+    stats.passes = compactionPasses;
+    stats.trimmedMessages = trimmedMessages;
+    stats.reclaimedBytes = reclaimedBytes;
+    stats.compressedSegments = compressedSegments;
+    stats.compressedRawBytes = compressedRawBytes;
+    stats.compressedBytes = compressedBytes;
+    stats.lastPassMicros = lastPassMicros;
+    stats.longestHoldMicros = longestHoldMicros;
+    return stats;
+}
+
+// Write-ahead: the record reaches the log before the in-memory state changes. Records of users
+// on different stripes may reach the log in one order and the state in the other, which replay
+// cannot tell apart: neither record depends on the other.
+bool UserManager::commit(WalRecord record, UserId first, UserId second) {
+    if (!log(record)) return false;
+    apply(record, first, second);
+    return true;
+}
+
+// The flag is only acted on once the caller has let go of its users.
+bool UserManager::log(WalRecord& record) {
+    uint64_t sequence = wal.append(record);
+    if (sequence == 0) {
+        checkpointDue = true;
+        return false;
+    }
+    loggedSequence = sequence;
+    if (wal.recordCount() >= checkpointInterval) {
+        checkpointDue = true;
+    }
+    return true;
+}
+
+// The capture needs every stripe, which the caller could not take while holding its own.
+void UserManager::checkpointIfDue() {
+    if (!checkpointDue.exchange(false)) return;
+    AllLock lock(*this);
+    if (wal.recordCount() >= checkpointInterval) {
+        startCheckpoint();
+    }
+}
+
+// Replays one mutation. Records name users, which are looked up once here; from then on only
+// IDs are used.
+void UserManager::applyRecord(const WalRecord& record) {
+    const std::vector<std::string>& f = record.fields;
+    if (record.type == WalRecordType::RegisterUser) {
+        if (f.size() == 2) apply(record, users.intern(f[0]), kNoUser);
+        return;
+    }
+    if (f.size() >= 2) apply(record, users.find(f[0]), users.find(f[1]));
+}
 
-        j[username] = userJson;
+// Records were validated when logged; missing users are skipped defensively so a hand-edited
+// snapshot cannot crash startup.
+void UserManager::apply(const WalRecord& record, UserId first, UserId second) {
+    const std::vector<std::string>& f = record.fields;
+    switch (record.type) {
+    case WalRecordType::RegisterUser: {
+        if (f.size() != 2) return;
+        auto [user, added] = users.add(first);
+        if (!added) return;
+        user->passwordHash = f[1];
+        // A running checkpoint never saw the user, so it has nothing to set aside.
+        user->checkpointEpoch = checkpointEpoch;
+        return;
+    }
+    case WalRecordType::FriendRequest: {
+        User* sender = f.size() == 2 ? users.get(first) : nullptr;
+        User* receiver = f.size() == 2 ? users.get(second) : nullptr;
+        if (!sender || !receiver) return;
+        preserve(sender);
+        preserve(receiver);
+        sender->sendFriendRequestTo(receiver->id);
+        receiver->receiveFriendRequestFrom(sender->id);
+        return;
+    }
+    case WalRecordType::FriendAccept: {
+        User* receiver = f.size() == 2 ? users.get(first) : nullptr;
+        User* sender = f.size() == 2 ? users.get(second) : nullptr;
+        if (!receiver || !sender) return;
+        preserve(receiver);
+        preserve(sender);
+        if (receiver->acceptFriendRequestFrom(sender->id)) {
+            sender->completeOutgoingFriendRequest(receiver->id);
+        }
+        return;
+    }
+    case WalRecordType::FriendReject: {
+        User* rejector = f.size() == 2 ? users.get(first) : nullptr;
+        User* sender = f.size() == 2 ? users.get(second) : nullptr;
+        if (!rejector || !sender) return;
+        preserve(rejector);
+        preserve(sender);
+        rejector->rejectFriendRequestFrom(sender->id);
+        sender->cancelOutgoingFriendRequest(rejector->id);
+        return;
     }
+    case WalRecordType::Message: {
+        User* sender = f.size() == 3 || f.size() == 4 ? users.get(first) : nullptr;
+        User* receiver = f.size() == 3 || f.size() == 4 ? users.get(second) : nullptr;
+        if (!sender || !receiver) return;
+        int64_t timestamp = f.size() == 4 ? std::strtoll(f[3].c_str(), nullptr, 10) : currentTimeMillis();
+        ChatHistory& history = conversations.open(sender->id, receiver->id);
+        preserve(history);
+        history.append(Message{sender->id, f[2], timestamp});
+        sender->addChatPartner(receiver->id);
+        receiver->addChatPartner(sender->id);
+        return;
+    }
+    }
+}
 
-    std::ofstream outFile(dataFile);
-    outFile << j.dump(4);
+// Only registered users have an ID worth handing out; a name that merely appears in a friend
+// list does not.
+UserId UserManager::findUser(std::string_view username) const {
+    UserId id = users.find(username);
+    return users.get(id) ? id : kNoUser;
 }
 
 // Checks if a user exists in the system.
-bool UserManager::userExists(const std::string& username) const {
-    return users.count(username) > 0;
+bool UserManager::userExists(UserId id) const {
+    return users.get(id) != nullptr;
 }
 
-// Registers a new user if the username is not already taken and persists changes.
+// Registers a new user if the username is not already taken and persists changes. Interning
+// first gives the name its stripe; if another thread registers it meanwhile, the name simply
+// stays interned, as names only seen in friend lists do.
 bool UserManager::registerUser(const std::string& username, const std::string& password) {
-    if (userExists(username)) return false;
-    users.emplace(username, User(username, password));
-    saveToFile();
-    return true;
+    if (findUser(username) != kNoUser) return false;
+    UserId id = users.intern(username);
+    bool committed;
+    {
+        std::unique_lock<std::shared_mutex> lock(stripeOf(id));
+        if (users.get(id)) return false;
+        // Only the hash is logged; the plain password never reaches the disk.
+        committed = commit({WalRecordType::RegisterUser, {username, User::hashPassword(password)}}, id);
+    }
+    checkpointIfDue();
+    return committed;
 }
 
 // Authenticates a user by checking their username and password.
 bool UserManager::authenticateUser(const std::string& username, const std::string& password) const {
-    auto it = users.find(username);
-    return it != users.end() && it->second.checkPassword(password);
+    UserId id = users.find(username);
+    std::shared_lock<std::shared_mutex> lock(stripeOf(id));
+    const User* user = users.get(id);
+    return user && user->checkPassword(password);
 }
 
-// Retrieves a mutable User object by username, if found.
-std::optional<std::reference_wrapper<User>> UserManager::getUser(const std::string& username) {
-    auto it = users.find(username);
-    if (it == users.end()) return std::nullopt;
-    return it->second;
+// Retrieves a mutable User object by ID, if registered.
+std::optional<std::reference_wrapper<User>> UserManager::getUser(UserId id) {
+    User* user = users.get(id);
+    if (!user) return std::nullopt;
+    return *user;
 }
 
-// Retrieves a const User object by username, if found.
-std::optional<std::reference_wrapper<const User>> UserManager::getUser(const std::string& username) const {
-    auto it = users.find(username);
-    if (it == users.end()) return std::nullopt;
-    return it->second;
+// Retrieves a const User object by ID, if registered.
+std::optional<std::reference_wrapper<const User>> UserManager::getUser(UserId id) const {
+    const User* user = users.get(id);
+    if (!user) return std::nullopt;
+    return *user;
 }
 
-// Sends a friend request from one user to another, with validation and persistence.
-bool UserManager::sendFriendRequest(const std::string& from, const std::string& to) {
-    if (!userExists(from) || !userExists(to) || from == to) return false;
+// A user's friends change only under its own stripe, so sharing that one is enough.
+bool UserManager::areFriends(UserId user, UserId other) const {
+    std::shared_lock<std::shared_mutex> lock(stripeOf(user));
+    const User* found = users.get(user);
+    return found && found->hasFriend(other);
+}
 
-    User& sender = users.at(from);
-    User& receiver = users.at(to);
+// Sends a friend request from one user to another, with validation and persistence. The log
+// records names, so it stays valid whatever IDs the next start hands out.
+bool UserManager::sendFriendRequest(UserId from, UserId to) {
+    bool committed;
+    {
+        PairLock lock(*this, from, to);
+        User* sender = users.get(from);
+        User* receiver = users.get(to);
+        if (!sender || !receiver || from == to) return false;
 
-    // Prevent duplicate or already accepted requests.
-    if (sender.hasSentRequestTo(to) || receiver.hasPendingRequestFrom(from) || sender.hasFriend(to)) return false;
+        // Prevent duplicate or already accepted requests.
+        if (sender->hasSentRequestTo(to) || receiver->hasPendingRequestFrom(from) || sender->hasFriend(to)) return false;
 
-    sender.sendFriendRequestTo(to);
-    receiver.receiveFriendRequestFrom(from);
-    saveToFile();
-    return true;
+        committed = commit({WalRecordType::FriendRequest, {users.name(from), users.name(to)}}, from, to);
+    }
+    checkpointIfDue();
+    return committed;
 }
 
 // Accepts a friend request, updating both users' states and persisting changes.
-bool UserManager::acceptFriendRequest(const std::string& username, const std::string& from) {
-    if (!userExists(username) || !userExists(from)) return false;
-
-    User& receiver = users.at(username);
-    User& sender = users.at(from);
+bool UserManager::acceptFriendRequest(UserId user, UserId from) {
+    bool committed;
+    {
+        PairLock lock(*this, user, from);
+        User* receiver = users.get(user);
+        if (!receiver || !users.get(from)) return false;
 
-    if (!receiver.hasPendingRequestFrom(from)) return false;
+        if (!receiver->hasPendingRequestFrom(from)) return false;
 
-    bool success = receiver.acceptFriendRequestFrom(from);
-    if (success) {
-        sender.completeOutgoingFriendRequest(username);
+        committed = commit({WalRecordType::FriendAccept, {users.name(user), users.name(from)}}, user, from);
     }
-
-    saveToFile();
-    return success;
+    checkpointIfDue();
+    return committed;
 }
 
 // Rejects a friend request, updating both users' states and persisting changes.
-bool UserManager::rejectFriendRequest(const std::string& rejecting_username, const std::string& sender_username) {
-    if (!userExists(rejecting_username) || !userExists(sender_username)) return false;
-
-    User& rejector = users.at(rejecting_username);
-    User& sender = users.at(sender_username);
+bool UserManager::rejectFriendRequest(UserId rejecting, UserId sender) {
+    bool committed;
+    {
+        PairLock lock(*this, rejecting, sender);
+        User* rejector = users.get(rejecting);
+        if (!rejector || !users.get(sender)) return false;
 
-    if (!rejector.hasPendingRequestFrom(sender_username)) return false;
+        if (!rejector->hasPendingRequestFrom(sender)) return false;
 
-    rejector.rejectFriendRequestFrom(sender_username);
-    sender.cancelOutgoingFriendRequest(rejecting_username);
-    saveToFile();
-    return true;
+        committed = commit({WalRecordType::FriendReject, {users.name(rejecting), users.name(sender)}}, rejecting, sender);
+    }
+    checkpointIfDue();
+    return committed;
 }
 
-// Retrieves a user's incoming friend requests, if the user exists.
-std::optional<std::reference_wrapper<const std::unordered_set<std::string>>> UserManager::getIncomingFriendRequests(const std::string& username) const {
-    auto it = users.find(username);
-    if (it == users.end()) {
+// Copies a user's incoming friend requests, if the user exists, so they can be read unlocked.
+std::optional<std::vector<UserId>> UserManager::getIncomingFriendRequests(UserId user) const {
+    std::shared_lock<std::shared_mutex> lock(stripeOf(user));
+    const User* found = users.get(user);
+    if (!found) {
         return std::nullopt;
     }
-    return it->second.getIncomingFriendRequests();
+    const UserIdSet& requests = found->getIncomingFriendRequests();
+    return std::vector<UserId>(requests.begin(), requests.end());
 }
 
 // Stores a chat message between two users and persists changes.
-void UserManager::storeMessage(const std::string& sender, const std::string& receiver, const std::string& content) {
-    if (!userExists(sender) || !userExists(receiver)) return;
+bool UserManager::storeMessage(UserId sender, UserId receiver, const std::string& content) {
+    bool committed;
+    {
+        PairLock lock(*this, sender, receiver);
+        if (!userExists(sender) || !userExists(receiver)) return false;
+
+        committed = commit({WalRecordType::Message, {users.name(sender), users.name(receiver), content, std::to_string(currentTimeMillis())}},
+                           sender, receiver);
+    }
+    checkpointIfDue();
+    return committed;
+}
 
-    users.at(sender).storeMessage(receiver, sender, content);
-    users.at(receiver).storeMessage(sender, sender, content);
-    saveToFile();
+// Looks the conversation up in the shared store and reads only the tail of its log. Reading
+// pages messages in and, the first time, cuts the log back to what survived, so it holds both
+// stripes exclusively like a message would.
+std::vector<Message> UserManager::getChatHistory(UserId user, UserId peer, size_t limit) const {
+    PairLock lock(*this, user, peer);
+    const ChatHistory* history = conversations.find(user, peer);
+    if (!history) return std::vector<Message>();
+    preserve(*history);
+    return history->tail(limit);
 }
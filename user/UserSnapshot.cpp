@@ -0,0 +1,832 @@
+#include "../include/user/UserSnapshot.hpp"
+#include "../include/user/Checksum.hpp"
+#include "../include/nlohmann/json.hpp"
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "The snapshot format is written in host byte order");
+
+namespace {
+// First bytes of every binary snapshot.
+constexpr char kMagic[8] = {'C', 'H', 'A', 'T', 'S', 'N', 'A', 'P'};
+
+// Keys of the JSON envelope. Older files are a bare object of users; since every user
+// entry is an object, a numeric "walSequence" unambiguously marks the envelope.
+const char* const kSequenceKey = "walSequence";
+const char* const kUsersKey = "users";
+const char* const kConversationsKey = "conversations";
+
+// File header. Table offsets are not stored: they follow from the counts, so they cannot disagree.
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t checksum;          // CRC-32 of the tables.
+    uint64_t fileSize;
+    uint64_t walSequence;       // Newest write-ahead log record the snapshot includes.
+    uint32_t stringCount;
+    uint32_t userCount;
+    uint32_t adjacencyCount;
+    uint32_t conversationCount;
+    uint64_t stringBytes;       // Size of the string blob.
+    uint64_t reserved;
+};
+static_assert(sizeof(Header) == 64, "Header layout is part of the file format");
+
+// Location of a string in the blob.
+struct StringEntry {
+    uint64_t offset;
+    uint32_t length;
+    uint32_t reserved;
+};
+static_assert(sizeof(StringEntry) == 16, "StringEntry layout is part of the file format");
+
+// One user. Names are string indices; ranges index the adjacency table.
+struct UserEntry {
+    uint32_t name;
+    uint32_t passwordHash;
+    uint32_t friendsBegin, friendsCount;
+    uint32_t incomingBegin, incomingCount;
+    uint32_t outgoingBegin, outgoingCount;
+};
+static_assert(sizeof(UserEntry) == 32, "UserEntry layout is part of the file format");
+
+// One conversation between two participants (string indices, in sorted order). Its messages
+// are in message log `id`, which held `messageCount` of them when the snapshot was written.
+struct ConversationEntry {
+    uint32_t first;
+    uint32_t second;
+    uint32_t id;
+    uint32_t reserved;
+    uint64_t messageCount;
+};
+static_assert(sizeof(ConversationEntry) == 24, "ConversationEntry layout is part of the file format");
+
+// Rounds up to the 8-byte alignment every table starts at.
+uint64_t align8(uint64_t n) {
+    return (n + 7) & ~uint64_t(7);
+}
+
+// File offsets of the tables, derived from the header's counts.
+struct Layout {
+    uint64_t strings, blob, users, adjacency, conversations, end;
+
+    explicit Layout(const Header& h) {
+        strings = sizeof(Header);
+        blob = strings + uint64_t(h.stringCount) * sizeof(StringEntry);
+        users = align8(blob + h.stringBytes);
+        adjacency = users + uint64_t(h.userCount) * sizeof(UserEntry);
+        conversations = align8(adjacency + uint64_t(h.adjacencyCount) * sizeof(uint32_t));
+        end = conversations + uint64_t(h.conversationCount) * sizeof(ConversationEntry);
+    }
+};
+
+// Copies a table entry out of the mapping.
+template <typename T>
+T load(const char* p) {
+    T value;
+    std::memcpy(&value, p, sizeof(T));
+    return value;
+}
+
+// Read-only mapping of a whole file, unmapped on destruction.
+struct Mapping {
+    const char* data = nullptr;
+    size_t size = 0;
+
+    Mapping() = default;
+    Mapping(const Mapping&) = delete;
+    Mapping& operator=(const Mapping&) = delete;
+    ~Mapping() {
+        if (data) {
+            ::munmap(const_cast<char*>(data), size);
+        }
+    }
+};
+
+// Output file written through one large buffer straight to the descriptor. Errors are sticky
+// and reported by finish(), so writers do not check every call.
+class FileWriter {
+public:
+    static constexpr size_t kBufferSize = 1 << 20;
+
+    explicit FileWriter(const std::string& path)
+        : fd(::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)),
+          buffer(new char[kBufferSize]), failed(fd < 0) {}
+    ~FileWriter() {
+        if (fd >= 0) ::close(fd);
+    }
+
+    // Appends bytes; writes larger than the buffer bypass it.
+    void write(const void* data, size_t size) {
+        if (size == 0) return;
+        if (size > kBufferSize - used) {
+            flush();
+            if (size >= kBufferSize) {
+                writeAll(static_cast<const char*>(data), size);
+                return;
+            }
+        }
+        std::memcpy(buffer.get() + used, data, size);
+        used += size;
+    }
+    void write(std::string_view text) { write(text.data(), text.size()); }
+    void put(char c) {
+        if (used == kBufferSize) flush();
+        buffer[used++] = c;
+    }
+
+    // Overwrites bytes already written at `offset`.
+    void writeAt(uint64_t offset, const void* data, size_t size) {
+        flush();
+        if (failed) return;
+        failed = ::pwrite(fd, data, size, static_cast<off_t>(offset)) != static_cast<ssize_t>(size);
+    }
+
+    // Flushes, optionally syncs, and closes; returns true if every write succeeded.
+    bool finish(bool sync) {
+        flush();
+        if (!failed && sync && ::fdatasync(fd) != 0) failed = true;
+        if (fd >= 0 && ::close(fd) != 0) failed = true;
+        fd = -1;
+        return !failed;
+    }
+
+private:
+    // Empties the buffer into the file.
+    void flush() {
+        writeAll(buffer.get(), used);
+        used = 0;
+    }
+
+    // Writes everything, retrying short writes.
+    void writeAll(const char* data, size_t size) {
+        while (size > 0 && !failed) {
+            ssize_t n = ::write(fd, data, size);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                failed = true;
+                break;
+            }
+            data += n;
+            size -= static_cast<size_t>(n);
+        }
+    }
+
+    int fd;
+    std::unique_ptr<char[]> buffer;
+    size_t used = 0;
+    bool failed;
+};
+
+// Writes `path` through a temporary file and renames it over the original, so readers see
+// either the old file or the complete new one.
+template <typename WriteFn>
+bool replaceFile(const std::string& path, bool sync, WriteFn write) {
+    std::string tempFile = path + ".tmp";
+    FileWriter out(tempFile);
+    write(out);
+    std::error_code error;
+    if (!out.finish(sync)) {
+        std::filesystem::remove(tempFile, error);
+        return false;
+    }
+    std::filesystem::rename(tempFile, path, error);
+    return !error;
+}
+
+// Returns the length of the well-formed UTF-8 sequence starting at `p`, or 0 if it is not one.
+size_t utf8Length(const unsigned char* p, const unsigned char* end) {
+    auto continuation = [&](size_t i, unsigned char low = 0x80, unsigned char high = 0xbf) {
+        return p + i < end && p[i] >= low && p[i] <= high;
+    };
+    unsigned char c = p[0];
+    if (c >= 0xc2 && c <= 0xdf) return continuation(1) ? 2 : 0;
+    if (c >= 0xe0 && c <= 0xef) {
+        bool second = c == 0xe0 ? continuation(1, 0xa0) : c == 0xed ? continuation(1, 0x80, 0x9f) : continuation(1);
+        return second && continuation(2) ? 3 : 0;
+    }
+    if (c >= 0xf0 && c <= 0xf4) {
+        bool second = c == 0xf0 ? continuation(1, 0x90) : c == 0xf4 ? continuation(1, 0x80, 0x8f) : continuation(1);
+        return second && continuation(2) && continuation(3) ? 4 : 0;
+    }
+    return 0;
+}
+
+// Writes a quoted JSON string. Runs of plain ASCII are copied in one piece; bytes that are not
+// valid UTF-8 become U+FFFD so the output always parses.
+void writeJsonString(FileWriter& out, std::string_view text) {
+    static const char kHex[] = "0123456789abcdef";
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(text.data());
+    const unsigned char* end = p + text.size();
+    const unsigned char* run = p;
+    out.put('"');
+    while (p < end) {
+        unsigned char c = *p;
+        if (c >= 0x20 && c < 0x80 && c != '"' && c != '\\') {
+            ++p;
+            continue;
+        }
+        out.write(run, static_cast<size_t>(p - run));
+        if (c >= 0x80) {
+            size_t length = utf8Length(p, end);
+            if (length > 0) {
+                out.write(p, length);
+                p += length;
+            } else {
+                out.write("\\ufffd");
+                ++p;
+            }
+        } else {
+            switch (c) {
+            case '"': out.write("\\\""); break;
+            case '\\': out.write("\\\\"); break;
+            case '\n': out.write("\\n"); break;
+            case '\r': out.write("\\r"); break;
+            case '\t': out.write("\\t"); break;
+            case '\b': out.write("\\b"); break;
+            case '\f': out.write("\\f"); break;
+            default: {
+                char escape[6] = {'\\', 'u', '0', '0', kHex[c >> 4], kHex[c & 0xf]};
+                out.write(escape, sizeof(escape));
+            }
+            }
+            ++p;
+        }
+        run = p;
+    }
+    out.write(run, static_cast<size_t>(p - run));
+    out.put('"');
+}
+
+// Writes a set of users as a JSON array of their names.
+void writeJsonNames(FileWriter& out, const UserTable& users, const UserIdSet& ids) {
+    out.put('[');
+    bool first = true;
+    for (UserId id : ids) {
+        if (!first) out.put(',');
+        first = false;
+        writeJsonString(out, users.name(id));
+    }
+    out.put(']');
+}
+
+// A validated snapshot mapping.
+struct MappedSnapshot {
+    Mapping map;
+    Header header{};
+    std::unique_ptr<Layout> layout;
+    std::vector<std::string_view> strings; // Views into the string blob.
+};
+
+// Maps `path` and checks the header, sizes, table checksum and string table. Returns null and
+// sets `error` on failure.
+std::unique_ptr<MappedSnapshot> openSnapshot(const std::string& path, std::string& error) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        error = std::strerror(errno);
+        return nullptr;
+    }
+    auto snapshot = std::make_unique<MappedSnapshot>();
+    Mapping& map = snapshot->map;
+    struct stat info;
+    if (::fstat(fd, &info) == 0 && static_cast<size_t>(info.st_size) >= sizeof(Header)) {
+        map.size = static_cast<size_t>(info.st_size);
+        void* data = ::mmap(nullptr, map.size, PROT_READ, MAP_PRIVATE, fd, 0);
+        map.data = data == MAP_FAILED ? nullptr : static_cast<const char*>(data);
+    }
+    ::close(fd);
+    if (!map.data) {
+        error = "file too small or not mappable";
+        return nullptr;
+    }
+    ::madvise(const_cast<char*>(map.data), map.size, MADV_SEQUENTIAL);
+
+    Header& header = snapshot->header;
+    header = load<Header>(map.data);
+    if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0) {
+        error = "not a snapshot";
+        return nullptr;
+    }
+    if (header.version != UserSnapshot::kVersion) {
+        error = "unsupported snapshot version " + std::to_string(header.version);
+        return nullptr;
+    }
+    // Bound every count by the file size before deriving offsets, so the arithmetic cannot overflow.
+    if (header.fileSize != map.size || header.stringBytes > map.size) {
+        error = "size mismatch";
+        return nullptr;
+    }
+    snapshot->layout = std::make_unique<Layout>(header);
+    const Layout& layout = *snapshot->layout;
+    if (layout.end != map.size) {
+        error = "table sizes do not add up to the file size";
+        return nullptr;
+    }
+    const char* base = map.data;
+    if (crc32Update(0, base + layout.strings, layout.end - layout.strings) != header.checksum) {
+        error = "checksum mismatch";
+        return nullptr;
+    }
+
+    snapshot->strings.reserve(header.stringCount);
+    for (uint32_t i = 0; i < header.stringCount; ++i) {
+        StringEntry entry = load<StringEntry>(base + layout.strings + uint64_t(i) * sizeof(StringEntry));
+        if (entry.offset > header.stringBytes || entry.length > header.stringBytes - entry.offset) {
+            error = "string " + std::to_string(i) + " out of bounds";
+            return nullptr;
+        }
+        snapshot->strings.emplace_back(base + layout.blob + entry.offset, entry.length);
+    }
+    return snapshot;
+}
+
+// Records every conversation with both participants that still exist.
+void linkPartners(UserTable& users, const ConversationStore& conversations) {
+    for (const auto& [key, history] : conversations) {
+        User* first = users.get(key.first);
+        User* second = users.get(key.second);
+        if (!first || !second) continue;
+        first->addChatPartner(key.second);
+        second->addChatPartner(key.first);
+    }
+}
+
+} // namespace
+
+// Reads the magic and version from the header.
+uint32_t UserSnapshot::binaryVersion(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    char prefix[sizeof(kMagic) + sizeof(uint32_t)] = {};
+    in.read(prefix, sizeof(prefix));
+    if (in.gcount() != sizeof(prefix) || std::memcmp(prefix, kMagic, sizeof(kMagic)) != 0) return 0;
+    return load<uint32_t>(prefix + sizeof(kMagic));
+}
+
+// Builds users and conversations from the tables. Conversations only name their message logs,
+// so nothing but the tables is read.
+bool UserSnapshot::readBinary(const std::string& path, UserTable& users, ConversationStore& conversations,
+                              uint64_t& walSequence, std::string& error) {
+    std::unique_ptr<MappedSnapshot> snapshot = openSnapshot(path, error);
+    if (!snapshot) {
+        return false;
+    }
+    const Header& header = snapshot->header;
+    const Layout& layout = *snapshot->layout;
+    const std::vector<std::string_view>& strings = snapshot->strings;
+    const char* base = snapshot->map.data;
+
+    // Names are interned once per string, so each is hashed the first time it is seen.
+    std::vector<UserId> interned(header.stringCount, kNoUser);
+    auto intern = [&](uint32_t index) {
+        if (interned[index] == kNoUser) interned[index] = users.intern(strings[index]);
+        return interned[index];
+    };
+    auto adjacent = [&](uint32_t begin, uint32_t count, UserIdSet& out) {
+        if (begin > header.adjacencyCount || count > header.adjacencyCount - begin) return false;
+        out.reserve(count);
+        for (uint32_t i = begin; i < begin + count; ++i) {
+            uint32_t index = load<uint32_t>(base + layout.adjacency + uint64_t(i) * sizeof(uint32_t));
+            if (index >= header.stringCount) return false;
+            out.insert(intern(index));
+        }
+        return true;
+    };
+
+    for (uint32_t u = 0; u < header.userCount; ++u) {
+        UserEntry entry = load<UserEntry>(base + layout.users + uint64_t(u) * sizeof(UserEntry));
+        if (entry.name >= header.stringCount || entry.passwordHash >= header.stringCount) {
+            error = "user " + std::to_string(u) + " has a bad name";
+            return false;
+        }
+        auto [user, added] = users.add(intern(entry.name));
+        if (!added) {
+            error = "duplicate user";
+            return false;
+        }
+        user->passwordHash = strings[entry.passwordHash];
+        if (!adjacent(entry.friendsBegin, entry.friendsCount, user->friends) ||
+            !adjacent(entry.incomingBegin, entry.incomingCount, user->incomingRequests) ||
+            !adjacent(entry.outgoingBegin, entry.outgoingCount, user->outgoingRequests)) {
+            error = "user " + std::string(strings[entry.name]) + " has a bad friend list";
+            return false;
+        }
+    }
+
+    for (uint32_t c = 0; c < header.conversationCount; ++c) {
+        ConversationEntry entry = load<ConversationEntry>(base + layout.conversations + uint64_t(c) * sizeof(ConversationEntry));
+        if (entry.first >= header.stringCount || entry.second >= header.stringCount) {
+            error = "conversation " + std::to_string(c) + " is corrupt";
+            return false;
+        }
+        if (!conversations.restore(intern(entry.first), intern(entry.second), entry.id, entry.messageCount)) {
+            error = "conversation " + std::to_string(c) + " is a duplicate";
+            return false;
+        }
+    }
+
+    linkPartners(users, conversations);
+    walSequence = header.walSequence;
+    return true;
+}
+
+// Writes the live state.
+bool UserSnapshot::writeBinary(const std::string& path, const UserTable& users, const ConversationStore& conversations,
+                               uint64_t walSequence, bool sync) {
+    std::vector<const User*> userList(users.list().begin(), users.list().end());
+    return writeBinary(path, users, userList, conversationStates(conversations), walSequence, sync);
+}
+
+// Reads each conversation's log ID and length.
+std::vector<UserSnapshot::ConversationState> UserSnapshot::conversationStates(const ConversationStore& conversations) {
+    std::vector<ConversationState> states;
+    states.reserve(conversations.size());
+    for (const ChatHistory* history : conversations.list()) {
+        states.push_back(
+            ConversationState{history->participants[0], history->participants[1], history->log.id(), history->log.size()});
+    }
+    return states;
+}
+
+// Gives every name and password hash a string index once, lays the tables out, then streams
+// them to disk checksumming as it goes. Names are indexed by ID, so only hashes are hashed.
+bool UserSnapshot::writeBinary(const std::string& path, const UserTable& names, const std::vector<const User*>& users,
+                               const std::vector<ConversationState>& conversations, uint64_t walSequence, bool sync) {
+    constexpr uint32_t kUnset = ~uint32_t(0);
+    std::unordered_map<std::string_view, uint32_t> ids;
+    std::vector<uint32_t> nameIndex;
+    std::vector<std::string_view> strings;
+    auto intern = [&](std::string_view s) {
+        auto [it, inserted] = ids.try_emplace(s, static_cast<uint32_t>(strings.size()));
+        if (inserted) strings.push_back(s);
+        return it->second;
+    };
+    // A name and a password hash may be the same string; they then share an index.
+    auto internName = [&](UserId id) {
+        if (id > nameIndex.size()) nameIndex.resize(std::max<size_t>(id, nameIndex.size() * 2), kUnset);
+        uint32_t& index = nameIndex[id - 1];
+        if (index == kUnset) index = intern(names.name(id));
+        return index;
+    };
+
+    std::vector<UserEntry> userEntries;
+    std::vector<uint32_t> adjacency;
+    std::vector<ConversationEntry> conversationEntries;
+    auto addSet = [&](const UserIdSet& set, uint32_t& begin, uint32_t& count) {
+        begin = static_cast<uint32_t>(adjacency.size());
+        count = static_cast<uint32_t>(set.size());
+        for (UserId id : set) adjacency.push_back(internName(id));
+    };
+
+    userEntries.reserve(users.size());
+    for (const User* user : users) {
+        UserEntry entry{};
+        entry.name = internName(user->id);
+        entry.passwordHash = intern(user->passwordHash);
+        addSet(user->friends, entry.friendsBegin, entry.friendsCount);
+        addSet(user->incomingRequests, entry.incomingBegin, entry.incomingCount);
+        addSet(user->outgoingRequests, entry.outgoingBegin, entry.outgoingCount);
+        userEntries.push_back(entry);
+    }
+    conversationEntries.reserve(conversations.size());
+    for (const ConversationState& conversation : conversations) {
+        conversationEntries.push_back(
+            ConversationEntry{internName(conversation.first), internName(conversation.second), conversation.id, 0, conversation.count});
+    }
+
+    Header header{};
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.walSequence = walSequence;
+    header.stringCount = static_cast<uint32_t>(strings.size());
+    header.userCount = static_cast<uint32_t>(userEntries.size());
+    header.adjacencyCount = static_cast<uint32_t>(adjacency.size());
+    header.conversationCount = static_cast<uint32_t>(conversationEntries.size());
+    std::vector<StringEntry> stringEntries;
+    stringEntries.reserve(strings.size());
+    for (std::string_view s : strings) {
+        stringEntries.push_back(StringEntry{header.stringBytes, static_cast<uint32_t>(s.size()), 0});
+        header.stringBytes += s.size();
+    }
+    Layout layout(header);
+    header.fileSize = layout.end;
+
+    return replaceFile(path, sync, [&](FileWriter& out) {
+        uint32_t checksum = 0;
+        uint64_t position = sizeof(Header);
+        auto put = [&](const void* data, size_t size) {
+            out.write(data, size);
+            checksum = crc32Update(checksum, static_cast<const char*>(data), size);
+            position += size;
+        };
+        auto padTo = [&](uint64_t offset) {
+            static const char zeros[8] = {};
+            put(zeros, offset - position);
+        };
+
+        out.write(&header, sizeof(header));
+        put(stringEntries.data(), stringEntries.size() * sizeof(StringEntry));
+        for (std::string_view s : strings) put(s.data(), s.size());
+        padTo(layout.users);
+        put(userEntries.data(), userEntries.size() * sizeof(UserEntry));
+        put(adjacency.data(), adjacency.size() * sizeof(uint32_t));
+        padTo(layout.conversations);
+        put(conversationEntries.data(), conversationEntries.size() * sizeof(ConversationEntry));
+
+        header.checksum = checksum;
+        out.writeAt(0, &header, sizeof(header));
+    });
+}
+
+// Builds users and conversations straight from parser events. A stack of frames tracks where in
+// the document the parser is; each event either fills in the user or conversation being read or
+// is skipped along with its value.
+class UserSnapshot::JsonLoader : public nlohmann::json_sax<nlohmann::json> {
+public:
+    JsonLoader(UserTable& users, ConversationStore& conversations) : users(users), conversations(conversations) {}
+
+    uint64_t walSequence = 0;
+    std::string error;
+
+    bool null() override { return true; }
+    bool boolean(bool) override { return true; }
+    bool number_integer(number_integer_t value) override {
+        if (top() == Frame::Message && key_ == "timestamp") timestamp = value;
+        return true;
+    }
+    bool number_float(number_float_t, const string_t&) override { return true; }
+    bool binary(binary_t&) override { return true; }
+
+    bool number_unsigned(number_unsigned_t value) override {
+        if (top() == Frame::Root && key_ == kSequenceKey) {
+            walSequence = value;
+            sawSequence = true;
+        } else if (top() == Frame::Message && key_ == "timestamp") {
+            timestamp = static_cast<int64_t>(value);
+        }
+        return true;
+    }
+
+    bool string(string_t& value) override {
+        switch (top()) {
+        case Frame::User:
+            if (key_ == "passwordHash") current->passwordHash = std::move(value);
+            userEmpty = false;
+            break;
+        case Frame::Set:
+            set->insert(users.intern(value));
+            break;
+        case Frame::Participants:
+            participants.push_back(std::move(value));
+            break;
+        case Frame::Message:
+            if (key_ == "sender") sender = users.intern(value);
+            else if (key_ == "content") content = std::move(value);
+            break;
+        default:
+            break;
+        }
+        return true;
+    }
+
+    bool key(string_t& value) override {
+        key_ = std::move(value);
+        return true;
+    }
+
+    bool start_object(std::size_t) override {
+        if (frames.empty()) {
+            frames.push_back(Frame::Root);
+            return true;
+        }
+        switch (top()) {
+        case Frame::Root:
+            // The envelope's "users" member holds users one level down. It is told apart from a
+            // legacy user named "users" by walSequence coming first (as writeJson orders it) or,
+            // failing that, by its first member being an object other than a user's chatHistory.
+            if (key_ == kUsersKey && sawSequence) {
+                frames.push_back(Frame::Users);
+            } else {
+                beginUser(std::move(key_));
+            }
+            return true;
+        case Frame::Users:
+            beginUser(std::move(key_));
+            return true;
+        case Frame::User:
+            if (frames.size() == 2 && currentName == kUsersKey && userEmpty && key_ != "chatHistory") {
+                current.reset();
+                frames.back() = Frame::Users;
+                beginUser(std::move(key_));
+            } else if (key_ == "chatHistory") {
+                frames.push_back(Frame::History);
+            } else {
+                frames.push_back(Frame::Skip);
+            }
+            userEmpty = false;
+            return true;
+        case Frame::Conversations:
+            participants.clear();
+            frames.push_back(Frame::Shared);
+            return true;
+        case Frame::Conversation:
+            sender = kNoUser;
+            content.clear();
+            timestamp = now;
+            frames.push_back(Frame::Message);
+            return true;
+        default:
+            frames.push_back(Frame::Skip);
+            return true;
+        }
+    }
+
+    bool end_object() override {
+        Frame frame = top();
+        frames.pop_back();
+        if (frame == Frame::User && frames.size() == 1 && userEmpty) {
+            // An envelope whose "users" object is empty; real users always carry a passwordHash.
+            current.reset();
+        } else if (frame == Frame::User) {
+            // A name listed twice keeps the last entry, as a JSON object would.
+            User* user = users.add(currentId()).first;
+            *user = std::move(*current);
+            current.reset();
+        } else if (frame == Frame::Message) {
+            target->append(Message{std::move(sender), std::move(content), timestamp});
+        }
+        return true;
+    }
+
+    bool start_array(std::size_t) override {
+        if (top() == Frame::User) {
+            userEmpty = false;
+            if (key_ == "friends") set = &current->friends;
+            else if (key_ == "incomingRequests") set = &current->incomingRequests;
+            else if (key_ == "outgoingRequests") set = &current->outgoingRequests;
+            else set = nullptr;
+            frames.push_back(set ? Frame::Set : Frame::Skip);
+        } else if (top() == Frame::History) {
+            // Older exports hold each conversation under both participants; the first copy wins.
+            target = &conversations.open(currentId(), users.intern(key_));
+            frames.push_back(target->size() == 0 ? Frame::Conversation : Frame::Skip);
+        } else if (top() == Frame::Root && key_ == kConversationsKey) {
+            frames.push_back(Frame::Conversations);
+        } else if (top() == Frame::Shared && key_ == "participants") {
+            participants.clear();
+            frames.push_back(Frame::Participants);
+        } else if (top() == Frame::Shared && key_ == "messages" && participants.size() == 2) {
+            target = &conversations.open(users.intern(participants[0]), users.intern(participants[1]));
+            frames.push_back(Frame::Conversation);
+        } else {
+            frames.push_back(Frame::Skip);
+        }
+        return true;
+    }
+
+    bool end_array() override {
+        frames.pop_back();
+        return true;
+    }
+
+    bool parse_error(std::size_t, const std::string&, const nlohmann::detail::exception& e) override {
+        error = e.what();
+        return false;
+    }
+
+private:
+    // What the value being parsed belongs to.
+    enum class Frame {
+        Root,          // The top-level object.
+        Users,         // The envelope's "users" object.
+        User,          // A user's fields.
+        Set,           // friends, incomingRequests or outgoingRequests.
+        History,       // A legacy user's chatHistory: partner to messages.
+        Conversations, // The top-level "conversations" array.
+        Shared,        // One {participants, messages} object in it.
+        Participants,  // Its two participant names.
+        Conversation,  // Array of messages appended to `target`.
+        Message,       // One {sender, content} object.
+        Skip           // Anything unrecognized, ignored with all it contains.
+    };
+
+    // Returns the innermost frame.
+    Frame top() const { return frames.empty() ? Frame::Skip : frames.back(); }
+
+    // Starts reading a user's fields.
+    void beginUser(std::string username) {
+        currentName = std::move(username);
+        current = std::make_unique<User>();
+        userEmpty = true;
+        frames.push_back(Frame::User);
+    }
+
+    // Returns the ID of the user being read, interning its name on first use, so the envelope's
+    // "users" object, mistaken for a user until its first member, never is.
+    UserId currentId() {
+        if (current->id == kNoUser) current->id = users.intern(currentName);
+        return current->id;
+    }
+
+    UserTable& users;
+    ConversationStore& conversations;
+    std::vector<Frame> frames;
+    std::string key_;                       // Most recent object key.
+    bool sawSequence = false;               // walSequence appeared before "users".
+    std::string currentName;                // Name of the user being read...
+    std::unique_ptr<User> current;          // ...and its fields.
+    bool userEmpty = false;                 // No field of `current` has been seen yet.
+    UserIdSet* set = nullptr;
+    std::vector<std::string> participants;  // Of the shared conversation being read.
+    ChatHistory* target = nullptr;          // Conversation messages are appended to.
+    UserId sender = kNoUser;
+    std::string content;
+    int64_t timestamp = 0;
+    // Stands in for missing timestamps, which exports from before message logs do not have.
+    const int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+};
+
+// Streams the file through the SAX loader in 1 MiB reads; either JSON layout is accepted: the
+// {walSequence, users, conversations} envelope or a bare object of users with their own histories.
+bool UserSnapshot::readJson(const std::string& path, UserTable& users, ConversationStore& conversations,
+                            uint64_t& walSequence, std::string& error) {
+    std::vector<char> buffer(1 << 20);
+    std::ifstream inFile;
+    inFile.rdbuf()->pubsetbuf(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    inFile.open(path, std::ios::binary);
+    if (!inFile.is_open()) {
+        error = "cannot open file";
+        return false;
+    }
+
+    JsonLoader loader(users, conversations);
+    if (!nlohmann::json::sax_parse(inFile, &loader)) {
+        error = loader.error.empty() ? "malformed user data" : loader.error;
+        return false;
+    }
+
+    linkPartners(users, conversations);
+    walSequence = loader.walSequence;
+    return true;
+}
+
+// Serializes compact JSON straight into the output buffer, walking users and conversations in place.
+bool UserSnapshot::writeJson(const std::string& path, const UserTable& users, const ConversationStore& conversations,
+                             uint64_t walSequence) {
+    return replaceFile(path, false, [&](FileWriter& out) {
+        // walSequence goes first so a streaming reader knows the layout before it reaches the users.
+        out.write("{\"walSequence\":");
+        out.write(std::to_string(walSequence));
+        out.write(",\"users\":{");
+        bool firstUser = true;
+        for (const User* user : users.list()) {
+            if (!firstUser) out.put(',');
+            firstUser = false;
+            writeJsonString(out, users.name(user->id));
+            out.write(":{\"passwordHash\":");
+            writeJsonString(out, user->passwordHash);
+            out.write(",\"friends\":");
+            writeJsonNames(out, users, user->friends);
+            out.write(",\"incomingRequests\":");
+            writeJsonNames(out, users, user->incomingRequests);
+            out.write(",\"outgoingRequests\":");
+            writeJsonNames(out, users, user->outgoingRequests);
+            out.put('}');
+        }
+        out.write("},\"conversations\":[");
+        bool firstConversation = true;
+        for (const ChatHistory* history : conversations.list()) {
+            if (!firstConversation) out.put(',');
+            firstConversation = false;
+            out.write("{\"participants\":[");
+            writeJsonString(out, users.name(history->participants[0]));
+            out.put(',');
+            writeJsonString(out, users.name(history->participants[1]));
+            out.write("],\"messages\":[");
+            bool firstMessage = true;
+            history->forEach([&](UserId sender, std::string_view content, int64_t timestamp) {
+                if (!firstMessage) out.put(',');
+                firstMessage = false;
+                out.write("{\"sender\":");
+                writeJsonString(out, users.name(sender));
+                out.write(",\"content\":");
+                writeJsonString(out, content);
+                out.write(",\"timestamp\":");
+                out.write(std::to_string(timestamp));
+                out.put('}');
+            });
+            out.write("]}");
+        }
+        out.write("]}\n");
+    });
+}
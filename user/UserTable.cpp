@@ -0,0 +1,54 @@
+#include "../include/user/UserTable.hpp"
+#include <mutex>
+
+UserId UserTable::find(std::string_view name) const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    auto it = ids.find(name);
+    return it != ids.end() ? it->second : kNoUser;
+}
+
+// Names already interned only take the shared lock; readers are blocked just while a new one is added.
+// The insert probes once: the entry is claimed under the caller's view, then pointed at the copy.
+UserId UserTable::intern(std::string_view name) {
+    if (UserId id = find(name)) return id;
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    auto [it, inserted] = ids.try_emplace(name, kNoUser);
+    if (!inserted) return it->second;
+    it->first = names.emplace_back(name);
+    UserId id = static_cast<UserId>(names.size());
+    auto [chunk, offset] = locate(id);
+    Slot* slots = chunks[chunk].load(std::memory_order_relaxed);
+    if (!slots) {
+        slots = new Slot[kFirstChunk << chunk];
+        chunks[chunk].store(slots, std::memory_order_release);
+    }
+    // Whoever learns the ID learns it through `ids` under the lock, which makes the name visible.
+    slots[offset].name = &names.back();
+    it->second = id;
+    return id;
+}
+
+UserTable::~UserTable() {
+    clear();
+}
+
+// Registration is rare, so it takes the exclusive lock. The user is visible to get() at once;
+// the caller keeps others off its fields until it has set them.
+std::pair<User*, bool> UserTable::add(UserId id) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    Slot* found = slot(id);
+    if (User* user = found->user.load(std::memory_order_relaxed)) return {user, false};
+    User* user = &users.emplace_back(id);
+    registered.push_back(user);
+    found->user.store(user, std::memory_order_release);
+    return {user, true};
+}
+
+void UserTable::clear() {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    ids.clear();
+    names.clear();
+    for (std::atomic<Slot*>& chunk : chunks) delete[] chunk.exchange(nullptr);
+    registered.clear();
+    users.clear();
+}
@@ -0,0 +1,487 @@
+#include "../include/user/WriteAheadLog.hpp"
+#include "../include/user/Checksum.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+// Bytes in front of every payload: length and checksum.
+constexpr size_t kHeaderSize = 8;
+// Bytes of a payload before its fields: sequence, type and field count.
+constexpr size_t kPayloadPrefix = 10;
+// Largest payload replay accepts; anything bigger is treated as corruption.
+constexpr uint32_t kMaxPayload = 64 << 20;
+
+// Appends an integer in little-endian byte order.
+template <typename T>
+void putInt(std::string& out, T value) {
+    for (size_t i = 0; i < sizeof(T); ++i) {
+        out.push_back(static_cast<char>(value >> (8 * i)));
+    }
+}
+
+// Reads a little-endian integer.
+template <typename T>
+T getInt(const char* p) {
+    T value = 0;
+    for (size_t i = 0; i < sizeof(T); ++i) {
+        value |= static_cast<T>(static_cast<unsigned char>(p[i])) << (8 * i);
+    }
+    return value;
+}
+
+// Decodes a payload; returns false if it does not describe a well-formed record.
+bool decodePayload(const char* p, size_t size, WalRecord& record) {
+    if (size < kPayloadPrefix) return false;
+    record.sequence = getInt<uint64_t>(p);
+    record.type = static_cast<WalRecordType>(static_cast<unsigned char>(p[8]));
+    size_t count = static_cast<unsigned char>(p[9]);
+    record.fields.clear();
+    size_t offset = kPayloadPrefix;
+    for (size_t i = 0; i < count; ++i) {
+        if (size - offset < 4) return false;
+        uint32_t length = getInt<uint32_t>(p + offset);
+        offset += 4;
+        if (size - offset < length) return false;
+        record.fields.emplace_back(p + offset, length);
+        offset += length;
+    }
+    return offset == size;
+}
+
+// Reads the whole file behind `fd` into `content`. Returns false if it could not be examined.
+bool readAll(int fd, std::string& content) {
+    struct stat info;
+    if (::fstat(fd, &info) != 0) return false;
+    content.assign(static_cast<size_t>(info.st_size), '\0');
+    size_t loaded = 0;
+    while (loaded < content.size()) {
+        ssize_t n = ::pread(fd, content.data() + loaded, content.size() - loaded, static_cast<off_t>(loaded));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        loaded += static_cast<size_t>(n);
+    }
+    content.resize(loaded);
+    return true;
+}
+} // namespace
+
+// Opens the log for appending; every write lands at the end of the file.
+WriteAheadLog::WriteAheadLog(const std::string& path, const PersistenceOptions& options) : path(path), options(options) {
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot open write-ahead log " + path + ": " + std::strerror(errno));
+    }
+    if (options.durability != Durability::Memory) {
+        writer = std::thread(&WriteAheadLog::writeLoop, this);
+    }
+}
+
+// Lets the writer finish everything queued before the file is closed.
+WriteAheadLog::~WriteAheadLog() {
+    if (writer.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        pendingReady.notify_one();
+        writer.join();
+    }
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
+
+// Reads the retired file a checkpoint left behind, if any, then the whole log, applies intact
+// records past the snapshot and cuts off anything after the first bad one.
+size_t WriteAheadLog::replay(uint64_t afterSequence, const std::function<void(const WalRecord&)>& apply) {
+    size_t applied = 0;
+    WalRecord record{};
+    // Applies the records in `content` and returns the length of the intact prefix.
+    auto replayContent = [&](const std::string& content) {
+        size_t offset = 0;
+        while (content.size() - offset >= kHeaderSize) {
+            uint32_t length = getInt<uint32_t>(content.data() + offset);
+            uint32_t checksum = getInt<uint32_t>(content.data() + offset + 4);
+            const char* payload = content.data() + offset + kHeaderSize;
+            if (length > kMaxPayload || content.size() - offset - kHeaderSize < length ||
+                crc32Update(0, payload, length) != checksum || !decodePayload(payload, length, record)) {
+                break;
+            }
+            offset += kHeaderSize + length;
+            ++records;
+            if (record.sequence > newestSequence) {
+                newestSequence = record.sequence;
+            }
+            if (record.sequence > afterSequence) {
+                apply(record);
+                ++applied;
+            }
+        }
+        return offset;
+    };
+
+    std::string retiredPath = path + ".1";
+    int retiredFd = ::open(retiredPath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (retiredFd >= 0) {
+        retired = true;
+        std::string content;
+        readAll(retiredFd, content);
+        ::close(retiredFd);
+        // It was synced before the current file was started, so damage here is not a torn tail;
+        // the records after it are still applied.
+        size_t offset = replayContent(content);
+        if (offset < content.size()) {
+            std::cerr << "Write-ahead log " << retiredPath << ": skipping " << content.size() - offset
+                      << " bytes of corrupt records." << std::endl;
+        }
+    }
+
+    std::string content;
+    if (!readAll(fd, content)) return applied;
+    size_t offset = replayContent(content);
+    if (offset < content.size()) {
+        std::cerr << "Write-ahead log " << path << ": discarding " << content.size() - offset
+                  << " bytes of torn or corrupt records." << std::endl;
+        if (::ftruncate(fd, static_cast<off_t>(offset)) != 0) {
+            std::cerr << "Cannot truncate " << path << ": " << std::strerror(errno) << std::endl;
+        }
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    bytes = writtenBytes = offset;
+    writtenSequence = syncedSequence = newestSequence;
+    return applied;
+}
+
+// Encodes the record onto the pending buffer. The writer picks it up with whatever else
+// arrives during the batch window; a crash leaves at most a torn tail, never a gap.
+uint64_t WriteAheadLog::append(WalRecord& record) {
+    std::string payload;
+    putInt<uint64_t>(payload, 0);
+    payload.push_back(static_cast<char>(record.type));
+    payload.push_back(static_cast<char>(record.fields.size()));
+    for (const std::string& field : record.fields) {
+        putInt<uint32_t>(payload, static_cast<uint32_t>(field.size()));
+        payload += field;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (failed) {
+        return 0;
+    }
+    record.sequence = ++newestSequence;
+    if (options.durability == Durability::Memory) {
+        return record.sequence;
+    }
+    // The sequence is only known under the lock; patch it into the reserved slot.
+    for (size_t i = 0; i < 8; ++i) {
+        payload[i] = static_cast<char>(record.sequence >> (8 * i));
+    }
+    size_t start = pending.size();
+    putInt<uint32_t>(pending, static_cast<uint32_t>(payload.size()));
+    putInt<uint32_t>(pending, crc32Update(0, payload.data(), payload.size()));
+    pending += payload;
+    bytes += pending.size() - start;
+    ++records;
+    if (start == 0) {
+        pendingReady.notify_one();
+    }
+    return record.sequence;
+}
+
+// Hands out a future for one record; it is ready at once unless Batch mode still owes an fsync.
+std::future<void> WriteAheadLog::whenDurable(uint64_t sequence) {
+    std::promise<void> promise;
+    std::future<void> future = promise.get_future();
+    std::lock_guard<std::mutex> lock(mutex);
+    if (options.durability != Durability::Batch || syncedSequence >= sequence) {
+        promise.set_value();
+    } else if (failed) {
+        promise.set_exception(std::make_exception_ptr(std::runtime_error("write-ahead log " + path + " failed")));
+    } else {
+        waiters.emplace_back(sequence, std::move(promise));
+    }
+    return future;
+}
+
+// Drains the queue, then truncates the log to empty and deletes a retired file.
+void WriteAheadLog::reset() {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (options.durability == Durability::Memory) {
+        records = 0;
+        return;
+    }
+    drained.wait(lock, [this] { return (failed || (pending.empty() && writtenSequence == newestSequence)) && !rotating; });
+    if (::ftruncate(fd, 0) != 0) {
+        std::cerr << "Cannot truncate " << path << ": " << std::strerror(errno) << std::endl;
+        return;
+    }
+    records = 0;
+    bytes = writtenBytes = 0;
+    if (failed) {
+        std::cerr << "Write-ahead log " << path << ": accepting records again." << std::endl;
+        failed = false;
+        writtenSequence = syncedSequence = newestSequence;
+    }
+    if (retired && ::unlink((path + ".1").c_str()) == 0) {
+        retired = false;
+    }
+}
+
+// Only marks the boundary; appends carry on into `pending` while the writer finishes the old file.
+bool WriteAheadLog::rotate() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (options.durability == Durability::Memory || retired || rotating || failed) return false;
+    rotating = true;
+    rotateBytes = pending.size();
+    rotateSequence = newestSequence;
+    records = 0;
+    bytes = 0;
+    pendingReady.notify_one();
+    return true;
+}
+
+// A failed unlink leaves the file for reset() or the next replay, whose snapshot skips its records.
+void WriteAheadLog::dropRetired() {
+    std::unique_lock<std::mutex> lock(mutex);
+    drained.wait(lock, [this] { return !rotating; });
+    if (!retired) return;
+    if (::unlink((path + ".1").c_str()) != 0) {
+        std::cerr << "Cannot remove " << path << ".1: " << std::strerror(errno) << std::endl;
+        return;
+    }
+    retired = false;
+}
+
+// Moves the sequence counter forward so new records sort after the snapshot.
+void WriteAheadLog::advanceTo(uint64_t sequence) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (sequence > newestSequence) {
+        newestSequence = writtenSequence = syncedSequence = sequence;
+    }
+}
+
+// Reads the newest sequence number.
+uint64_t WriteAheadLog::lastSequence() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return newestSequence;
+}
+
+// Reads the record count.
+size_t WriteAheadLog::recordCount() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return records;
+}
+
+// Reads the log size.
+uint64_t WriteAheadLog::sizeBytes() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return bytes;
+}
+
+// Reads the number of batches written.
+uint64_t WriteAheadLog::batchCount() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return batches;
+}
+
+// Group commit: after the first record of a batch arrives, waits out the batch window so
+// concurrent appends join it, then writes the lot at once. Interval mode also syncs on a
+// timer when no new records arrive.
+void WriteAheadLog::writeLoop() {
+    using Clock = std::chrono::steady_clock;
+    std::unique_lock<std::mutex> lock(mutex);
+    Clock::time_point lastSync = Clock::now();
+
+    while (true) {
+        if (rotating) {
+            rotateFile(lock);
+            continue;
+        }
+        if (pending.empty()) {
+            if (stopping) break;
+            bool unsynced = syncedSequence < writtenSequence;
+            if (unsynced && options.durability == Durability::Interval) {
+                pendingReady.wait_until(lock, lastSync + options.syncInterval,
+                                        [this] { return stopping || rotating || !pending.empty(); });
+                if (pending.empty() && !rotating && Clock::now() >= lastSync + options.syncInterval) {
+                    uint64_t upTo = writtenSequence;
+                    lock.unlock();
+                    bool synced = sync();
+                    lock.lock();
+                    if (!synced) {
+                        fail();
+                        continue;
+                    }
+                    syncedSequence = upTo;
+                    lastSync = Clock::now();
+                }
+            } else {
+                pendingReady.wait(lock, [this] { return stopping || rotating || !pending.empty(); });
+            }
+            continue;
+        }
+
+        if (!stopping && options.batchWindow.count() > 0) {
+            pendingReady.wait_for(lock, options.batchWindow, [this] { return stopping || rotating; });
+            if (rotating) continue;
+        }
+
+        std::string batch;
+        batch.swap(pending);
+        uint64_t upTo = newestSequence;
+        uint64_t offset = writtenBytes;
+        lock.unlock();
+
+        bool syncNow = options.durability == Durability::Batch || Clock::now() >= lastSync + options.syncInterval;
+        bool written = writeBatch(batch, offset) && (!syncNow || sync());
+
+        lock.lock();
+        ++batches;
+        if (!written) {
+            bytes -= batch.size();
+            fail();
+            continue;
+        }
+        writtenBytes += batch.size();
+        writtenSequence = upTo;
+        if (syncNow) {
+            syncedSequence = upTo;
+            lastSync = Clock::now();
+        }
+        releaseWaiters();
+        drained.notify_all();
+    }
+
+    if (syncedSequence < writtenSequence) {
+        lock.unlock();
+        bool synced = sync();
+        lock.lock();
+        if (!synced) {
+            fail();
+            return;
+        }
+        syncedSequence = writtenSequence;
+    }
+    releaseWaiters();
+}
+
+// The old file is complete and synced before it is renamed, so <path>.1 never needs a torn tail
+// cut off. If the rename fails the old file simply stays in use: its records are all covered by
+// the snapshot and replay skips them.
+void WriteAheadLog::rotateFile(std::unique_lock<std::mutex>& lock) {
+    std::string batch = pending.substr(0, rotateBytes);
+    pending.erase(0, rotateBytes);
+    uint64_t upTo = rotateSequence;
+    uint64_t offset = writtenBytes;
+    lock.unlock();
+
+    bool written = (batch.empty() || writeBatch(batch, offset)) && sync();
+    std::string retiredPath = path + ".1";
+    int newFd = -1;
+    if (::rename(path.c_str(), retiredPath.c_str()) != 0) {
+        std::cerr << "Cannot rename " << path << " to " << retiredPath << ": " << std::strerror(errno) << std::endl;
+    } else {
+        newFd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (newFd < 0) {
+            // Keep appending to the old file under its new name; the next reset() empties it.
+            std::cerr << "Cannot open write-ahead log " << path << ": " << std::strerror(errno) << std::endl;
+            if (::rename(retiredPath.c_str(), path.c_str()) != 0) {
+                std::cerr << "Cannot rename " << retiredPath << " back: " << std::strerror(errno) << std::endl;
+            }
+        } else {
+            std::string directory = std::filesystem::path(path).parent_path().string();
+            int directoryFd = ::open(directory.empty() ? "." : directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (directoryFd >= 0) {
+                ::fsync(directoryFd);
+                ::close(directoryFd);
+            }
+        }
+    }
+
+    lock.lock();
+    if (newFd >= 0) {
+        ::close(fd);
+        fd = newFd;
+        writtenBytes = 0;
+        retired = true;
+    } else if (written) {
+        writtenBytes += batch.size();
+        bytes += writtenBytes;
+    }
+    ++batches;
+    rotating = false;
+    if (!written) {
+        fail();
+        return;
+    }
+    writtenSequence = std::max(writtenSequence, upTo);
+    syncedSequence = std::max(syncedSequence, upTo);
+    releaseWaiters();
+    drained.notify_all();
+}
+
+// Writes one batch; a failed write is rolled back so later batches do not land behind garbage.
+bool WriteAheadLog::writeBatch(const std::string& batch, uint64_t offset) {
+    size_t written = 0;
+    while (written < batch.size()) {
+        ssize_t n = ::write(fd, batch.data() + written, batch.size() - written);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            std::cerr << "Write-ahead log " << path << ": append failed: " << std::strerror(errno) << std::endl;
+            if (::ftruncate(fd, static_cast<off_t>(offset)) != 0) {
+                std::cerr << "Cannot truncate " << path << ": " << std::strerror(errno) << std::endl;
+            }
+            return false;
+        }
+        written += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// fdatasync is enough: the log only grows, and its size is the metadata that matters.
+bool WriteAheadLog::sync() {
+    if (::fdatasync(fd) != 0) {
+        std::cerr << "Write-ahead log " << path << ": sync failed: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// After a failed fsync the kernel may already have dropped the dirty pages, so nothing written
+// since the last good sync can be trusted either; everything not known to be durable fails.
+void WriteAheadLog::fail() {
+    if (!failed) {
+        std::cerr << "Write-ahead log " << path << ": refusing records until the next checkpoint." << std::endl;
+    }
+    failed = true;
+    // A rotation under way still writes the part of `pending` that belongs to the old file,
+    // which `bytes` no longer counts; there is nothing left of it to write.
+    bytes -= pending.size() - (rotating ? std::min(rotateBytes, pending.size()) : 0);
+    pending.clear();
+    rotateBytes = 0;
+    std::exception_ptr error = std::make_exception_ptr(std::runtime_error("write-ahead log " + path + " failed"));
+    for (auto& waiter : waiters) {
+        waiter.second.set_exception(error);
+    }
+    waiters.clear();
+    drained.notify_all();
+}
+
+// Completes every waiter whose record is now synced.
+void WriteAheadLog::releaseWaiters() {
+    auto covered = [this](const std::pair<uint64_t, std::promise<void>>& waiter) { return waiter.first <= syncedSequence; };
+    for (auto& waiter : waiters) {
+        if (covered(waiter)) {
+            waiter.second.set_value();
+        }
+    }
+    waiters.erase(std::remove_if(waiters.begin(), waiters.end(), covered), waiters.end());
+}